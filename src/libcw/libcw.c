@@ -29,6 +29,7 @@
 #include <string.h>
 
 #include "libcw.h"
+#include "libcw_data.h"
 #include "libcw_debug.h"
 #include "libcw_gen.h"
 #include "libcw_key.h"
@@ -60,6 +61,7 @@ extern cw_debug_t cw_debug_object_dev;
 static cw_rec_t cw_receiver = {
 
 	.state = RS_IDLE,
+	.trie_node = CW_DATA_TRIE_ROOT,
 
 
 	.speed                      = CW_SPEED_INITIAL,
@@ -1669,6 +1671,7 @@ void cw_clear_receive_buffer(void)
 
 	memset(cw_receiver.representation, 0, sizeof (cw_receiver.representation));
 	cw_receiver.representation_ind = 0;
+	cw_receiver.trie_node = CW_DATA_TRIE_ROOT;
 
 	cw_rec_set_state_internal(&cw_receiver, RS_IDLE);
 
@@ -1727,6 +1730,7 @@ void cw_reset_receive(void)
 
 	memset(cw_receiver.representation, 0, sizeof (cw_receiver.representation));
 	cw_receiver.representation_ind = 0;
+	cw_receiver.trie_node = CW_DATA_TRIE_ROOT;
 	cw_rec_set_state_internal(&cw_receiver, RS_IDLE);
 
 	cw_rec_reset_statistics(&cw_receiver);
@@ -9,6 +9,11 @@
 
 
 
+#include <time.h> /* struct timespec */
+
+
+
+
 #include "libcw.h"
 
 
@@ -62,6 +67,9 @@ typedef struct cw_key_struct cw_key_t;
 struct cw_rec_struct;
 typedef struct cw_rec_struct cw_rec_t;
 
+struct cw_mixer_struct;
+typedef struct cw_mixer_struct cw_mixer_t;
+
 typedef enum cw_audio_systems cw_sound_system_t;
 
 typedef struct cw_gen_config_t {
@@ -183,6 +191,92 @@ cw_ret_t cw_gen_stop(cw_gen_t * gen);
 
 
 
+/**
+   @brief Render tones enqueued in generator into memory
+
+   Dequeue all tones from generator's tone queue and convert them into PCM
+   samples, without waiting for a sound sink to play them. The function
+   returns when the tone queue has been drained, so the samples are
+   produced as fast as CPU allows.
+
+   The samples are calculated by the same code that calculates samples
+   for sound sink of a running generator, with the same sample rate. For
+   generators using sound systems that don't operate on samples (Null,
+   Console) a sample rate of the sound system is used too.
+
+   @p gen must not be started with cw_gen_start(): tones from the queue
+   would be consumed by two parties at the same time.
+
+   The samples are put into @p *samples buffer. The buffer is managed in
+   the same way as getline(3) manages its buffer: if @p *samples is NULL,
+   or if @p *size is too small to hold all samples, the buffer is
+   (re)allocated with realloc(), and @p *samples and @p *size are
+   updated. Caller owns the buffer and should free() it even if the
+   function fails.
+
+   If the last tone in the queue is "forever" tone, the tone is rendered
+   only once, and is left in the queue.
+
+   Samples rendered by consecutive calls to the function form one
+   continuous sound wave.
+
+   @exception EINVAL one of arguments is NULL
+   @exception EBUSY @p gen has been started with cw_gen_start()
+   @exception ENOMEM failed to allocate memory for samples
+
+   @param[in] gen generator with enqueued tones
+   @param[in,out] samples pointer to output buffer with samples
+   @param[in,out] size size of the output buffer [samples]
+   @param[out] n_samples count of samples rendered into the output buffer
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+cw_ret_t cw_gen_render(cw_gen_t * gen, cw_sample_t ** samples, size_t * size, size_t * n_samples);
+
+
+
+
+/**
+   @brief Fill buffer with samples of tones enqueued in generator
+
+   Pull mode of generator: dequeue tones from generator's tone queue and
+   calculate exactly @p n PCM samples into @p out. The function is meant
+   to be called from audio callback of a host application (e.g. SDL or
+   JACK callback) that asks for a given number of samples. The generator
+   doesn't need its own thread or sound device, so it may be created
+   with Null sound system and must not be started with cw_gen_start().
+
+   A tone that doesn't fit into @p out is continued in next call to the
+   function, so samples produced by consecutive calls form one
+   continuous sound wave. When the tone queue is empty, the rest of @p
+   out is filled with silence.
+
+   Key value tracking and low-water callbacks (see
+   cw_gen_register_low_level_callback()) work in the same way as in
+   started generator, but they are called from the thread calling this
+   function. Clients waiting with cw_gen_wait_for_queue_level() or
+   cw_gen_wait_for_end_of_current_tone() are woken up when tones are
+   dequeued.
+
+   Don't mix calls to this function with calls to cw_gen_render() for
+   the same generator.
+
+   @exception EINVAL @p gen or @p out is NULL, or @p n is larger than INT_MAX
+   @exception EBUSY @p gen has been started with cw_gen_start()
+
+   @param[in] gen generator with enqueued tones
+   @param[out] out buffer for samples
+   @param[in] n count of samples to put into @p out
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+cw_ret_t cw_gen_fill(cw_gen_t * gen, cw_sample_t * out, size_t n);
+
+
+
+
 /**
    @brief Set label (name) of given generator instance
 
@@ -651,6 +745,152 @@ cw_ret_t cw_gen_enqueue_string(cw_gen_t * gen, const char * string);
 
 
 
+/**
+   @brief Enqueue a string in generator, all or nothing
+
+   The function works like cw_gen_enqueue_string(), but either all
+   characters of @p string are enqueued, or none of them. Marks and
+   Spaces of the whole string are prepared first, and then they are
+   added to generator's tone queue in one step.
+
+   If the whole string can't be enqueued without going over high water
+   mark of tone queue, the function fails with errno set to EAGAIN, and
+   the tone queue is left unchanged. Client code can wait for the queue to
+   drain (e.g. with cw_gen_wait_for_queue_level()) and try again, or
+   split the string into shorter parts.
+
+   The function is also faster than cw_gen_enqueue_string() for long
+   strings, because the tone queue is locked only once.
+
+   @exception ENOENT @p string contains characters that can't be enqueued
+   @exception EAGAIN there is not enough free space in tone queue for @p string
+   @exception ENOMEM memory for Marks and Spaces can't be allocated
+
+   @param[in] gen generator to use
+   @param[in] string string to enqueue
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+cw_ret_t cw_gen_enqueue_string_atomic(cw_gen_t * gen, const char * string);
+
+
+
+
+/* Modes of generator's tone queue, see cw_gen_set_queue_mode(). */
+typedef enum {
+	/* Characters are expanded into Marks and Spaces when they are
+	   enqueued. */
+	CW_GEN_QUEUE_MODE_TONES = 0,
+
+	/* Characters are stored in queue as single entries, and are
+	   expanded into Marks and Spaces when they are dequeued. */
+	CW_GEN_QUEUE_MODE_CHARACTERS
+} cw_gen_queue_mode_t;
+
+
+
+
+/**
+   @brief Set mode of generator's tone queue
+
+   In default mode (CW_GEN_QUEUE_MODE_TONES) every character enqueued
+   with cw_gen_enqueue_character(), cw_gen_enqueue_character_no_ics()
+   or cw_gen_enqueue_string() is immediately expanded into about ten
+   tones, using durations of Marks and Spaces valid at the time of
+   enqueueing.
+
+   In CW_GEN_QUEUE_MODE_CHARACTERS mode every such character takes a
+   single entry in tone queue, and generator expands it into tones
+   when the character is dequeued. A queue of given capacity can then
+   hold about ten times more text, and changes of speed, gap,
+   weighting or frequency apply also to text that is already in the
+   queue.
+
+   In CW_GEN_QUEUE_MODE_CHARACTERS mode the length of queue (see
+   cw_gen_get_queue_length()) and levels of queue (see
+   cw_gen_wait_for_queue_level() and
+   cw_gen_register_low_level_callback()) are counted in characters,
+   and cw_gen_wait_for_end_of_current_tone() may return at the end of
+   a whole character. Tones enqueued with other functions are still
+   stored as tones in both modes.
+
+   The mode can be changed at any time. Entries that are already in
+   the queue are played according to the mode used to enqueue them.
+
+   @exception EINVAL @p gen is NULL or @p mode is not a valid mode
+
+   @param[in] gen generator for which to set the mode
+   @param[in] mode new mode of generator's tone queue
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+cw_ret_t cw_gen_set_queue_mode(cw_gen_t * gen, cw_gen_queue_mode_t mode);
+
+
+
+
+/**
+   @brief Get mode of generator's tone queue
+
+   @exception EINVAL @p gen or @p mode is NULL
+
+   @param[in] gen generator from which to get the mode
+   @param[out] mode current mode of generator's tone queue
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+cw_ret_t cw_gen_get_queue_mode(const cw_gen_t * gen, cw_gen_queue_mode_t * mode);
+
+
+
+
+/**
+   @brief Statistics of generator's tone queue
+
+   See cw_gen_get_queue_stats().
+*/
+typedef struct {
+	uint64_t n_enqueued;      /* Count of tones (or characters, see cw_gen_set_queue_mode()) accepted by tone queue. */
+	uint64_t n_dequeued;      /* Count of tones (or characters) taken from tone queue by generator. */
+	uint64_t n_rejected;      /* Count of enqueue calls rejected because tone queue was full (EAGAIN). */
+	size_t max_length;        /* Maximal length of tone queue observed. */
+	uint64_t n_drains;        /* Count of times the generator has dequeued last tone from tone queue, including normal end of a message. */
+	uint64_t empty_usecs;     /* Time between draining of tone queue and arrival of next tone, while generator was running. */
+	uint64_t lock_wait_usecs; /* Time spent by producers waiting for access to tone queue. */
+} cw_gen_queue_stats_t;
+
+
+
+
+/**
+   @brief Get statistics of generator's tone queue
+
+   Counters are maintained since creation of the generator. They can
+   be read at any time from any thread. Reading them doesn't lock the
+   queue, and the values are not a consistent snapshot: each of them
+   may be a bit older than the others.
+
+   A drained queue isn't an error on its own: the queue is drained
+   at the end of every message. Long or frequent periods of drained
+   queue in the middle of a message mean that the producer doesn't
+   keep up with the generator. Frequent rejections mean the opposite.
+
+   @exception EINVAL @p gen or @p stats is NULL
+
+   @param[in] gen generator
+   @param[out] stats statistics of generator's tone queue
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+cw_ret_t cw_gen_get_queue_stats(const cw_gen_t * gen, cw_gen_queue_stats_t * stats);
+
+
+
+
 /**
    @brief Wait for generator's tone queue to drain until only as many tones as given in @p level remain queued
 
@@ -685,6 +925,28 @@ cw_ret_t cw_gen_wait_for_queue_level(cw_gen_t * gen, size_t level);
 
 
 
+/**
+   @brief Wait for generator's tone queue to drain to @p level, but not longer than until @p deadline
+
+   Variant of cw_gen_wait_for_queue_level() with time limit. @p deadline
+   is an absolute time of CLOCK_MONOTONIC clock (see clock_gettime()). If
+   @p deadline is NULL, the function waits without time limit.
+
+   @exception ETIMEDOUT the deadline has passed before the queue has
+   drained to @p level
+
+   @param[in] gen generator on which to wait
+   @param[in] level level in queue, at which to return
+   @param[in] deadline absolute time (CLOCK_MONOTONIC) at which to stop waiting
+
+   @return CW_SUCCESS if the queue has drained to @p level
+   @return CW_FAILURE if the deadline has passed
+*/
+cw_ret_t cw_gen_wait_for_queue_level_timed(cw_gen_t * gen, size_t level, const struct timespec * deadline);
+
+
+
+
 /**
    @brief Cancel all pending queued tones in a generator, and return to silence
 
@@ -815,6 +1077,79 @@ cw_ret_t cw_gen_register_low_level_callback(cw_gen_t * gen, cw_queue_low_callbac
 
 
 
+/* Events of generator that can be watched through generator's event
+   file descriptor (see cw_gen_get_event_fd()). Values can be ORed. */
+enum {
+	/* Length of tone queue has dropped to given level. */
+	CW_GEN_EVENT_LEVEL       = 1 << 0,
+
+	/* The last tone from tone queue has been dequeued, or the queue
+	   has been flushed. */
+	CW_GEN_EVENT_QUEUE_EMPTY = 1 << 1,
+
+	/* Generator has ended playing a tone. */
+	CW_GEN_EVENT_TONE_END    = 1 << 2,
+
+	/* Generator's value (see cw_gen_register_value_tracking_callback_internal())
+	   has changed. */
+	CW_GEN_EVENT_VALUE       = 1 << 3,
+
+	CW_GEN_EVENT_ALL = CW_GEN_EVENT_LEVEL | CW_GEN_EVENT_QUEUE_EMPTY | CW_GEN_EVENT_TONE_END | CW_GEN_EVENT_VALUE
+};
+
+
+
+
+/**
+   @brief Get file descriptor that becomes readable on events of generator
+
+   The file descriptor can be watched with poll(), select() or epoll
+   together with descriptors of other generators and of user interface,
+   so that client code doesn't need a thread blocked in
+   cw_gen_wait_for_queue_level() or cw_gen_wait_for_end_of_current_tone().
+
+   The descriptor becomes readable when any of @p events happens. Call
+   cw_gen_read_events() to get the events that have happened and to make
+   the descriptor non-readable again. Don't read from the descriptor and
+   don't close it: it is owned by @p gen and is closed by cw_gen_delete().
+
+   The descriptor is created by first call to the function. Next calls
+   return the same descriptor and replace the set of watched events and
+   the level.
+
+   @exception EINVAL @p level is not lower than capacity of tone queue
+   @exception EMFILE, ENFILE, ENOMEM failed to create file descriptor
+
+   @param[in] gen generator to watch
+   @param[in] events events to watch, ORed CW_GEN_EVENT_* values
+   @param[in] level level of tone queue for CW_GEN_EVENT_LEVEL event
+
+   @return file descriptor on success
+   @return -1 on failure
+*/
+int cw_gen_get_event_fd(cw_gen_t * gen, unsigned int events, size_t level);
+
+
+
+
+/**
+   @brief Get events of generator that have happened since previous call
+
+   Function returns events watched with descriptor returned by
+   cw_gen_get_event_fd(), and makes the descriptor non-readable until
+   next event. The function may return zero if the descriptor has
+   been woken up by an event that has already been returned by
+   previous call.
+
+   @param[in] gen generator to watch
+
+   @return ORed CW_GEN_EVENT_* values
+*/
+unsigned int cw_gen_read_events(cw_gen_t * gen);
+
+
+
+
 /**
    @brief Wait for the current tone to complete
 
@@ -831,6 +1166,27 @@ cw_ret_t cw_gen_wait_for_end_of_current_tone(cw_gen_t * gen);
 
 
 
+/**
+   @brief Wait for the current tone to complete, but not longer than until @p deadline
+
+   Variant of cw_gen_wait_for_end_of_current_tone() with time limit. @p
+   deadline is an absolute time of CLOCK_MONOTONIC clock (see
+   clock_gettime()). If @p deadline is NULL, the function waits without
+   time limit.
+
+   @exception ETIMEDOUT the deadline has passed before end of tone
+
+   @param[in] gen generator to wait on
+   @param[in] deadline absolute time (CLOCK_MONOTONIC) at which to stop waiting
+
+   @return CW_SUCCESS if the tone has ended
+   @return CW_FAILURE if the deadline has passed
+*/
+cw_ret_t cw_gen_wait_for_end_of_current_tone_timed(cw_gen_t * gen, const struct timespec * deadline);
+
+
+
+
 /**
    @brief See if generator's tone queue is full
 
@@ -852,6 +1208,197 @@ void cw_gen_register_value_tracking_callback_internal(cw_gen_t * gen, cw_gen_val
 
 
 
+/* **************** Mixer **************** */
+
+
+
+
+/**
+   @brief Create new mixer
+
+   Mixer mixes samples of many generators and plays them on a single
+   sound device, with a single thread. This is cheaper than running
+   many started generators, each with its own thread and its own sound
+   device.
+
+   Sound device of the mixer is opened according to @p gen_conf, in the
+   same way as for generator created with cw_gen_new(). Console sound
+   system is not supported.
+
+   @exception EINVAL Console sound system requested
+   @exception ENOMEM failed to allocate memory
+
+   @param[in] gen_conf configuration of sound device of the mixer
+
+   @return new mixer on success
+   @return NULL on failure
+*/
+cw_mixer_t * cw_mixer_new(const cw_gen_config_t * gen_conf);
+
+
+
+
+/**
+   @brief Delete a mixer
+
+   The mixer is stopped if necessary. Generators registered in the
+   mixer are not deleted. @p *mixer is set to NULL.
+
+   @param[in,out] mixer pointer to mixer to delete
+*/
+void cw_mixer_delete(cw_mixer_t ** mixer);
+
+
+
+
+/**
+   @brief Start playing mixed generators on mixer's sound device
+
+   Mixer's thread pulls samples from registered generators (see
+   cw_gen_fill()) once per period of sound device, mixes them, and
+   writes them to the device. The sound devices are mono, so
+   generators' pan is not used by the thread.
+
+   @exception EINVAL @p mixer is NULL
+   @exception EBUSY mixer has been already started
+
+   @param[in] mixer mixer to start
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+cw_ret_t cw_mixer_start(cw_mixer_t * mixer);
+
+
+
+
+/**
+   @brief Stop mixer's thread
+
+   @exception EINVAL @p mixer is NULL
+
+   @param[in] mixer mixer to stop
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+cw_ret_t cw_mixer_stop(cw_mixer_t * mixer);
+
+
+
+
+/**
+   @brief Register generator in mixer
+
+   @p gen will be a source of samples for the mixer. It must not be
+   started with cw_gen_start(), and it can be registered in at most one
+   mixer. The generator is switched to sample rate of the mixer, so it
+   should be registered before its tones are pulled for the first time.
+   Remove the generator from the mixer before deleting it.
+
+   The generator can be registered while the mixer is started, also
+   from a callback of another generator registered in the mixer (see
+   cw_gen_register_low_level_callback()).
+
+   @exception EINVAL @p mixer or @p gen is NULL, invalid @p gain or @p pan, or @p gen already registered
+   @exception EBUSY @p gen has been started with cw_gen_start()
+   @exception ENOMEM failed to allocate memory
+
+   @param[in] mixer mixer
+   @param[in] gen generator to register
+   @param[in] gain gain of generator's samples in the mix, 0 to 100 [percent]
+   @param[in] pan position of generator in stereo mix, -100 (left) to 100 (right)
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+cw_ret_t cw_mixer_add_generator(cw_mixer_t * mixer, cw_gen_t * gen, int gain, int pan);
+
+
+
+
+/**
+   @brief Remove generator from mixer
+
+   When the function returns, mixer doesn't use @p gen anymore, and
+   @p gen can be deleted. The exception is a call from a callback of a
+   generator registered in the mixer: the function can be called from
+   such callback, but @p gen may be used until the end of current
+   period of the mixer.
+
+   @exception EINVAL @p mixer is NULL, or @p gen is not registered in the mixer
+
+   @param[in] mixer mixer
+   @param[in] gen generator to remove
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+cw_ret_t cw_mixer_remove_generator(cw_mixer_t * mixer, cw_gen_t * gen);
+
+
+
+
+/**
+   @brief Change gain and pan of generator registered in mixer
+
+   See cw_mixer_add_generator() for description of arguments.
+
+   @exception EINVAL @p mixer is NULL, invalid @p gain or @p pan, or @p gen is not registered in the mixer
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+cw_ret_t cw_mixer_set_gain_and_pan(cw_mixer_t * mixer, cw_gen_t * gen, int gain, int pan);
+
+
+
+
+/**
+   @brief Get sample rate of mixer
+
+   All generators registered in the mixer use this sample rate.
+
+   @param[in] mixer mixer
+
+   @return sample rate [Hz]
+*/
+unsigned int cw_mixer_get_sample_rate(const cw_mixer_t * mixer);
+
+
+
+
+/**
+   @brief Fill buffer with stereo mix of registered generators
+
+   Pull mode of mixer: pull @p n_frames samples from each registered
+   generator (see cw_gen_fill()), and put @p n_frames frames of stereo
+   mix into @p out. Each frame consists of two samples: left channel,
+   then right channel. Generators are panned with constant power pan
+   law, so a generator in the center of the mix has its gain
+   decreased by 3 dB in each channel.
+
+   Samples of generators are summed with generators' gains, and the
+   sums are saturated to range of cw_sample_t.
+
+   @p mixer must not be started with cw_mixer_start(). Don't call the
+   function from callbacks of generators registered in the mixer.
+
+   @exception EINVAL @p mixer or @p out is NULL
+   @exception EBUSY @p mixer has been started with cw_mixer_start()
+
+   @param[in] mixer mixer
+   @param[out] out buffer for 2 * @p n_frames samples
+   @param[in] n_frames count of frames to put into @p out
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+cw_ret_t cw_mixer_fill(cw_mixer_t * mixer, cw_sample_t * out, size_t n_frames);
+
+
+
+
 /* **************** Key **************** */
 
 
@@ -951,6 +1498,8 @@ cw_ret_t cw_key_ik_notify_dot_paddle_event(volatile cw_key_t * key, cw_key_value
 void cw_key_ik_get_paddles(const volatile cw_key_t * key, cw_key_value_t * dot_paddle_value, cw_key_value_t * dash_paddle_value);
 cw_ret_t cw_key_ik_wait_for_end_of_current_element(const volatile cw_key_t * key);
 cw_ret_t cw_key_ik_wait_for_keyer(volatile cw_key_t * key);
+cw_ret_t cw_key_ik_wait_for_end_of_current_element_timed(const volatile cw_key_t * key, const struct timespec * deadline);
+cw_ret_t cw_key_ik_wait_for_keyer_timed(volatile cw_key_t * key, const struct timespec * deadline);
 
 cw_ret_t cw_key_sk_get_value(const volatile cw_key_t * key, cw_key_value_t * key_value);
 cw_ret_t cw_key_sk_set_value(volatile cw_key_t * key, cw_key_value_t key_value);
@@ -1029,6 +1578,7 @@ int cw_rec_get_label(const cw_rec_t * rec, char * label, size_t size);
 
 /* Helper receive functions. */
 cw_ret_t cw_rec_poll_character(cw_rec_t * rec, const struct timeval * timestamp, char * character, bool * is_end_of_word, bool * is_error);
+cw_ret_t cw_rec_poll_character_ns(cw_rec_t * rec, int64_t timestamp_ns, char * character, bool * is_end_of_word, bool * is_error);
 
 
 /* Setters of receiver's essential parameters. */
@@ -1104,9 +1654,112 @@ cw_ret_t cw_rec_mark_begin(cw_rec_t * rec, const struct timeval * timestamp);
 cw_ret_t cw_rec_mark_end(cw_rec_t * rec, const struct timeval * timestamp);
 cw_ret_t cw_rec_add_mark(cw_rec_t * rec, const struct timeval * timestamp, char mark);
 
+/* Main receive functions using CLOCK_MONOTONIC (or sample counter)
+   timestamps [nanoseconds]. */
+cw_ret_t cw_rec_mark_begin_ns(cw_rec_t * rec, int64_t timestamp_ns);
+cw_ret_t cw_rec_mark_end_ns(cw_rec_t * rec, int64_t timestamp_ns);
+cw_ret_t cw_rec_add_mark_ns(cw_rec_t * rec, int64_t timestamp_ns, char mark);
+
 
 /* Helper receive functions. */
 cw_ret_t cw_rec_poll_representation(cw_rec_t * rec, const struct timeval * timestamp, char * representation, bool * is_end_of_word, bool * is_error);
+cw_ret_t cw_rec_poll_representation_ns(cw_rec_t * rec, int64_t timestamp_ns, char * representation, bool * is_end_of_word, bool * is_error);
+
+
+
+
+/**
+   @brief Mark or Space of key, for cw_rec_decode_events()
+
+   Mark is a period of time when the key is closed, Space is a period
+   of time when the key is open.
+*/
+typedef struct {
+	bool is_mark;  /* Mark (true) or Space (false). */
+	int duration;  /* Duration of the Mark or Space [microseconds]. */
+} cw_rec_event_t;
+
+/**
+   @brief Callback receiving characters decoded by cw_rec_decode_events() or by receiver in callback mode
+
+   @p character is zero if @p representation can't be converted to a
+   character.
+
+   @param[in] arg argument passed to cw_rec_decode_events() or cw_rec_register_callback()
+   @param[in] character received character
+   @param[in] representation representation (Dots and Dashes) of the character
+   @param[in] is_end_of_word the character is followed by inter-word-space
+   @param[in] is_error receiver was in error state when receiving the character, or @p representation is not a valid character
+*/
+typedef void (* cw_rec_decode_callback_t)(void * arg, char character, const char * representation, bool is_end_of_word, bool is_error);
+
+
+
+
+/**
+   @brief Decode a recording of Marks and Spaces
+
+   Function passes durations of Marks and Spaces from @p events
+   through state machine of @p rec, and calls @p callback for every
+   received character. Durations are taken only from @p events: the
+   function never reads the clock, and there is no need to poll the
+   receiver. Current speed, tolerance, gap, noise spike threshold and
+   adaptive mode of @p rec are used, and statistics of the receiver
+   are updated.
+
+   Consecutive events of the same kind are merged into one Mark or
+   one Space. End of @p events is treated as inter-word-space, so the
+   last character is always passed to @p callback. Because of this a
+   long recording can be decoded in parts if every part ends at a
+   word boundary.
+
+   State of @p rec is reset at the beginning and at the end of the
+   function, so Marks passed to cw_rec_mark_begin()/cw_rec_mark_end()
+   before the call are discarded.
+
+   @exception EINVAL @p rec or @p callback is NULL, @p events is NULL and @p n_events is not zero, or one of events has negative duration
+
+   @param[in,out] rec receiver
+   @param[in] events Marks and Spaces to decode
+   @param[in] n_events count of items in @p events
+   @param[in] callback callback receiving decoded characters
+   @param[in] callback_arg argument passed to @p callback
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+cw_ret_t cw_rec_decode_events(cw_rec_t * rec, const cw_rec_event_t * events, size_t n_events, cw_rec_decode_callback_t callback, void * callback_arg);
+cw_ret_t cw_rec_register_callback(cw_rec_t * rec, cw_rec_decode_callback_t callback, void * callback_arg);
+
+
+
+
+/**
+   @brief Pool of receivers decoding many independent channels on worker threads
+*/
+typedef struct cw_rec_pool_struct cw_rec_pool_t;
+
+/**
+   @brief Callback receiving characters decoded in channels of pool of receivers
+
+   Arguments other than @p channel are the same as in cw_rec_decode_callback_t.
+
+   @param[in] arg argument passed to cw_rec_pool_new()
+   @param[in] channel channel in which the character has been received
+   @param[in] character received character
+   @param[in] representation representation (Dots and Dashes) of the character
+   @param[in] is_end_of_word the character is followed by inter-word-space
+   @param[in] is_error receiver was in error state when receiving the character, or @p representation is not a valid character
+*/
+typedef void (* cw_rec_pool_callback_t)(void * arg, size_t channel, char character, const char * representation, bool is_end_of_word, bool is_error);
+
+cw_rec_pool_t * cw_rec_pool_new(size_t n_channels, size_t n_workers, cw_rec_pool_callback_t callback, void * callback_arg);
+void cw_rec_pool_delete(cw_rec_pool_t ** pool);
+cw_rec_t * cw_rec_pool_get_receiver(cw_rec_pool_t * pool, size_t channel);
+cw_ret_t cw_rec_pool_push_events(cw_rec_pool_t * pool, size_t channel, const cw_rec_event_t * events, size_t n_events);
+cw_ret_t cw_rec_pool_end_stream(cw_rec_pool_t * pool, size_t channel);
+cw_ret_t cw_rec_pool_wait(cw_rec_pool_t * pool);
+
 
 void cw_rec_enable_adaptive_mode(cw_rec_t * rec);
 void cw_rec_disable_adaptive_mode(cw_rec_t * rec);
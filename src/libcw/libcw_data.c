@@ -83,6 +83,8 @@ static __attribute__((constructor)) void cw_data_constructor_internal(void);
 static size_t g_main_table_maximum_representation_length;
 static int g_main_table_characters_count;
 static const cw_entry_t * g_main_table_fast_lookup[UCHAR_MAX];  /* Fast lookup table */
+static const cw_entry_t * g_main_table_trie[CW_DATA_MAX_REPRESENTATION_HASH + 1]; /* Entries indexed with hash of representation (node of trie). */
+static bool g_main_table_trie_is_prefix[CW_DATA_MAX_REPRESENTATION_HASH + 1];    /* Is node of trie a prefix of any representation? */
 const cw_entry_t CW_TABLE[] = { /* TODO: make it accessible through function only, and add static keyword. */
 	/* ASCII 7bit letters */
 	{'A', ".-"  },  {'B', "-..."},  {'C', "-.-."},
@@ -492,6 +494,67 @@ unsigned int cw_representation_to_hash_internal(const char * representation)
 
 
 
+/**
+   @brief Walk one step down the trie of representations
+
+   Hash of representation calculated by
+   cw_representation_to_hash_internal() is also an index of a node in
+   a binary trie of representations: children of node N are nodes
+   2*N (Dot) and 2*N+1 (Dash). The root of the trie
+   (CW_DATA_TRIE_ROOT) is an empty representation.
+
+   Function returns the node reached from @p node with @p mark. If
+   no representation of a character starts with representation of
+   the reached node, the function returns zero. Zero is also
+   returned for zero @p node, so once the walk fails, it stays
+   failed.
+
+   @param[in] node current node of trie
+   @param[in] mark Dot or Dash
+
+   @return non-zero node of trie if representation can still form a valid character
+   @return zero otherwise
+*/
+unsigned int cw_data_trie_next_internal(unsigned int node, char mark)
+{
+	if (0 == node || node > (CW_DATA_MAX_REPRESENTATION_HASH >> 1U)) {
+		return 0;
+	}
+
+	unsigned int child = node << 1U;
+	if (CW_DASH_REPRESENTATION == mark) {
+		child |= 1U;
+	} else if (CW_DOT_REPRESENTATION != mark) {
+		return 0;
+	}
+
+	return g_main_table_trie_is_prefix[child] ? child : 0;
+}
+
+
+
+
+/**
+   @brief Return character at given node of trie of representations
+
+   See cw_data_trie_next_internal() for description of the trie.
+
+   @param[in] node node of trie
+
+   @return zero if there is no character for given node
+   @return non-zero character at given node otherwise
+*/
+int cw_data_trie_character_internal(unsigned int node)
+{
+	if (node > CW_DATA_MAX_REPRESENTATION_HASH || NULL == g_main_table_trie[node]) {
+		return 0;
+	}
+	return g_main_table_trie[node]->character;
+}
+
+
+
+
 /**
    @brief Return character corresponding to given representation
 
@@ -1418,6 +1481,17 @@ void cw_data_constructor_internal(void)
 
 		/* Calculate count of characters in main lookup table. */
 		g_main_table_characters_count++;
+
+		/* Initialize trie of representations. All nodes on the
+		   path from the root to node of this representation are
+		   prefixes of a valid representation. */
+		const unsigned int hash = cw_representation_to_hash_internal(cw_entry->representation);
+		if (hash) {
+			g_main_table_trie[hash] = cw_entry;
+			for (unsigned int node = hash; node >= CW_DATA_TRIE_ROOT; node >>= 1U) {
+				g_main_table_trie_is_prefix[node] = true;
+			}
+		}
 	}
 
 
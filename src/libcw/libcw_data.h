@@ -27,6 +27,9 @@
 #define CW_DATA_MIN_REPRESENTATION_HASH 2
 #define CW_DATA_MAX_REPRESENTATION_HASH 255
 
+/* Root of trie of representations (hash of empty representation). See cw_data_trie_next_internal(). */
+#define CW_DATA_TRIE_ROOT 1U
+
 
 
 
@@ -45,6 +48,8 @@ cw_ret_t cw_data_init_r2c_hash_table_internal(const cw_entry_t * table[]);
 int cw_representation_to_character_internal(const char * representation);
 int cw_representation_to_character_direct_internal(const char * representation);
 unsigned int cw_representation_to_hash_internal(const char * representation); /* TODO: uint8_t return value (or maybe uint16_t?). */
+unsigned int cw_data_trie_next_internal(unsigned int node, char mark);
+int cw_data_trie_character_internal(unsigned int node);
 const char * cw_character_to_representation_internal(int character);
 const char * cw_lookup_procedural_character_internal(int character, bool * is_usually_expanded);
 
@@ -67,6 +67,7 @@
 
 #include <errno.h>
 #include <inttypes.h> /* uint32_t */
+#include <limits.h>
 #include <math.h>
 #include <signal.h>
 #include <stdbool.h>
@@ -98,6 +99,7 @@
 #include "libcw_debug_internal.h"
 #include "libcw_gen.h"
 #include "libcw_gen_internal.h"
+#include "libcw_gen_kernels.h"
 #include "libcw_null.h"
 #include "libcw_oss.h"
 #include "libcw_rec.h"
@@ -156,8 +158,34 @@ const unsigned int cw_supported_sample_rates[] = {
 static cw_ret_t cw_gen_value_tracking_internal(cw_gen_t * gen, const cw_tone_t * tone, cw_queue_state_t queue_state);
 static void cw_gen_value_tracking_set_value_internal(cw_gen_t * gen, volatile cw_key_t * key, cw_key_value_t value);
 static void cw_gen_empty_tone_calculate_samples_size_internal(const cw_gen_t * gen, cw_tone_t * tone);
-static void cw_gen_silencing_tone_calculate_samples_size_internal(const cw_gen_t * gen, cw_tone_t * tone);
-static void cw_gen_tone_calculate_samples_size_internal(const cw_gen_t * gen, cw_tone_t * tone);
+static void cw_gen_silencing_tone_calculate_samples_size_internal(cw_gen_t * gen, cw_tone_t * tone);
+static void cw_gen_tone_calculate_samples_size_internal(cw_gen_t * gen, cw_tone_t * tone);
+static void cw_gen_tone_slope_sync_internal(cw_gen_t * gen);
+static cw_ret_t cw_gen_render_write_buffer_internal(cw_gen_t * gen);
+static cw_ret_t cw_gen_render_append_internal(cw_gen_t * gen, const cw_sample_t * samples, size_t n_samples);
+static cw_ret_t cw_gen_fill_write_buffer_internal(cw_gen_t * gen);
+static int cw_gen_ics_duration_internal(const cw_gen_t * gen, int space_units_count);
+static int cw_gen_iws_duration_internal(const cw_gen_t * gen, int space_units_count);
+static void cw_gen_character_to_symbol_internal(char character, bool no_ics, int * space_units_count, cw_tone_t * tone);
+static cw_ret_t cw_gen_enqueue_symbol_internal(cw_gen_t * gen, char character, bool no_ics);
+static cw_ret_t cw_gen_stage_valid_character_internal(cw_gen_t * gen, cw_tq_staging_t * staging, char character, bool no_ics);
+static cw_ret_t cw_gen_enqueue_valid_character_tones_internal(cw_gen_t * gen, char character, bool no_ics);
+static int cw_gen_character_to_tones_internal(const cw_gen_t * gen, char character, bool no_ics, int * space_units_count, cw_tone_t * tones);
+static void cw_gen_staging_init_internal(cw_gen_t * gen, cw_tq_staging_t * staging);
+static void cw_gen_expand_symbol_internal(cw_gen_t * gen, const cw_tone_t * symbol);
+static cw_queue_state_t cw_gen_dequeue_tone_internal(cw_gen_t * gen, cw_tone_t * tone);
+static void cw_gen_sustain_begin_internal(cw_gen_t * gen, const cw_tone_t * tone, cw_queue_state_t queue_state);
+static bool cw_gen_sustain_tone_internal(cw_gen_t * gen);
+static void cw_gen_calculate_spans_internal(const cw_gen_t * gen, cw_tone_t * tone, cw_sample_t * samples, int n_samples, double phase);
+static void cw_gen_advance_phase_internal(cw_gen_t * gen, int frequency, int n_samples);
+static const cw_sample_t * cw_gen_mark_cache_get_internal(cw_gen_t * gen, const cw_tone_t * tone);
+static void cw_gen_mark_cache_invalidate_internal(cw_gen_t * gen);
+static void cw_gen_mark_cache_delete_internal(cw_gen_t * gen);
+static void cw_gen_apply_output_gain_internal(cw_gen_t * gen, cw_sample_t * samples, int n_samples);
+static bool cw_gen_wavetable_is_applicable_internal(const cw_gen_t * gen, const cw_tone_t * tone, int n_samples);
+static cw_ret_t cw_gen_wavetable_copy_internal(cw_gen_t * gen, cw_tone_t * tone, cw_sample_t * samples, int n_samples);
+static int cw_gen_wavetable_find_position_internal(const cw_gen_t * gen, double phase);
+static cw_ret_t cw_gen_wavetable_calculate_internal(cw_gen_t * gen, int frequency, double phase);
 
 
 
@@ -181,6 +209,15 @@ static const char * default_sound_devices[] = {
 
 static const int CW_AUDIO_VOLUME_RANGE = (1U << 15U);  /* 2^15 = 32768 */
 
+/* Amplitude of sine wave calculated for tones. Volume of generator is
+   applied later, to whole sound buffer (see cw_gen_t::output_gain). */
+static const int CW_AUDIO_FULL_SCALE_AMPLITUDE = (1U << 15U) - 1;
+
+/* Duration of linear ramp of output gain after change of volume. Short
+   enough to make the change appear immediate, long enough to avoid a
+   click. [us] */
+static const int CW_AUDIO_OUTPUT_GAIN_RAMP_DURATION = 5000;
+
 /*
   Shortest duration of time (in microseconds) that is used by libcw for idle
   waiting and idle loops. If a libcw function needs to wait for something, or
@@ -210,6 +247,11 @@ static const int CW_AUDIO_VOLUME_RANGE = (1U << 15U);  /* 2^15 = 32768 */
 */
 static const int CW_AUDIO_QUANTUM_DURATION_INITIAL = 500;  /* [us] */
 
+/* Size of sound buffer used when rendering tones with generator that
+   doesn't have its own sound buffer (Null and Console sound systems). The
+   value is the same as used by PulseAudio sound system. */
+static const int CW_GEN_RENDER_BUFFER_N_SAMPLES = 256;
+
 
 
 
@@ -517,6 +559,17 @@ cw_gen_t * cw_gen_new(const cw_gen_config_t * gen_conf)
 		gen->gap = CW_GAP_INITIAL;
 		gen->weighting = CW_WEIGHTING_INITIAL;
 
+		/* Characters are expanded into tones when enqueued. */
+		gen->queue_mode = CW_GEN_QUEUE_MODE_TONES;
+		gen->expansion.n_tones = 0;
+		gen->expansion.next = 0;
+		gen->sustained.active = false;
+
+		/* Initial volume is applied without ramp. */
+		gen->output_gain.current = gen->volume_abs;
+		gen->output_gain.target = gen->volume_abs;
+		gen->output_gain.step = 0;
+
 
 		/* Generator's timing parameters. */
 		gen->durations.dot_duration = 0;
@@ -533,6 +586,7 @@ cw_gen_t * cw_gen_new(const cw_gen_config_t * gen_conf)
 
 
 		gen->parameters_in_sync = false;
+		pthread_mutex_init(&gen->parameters_mutex, NULL);
 	}
 
 
@@ -552,8 +606,9 @@ cw_gen_t * cw_gen_new(const cw_gen_config_t * gen_conf)
 		/* Tone parameters. */
 		gen->tone_slope.duration = CW_AUDIO_SLOPE_DURATION;
 		gen->tone_slope.shape = CW_TONE_SLOPE_SHAPE_RAISED_COSINE;
-		gen->tone_slope.amplitudes = NULL;
-		gen->tone_slope.n_amplitudes = 0;
+		gen->tone_slope.table = NULL;
+		gen->tone_slope.consumer_table = NULL;
+		pthread_mutex_init(&gen->tone_slope.mutex, NULL);
 
 
 		/* Library's client. */
@@ -648,6 +703,10 @@ cw_gen_t * cw_gen_new(const cw_gen_config_t * gen_conf)
 			cw_gen_delete(&gen);
 			return (cw_gen_t *) NULL;
 		}
+		/* Nothing consumes tones yet, so the table can be taken
+		   on consumer's side right away. Code calculating
+		   samples outside of generator's thread relies on it. */
+		cw_gen_tone_slope_sync_internal(gen);
 	}
 
 	/* Tracking of generator's value. */
@@ -715,8 +774,17 @@ void cw_gen_delete(cw_gen_t **gen)
 	free((*gen)->library_client.name);
 	(*gen)->library_client.name = NULL;
 
-	free((*gen)->tone_slope.amplitudes);
-	(*gen)->tone_slope.amplitudes = NULL;
+	cw_slope_table_put_internal((*gen)->tone_slope.table);
+	(*gen)->tone_slope.table = NULL;
+	cw_slope_table_put_internal((*gen)->tone_slope.consumer_table);
+	(*gen)->tone_slope.consumer_table = NULL;
+	pthread_mutex_destroy(&(*gen)->tone_slope.mutex);
+	pthread_mutex_destroy(&(*gen)->parameters_mutex);
+
+	cw_gen_mark_cache_delete_internal(*gen);
+
+	free((*gen)->wavetable.samples);
+	(*gen)->wavetable.samples = NULL;
 
 	cw_tq_delete_internal(&(*gen)->tq);
 
@@ -804,9 +872,7 @@ cw_ret_t cw_gen_stop(cw_gen_t * gen)
 	  that gen->do_dequeue_and_generate is false, and to get the thread
 	  function to return (and thus to end the thread).
 	*/
-	pthread_mutex_lock(&gen->tq->wait_mutex);
-	pthread_cond_broadcast(&gen->tq->wait_var);
-	pthread_mutex_unlock(&gen->tq->wait_mutex);
+	cw_tq_notify_waiters_internal(gen->tq, CW_TQ_WAIT_TONE_AVAILABLE);
 #if 0
 	/* Original implementation using signals. */
 	/* This was disabled some time before 2017-01-19. */
@@ -902,6 +968,294 @@ cw_ret_t cw_gen_join_thread_internal(cw_gen_t * gen)
 
 
 
+cw_ret_t cw_gen_render(cw_gen_t * gen, cw_sample_t ** samples, size_t * size, size_t * n_samples)
+{
+	if (NULL == gen || NULL == samples || NULL == size || NULL == n_samples) {
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+
+	if (gen->thread.running) {
+		/* Generator's thread would be dequeueing the same tones. */
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_GENERATOR, CW_DEBUG_ERROR,
+			      MSG_PREFIX "'%s': can't render tones in running generator", gen->label);
+		errno = EBUSY;
+		return CW_FAILURE;
+	}
+
+	/* Null and Console sound systems don't calculate samples, so they
+	   don't have a sound buffer. Borrow one just for the rendering. */
+	const bool own_buffer = NULL == gen->buffer;
+	if (own_buffer) {
+		gen->buffer = (cw_sample_t *) calloc(CW_GEN_RENDER_BUFFER_N_SAMPLES, sizeof (cw_sample_t));
+		if (NULL == gen->buffer) {
+			cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
+				      MSG_PREFIX "calloc()");
+			errno = ENOMEM;
+			return CW_FAILURE;
+		}
+		gen->buffer_n_samples = CW_GEN_RENDER_BUFFER_N_SAMPLES;
+		gen->buffer_sub_start = 0;
+		gen->buffer_sub_stop = 0;
+	}
+
+	/* Full sound buffers will go to caller's memory instead of sound sink. */
+	cw_ret_t (* write_buffer_to_sound_device)(cw_gen_t *) = gen->write_buffer_to_sound_device;
+	gen->write_buffer_to_sound_device = cw_gen_render_write_buffer_internal;
+
+	gen->render.samples = *samples;
+	gen->render.size = NULL == *samples ? 0 : *size;
+	gen->render.n_samples = 0;
+	gen->render.failed = false;
+
+	/* Generator that has never been started has invalid phase offset. */
+	if (gen->phase_offset < 0.0F) {
+		gen->phase_offset = 0.0F;
+	}
+
+	cw_tone_t tone;
+	CW_TONE_INIT(&tone, 0, 0, CW_SLOPE_MODE_STANDARD_SLOPES);
+
+	while (!gen->render.failed) {
+		/* We are the only consumer of tones, so the head can't be
+		   changed by anyone else between these two lines. */
+		const size_t head = gen->tq->head;
+		const cw_queue_state_t queue_state = cw_gen_dequeue_tone_internal(gen, &tone);
+
+		cw_gen_value_tracking_internal(gen, &tone, queue_state);
+		if (CW_TQ_EMPTY == queue_state) {
+			break;
+		}
+
+		cw_gen_tone_calculate_samples_size_internal(gen, &tone);
+		cw_gen_write_to_soundcard_internal(gen, &tone);
+
+		if (tone.is_forever && head == gen->tq->head) {
+			/* The "forever" tone is the last tone in queue, and
+			   dequeue function will be returning it over and over
+			   again. Since nobody will enqueue a tone that could end
+			   the "forever" tone, this is the end of rendering. */
+			break;
+		}
+	}
+
+	/* Samples from the beginning of a sound buffer that wasn't filled
+	   up completely. */
+	if (!gen->render.failed && gen->buffer_sub_start > 0) {
+		cw_gen_apply_output_gain_internal(gen, gen->buffer, gen->buffer_sub_start);
+		cw_gen_render_append_internal(gen, gen->buffer, (size_t) gen->buffer_sub_start);
+	}
+	gen->buffer_sub_start = 0;
+	gen->buffer_sub_stop = 0;
+
+	gen->write_buffer_to_sound_device = write_buffer_to_sound_device;
+	if (own_buffer) {
+		free(gen->buffer);
+		gen->buffer = NULL;
+		gen->buffer_n_samples = -1;
+	}
+
+	/* Caller owns the buffer, even if it has been (re)allocated here. */
+	*samples = gen->render.samples;
+	*size = gen->render.size;
+	*n_samples = gen->render.n_samples;
+	gen->render.samples = NULL;
+	gen->render.size = 0;
+
+	if (gen->render.failed) {
+		errno = ENOMEM;
+		return CW_FAILURE;
+	}
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   @brief Append full sound buffer to caller's output buffer
+
+   This function is used as generator's "write buffer to sound device"
+   function during rendering of tones with cw_gen_render().
+
+   @param[in] gen generator with full sound buffer
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+static cw_ret_t cw_gen_render_write_buffer_internal(cw_gen_t * gen)
+{
+	return cw_gen_render_append_internal(gen, gen->buffer, (size_t) gen->buffer_n_samples);
+}
+
+
+
+
+/**
+   @brief Append samples to caller's output buffer
+
+   Expand the output buffer if necessary. If the expansion fails, the
+   failure is remembered in @p gen, and all further samples are dropped.
+
+   @param[in] gen generator that renders tones
+   @param[in] samples samples to append
+   @param[in] n_samples count of samples to append
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+static cw_ret_t cw_gen_render_append_internal(cw_gen_t * gen, const cw_sample_t * samples, size_t n_samples)
+{
+	if (gen->render.failed) {
+		return CW_FAILURE;
+	}
+
+	if (gen->render.n_samples + n_samples > gen->render.size) {
+		/* Grow geometrically to avoid realloc() on every sound buffer. */
+		size_t new_size = 2 * gen->render.size;
+		if (new_size < gen->render.n_samples + n_samples) {
+			new_size = gen->render.n_samples + n_samples;
+		}
+		cw_sample_t * new_samples = (cw_sample_t *) realloc(gen->render.samples, new_size * sizeof (cw_sample_t));
+		if (NULL == new_samples) {
+			cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
+				      MSG_PREFIX "realloc()");
+			gen->render.failed = true;
+			return CW_FAILURE;
+		}
+		gen->render.samples = new_samples;
+		gen->render.size = new_size;
+	}
+
+	memcpy(gen->render.samples + gen->render.n_samples, samples, n_samples * sizeof (cw_sample_t));
+	gen->render.n_samples += n_samples;
+
+	return CW_SUCCESS;
+}
+
+
+
+
+cw_ret_t cw_gen_fill(cw_gen_t * gen, cw_sample_t * out, size_t n)
+{
+	if (NULL == gen || NULL == out) {
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+
+	if (n > INT_MAX) {
+		/* Client's buffer is used as sound buffer, which has
+		   size of type int. */
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+
+	if (gen->thread.running) {
+		/* Generator's thread would be dequeueing the same tones. */
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_GENERATOR, CW_DEBUG_ERROR,
+			      MSG_PREFIX "'%s': can't fill buffer with samples in running generator", gen->label);
+		errno = EBUSY;
+		return CW_FAILURE;
+	}
+
+	if (0 == n) {
+		return CW_SUCCESS;
+	}
+
+	/* Samples will be calculated directly into client's buffer. The
+	   buffer will be "full" exactly once: after the last of its n
+	   samples has been calculated. */
+	cw_sample_t * buffer = gen->buffer;
+	const int buffer_n_samples = gen->buffer_n_samples;
+	cw_ret_t (* write_buffer_to_sound_device)(cw_gen_t *) = gen->write_buffer_to_sound_device;
+
+	gen->buffer = out;
+	gen->buffer_n_samples = (int) n;
+	gen->buffer_sub_start = 0;
+	gen->buffer_sub_stop = 0;
+	gen->write_buffer_to_sound_device = cw_gen_fill_write_buffer_internal;
+	gen->fill.active = true;
+	gen->fill.buffer_full = false;
+
+	/* Generator that has never been started has invalid phase offset. */
+	if (gen->phase_offset < 0.0F) {
+		gen->phase_offset = 0.0F;
+	}
+
+	cw_tone_t * tone = &gen->fill.tone;
+
+	while (!gen->fill.buffer_full) {
+		if (!gen->fill.tone_pending && cw_gen_sustain_tone_internal(gen)) {
+			/* Next quantum of the "forever" tone. */
+			cw_gen_tone_calculate_samples_size_internal(gen, tone);
+		} else if (!gen->fill.tone_pending) {
+			const cw_queue_state_t queue_state = cw_gen_dequeue_tone_internal(gen, tone);
+			cw_gen_value_tracking_internal(gen, tone, queue_state);
+			cw_gen_sustain_begin_internal(gen, tone, queue_state);
+
+			if (CW_TQ_EMPTY == queue_state) {
+				/* Pad the rest of client's buffer with silence.
+				   The padding starts at ->buffer_sub_start, which
+				   may be zero, so its size is set here. */
+				cw_gen_empty_tone_calculate_samples_size_internal(gen, tone);
+				tone->n_samples = gen->buffer_n_samples - gen->buffer_sub_start;
+			} else {
+				cw_gen_tone_calculate_samples_size_internal(gen, tone);
+
+				/* Let clients waiting for end of tone know about
+				   dequeued tone. Consecutive "forever" tones are
+				   the same tone for them. */
+				if (!(gen->fill.prev_tone_is_forever && tone->is_forever)) {
+					cw_tq_notify_waiters_internal(gen->tq, CW_TQ_WAIT_TONE_END);
+					cw_tq_post_event_internal(gen->tq, CW_GEN_EVENT_TONE_END);
+				}
+				gen->fill.prev_tone_is_forever = tone->is_forever;
+			}
+		}
+
+		cw_gen_write_to_soundcard_internal(gen, tone);
+
+		gen->fill.tone_pending = tone->sample_iterator < tone->n_samples;
+		if (!gen->fill.tone_pending && 0 != tone->duration) {
+			/* A duration of Mark or Space has elapsed (see
+			   comment in cw_gen_dequeue_and_generate_internal()). */
+			cw_key_ik_update_graph_state_internal(gen->key);
+		}
+	}
+
+	gen->fill.active = false;
+	gen->write_buffer_to_sound_device = write_buffer_to_sound_device;
+	gen->buffer = buffer;
+	gen->buffer_n_samples = buffer_n_samples;
+	gen->buffer_sub_start = 0;
+	gen->buffer_sub_stop = 0;
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   @brief Mark client's buffer as filled
+
+   This function is used as generator's "write buffer to sound device"
+   function during a call to cw_gen_fill(). Samples are already in
+   client's buffer, so there is nothing to write.
+
+   @param[in] gen generator with full sound buffer
+
+   @return CW_SUCCESS
+*/
+static cw_ret_t cw_gen_fill_write_buffer_internal(cw_gen_t * gen)
+{
+	gen->fill.buffer_full = true;
+	return CW_SUCCESS;
+}
+
+
+
+
 /**
    @brief Open sound system
 
@@ -1032,8 +1386,24 @@ void * cw_gen_dequeue_and_generate_internal(void * arg)
 	cw_tone_t tone;
 	CW_TONE_INIT(&tone, 0, 0, CW_SLOPE_MODE_STANDARD_SLOPES);
 
+	/* Sustained tone from previous run of the thread is not in 'tone'. */
+	gen->sustained.active = false;
+
 	while (gen->do_dequeue_and_generate) {
-		const cw_queue_state_t queue_state = cw_tq_dequeue_internal(gen->tq, &tone);
+		if (cw_gen_sustain_tone_internal(gen)) {
+			/* Generate next quantum of the "forever" tone. For
+			   listeners this is still the same tone, so there is
+			   nothing else to do. */
+			if (gen->sound_system == CW_AUDIO_NULL || gen->sound_system == CW_AUDIO_CONSOLE) {
+				gen->write_tone_to_sound_device(gen, &tone);
+			} else {
+				cw_gen_tone_calculate_samples_size_internal(gen, &tone);
+				cw_gen_write_to_soundcard_internal(gen, &tone);
+			}
+			continue;
+		}
+
+		const cw_queue_state_t queue_state = cw_gen_dequeue_tone_internal(gen, &tone);
 		if (CW_TQ_EMPTY == queue_state) {
 
 			cw_debug_msg (&cw_debug_object, CW_DEBUG_GENERATOR, CW_DEBUG_INFO,
@@ -1072,14 +1442,12 @@ void * cw_gen_dequeue_and_generate_internal(void * arg)
 			/* The 'while' loop handles spurious wakeups of
 			   pthread_cond_wait() and also ensures that the
 			   wait() function is called only when a wait is
-			   necessary. TODO: make sure that getting
-			   gen->tq->state doesn't require locking a tq
-			   mutex. */
-			pthread_mutex_lock(&(gen->tq->wait_mutex));
-			while (CW_TQ_EMPTY == gen->tq->state && gen->do_dequeue_and_generate) {
-				pthread_cond_wait(&gen->tq->wait_var, &gen->tq->wait_mutex);
+			   necessary. */
+			cw_tq_waiter_lock_internal(gen->tq, CW_TQ_WAIT_TONE_AVAILABLE);
+			while (CW_TQ_EMPTY == cw_tq_get_state_internal(gen->tq) && gen->do_dequeue_and_generate) {
+				cw_tq_waiter_wait_internal(gen->tq, CW_TQ_WAIT_TONE_AVAILABLE);
 			}
-			pthread_mutex_unlock(&(gen->tq->wait_mutex));
+			cw_tq_waiter_unlock_internal(gen->tq, CW_TQ_WAIT_TONE_AVAILABLE);
 
 #if 0
 			/* Original implementation using signals. */ /* This code has been disabled some time before 2017-01-19. */
@@ -1156,9 +1524,8 @@ void * cw_gen_dequeue_and_generate_internal(void * arg)
 #ifdef GENERATOR_CLIENT_THREAD
 			fprintf(stderr, MSG_PREFIX "      sending signal on dequeue, target thread id = %ld\n", gen->library_client.thread_id);
 #endif
-			pthread_mutex_lock(&gen->tq->wait_mutex);
-			pthread_cond_broadcast(&gen->tq->wait_var);
-			pthread_mutex_unlock(&gen->tq->wait_mutex);
+			cw_tq_notify_waiters_internal(gen->tq, CW_TQ_WAIT_TONE_END);
+			cw_tq_post_event_internal(gen->tq, CW_GEN_EVENT_TONE_END);
 		}
 
 #ifdef GENERATOR_CLIENT_THREAD
@@ -1224,6 +1591,8 @@ void * cw_gen_dequeue_and_generate_internal(void * arg)
 #ifdef ENABLE_DEV_LIBCW_DEBUGGING
 		cw_debug_ev (&cw_debug_object_ev, 0, tone.frequency ? CW_DEBUG_EVENT_TONE_LOW : CW_DEBUG_EVENT_TONE_HIGH);
 #endif
+		cw_gen_sustain_begin_internal(gen, &tone, queue_state);
+
 		/* And finally, at the very end... */
 		CW_TONE_COPY(&prev_tone, &tone);
 
@@ -1232,6 +1601,9 @@ void * cw_gen_dequeue_and_generate_internal(void * arg)
 	cw_debug_msg (&cw_debug_object, CW_DEBUG_GENERATOR, CW_DEBUG_INFO,
 		      MSG_PREFIX "EXIT: generator stopped (gen->do_dequeue_and_generate = %d)", gen->do_dequeue_and_generate);
 
+	/* Stopped generator doesn't wait for tones. */
+	cw_tq_stats_consumer_stopped_internal(gen->tq);
+
 	/* Some functions in main thread may be waiting for the last
 	   notification from the generator thread to continue/finalize
 	   their business. Let's send that notification right before
@@ -1244,10 +1616,8 @@ void * cw_gen_dequeue_and_generate_internal(void * arg)
 	   base. What was I thinking? */
 	cw_usleep_internal(CW_USECS_PER_SEC / 2);
 
-	pthread_mutex_lock(&gen->tq->wait_mutex);
-	/* There may be many listeners, so use broadcast(). */
-	pthread_cond_broadcast(&gen->tq->wait_var);
-	pthread_mutex_unlock(&gen->tq->wait_mutex);
+	/* There may be many listeners, on any wait channel. */
+	cw_tq_notify_all_waiters_internal(gen->tq);
 
 #ifdef GENERATOR_CLIENT_THREAD
 	/* Original implementation using signals. */
@@ -1276,6 +1646,22 @@ void * cw_gen_dequeue_and_generate_internal(void * arg)
    so initial phase of new fragment of sine wave in the buffer matches
    ending phase of a sine wave generated in previous call.
 
+   The fragment is split into spans that correspond to parts of the
+   tone: rising slope, plateau, falling slope, or silence (for tones
+   with zero frequency). Each span is calculated in one go, without
+   deciding about amplitude of every sample: silence is just zeroed,
+   plateau is calculated with constant amplitude, and slopes take
+   amplitudes from tables of slope amplitudes.
+
+   The sine wave is calculated by a kernel selected for CPU at load time
+   of the library (see libcw_gen_kernels.c). The kernel advances phase of
+   the sine wave incrementally, and may use SIMD instructions. Every
+   span starts with exact phase, so rounding errors of the kernel don't
+   accumulate.
+
+   Fragments of plateaus of long tones are copied from generator's
+   wavetable (see cw_gen_t::wavetable) instead of being calculated.
+
    @internal
    @reviewed 2020-08-04
    @endinternal
@@ -1289,47 +1675,121 @@ int cw_gen_calculate_sine_wave_internal(cw_gen_t * gen, cw_tone_t * tone)
 {
 	assert (gen->buffer_sub_stop <= gen->buffer_n_samples);
 
-	/* We need two separate iterators to correctly generate sine wave:
-	    -- i -- for iterating through output buffer (generator
-	            buffer's subarea), it can travel between buffer
-	            cells delimited by start and stop (inclusive);
-	    -- t -- for calculating phase of a sine wave; 't' always has to
-	            start from zero for every calculated subarea (i.e. for
-		    every call of this function);
+	const int n_samples = gen->buffer_sub_stop - gen->buffer_sub_start + 1;
+	cw_sample_t * samples = gen->buffer + gen->buffer_sub_start;
 
-	  Initial/starting phase of generated fragment is always retained
-	  in gen->phase_offset, it is the only "memory" of previously
-	  calculated fragment of sine wave (to be precise: it stores phase
-	  of last sample in previously calculated fragment).
-	  Therefore iterator used to calculate phase of sine wave can't have
-	  the memory too. Therefore it has to always start from zero for
-	  every new fragment of sine wave. Therefore a separate t. */
+	if (cw_gen_wavetable_is_applicable_internal(gen, tone, n_samples)
+	    && CW_SUCCESS == cw_gen_wavetable_copy_internal(gen, tone, samples, n_samples)) {
+		return n_samples;
+	}
+
+	cw_gen_calculate_spans_internal(gen, tone, samples, n_samples, (double) gen->phase_offset);
+	cw_gen_advance_phase_internal(gen, tone->frequency, n_samples);
+
+	return n_samples;
+}
+
+
+
+
+/**
+   @brief Calculate samples of spans of a tone
+
+   Calculate @p n_samples samples of @p tone, starting with sample
+   indicated by tone's sample iterator, and put them into @p samples.
+   The tone's sample iterator is advanced by @p n_samples.
+
+   See cw_gen_calculate_sine_wave_internal() for description of spans.
+
+   @param[in] gen generator that generates sine wave
+   @param[in,out] tone specification of samples that should be calculated
+   @param[out] samples buffer for samples
+   @param[in] n_samples count of samples to calculate
+   @param[in] phase phase of first calculated sample
+*/
+static void cw_gen_calculate_spans_internal(const cw_gen_t * gen, cw_tone_t * tone, cw_sample_t * samples, int n_samples, double phase)
+{
+	if (tone->frequency <= 0) {
+		/* Silence. */
+		memset(samples, 0, (size_t) n_samples * sizeof (cw_sample_t));
+		tone->sample_iterator += n_samples;
+		return;
+	}
+
+	const cw_sine_kernel_t kernel = cw_sine_kernel_get_internal();
+
+	/* Angle by which the phase advances with every sample. */
+	const double step = 2.0 * (double) CW_PI * tone->frequency / gen->sample_rate;
+
+	/* Table of amplitudes of rising slope is followed by the same
+	   amplitudes in reversed order, forming falling slope. Volume of
+	   generator is applied later, in output gain stage. */
+	const cw_slope_table_t * table = gen->tone_slope.consumer_table;
+	const int16_t * rising_amplitudes = table ? table->amplitudes : NULL;
+	const int16_t * falling_amplitudes = table ? table->amplitudes + table->n_amplitudes : NULL;
+
+	const cw_sample_iter_t plateau_end = tone->n_samples - tone->falling_slope_n_samples;
 
-	float phase = 0.0F;
 	int t = 0;
+	while (t < n_samples) {
+		const cw_sample_iter_t i = tone->sample_iterator;
+		cw_sample_iter_t span_n_samples = 0;
+		const int16_t * amplitudes = NULL; /* NULL for plateau. */
 
-	for (int i = gen->buffer_sub_start; i <= gen->buffer_sub_stop; i++) {
-		phase = (2.0F * CW_PI
-			 * (float) (tone->frequency * t)
-			 / (float) gen->sample_rate)
-			+ gen->phase_offset;
-		const int amplitude = cw_gen_calculate_sample_amplitude_internal(gen, tone);
+		if (i < tone->rising_slope_n_samples) {
+			span_n_samples = tone->rising_slope_n_samples - i;
+			amplitudes = rising_amplitudes + i;
 
-		gen->buffer[i] = ((float) amplitude) * sinf(phase);
+		} else if (i < plateau_end) {
+			span_n_samples = plateau_end - i;
 
-		tone->sample_iterator++;
+		} else {
+			cw_assert (i < tone->n_samples, MSG_PREFIX "->sample_iterator out of bounds: %"PRId64" / %"PRId64, i, tone->n_samples);
+			span_n_samples = tone->n_samples - i;
+			/* i-th sample of tone has amplitude
+			   amplitudes[n_samples - i - 1] of rising slope. */
+			amplitudes = falling_amplitudes + (table->n_amplitudes - (tone->n_samples - i));
+		}
 
-		t++;
+		if (span_n_samples > n_samples - t) {
+			span_n_samples = n_samples - t;
+		}
+
+		kernel(samples + t, (int) span_n_samples, amplitudes, (float) CW_AUDIO_FULL_SCALE_AMPLITUDE,
+		       phase + step * t, step);
+
+		tone->sample_iterator += span_n_samples;
+		t += (int) span_n_samples;
 	}
 
-	phase = (2.0F * CW_PI
-		 * (float) (tone->frequency * t)
-		 / (float) gen->sample_rate)
+	return;
+}
+
+
+
+
+/**
+   @brief Advance phase offset of generator's sine wave
+
+   Calculate phase of the sample following @p n_samples samples of sine
+   wave with given @p frequency, and store it in generator as phase
+   offset of next fragment of sine wave.
+
+   @param[in,out] gen generator
+   @param[in] frequency frequency of the sine wave
+   @param[in] n_samples count of samples of calculated fragment of sine wave
+*/
+static void cw_gen_advance_phase_internal(cw_gen_t * gen, int frequency, int n_samples)
+{
+	/* Exact phase of the first sample in next fragment to be
+	   calculated, not affected by rounding errors of the
+	   kernel. */
+	const float phase = (2.0F * CW_PI
+			     * (float) (frequency * n_samples)
+			     / (float) gen->sample_rate)
 		+ gen->phase_offset;
 
-	/* "phase" is now phase of the first sample in next fragment to be
-	   calculated.
-	   However, for long fragments this can be a large value, well
+	/* For long fragments "phase" can be a large value, well
 	   beyond <0; 2*Pi) range.
 	   The value of phase may further accumulate in different
 	   calculations, and at some point it may overflow. This would
@@ -1340,98 +1800,530 @@ int cw_gen_calculate_sine_wave_internal(cw_gen_t * gen, cw_tone_t * tone)
 	   other words, lets apply modulo operation to the phase.
 
 	   The normalized phase will be used as a phase offset for next
-	   fragment (during next function call). It will be added phase of
-	   every sample calculated in next function call. */
+	   fragment (during next function call). */
 
 	/* TODO: check if n_periods can be a float. We could avoid the casts. */
 	const int n_periods = (int) floorf(phase / (2.0F * CW_PI));
 	gen->phase_offset = phase - (float) n_periods * 2.0F * CW_PI;
 
-	return t;
+	return;
 }
 
 
 
 
 /**
-   @brief Calculate value of a single sample of sine wave
+   @brief Get samples of a mark from generator's cache of marks
 
-   This function calculates an amplitude (a value) of a single sample
-   in sine wave PCM data.
+   Only marks with rising slope, not longer than one second, can be
+   cached. Samples of such marks are calculated starting with phase zero
+   (see comment on cw_gen_t::mark_cache), so a caller using samples
+   from the cache must start the mark with phase zero too.
 
-   Actually "calculation" is a bit too big word. The function just
-   makes a decision which of precalculated values to return. There are
-   no complicated arithmetical calculations being made each time the
-   function is called, so the execution time should be pretty small.
+   If samples of the mark are not in the cache yet, they are calculated
+   and put into the cache. Least recently used entry of the cache is
+   replaced if necessary.
 
-   The precalcuated values depend on some factors, so the values
-   should be re-calculated each time these factors change. See
-   cw_gen_set_tone_slope() for list of these factors.
+   The function must be called only by code consuming tones.
 
-   A generator contains some of information needed to get an amplitude of
-   every sample in a sine wave - this is why this function needs @p gen.  If
-   tone's slopes are non-rectangular, the duration of slopes is defined in
-   generator. If a tone is non-silent, the volume is also defined in
-   generator.
+   @param[in] gen generator
+   @param[in] tone tone with mark
 
-   However, decision tree for getting the amplitude also depends on some
-   parameters that are strictly bound to tone, such as what is the shape of
-   slopes for a given tone - this is why we have @p tone.  The @p tone also
-   stores iterator of samples - this is how we know for which sample in a
-   tone to calculate the amplitude.
+   @return pointer to all samples of the mark on success
+   @return NULL if the mark can't be cached, or on errors
+*/
+static const cw_sample_t * cw_gen_mark_cache_get_internal(cw_gen_t * gen, const cw_tone_t * tone)
+{
+	if (tone->frequency <= 0
+	    || tone->rising_slope_n_samples <= 0
+	    || tone->is_forever
+	    || tone->n_samples > (cw_sample_iter_t) gen->sample_rate) {
 
-   @internal
-   @reviewed 2020-08-05
-   @endinternal
+		return NULL;
+	}
 
-   @param[in] gen generator used to generate a sine wave
-   @param[in] tone tone being generated
+	if (gen->mark_cache.entries_generation != gen->mark_cache.synced_generation) {
+		/* Parameters of tones have changed since the entries
+		   were created. */
+		cw_gen_mark_cache_delete_internal(gen);
+		gen->mark_cache.entries_generation = gen->mark_cache.synced_generation;
+	}
 
-   @return value of a sample of sine wave, a non-negative number
-*/
-int cw_gen_calculate_sample_amplitude_internal(cw_gen_t * gen, const cw_tone_t * tone)
-{
-#if 0   /* Blunt algorithm for calculating amplitude. For debug purposes only. */
+	gen->mark_cache.clock++;
 
-	return tone->frequency ? gen->volume_abs : 0;
+	cw_gen_mark_cache_entry_t * lru = &gen->mark_cache.entries[0];
+	for (int i = 0; i < CW_GEN_MARK_CACHE_N_ENTRIES; i++) {
+		cw_gen_mark_cache_entry_t * entry = &gen->mark_cache.entries[i];
+		if (NULL != entry->samples
+		    && entry->n_samples == tone->n_samples
+		    && entry->frequency == tone->frequency
+		    && entry->rising_slope_n_samples == tone->rising_slope_n_samples
+		    && entry->falling_slope_n_samples == tone->falling_slope_n_samples) {
 
-#else
+			entry->last_used = gen->mark_cache.clock;
+			return entry->samples;
+		}
 
-	if (tone->frequency <= 0) {
-		return 0;
+		if (NULL == entry->samples) {
+			lru = entry;
+		} else if (NULL != lru->samples && entry->last_used < lru->last_used) {
+			lru = entry;
+		}
 	}
 
+	cw_sample_t * samples = (cw_sample_t *) realloc(lru->samples, (size_t) tone->n_samples * sizeof (cw_sample_t));
+	if (NULL == samples) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
+			      MSG_PREFIX "realloc()");
+		return NULL;
+	}
 
-	float amplitude = 0.0F;
+	cw_tone_t mark;
+	CW_TONE_COPY(&mark, tone);
+	mark.sample_iterator = 0;
+	cw_gen_calculate_spans_internal(gen, &mark, samples, (int) mark.n_samples, 0.0);
 
-	/* Every tone, regardless of slope mode (CW_SLOPE_MODE_*), has
-	   three components. It has rising slope + plateau + falling
-	   slope.
+	lru->samples = samples;
+	lru->n_samples = tone->n_samples;
+	lru->frequency = tone->frequency;
+	lru->rising_slope_n_samples = tone->rising_slope_n_samples;
+	lru->falling_slope_n_samples = tone->falling_slope_n_samples;
+	lru->last_used = gen->mark_cache.clock;
 
-	   There can be four variants of rising and falling slope
-	   length, just as there are four CW_SLOPE_MODE_* values.
+	return lru->samples;
+}
 
-	   There can be also tones with zero-length plateau, and there
-	   can be also tones with zero-length slopes. */
+
+
+
+/**
+   @brief Invalidate generator's cache of marks
+
+   Call this function each time a parameter affecting samples of marks
+   is changed.
+
+   The function can be called by any thread. Invalid entries will be
+   deleted by code consuming tones, at next use of the cache.
+
+   @param[in] gen generator
+*/
+static void cw_gen_mark_cache_invalidate_internal(cw_gen_t * gen)
+{
+	/* Release: a consumer that sees new generation also sees
+	   new parameters (e.g. new table of slope amplitudes)
+	   changed before the call. */
+	__atomic_add_fetch(&gen->mark_cache.generation, 1, __ATOMIC_RELEASE);
+	return;
+}
+
+
+
+
+/**
+   @brief Delete all entries of generator's cache of marks
+
+   @param[in] gen generator
+*/
+static void cw_gen_mark_cache_delete_internal(cw_gen_t * gen)
+{
+	for (int i = 0; i < CW_GEN_MARK_CACHE_N_ENTRIES; i++) {
+		free(gen->mark_cache.entries[i].samples);
+		gen->mark_cache.entries[i].samples = NULL;
+	}
+	return;
+}
+
+
+
+
+/**
+   @brief Apply generator's volume to samples in sound buffer
+
+   Samples of tones are calculated with full amplitude. Volume of
+   generator is applied to them by this function, just before samples
+   are pushed to sound sink.
+
+   When volume has changed since last call, gain of samples goes from
+   previous volume to the new one in a short linear ramp. The ramp
+   starts at the first sample in @p samples, so the change is audible
+   in the first buffer written after the change.
+
+   The function must be called only by code consuming tones.
+
+   @param[in] gen generator
+   @param[in,out] samples samples to which to apply the volume
+   @param[in] n_samples count of samples
+*/
+static void cw_gen_apply_output_gain_internal(cw_gen_t * gen, cw_sample_t * samples, int n_samples)
+{
+	/* Volume can be changed by other thread, read it only once. */
+	const int target = gen->volume_abs;
+
+	if (target != gen->output_gain.target) {
+		/* New volume, new ramp starting at current gain. */
+		int ramp_n_samples = (int) (((gen->sample_rate / 100) * CW_AUDIO_OUTPUT_GAIN_RAMP_DURATION) / 10000);
+		if (ramp_n_samples < 1) {
+			ramp_n_samples = 1;
+		}
+		int step = (target - gen->output_gain.current) / ramp_n_samples;
+		if (0 == step) {
+			step = target > gen->output_gain.current ? 1 : -1;
+		}
+		gen->output_gain.target = target;
+		gen->output_gain.step = step;
+	}
+
+	int gain = gen->output_gain.current;
+	int i = 0;
+
+	/* Ramp. */
+	for (; i < n_samples && gain != target; i++) {
+		gain += gen->output_gain.step;
+		if ((gen->output_gain.step > 0 && gain > target)
+		    || (gen->output_gain.step < 0 && gain < target)) {
+			gain = target;
+		}
+		samples[i] = (cw_sample_t) ((samples[i] * gain) >> 15);
+	}
+	gen->output_gain.current = gain;
+
+	/* Constant gain. Full volume leaves samples unchanged. */
+	if (gain < CW_AUDIO_VOLUME_RANGE) {
+		const cw_gain_kernel_t kernel = cw_gain_kernel_get_internal();
+		kernel(samples + i, n_samples - i, gain);
+	}
+
+	return;
+}
+
+
+
+
+/**
+   @brief Check if samples of a tone can be copied from wavetable
+
+   Wavetable is used only for plateaus of long tones: "forever" tones,
+   and tones longer than one second (shorter marks are taken from cache
+   of marks). All @p n_samples samples, starting at tone's sample
+   iterator, must belong to tone's plateau.
+
+   @param[in] gen generator
+   @param[in] tone tone to be calculated
+   @param[in] n_samples count of samples to be calculated
+
+   @return true if wavetable can be used
+   @return false otherwise
+*/
+static bool cw_gen_wavetable_is_applicable_internal(const cw_gen_t * gen, const cw_tone_t * tone, int n_samples)
+{
+	if (tone->frequency <= 0) {
+		return false;
+	}
+	if (!tone->is_forever && tone->n_samples <= (cw_sample_iter_t) gen->sample_rate) {
+		return false;
+	}
+
+	return tone->sample_iterator >= tone->rising_slope_n_samples
+		&& tone->sample_iterator + n_samples <= tone->n_samples - tone->falling_slope_n_samples;
+}
+
+
+
+
+/**
+   @brief Copy samples of plateau of a tone from wavetable
+
+   Put into @p samples @p n_samples samples of sine wave with tone's
+   frequency and full amplitude, starting at generator's current phase
+   offset. Advance tone's sample iterator and generator's phase offset.
+
+   The wavetable is (re)calculated when necessary.
+
+   @param[in] gen generator
+   @param[in,out] tone tone to be calculated
+   @param[out] samples buffer for samples
+   @param[in] n_samples count of samples to copy
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+static cw_ret_t cw_gen_wavetable_copy_internal(cw_gen_t * gen, cw_tone_t * tone, cw_sample_t * samples, int n_samples)
+{
+	const double phase = (double) gen->phase_offset;
+
+	int position = -1;
+	if (NULL != gen->wavetable.samples && gen->wavetable.frequency == tone->frequency) {
+		if (fabsf(gen->phase_offset - gen->wavetable.position_phase) < 1e-6F) {
+			/* Continuation of previous copy, most probably the
+			   same tone. */
+			position = gen->wavetable.position;
+		} else {
+			position = cw_gen_wavetable_find_position_internal(gen, phase);
+		}
+	}
+	if (position < 0) {
+		if (CW_SUCCESS != cw_gen_wavetable_calculate_internal(gen, tone->frequency, phase)) {
+			return CW_FAILURE;
+		}
+		position = 0;
+	}
+
+	int i = 0;
+	while (i < n_samples) {
+		int n = gen->wavetable.n_samples - position;
+		if (n > n_samples - i) {
+			n = n_samples - i;
+		}
+		memcpy(samples + i, gen->wavetable.samples + position, (size_t) n * sizeof (cw_sample_t));
+		i += n;
+		position = (position + n) % gen->wavetable.n_samples;
+	}
+	tone->sample_iterator += n_samples;
+
+	/* Phase offset of next sample is calculated from position in the
+	   table, so errors of phase don't accumulate in long tones. */
+	const double step = 2.0 * (double) CW_PI * tone->frequency / gen->sample_rate;
+	const double next_phase = fmod(gen->wavetable.phase + step * position, 2.0 * (double) CW_PI);
+	gen->phase_offset = (float) next_phase;
+
+	gen->wavetable.position = position;
+	gen->wavetable.position_phase = gen->phase_offset;
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   @brief Find sample in wavetable that has given phase
+
+   @param[in] gen generator
+   @param[in] phase phase of sine wave to find
+
+   @return index of sample in wavetable
+   @return -1 if the table has no sample with given phase
+*/
+static int cw_gen_wavetable_find_position_internal(const cw_gen_t * gen, double phase)
+{
+	const double two_pi = 2.0 * (double) CW_PI;
+	const double period_n_samples = (double) gen->sample_rate / gen->wavetable.frequency;
+	const int n_periods = (int) lround(gen->wavetable.n_samples / period_n_samples);
+
+	double delta = fmod(phase - gen->wavetable.phase, two_pi);
+	if (delta < 0.0) {
+		delta += two_pi;
+	}
+
+	/* The phase is found in every period of the table, but only in
+	   one of them (if any) it is the phase of a sample. */
+	const double first = delta / two_pi * period_n_samples;
+	for (int p = 0; p < n_periods; p++) {
+		const double x = first + p * period_n_samples;
+		const double nearest = floor(x + 0.5);
+		if (fabs(x - nearest) < 0.01) {
+			return (int) nearest % gen->wavetable.n_samples;
+		}
+	}
+
+	return -1;
+}
+
+
+
+
+/**
+   @brief Calculate samples in wavetable
+
+   The table will contain the shortest sequence of samples that forms an
+   integer number of periods of sine wave with frequency @p frequency.
+   This is never more than one second of samples.
+
+   @param[in] gen generator
+   @param[in] frequency frequency of sine wave
+   @param[in] phase phase of first sample in the table
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+static cw_ret_t cw_gen_wavetable_calculate_internal(cw_gen_t * gen, int frequency, double phase)
+{
+	/* sample_rate / gcd samples are frequency / gcd periods. */
+	unsigned int a = gen->sample_rate;
+	unsigned int b = (unsigned int) frequency;
+	while (0 != b) {
+		const unsigned int r = a % b;
+		a = b;
+		b = r;
+	}
+	const int n_samples = (int) (gen->sample_rate / a);
+
+	if (n_samples != gen->wavetable.n_samples || NULL == gen->wavetable.samples) {
+		cw_sample_t * samples = (cw_sample_t *) realloc(gen->wavetable.samples, (size_t) n_samples * sizeof (cw_sample_t));
+		if (NULL == samples) {
+			cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
+				      MSG_PREFIX "realloc()");
+			return CW_FAILURE;
+		}
+		gen->wavetable.samples = samples;
+		gen->wavetable.n_samples = n_samples;
+	}
+
+	const double step = 2.0 * (double) CW_PI * frequency / gen->sample_rate;
+	const cw_sine_kernel_t kernel = cw_sine_kernel_get_internal();
+	kernel(gen->wavetable.samples, n_samples, NULL, (float) CW_AUDIO_FULL_SCALE_AMPLITUDE, phase, step);
+
+	gen->wavetable.frequency = frequency;
+	gen->wavetable.phase = phase;
+	gen->wavetable.position = 0;
+	gen->wavetable.position_phase = (float) phase;
+
+	return CW_SUCCESS;
+}
+
+
+
+
+#ifdef LIBCW_UNIT_TESTS
+/**
+   @brief Calculate a fragment of sine wave with sinf()
+
+   Reference implementation of cw_gen_calculate_sine_wave_internal(),
+   calling sinf() for every sample. It is used by unit tests to verify
+   correctness and speed of the oscillator. Arguments and return value
+   are the same as in cw_gen_calculate_sine_wave_internal().
+
+   @param[in] gen generator that generates sine wave
+   @param[in,out] tone specification of samples that should be calculated
+
+   @return number of calculated samples
+*/
+int cw_gen_calculate_sine_wave_sinf_internal(cw_gen_t * gen, cw_tone_t * tone)
+{
+	assert (gen->buffer_sub_stop <= gen->buffer_n_samples);
+
+	/* We need two separate iterators to correctly generate sine wave:
+	    -- i -- for iterating through output buffer (generator
+	            buffer's subarea), it can travel between buffer
+	            cells delimited by start and stop (inclusive);
+	    -- t -- for calculating phase of a sine wave; 't' always has to
+	            start from zero for every calculated subarea (i.e. for
+		    every call of this function). */
+
+	float phase = 0.0F;
+	int t = 0;
+
+	for (int i = gen->buffer_sub_start; i <= gen->buffer_sub_stop; i++) {
+		phase = (2.0F * CW_PI
+			 * (float) (tone->frequency * t)
+			 / (float) gen->sample_rate)
+			+ gen->phase_offset;
+		const int amplitude = cw_gen_calculate_sample_amplitude_internal(gen, tone);
+
+		gen->buffer[i] = ((float) amplitude) * sinf(phase);
+
+		tone->sample_iterator++;
+
+		t++;
+	}
+
+	phase = (2.0F * CW_PI
+		 * (float) (tone->frequency * t)
+		 / (float) gen->sample_rate)
+		+ gen->phase_offset;
+
+	const int n_periods = (int) floorf(phase / (2.0F * CW_PI));
+	gen->phase_offset = phase - (float) n_periods * 2.0F * CW_PI;
+
+	return t;
+}
+
+
+
+
+/**
+   @brief Calculate value of a single sample of sine wave
+
+   This function calculates an amplitude (a value) of a single sample
+   in sine wave PCM data.
+
+   cw_gen_calculate_sine_wave_internal() calculates amplitudes of whole
+   spans of samples, this function is used only by reference
+   implementation in unit tests.
+
+   Actually "calculation" is a bit too big word. The function just
+   makes a decision which of precalculated values to return. There are
+   no complicated arithmetical calculations being made each time the
+   function is called, so the execution time should be pretty small.
+
+   The precalcuated values depend on some factors, so the values
+   should be re-calculated each time these factors change. See
+   cw_gen_set_tone_slope() for list of these factors.
+
+   A generator contains some of information needed to get an amplitude of
+   every sample in a sine wave - this is why this function needs @p gen.  If
+   tone's slopes are non-rectangular, the duration of slopes is defined in
+   generator. If a tone is non-silent, the volume is also defined in
+   generator.
+
+   However, decision tree for getting the amplitude also depends on some
+   parameters that are strictly bound to tone, such as what is the shape of
+   slopes for a given tone - this is why we have @p tone.  The @p tone also
+   stores iterator of samples - this is how we know for which sample in a
+   tone to calculate the amplitude.
+
+   @internal
+   @reviewed 2020-08-05
+   @endinternal
+
+   @param[in] gen generator used to generate a sine wave
+   @param[in] tone tone being generated
+
+   @return value of a sample of sine wave, a non-negative number
+*/
+int cw_gen_calculate_sample_amplitude_internal(cw_gen_t * gen, const cw_tone_t * tone)
+{
+#if 0   /* Blunt algorithm for calculating amplitude. For debug purposes only. */
+
+	return tone->frequency ? CW_AUDIO_FULL_SCALE_AMPLITUDE : 0;
+
+#else
+
+	if (tone->frequency <= 0) {
+		return 0;
+	}
+
+
+	int amplitude = 0;
+
+	/* Every tone, regardless of slope mode (CW_SLOPE_MODE_*), has
+	   three components. It has rising slope + plateau + falling
+	   slope.
+
+	   There can be four variants of rising and falling slope
+	   length, just as there are four CW_SLOPE_MODE_* values.
+
+	   There can be also tones with zero-length plateau, and there
+	   can be also tones with zero-length slopes. */
 
 	if (tone->sample_iterator < tone->rising_slope_n_samples) {
 		/* Beginning of tone, rising slope. */
 		const int i = tone->sample_iterator;
-		amplitude = gen->tone_slope.amplitudes[i];
+		amplitude = (gen->tone_slope.consumer_table->amplitudes[i] * CW_AUDIO_FULL_SCALE_AMPLITUDE) >> 15;
 		assert (amplitude >= 0);
 
 	} else if (tone->sample_iterator >= tone->rising_slope_n_samples
 		   && tone->sample_iterator < tone->n_samples - tone->falling_slope_n_samples) {
 
 		/* Middle of tone, plateau, constant amplitude. */
-		amplitude = (float) gen->volume_abs;
+		amplitude = CW_AUDIO_FULL_SCALE_AMPLITUDE;
 		assert (amplitude >= 0);
 
 	} else if (tone->sample_iterator >= tone->n_samples - tone->falling_slope_n_samples) {
 		/* Falling slope. */
 		const cw_sample_iter_t i = tone->n_samples - tone->sample_iterator - 1;
 		assert (i >= 0);
-		amplitude = gen->tone_slope.amplitudes[i];
+		amplitude = (gen->tone_slope.consumer_table->amplitudes[i] * CW_AUDIO_FULL_SCALE_AMPLITUDE) >> 15;
 		assert (amplitude >= 0);
 
 	} else {
@@ -1446,10 +2338,11 @@ int cw_gen_calculate_sample_amplitude_internal(cw_gen_t * gen, const cw_tone_t *
 			   tone->falling_slope_n_samples);
 	}
 
-	assert (amplitude >= 0.0F);
-	return (int) amplitude;
+	assert (amplitude >= 0);
+	return amplitude;
 #endif
 }
+#endif /* #ifdef LIBCW_UNIT_TESTS */
 
 
 
@@ -1490,8 +2383,10 @@ int cw_gen_calculate_sample_amplitude_internal(cw_gen_t * gen, const cw_tone_t *
 
    @li shape of slope,
    @li duration of slope,
-   @li generator's sample rate,
-   @li generator's volume.
+   @li generator's sample rate.
+
+   Change of generator's volume doesn't require a call to this
+   function: volume is applied to samples by output gain stage.
 
    There are four supported shapes of slopes:
    @li linear (the only one supported by libcw until version 4.1.1),
@@ -1564,40 +2459,43 @@ cw_ret_t cw_gen_set_tone_slope(cw_gen_t * gen, int slope_shape, int slope_durati
 	cw_assert (slope_n_samples >= 0, MSG_PREFIX "negative slope_n_samples: %d", slope_n_samples);
 
 
-	/* Reallocate the table of slope amplitudes only when necessary.
-
-	   In practice the function will be called foremost when user changes
-	   volume of tone, and then the function may be called several times
-	   in a row if volume is changed in steps. In such situation the size
-	   of amplitudes table doesn't change.
+	/* Get a table of slope amplitudes only when shape or duration of
+	   slopes changes. Tables are shared with other generators. */
 
-	   TODO: do we really need to change type/duration of slopes when
-	   volume changes? Perhaps a call to
-	   cw_gen_recalculate_slope_amplitudes_internal() would be enough? */
+	pthread_mutex_lock(&gen->tone_slope.mutex);
 
-	if (gen->tone_slope.n_amplitudes != slope_n_samples) {
-
-		 /* Remember that slope_n_samples may be zero. In that
-		    case realloc() would equal to free(). We don't
-		    want to have NULL ->amplitudes, so don't modify
-		    ->amplitudes for zero-duration slopes.  Since with
-		    zero-duration slopes we won't be referring to
-		    ->amplitudes[], it is ok that the table will not
-		    be up-to-date. */
+	cw_slope_table_t * old_table = NULL;
+	cw_slope_table_t * table = gen->tone_slope.table;
+	if ((NULL == table && slope_n_samples > 0)
+	    || (NULL != table && (table->shape != gen->tone_slope.shape || table->n_amplitudes != slope_n_samples))) {
 
+		/* Remember that slope_n_samples may be zero. With
+		   zero-duration slopes we won't be referring to
+		   ->table, so there is no table for them. */
+		table = NULL;
 		if (slope_n_samples > 0) {
-			gen->tone_slope.amplitudes = realloc(gen->tone_slope.amplitudes, sizeof(float) * slope_n_samples);
-			if (!gen->tone_slope.amplitudes) {
+			table = cw_slope_table_get_internal(gen->tone_slope.shape, slope_n_samples);
+			if (!table) {
+				pthread_mutex_unlock(&gen->tone_slope.mutex);
 				cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_GENERATOR, CW_DEBUG_ERROR,
-					      MSG_PREFIX "failed to realloc() table of slope amplitudes");
+					      MSG_PREFIX "failed to get table of slope amplitudes");
 				return CW_FAILURE;
 			}
 		}
 
-		gen->tone_slope.n_amplitudes = slope_n_samples;
+		/* The new table replaces the old one with a single
+		   store. Consumer may still calculate samples of current
+		   tone with the old table, but it holds its own reference
+		   to the table (see cw_gen_tone_slope_sync_internal()), so
+		   the table is freed when the consumer stops using it. */
+		old_table = gen->tone_slope.table;
+		__atomic_store_n(&gen->tone_slope.table, table, __ATOMIC_RELEASE);
 	}
 
-	cw_gen_recalculate_slope_amplitudes_internal(gen);
+	pthread_mutex_unlock(&gen->tone_slope.mutex);
+	cw_slope_table_put_internal(old_table);
+
+	cw_gen_mark_cache_invalidate_internal(gen);
 
 	return CW_SUCCESS;
 }
@@ -1606,52 +2504,35 @@ cw_ret_t cw_gen_set_tone_slope(cw_gen_t * gen, int slope_shape, int slope_durati
 
 
 /**
-   @brief Recalculate amplitudes of PCM samples that form tone's slopes
+   @brief Change sample rate of generator that doesn't play on its sound device
 
-   @internal
-   @reviewed 2020-08-05
-   @endinternal
+   Generators registered in a mixer produce samples with sample rate of
+   mixer's sound device. Parameters of generator that depend on sample
+   rate are recalculated.
 
-   TODO: consider writing unit test code for the function.
+   Don't call the function for started generator.
 
    @param[in] gen generator
-*/
-void cw_gen_recalculate_slope_amplitudes_internal(cw_gen_t * gen)
-{
-	/* The values in amplitudes[] change from zero to max (at
-	   least for any sane slope shape), so naturally they can be
-	   used in forming rising slope. However they can be used in
-	   forming falling slope as well - just iterate the table from
-	   end to beginning. */
-	for (int i = 0; i < gen->tone_slope.n_amplitudes; i++) {
-
-		if (gen->tone_slope.shape == CW_TONE_SLOPE_SHAPE_LINEAR) {
-			gen->tone_slope.amplitudes[i] = (float) (i * gen->volume_abs) / (float) gen->tone_slope.n_amplitudes;
-
-		} else if (gen->tone_slope.shape == CW_TONE_SLOPE_SHAPE_SINE) {
-			const float radian = (float) i * (CW_PI / 2.0F) / (float) gen->tone_slope.n_amplitudes;
-			const float y = sinf(radian);
-			gen->tone_slope.amplitudes[i] = y * (float) gen->volume_abs;
-
-		} else if (gen->tone_slope.shape == CW_TONE_SLOPE_SHAPE_RAISED_COSINE) {
-			const float radian = (float) i * CW_PI / (float) gen->tone_slope.n_amplitudes;
-			const float y = (1 - ((1 + cosf(radian)) / 2));
-			gen->tone_slope.amplitudes[i] = y * (float) gen->volume_abs;
-
-		} else if (gen->tone_slope.shape == CW_TONE_SLOPE_SHAPE_RECTANGULAR) {
-			/* CW_TONE_SLOPE_SHAPE_RECTANGULAR is covered
-			   before entering this "for" loop. */
-			/* TODO: to avoid treating
-			   CW_TONE_SLOPE_SHAPE_RECTANGULAR as special case,
-			   add the calculation here. */
-			cw_assert (0, MSG_PREFIX "we shouldn't be here, calculating rectangular slopes");
-
-		} else {
-			cw_assert (0, MSG_PREFIX "unsupported slope shape %d", gen->tone_slope.shape);
-		}
-	}
+   @param[in] sample_rate new sample rate
 
-	return;
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+cw_ret_t cw_gen_set_sample_rate_internal(cw_gen_t * gen, unsigned int sample_rate)
+{
+	if (gen->sample_rate == sample_rate) {
+		return CW_SUCCESS;
+	}
+
+	gen->sample_rate = sample_rate;
+
+	/* Contents of wavetable depend on sample rate. Zero frequency
+	   forces recalculation of the table. */
+	gen->wavetable.frequency = 0;
+
+	/* Count of samples in slopes depends on sample rate. This also
+	   invalidates cache of marks. */
+	return cw_gen_set_tone_slope(gen, -1, -1);
 }
 
 
@@ -1673,8 +2554,9 @@ int cw_gen_write_to_soundcard_internal(cw_gen_t * gen, cw_tone_t * tone)
 {
 	cw_assert (NULL != tone, MSG_PREFIX "'tone' argument should always be non-NULL");
 
-	/* Total number of samples to write in a loop below. */
-	int64_t samples_to_write = tone->n_samples;
+	/* Total number of samples to write in a loop below. The tone may
+	   have been partially written to a buffer of cw_gen_fill(). */
+	int64_t samples_to_write = tone->n_samples - tone->sample_iterator;
 
 #define LIBCW_WRITE_LOOP_DEBUG_LEVEL 0
 #if LIBCW_WRITE_LOOP_DEBUG_LEVEL > 0
@@ -1685,6 +2567,18 @@ int cw_gen_write_to_soundcard_internal(cw_gen_t * gen, cw_tone_t * tone)
 		(double) n_loops_expected, tone->frequency, gen->buffer_n_samples, samples_to_write);
 #endif
 
+	/* Mark with rising slope starts with amplitude zero, so the
+	   phase of its sine wave can be reset without audible click. With
+	   constant initial phase, samples of the mark can be taken from
+	   cache. */
+	const cw_sample_t * cached = NULL;
+	if (tone->frequency > 0 && tone->rising_slope_n_samples > 0) {
+		if (0 == tone->sample_iterator) {
+			gen->phase_offset = 0.0F;
+		}
+		cached = cw_gen_mark_cache_get_internal(gen, tone);
+	}
+
 	// cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_GENERATOR, CW_DEBUG_DEBUG, MSG_PREFIX "%lld samples, %d us, %d Hz", tone->n_samples, tone->duration, gen->frequency);
 	while (samples_to_write > 0) {
 
@@ -1731,20 +2625,34 @@ int cw_gen_write_to_soundcard_internal(cw_gen_t * gen, cw_tone_t * tone)
 #endif
 
 
-		const int calculated = cw_gen_calculate_sine_wave_internal(gen, tone);
-		cw_assert (calculated == buffer_sub_n_samples, MSG_PREFIX "calculated wrong number of samples: %d != %d", calculated, buffer_sub_n_samples);
+		if (NULL != cached) {
+			memcpy(gen->buffer + gen->buffer_sub_start, cached + tone->sample_iterator, (size_t) buffer_sub_n_samples * sizeof (cw_sample_t));
+			tone->sample_iterator += buffer_sub_n_samples;
+			cw_gen_advance_phase_internal(gen, tone->frequency, buffer_sub_n_samples);
+		} else {
+			const int calculated = cw_gen_calculate_sine_wave_internal(gen, tone);
+			cw_assert (calculated == buffer_sub_n_samples, MSG_PREFIX "calculated wrong number of samples: %d != %d", calculated, buffer_sub_n_samples);
+		}
 
 		if (gen->buffer_sub_stop == gen->buffer_n_samples - 1) {
 
 			/* We have a buffer full of samples. The
 			   buffer is ready to be pushed to sound
 			   sink. */
+			cw_gen_apply_output_gain_internal(gen, gen->buffer, gen->buffer_n_samples);
 			gen->write_buffer_to_sound_device(gen);
 #ifdef ENABLE_DEV_PCM_SAMPLES_FILE
 			cw_dev_debug_raw_sink_write_internal(gen);
 #endif
 			gen->buffer_sub_start = 0;
 			gen->buffer_sub_stop = 0;
+
+			if (gen->fill.active) {
+				/* Client's buffer is full. Remaining samples
+				   of the tone will be written in next call
+				   to cw_gen_fill(). */
+				break;
+			}
 		} else {
 			/* #needmoresamples
 			   There is still some space left in the
@@ -1867,7 +2775,7 @@ void cw_gen_empty_tone_calculate_samples_size_internal(const cw_gen_t * gen, cw_
    @param[in] gen
    @param[in] tone tone for which to calculate samples
 */
-void cw_gen_silencing_tone_calculate_samples_size_internal(const cw_gen_t * gen, cw_tone_t * tone)
+void cw_gen_silencing_tone_calculate_samples_size_internal(cw_gen_t * gen, cw_tone_t * tone)
 {
 	/* Make sure that we fill a buffer to the end (i.e. calculate as many
 	   samples as there are from current position in the buffer to the
@@ -1881,9 +2789,8 @@ void cw_gen_silencing_tone_calculate_samples_size_internal(const cw_gen_t * gen,
 	tone->duration = 0;    /* This value matters no more, because now we only deal with samples. */
 
 	/* Length of a single slope. */
-	cw_sample_iter_t slope_n_samples = gen->sample_rate / 100;
-	slope_n_samples *= gen->tone_slope.duration;
-	slope_n_samples /= 10000;
+	cw_gen_tone_slope_sync_internal(gen);
+	const cw_sample_iter_t slope_n_samples = gen->tone_slope.consumer_table ? gen->tone_slope.consumer_table->n_amplitudes : 0;
 
 	switch (tone->slope_mode) {
 	case CW_SLOPE_MODE_NO_SLOPES:
@@ -1931,7 +2838,7 @@ void cw_gen_silencing_tone_calculate_samples_size_internal(const cw_gen_t * gen,
    @param[in] gen
    @param[in] tone tone for which to calculate samples count.
 */
-void cw_gen_tone_calculate_samples_size_internal(const cw_gen_t * gen, cw_tone_t * tone)
+void cw_gen_tone_calculate_samples_size_internal(cw_gen_t * gen, cw_tone_t * tone)
 {
 	/* 100 * 10000 = 1.000.000 usecs per second. */
 	tone->n_samples = gen->sample_rate / 100;
@@ -1940,10 +2847,11 @@ void cw_gen_tone_calculate_samples_size_internal(const cw_gen_t * gen, cw_tone_t
 
 	//fprintf(stderr, MSG_PREFIX "length of regular tone = %d [samples]\n", tone->n_samples);
 
-	/* Length of a single slope (rising or falling). */
-	cw_sample_iter_t slope_n_samples = gen->sample_rate / 100;
-	slope_n_samples *= gen->tone_slope.duration;
-	slope_n_samples /= 10000;
+	/* Length of a single slope (rising or falling). Slopes of the
+	   tone are formed with generator's current table of slope
+	   amplitudes, so their length is taken from the table. */
+	cw_gen_tone_slope_sync_internal(gen);
+	const cw_sample_iter_t slope_n_samples = gen->tone_slope.consumer_table ? gen->tone_slope.consumer_table->n_amplitudes : 0;
 
 	if (tone->slope_mode == CW_SLOPE_MODE_RISING_SLOPE) {
 		tone->rising_slope_n_samples = slope_n_samples;
@@ -1984,6 +2892,46 @@ void cw_gen_tone_calculate_samples_size_internal(const cw_gen_t * gen, cw_tone_t
 
 
 
+/**
+   @brief Start using current table of slope amplitudes of generator
+
+   Function is called by code calculating samples of tones, at the
+   beginning of every tone. If cw_gen_set_tone_slope() has published a
+   new table, the consumer takes a reference to the new table and
+   releases its reference to the previous one. Since the previous table
+   is released by the consumer, it is never freed while the consumer is
+   still calculating samples with it.
+
+   @param[in] gen generator
+*/
+static void cw_gen_tone_slope_sync_internal(cw_gen_t * gen)
+{
+	/* Generation is read before the table. If the table is
+	   replaced after the read, the generation will be incremented
+	   after the replacement, and the marks calculated with the old
+	   table won't be used with next tone. */
+	gen->mark_cache.synced_generation = __atomic_load_n(&gen->mark_cache.generation, __ATOMIC_ACQUIRE);
+
+	if (__atomic_load_n(&gen->tone_slope.table, __ATOMIC_ACQUIRE) == gen->tone_slope.consumer_table) {
+		/* Usual case: slopes haven't changed since previous tone. */
+		return;
+	}
+
+	cw_slope_table_t * previous = gen->tone_slope.consumer_table;
+
+	pthread_mutex_lock(&gen->tone_slope.mutex);
+	gen->tone_slope.consumer_table = gen->tone_slope.table;
+	cw_slope_table_ref_internal(gen->tone_slope.consumer_table);
+	pthread_mutex_unlock(&gen->tone_slope.mutex);
+
+	cw_slope_table_put_internal(previous);
+
+	return;
+}
+
+
+
+
 cw_ret_t cw_gen_set_speed(cw_gen_t * gen, int new_value)
 {
 	if (new_value < CW_SPEED_MIN || new_value > CW_SPEED_MAX) {
@@ -2012,6 +2960,7 @@ cw_ret_t cw_gen_set_frequency(cw_gen_t * gen, int new_value)
 		return CW_FAILURE;
 	} else {
 		gen->frequency = new_value;
+		cw_gen_mark_cache_invalidate_internal(gen);
 		return CW_SUCCESS;
 	}
 }
@@ -2026,10 +2975,11 @@ cw_ret_t cw_gen_set_volume(cw_gen_t * gen, int new_value)
 		return CW_FAILURE;
 	} else {
 		gen->volume_percent = new_value;
+		/* Samples of tones don't depend on volume. The new volume
+		   will be applied by output gain stage to next sound
+		   buffer. */
 		gen->volume_abs = (gen->volume_percent * CW_AUDIO_VOLUME_RANGE) / 100;
 
-		cw_gen_set_tone_slope(gen, -1, -1);
-
 		return CW_SUCCESS;
 	}
 }
@@ -2232,34 +3182,23 @@ cw_ret_t cw_gen_enqueue_mark_internal(cw_gen_t * gen, char mark, bool is_first)
 
 
 /**
-   @brief Enqueue inter-character-space
-
-   The function enqueues enough space to form 3-Unit inter-character-space.
+   @brief Calculate duration of inter-character-space
 
-   The function can be called even when inter-mark-space has already been
-   enqueued. In such situation standard inter-mark-space (one Unit) will be
-   followed by just two Units to form a full standard inter-character-space
-   (three Units).
+   The inter-character-space should be shorter by spaces that were
+   already enqueued before it.
 
-   Inter-character adjustment space is added at the end.
-
-   @reviewedon 2023-08-06
+   @param[in] gen generator with synchronized durations
+   @param[in] space_units_count count of units of space enqueued right before the inter-character-space
 
-   @param[in] gen generator in which to enqueue the space
-
-   @return CW_SUCCESS on success
-   @return CW_FAILURE on failure
+   @return duration of inter-character-space, without additional space [us]
 */
-cw_ret_t cw_gen_enqueue_ics_internal(cw_gen_t * gen)
+static int cw_gen_ics_duration_internal(const cw_gen_t * gen, int space_units_count)
 {
-	/* Synchronize low-level timing parameters. */
-	cw_gen_sync_parameters_internal(gen);
-
-	/* The ics enqueued here should be shorter by already enqueued/played
+	/* The ics calculated here should be shorter by already enqueued/played
 	   spaces. Calculate the duration of shorter ics depending on what kind
 	   of spaces were already enqueued before. */
 	int ics_duration = 0;
-	switch (gen->space_units_count) {
+	switch (space_units_count) {
 	case 0:
 		/* It's possible that dot or dash was enqueued without ims with
 		   cw_gen_enqueue_ik_symbol_no_ims_internal(), or maybe the count was
@@ -2268,7 +3207,7 @@ cw_ret_t cw_gen_enqueue_ics_internal(cw_gen_t * gen)
 		break;
 	case UNITS_PER_IMS:
 		/* This ics is appended after already enqueued ims. Duration of the
-		   tone that we enqueue here should be shorter by ims. The ims and
+		   tone that we calculate here should be shorter by ims. The ims and
 		   current shortened tone will together form 3-units ics. */
 		ics_duration = gen->durations.ics_duration - gen->durations.ims_duration;
 		break;
@@ -2281,7 +3220,7 @@ cw_ret_t cw_gen_enqueue_ics_internal(cw_gen_t * gen)
 		break;
 	default:
 		cw_debug_msg (&cw_debug_object, CW_DEBUG_PARAMETERS, CW_DEBUG_ERROR,
-		              MSG_PREFIX "Unexpected count of space units in 'enqueue ics': %d", gen->space_units_count);
+		              MSG_PREFIX "Unexpected count of space units in 'enqueue ics': %d", space_units_count);
 		ics_duration = gen->durations.ics_duration;
 		break;
 	}
@@ -2293,52 +3232,30 @@ cw_ret_t cw_gen_enqueue_ics_internal(cw_gen_t * gen)
 		ics_duration = gen->durations.ics_duration;
 	}
 
-	/* Enqueue ics with calculated duration, plus any additional inter-character gap. */
-	cw_tone_t tone;
-	CW_TONE_INIT(&tone, 0, ics_duration + gen->durations.additional_space_duration, CW_SLOPE_MODE_NO_SLOPES);
-	const cw_ret_t cwret = cw_tq_enqueue_internal(gen->tq, &tone);
-	gen->space_units_count = UNITS_PER_ICS;
-	return cwret;
+	return ics_duration;
 }
 
 
 
 
 /**
-   @brief Enqueue space character (' ') in generator, to be sent using Morse code
-
-   The function should be used to enqueue a regular ' ' character.
-
-   The function enqueues space of length 5 Units. The function is intended to
-   be used after inter-mark-space and inter-character-space have already been
-   enqueued.
+   @brief Calculate duration of inter-word-space
 
-   In such situation standard inter-mark-space (one Unit) and
-   inter-character-space (two Units) and regular space (five units) form a
-   full standard inter-word-space (seven Units).
+   The inter-word-space should be shorter by spaces that were already
+   enqueued before it.
 
-   TODO: review this description again. This function alone doesn't send
-   space character, it sends a part of what can be seen as inter-word-space.
-
-   Inter-word adjustment space is added at the end.
-
-   @reviewedon 2023-08-06
-
-   @param[in] gen generator in which to enqueue the space
+   @param[in] gen generator with synchronized durations
+   @param[in] space_units_count count of units of space enqueued right before the inter-word-space
 
-   @return CW_SUCCESS on success
-   @return CW_FAILURE on failure
+   @return duration of inter-word-space, without adjustment space [us]
 */
-cw_ret_t cw_gen_enqueue_iws_internal(cw_gen_t * gen)
+static int cw_gen_iws_duration_internal(const cw_gen_t * gen, int space_units_count)
 {
-	/* Synchronize low-level timing parameters. */
-	cw_gen_sync_parameters_internal(gen);
-
-	/* The iws enqueued here should be shorter by already enqueued/played
+	/* The iws calculated here should be shorter by already enqueued/played
 	   spaces. Calculate the duration of shorter iws depending on what kind
 	   of spaces were already enqueued before. */
 	int iws_duration = 0;
-	switch (gen->space_units_count) {
+	switch (space_units_count) {
 	case 0:
 		/* We may get here when we only begin to play some string, or when
 		   some reset of space_units_count was done, or when previous
@@ -2348,13 +3265,13 @@ cw_ret_t cw_gen_enqueue_iws_internal(cw_gen_t * gen)
 	case UNITS_PER_IMS:
 		/* This iws is appended after already enqueued ims (e.g. at the end
 		   of a word, when ' ' space character is played). Duration of the
-		   tone that we enqueue here should be shorter by ims. The ims and
+		   tone that we calculate here should be shorter by ims. The ims and
 		   current shortened tone will together form 7-unit iws. */
 		iws_duration = gen->durations.iws_duration - gen->durations.ims_duration;
 		break;
 	case UNITS_PER_ICS:
 		/* This iws is appended after already enqueued ics. Duration of the
-		   tone that we enqueue here should be shorter by ics. The ics and
+		   tone that we calculate here should be shorter by ics. The ics and
 		   current shortened tone will together form 7-unit iws. */
 		iws_duration = gen->durations.iws_duration - gen->durations.ics_duration;
 		break;
@@ -2365,7 +3282,7 @@ cw_ret_t cw_gen_enqueue_iws_internal(cw_gen_t * gen)
 		break;
 	default:
 		cw_debug_msg (&cw_debug_object, CW_DEBUG_PARAMETERS, CW_DEBUG_ERROR,
-		              MSG_PREFIX "Unexpected count of space units in 'enqueue iws': %d", gen->space_units_count);
+		              MSG_PREFIX "Unexpected count of space units in 'enqueue iws': %d", space_units_count);
 		iws_duration = gen->durations.iws_duration;
 		break;
 	};
@@ -2377,6 +3294,81 @@ cw_ret_t cw_gen_enqueue_iws_internal(cw_gen_t * gen)
 		iws_duration = gen->durations.iws_duration;
 	}
 
+	return iws_duration;
+}
+
+
+
+
+/**
+   @brief Enqueue inter-character-space
+
+   The function enqueues enough space to form 3-Unit inter-character-space.
+
+   The function can be called even when inter-mark-space has already been
+   enqueued. In such situation standard inter-mark-space (one Unit) will be
+   followed by just two Units to form a full standard inter-character-space
+   (three Units).
+
+   Inter-character adjustment space is added at the end.
+
+   @reviewedon 2023-08-06
+
+   @param[in] gen generator in which to enqueue the space
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+cw_ret_t cw_gen_enqueue_ics_internal(cw_gen_t * gen)
+{
+	/* Synchronize low-level timing parameters. */
+	cw_gen_sync_parameters_internal(gen);
+
+	const int ics_duration = cw_gen_ics_duration_internal(gen, gen->space_units_count);
+
+	/* Enqueue ics with calculated duration, plus any additional inter-character gap. */
+	cw_tone_t tone;
+	CW_TONE_INIT(&tone, 0, ics_duration + gen->durations.additional_space_duration, CW_SLOPE_MODE_NO_SLOPES);
+	const cw_ret_t cwret = cw_tq_enqueue_internal(gen->tq, &tone);
+	gen->space_units_count = UNITS_PER_ICS;
+	return cwret;
+}
+
+
+
+
+/**
+   @brief Enqueue space character (' ') in generator, to be sent using Morse code
+
+   The function should be used to enqueue a regular ' ' character.
+
+   The function enqueues space of length 5 Units. The function is intended to
+   be used after inter-mark-space and inter-character-space have already been
+   enqueued.
+
+   In such situation standard inter-mark-space (one Unit) and
+   inter-character-space (two Units) and regular space (five units) form a
+   full standard inter-word-space (seven Units).
+
+   TODO: review this description again. This function alone doesn't send
+   space character, it sends a part of what can be seen as inter-word-space.
+
+   Inter-word adjustment space is added at the end.
+
+   @reviewedon 2023-08-06
+
+   @param[in] gen generator in which to enqueue the space
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+cw_ret_t cw_gen_enqueue_iws_internal(cw_gen_t * gen)
+{
+	/* Synchronize low-level timing parameters. */
+	cw_gen_sync_parameters_internal(gen);
+
+	const int iws_duration = cw_gen_iws_duration_internal(gen, gen->space_units_count);
+
 	/* Send silence for the word delay period, plus any adjustment
 	   that may be needed at end of word. Make it in two tones,
 	   and here is why.
@@ -2482,22 +3474,381 @@ cw_ret_t cw_gen_enqueue_representation(cw_gen_t * gen, const char * representati
 	   exists in the tone queue. However, since the queue is comfortably
 	   long, we can get away with just looking for a high water mark.  */
 	if (cw_tq_length_internal(gen->tq) >= gen->tq->high_water_mark) {
+		cw_tq_stats_rejected_internal(gen->tq);
 		errno = EAGAIN;
 		return CW_FAILURE;
 	}
 
-	/* Enqueue the marks. Every mark is followed by inter-mark-space. */
-	for (int i = 0; representation[i] != '\0'; i++) {
-		const bool is_first = i == 0;
-		if (CW_SUCCESS != cw_gen_enqueue_mark_internal(gen, representation[i], is_first)) {
+	/* Enqueue the marks. Every mark is followed by inter-mark-space. */
+	for (int i = 0; representation[i] != '\0'; i++) {
+		const bool is_first = i == 0;
+		if (CW_SUCCESS != cw_gen_enqueue_mark_internal(gen, representation[i], is_first)) {
+			return CW_FAILURE;
+		}
+	}
+
+	/* This function will enqueue just a right amount of space after the last
+	   inter-mark-space to form a 3-unit inter-character-space. */
+	if (CW_SUCCESS != cw_gen_enqueue_ics_internal(gen)) {
+		return CW_FAILURE;
+	}
+
+	return CW_SUCCESS;
+}
+
+
+
+
+cw_ret_t cw_gen_enqueue_representation_no_ics(cw_gen_t * gen, const char * representation)
+{
+	if (!cw_representation_is_valid(representation)) {
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+
+	/* Before we let this representation loose on tone generation,
+	   we'd really like to know that all of its tones will get queued
+	   up successfully.  The right way to do this is to calculate the
+	   number of tones in our representation, then check that the space
+	   exists in the tone queue. However, since the queue is comfortably
+	   long, we can get away with just looking for a high water mark.
+
+	   TODO: do the check the proper way.
+	   TODO: wrap this check into a function and reuse it in cw_gen_enqueue_representation()
+	*/
+	if (cw_tq_length_internal(gen->tq) >= gen->tq->high_water_mark) {
+		cw_tq_stats_rejected_internal(gen->tq);
+		errno = EAGAIN;
+		return CW_FAILURE;
+	}
+
+	/* Enqueue the marks. Every mark is followed by inter-mark-space. */
+	for (int i = 0; representation[i] != '\0'; i++) {
+		const bool is_first = i == 0;
+		if (CW_SUCCESS != cw_gen_enqueue_mark_internal(gen, representation[i], is_first)) {
+			return CW_FAILURE;
+		}
+	}
+
+	/* No inter-character-space added here. */
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   @brief Put Marks and Spaces of a given valid ASCII character into producer's staging buffer
+
+   The tones are moved to generator's tone queue when @p staging is
+   committed (or when it becomes full, see cw_tq_stage_internal()).
+
+   _valid_character_ in function's name means that the function expects the
+   character @p character to be valid (@p character should be validated by
+   caller before passing it to the function).
+
+   @exception ENOENT @p character is not a valid character.
+   @exception EAGAIN tone queue is full
+
+   @param[in] gen generator to be used to enqueue character
+   @param[in,out] staging producer's staging buffer
+   @param[in] character character to stage
+   @param[in] no_ics don't append inter-character-space to the character
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+static cw_ret_t cw_gen_stage_valid_character_internal(cw_gen_t * gen, cw_tq_staging_t * staging, char character, bool no_ics)
+{
+	/* ' ' character (i.e. inter-word-space) is a special case. */
+	if (' ' != character) {
+		const char * representation = cw_character_to_representation_internal(character);
+
+		/* This shouldn't happen since we are in _valid_character_ function... */
+		cw_assert (NULL != representation, MSG_PREFIX "failed to find representation for character '%c'/%hhx", character, character);
+
+		/* ... but fail gracefully anyway. */
+		if (NULL == representation) {
+			errno = ENOENT;
+			return CW_FAILURE;
+		}
+
+		/* Same check as in cw_gen_enqueue_representation(). Tones
+		   that are staged but not committed yet count too. */
+		if (cw_tq_length_internal(gen->tq) + staging->n_tones >= gen->tq->high_water_mark) {
+			cw_tq_stats_rejected_internal(gen->tq);
+			errno = EAGAIN;
+			return CW_FAILURE;
+		}
+	}
+
+	/* Synchronize low-level timing parameters. */
+	cw_gen_sync_parameters_internal(gen);
+
+	if (0 == staging->n_tones && ' ' == character) {
+		/* Duration of inter-word-space depends on tones that
+		   are at the end of tone queue when the staged tones
+		   are committed. */
+		staging->space_units_count_assumed = staging->space_units_count;
+	}
+
+	cw_tone_t tones[CW_GEN_CHARACTER_N_TONES_MAX];
+	pthread_mutex_lock(&gen->parameters_mutex);
+	const int n_tones = cw_gen_character_to_tones_internal(gen, character, no_ics, &staging->space_units_count, tones);
+	pthread_mutex_unlock(&gen->parameters_mutex);
+	for (int i = 0; i < n_tones; i++) {
+		if (CW_SUCCESS != cw_tq_stage_internal(gen->tq, staging, &tones[i])) {
+			return CW_FAILURE;
+		}
+	}
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   @brief Initialize producer's staging buffer for enqueueing characters in generator
+
+   Count of units of space in the staging buffer starts at the current
+   value of generator's counter, and the counter is updated when the
+   staged tones are committed.
+
+   @param[in] gen generator in which the characters will be enqueued
+   @param[out] staging staging buffer to initialize
+*/
+static void cw_gen_staging_init_internal(cw_gen_t * gen, cw_tq_staging_t * staging)
+{
+	cw_tq_staging_init_internal(staging);
+	staging->space_units_counter = &gen->space_units_count;
+	staging->space_units_count = __atomic_load_n(&gen->space_units_count, __ATOMIC_RELAXED);
+}
+
+
+
+
+/**
+   @brief Enqueue Marks and Spaces of a given valid ASCII character in generator
+
+   All tones of the character are enqueued at once, so they don't
+   interleave with tones enqueued at the same time by other producers.
+
+   @exception ENOENT @p character is not a valid character.
+   @exception EAGAIN tone queue is full
+
+   @param[in] gen generator to be used to enqueue character
+   @param[in] character character to enqueue
+   @param[in] no_ics don't append inter-character-space to the character
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+static cw_ret_t cw_gen_enqueue_valid_character_tones_internal(cw_gen_t * gen, char character, bool no_ics)
+{
+	cw_tq_staging_t staging;
+	for (;;) {
+		cw_gen_staging_init_internal(gen, &staging);
+
+		if (CW_SUCCESS != cw_gen_stage_valid_character_internal(gen, &staging, character, no_ics)) {
+			return CW_FAILURE;
+		}
+
+		if (CW_SUCCESS == cw_tq_commit_internal(gen->tq, &staging)) {
+			return CW_SUCCESS;
+		}
+		if (ESTALE != errno) {
+			return CW_FAILURE;
+		}
+		/* Another producer has enqueued its tones in the
+		   meantime. Calculate the tones again. */
+	}
+}
+
+
+
+
+/**
+   @brief Enqueue a given valid ASCII character in generator, to be sent using Morse code
+
+   _valid_character_ in function's name means that the function expects the
+   character @p character to be valid (@p character should be validated by
+   caller before passing it to the function).
+
+   no_ics in function's name means that the inter-character-space is not
+   appended at the end of Marks and Spaces enqueued in generator (but the
+   last inter-mark-space is).
+
+   @exception ENOENT @p character is not a valid character.
+
+   @internal
+   @reviewed 2020-08-06
+   @endinternal
+
+   @param[in] gen generator to be used to enqueue character
+   @param[in] character character to enqueue
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+cw_ret_t cw_gen_enqueue_valid_character_no_ics_internal(cw_gen_t * gen, char character)
+{
+	if (NULL == gen) {
+		cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_GENERATOR, CW_DEBUG_ERROR,
+			      MSG_PREFIX "no generator available");
+		return CW_FAILURE;
+	}
+
+	if (CW_GEN_QUEUE_MODE_CHARACTERS == gen->queue_mode) {
+		return cw_gen_enqueue_symbol_internal(gen, character, true);
+	}
+
+	/* No inter-character-space here. */
+	return cw_gen_enqueue_valid_character_tones_internal(gen, character, true);
+}
+
+
+
+
+/**
+   @brief Enqueue a given valid ASCII character in generator, to be sent using Morse code
+
+   After enqueueing last Mark (Dot or Dash) comprising a character, an
+   inter-mark-space is enqueued. Inter-character-space is enqueued after that
+   last inter-mark-space. The inter-character-space is not added if @p
+   character is a ' ' character (i.e. inter-word-space).
+
+   _valid_character_ in function's name means that the function expects the
+   character @p character to be valid (@p character should be validated by
+   caller before passing it to the function).
+
+   @exception ENOENT @p character is not a valid character.
+
+   @reviewed 2023-08-26
+
+   @param[in] gen generator to be used to enqueue character
+   @param[in] character character to enqueue
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+cw_ret_t cw_gen_enqueue_valid_character_internal(cw_gen_t * gen, char character)
+{
+	if (NULL != gen && CW_GEN_QUEUE_MODE_CHARACTERS == gen->queue_mode) {
+		/* Character will get its inter-character-space when it is
+		   dequeued and expanded. */
+		return cw_gen_enqueue_symbol_internal(gen, character, false);
+	}
+
+	if (NULL == gen) {
+		cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_GENERATOR, CW_DEBUG_ERROR,
+			      MSG_PREFIX "no generator available");
+		return CW_FAILURE;
+	}
+
+	/* Inter-character-space is added at the end of the character,
+	   but not after ' ' character (i.e. inter-word-space): iws should
+	   not be followed by ics. */
+	return cw_gen_enqueue_valid_character_tones_internal(gen, character, false);
+}
+
+
+
+
+cw_ret_t cw_gen_enqueue_character(cw_gen_t * gen, char character)
+{
+	if (!cw_character_is_valid(character)) {
+		errno = ENOENT;
+		return CW_FAILURE;
+	}
+
+	/* This function adds inter-character-space at the end of character. */
+	if (CW_SUCCESS != cw_gen_enqueue_valid_character_internal(gen, character)) {
+		return CW_FAILURE;
+	}
+
+	return CW_SUCCESS;
+}
+
+
+
+
+cw_ret_t cw_gen_enqueue_character_no_ics(cw_gen_t * gen, char character)
+{
+	if (!cw_character_is_valid(character)) {
+		errno = ENOENT;
+		return CW_FAILURE;
+	}
+
+	/* This function doesn't add inter-character-space at the end of character. */
+	if (CW_SUCCESS != cw_gen_enqueue_valid_character_no_ics_internal(gen, character)) {
+		return CW_FAILURE;
+	}
+
+	return CW_SUCCESS;
+}
+
+
+
+
+cw_ret_t cw_gen_enqueue_string(cw_gen_t * gen, const char * string)
+{
+	/* Check that the string is composed of valid characters. */
+	if (!cw_string_is_valid(string)) {
+		errno = ENOENT;
+		return CW_FAILURE;
+	}
+
+	if (CW_GEN_QUEUE_MODE_CHARACTERS == gen->queue_mode) {
+		/* Send every character in the string. */
+		for (int i = 0; string[i] != '\0'; i++) {
+			if (CW_SUCCESS != cw_gen_enqueue_symbol_internal(gen, string[i], false)) {
+				return CW_FAILURE;
+			}
+		}
+		return CW_SUCCESS;
+	}
+
+	/* Send every character in the string, committing tones of a few
+	   characters at once. A batch of characters is committed before
+	   the staging buffer becomes full, so that the batch is enqueued
+	   together with its count of units of space. */
+	cw_tq_staging_t staging;
+	int i = 0;
+	while ('\0' != string[i]) {
+		cw_gen_staging_init_internal(gen, &staging);
+
+		int n = 0;
+		int stage_errno = 0;
+		while ('\0' != string[i + n]
+		       && staging.n_tones + CW_GEN_CHARACTER_N_TONES_MAX <= CW_TQ_STAGING_CAPACITY) {
+
+			/* Inter-character-space is added at the end of character. */
+			if (CW_SUCCESS != cw_gen_stage_valid_character_internal(gen, &staging, string[i + n], false)) {
+				/* Characters staged before this one are
+				   still enqueued. */
+				stage_errno = errno;
+				break;
+			}
+			n++;
+		}
+
+		if (CW_SUCCESS != cw_tq_commit_internal(gen->tq, &staging)) {
+			if (ESTALE == errno) {
+				/* Another producer has enqueued its tones
+				   in the meantime. Calculate the tones of
+				   the batch again. */
+				continue;
+			}
 			return CW_FAILURE;
 		}
-	}
 
-	/* This function will enqueue just a right amount of space after the last
-	   inter-mark-space to form a 3-unit inter-character-space. */
-	if (CW_SUCCESS != cw_gen_enqueue_ics_internal(gen)) {
-		return CW_FAILURE;
+		if (0 != stage_errno) {
+			errno = stage_errno;
+			return CW_FAILURE;
+		}
+		i += n;
 	}
 
 	return CW_SUCCESS;
@@ -2506,96 +3857,123 @@ cw_ret_t cw_gen_enqueue_representation(cw_gen_t * gen, const char * representati
 
 
 
-cw_ret_t cw_gen_enqueue_representation_no_ics(cw_gen_t * gen, const char * representation)
+cw_ret_t cw_gen_enqueue_string_atomic(cw_gen_t * gen, const char * string)
 {
-	if (!cw_representation_is_valid(representation)) {
-		errno = EINVAL;
+	/* Check that the string is composed of valid characters. */
+	if (!cw_string_is_valid(string)) {
+		errno = ENOENT;
 		return CW_FAILURE;
 	}
 
-	/* Before we let this representation loose on tone generation,
-	   we'd really like to know that all of its tones will get queued
-	   up successfully.  The right way to do this is to calculate the
-	   number of tones in our representation, then check that the space
-	   exists in the tone queue. However, since the queue is comfortably
-	   long, we can get away with just looking for a high water mark.
+	const size_t len = strlen(string);
+	if (0 == len) {
+		return CW_SUCCESS;
+	}
 
-	   TODO: do the check the proper way.
-	   TODO: wrap this check into a function and reuse it in cw_gen_enqueue_representation()
-	*/
-	if (cw_tq_length_internal(gen->tq) >= gen->tq->high_water_mark) {
+	/* Every character takes at least one entry in tone queue. A
+	   string that can't fit under high water mark even then is
+	   rejected before memory for its tones is allocated, so the
+	   allocation below is bounded by the high water mark. */
+	if (cw_tq_length_internal(gen->tq) + len > gen->tq->high_water_mark) {
+		cw_tq_stats_rejected_internal(gen->tq);
 		errno = EAGAIN;
 		return CW_FAILURE;
 	}
 
-	/* Enqueue the marks. Every mark is followed by inter-mark-space. */
-	for (int i = 0; representation[i] != '\0'; i++) {
-		const bool is_first = i == 0;
-		if (CW_SUCCESS != cw_gen_enqueue_mark_internal(gen, representation[i], is_first)) {
-			return CW_FAILURE;
-		}
+	const bool characters_mode = CW_GEN_QUEUE_MODE_CHARACTERS == gen->queue_mode;
+	if (len > SIZE_MAX / sizeof (cw_tone_t) / CW_GEN_CHARACTER_N_TONES_MAX) {
+		errno = ENOMEM;
+		return CW_FAILURE;
+	}
+	const size_t n_tones_max = characters_mode ? len : len * CW_GEN_CHARACTER_N_TONES_MAX;
+	cw_tone_t * tones = (cw_tone_t *) malloc(n_tones_max * sizeof (cw_tone_t));
+	if (NULL == tones) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
+			      MSG_PREFIX "malloc()");
+		errno = ENOMEM;
+		return CW_FAILURE;
 	}
 
-	/* No inter-character-space added here. */
+	/* Synchronize low-level timing parameters. */
+	cw_gen_sync_parameters_internal(gen);
 
-	return CW_SUCCESS;
+	/* The counter is updated only when the tones are enqueued. If
+	   another producer enqueues its tones in the meantime, the tones
+	   are calculated again. */
+	cw_ret_t cwret = CW_FAILURE;
+	do {
+		const int assumed = __atomic_load_n(&gen->space_units_count, __ATOMIC_RELAXED);
+		int space_units_count = assumed;
+		size_t n_tones = 0;
+		pthread_mutex_lock(&gen->parameters_mutex);
+		for (size_t i = 0; i < len; i++) {
+			if (characters_mode) {
+				cw_gen_character_to_symbol_internal(string[i], false, &space_units_count, &tones[n_tones]);
+				n_tones++;
+			} else {
+				n_tones += (size_t) cw_gen_character_to_tones_internal(gen, string[i], false, &space_units_count, &tones[n_tones]);
+			}
+		}
+		pthread_mutex_unlock(&gen->parameters_mutex);
+
+		/* Same check as in cw_gen_enqueue_representation(), but
+		   for all tones of the string. */
+		if (cw_tq_length_internal(gen->tq) + n_tones > gen->tq->high_water_mark) {
+			cw_tq_stats_rejected_internal(gen->tq);
+			errno = EAGAIN;
+			cwret = CW_FAILURE;
+			break;
+		}
+
+		cwret = cw_tq_enqueue_many_counted_internal(gen->tq, tones, n_tones, &gen->space_units_count, assumed, space_units_count);
+	} while (CW_SUCCESS != cwret && ESTALE == errno);
+
+	free(tones);
+
+	return cwret;
 }
 
 
 
 
-/**
-   @brief Enqueue a given valid ASCII character in generator, to be sent using Morse code
+cw_ret_t cw_gen_set_queue_mode(cw_gen_t * gen, cw_gen_queue_mode_t mode)
+{
+	if (NULL == gen || (CW_GEN_QUEUE_MODE_TONES != mode && CW_GEN_QUEUE_MODE_CHARACTERS != mode)) {
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
 
-   _valid_character_ in function's name means that the function expects the
-   character @p character to be valid (@p character should be validated by
-   caller before passing it to the function).
+	gen->queue_mode = mode;
 
-   no_ics in function's name means that the inter-character-space is not
-   appended at the end of Marks and Spaces enqueued in generator (but the
-   last inter-mark-space is).
+	return CW_SUCCESS;
+}
 
-   @exception ENOENT @p character is not a valid character.
 
-   @internal
-   @reviewed 2020-08-06
-   @endinternal
 
-   @param[in] gen generator to be used to enqueue character
-   @param[in] character character to enqueue
 
-   @return CW_SUCCESS on success
-   @return CW_FAILURE on failure
-*/
-cw_ret_t cw_gen_enqueue_valid_character_no_ics_internal(cw_gen_t * gen, char character)
+cw_ret_t cw_gen_get_queue_mode(const cw_gen_t * gen, cw_gen_queue_mode_t * mode)
 {
-	if (NULL == gen) {
-		cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_GENERATOR, CW_DEBUG_ERROR,
-			      MSG_PREFIX "no generator available");
+	if (NULL == gen || NULL == mode) {
+		errno = EINVAL;
 		return CW_FAILURE;
 	}
 
-	/* ' ' character (i.e. inter-word-space) is a special case. */
-	if (character == ' ') {
-		return cw_gen_enqueue_iws_internal(gen);
-	}
+	*mode = gen->queue_mode;
+
+	return CW_SUCCESS;
+}
 
-	const char * representation = cw_character_to_representation_internal(character);
 
-	/* This shouldn't happen since we are in _valid_character_ function... */
-	cw_assert (NULL != representation, MSG_PREFIX "failed to find representation for character '%c'/%hhx", character, character);
 
-	/* ... but fail gracefully anyway. */
-	if (NULL == representation) {
-		errno = ENOENT;
-		return CW_FAILURE;
-	}
 
-	if (CW_SUCCESS != cw_gen_enqueue_representation_no_ics(gen, representation)) {
+cw_ret_t cw_gen_get_queue_stats(const cw_gen_t * gen, cw_gen_queue_stats_t * stats)
+{
+	if (NULL == gen || NULL == stats) {
+		errno = EINVAL;
 		return CW_FAILURE;
 	}
 
-	/* No inter-character-space here. */
+	cw_tq_get_stats_internal(gen->tq, stats);
 
 	return CW_SUCCESS;
 }
@@ -2604,112 +3982,320 @@ cw_ret_t cw_gen_enqueue_valid_character_no_ics_internal(cw_gen_t * gen, char cha
 
 
 /**
-   @brief Enqueue a given valid ASCII character in generator, to be sent using Morse code
+   @brief Create entry of tone queue with a given valid ASCII character
 
-   After enqueueing last Mark (Dot or Dash) comprising a character, an
-   inter-mark-space is enqueued. Inter-character-space is enqueued after that
-   last inter-mark-space. The inter-character-space is not added if @p
-   character is a ' ' character (i.e. inter-word-space).
+   The entry is used in CW_GEN_QUEUE_MODE_CHARACTERS mode. The
+   character is expanded into Marks and Spaces by
+   cw_gen_expand_symbol_internal() when it is dequeued.
 
-   _valid_character_ in function's name means that the function expects the
-   character @p character to be valid (@p character should be validated by
-   caller before passing it to the function).
+   The entry records which spaces were enqueued right before the
+   character, so that duration of inter-word-space (' ' character) can
+   be calculated in the same way as in cw_gen_enqueue_iws_internal().
 
-   @exception ENOENT @p character is not a valid character.
+   @param[in] character valid character
+   @param[in] no_ics don't append inter-character-space to the character
+   @param[in,out] space_units_count count of units of space enqueued right before the character; on return: count of units of space at the end of the character
+   @param[out] tone entry of tone queue
+*/
+static void cw_gen_character_to_symbol_internal(char character, bool no_ics, int * space_units_count, cw_tone_t * tone)
+{
+	CW_TONE_INIT(tone, 0, 0, CW_SLOPE_MODE_NO_SLOPES);
+	tone->symbol = character;
+	tone->is_first = ' ' != character;
+	if (no_ics) {
+		tone->symbol_flags |= CW_TONE_SYMBOL_NO_ICS;
+	}
+	if (UNITS_PER_IMS == *space_units_count) {
+		tone->symbol_flags |= CW_TONE_SYMBOL_AFTER_IMS;
+	} else if (UNITS_PER_ICS == *space_units_count) {
+		tone->symbol_flags |= CW_TONE_SYMBOL_AFTER_ICS;
+	} else {
+		; /* Inter-word-space will have its full duration. */
+	}
 
-   @reviewed 2023-08-26
+	/* Spaces that will end the character when it is expanded. */
+	if (' ' == character) {
+		*space_units_count = 0;
+	} else if (no_ics) {
+		*space_units_count = UNITS_PER_IMS;
+	} else {
+		*space_units_count = UNITS_PER_ICS;
+	}
+}
+
+
+
+
+/**
+   @brief Enqueue a given valid ASCII character as a single entry of tone queue
+
+   Function used in CW_GEN_QUEUE_MODE_CHARACTERS mode.
+
+   @exception EAGAIN tone queue is full
 
    @param[in] gen generator to be used to enqueue character
-   @param[in] character character to enqueue
+   @param[in] character valid character to enqueue
+   @param[in] no_ics don't append inter-character-space to the character
 
    @return CW_SUCCESS on success
    @return CW_FAILURE on failure
 */
-cw_ret_t cw_gen_enqueue_valid_character_internal(cw_gen_t * gen, char character)
+static cw_ret_t cw_gen_enqueue_symbol_internal(cw_gen_t * gen, char character, bool no_ics)
 {
-	/* This function is adding 1 Unit of inter-mark-space at the end. */
-	if (CW_SUCCESS != cw_gen_enqueue_valid_character_no_ics_internal(gen, character)) {
+	/* Same check as in cw_gen_enqueue_representation(). */
+	if (cw_tq_length_internal(gen->tq) >= gen->tq->high_water_mark) {
+		cw_tq_stats_rejected_internal(gen->tq);
+		errno = EAGAIN;
 		return CW_FAILURE;
 	}
 
+	cw_tone_t tone;
+	cw_ret_t cwret = CW_FAILURE;
+	do {
+		const int assumed = __atomic_load_n(&gen->space_units_count, __ATOMIC_RELAXED);
+		int space_units_count = assumed;
+		cw_gen_character_to_symbol_internal(character, no_ics, &space_units_count, &tone);
+
+		/* On errors the counter is reset by tone queue. */
+		cwret = cw_tq_enqueue_many_counted_internal(gen->tq, &tone, 1, &gen->space_units_count, assumed, space_units_count);
+	} while (CW_SUCCESS != cwret && ESTALE == errno);
+
+	return cwret;
+}
+
+
+
+
+/**
+   @brief Convert a given valid ASCII character into Marks and Spaces
+
+   The tones are the same tones that cw_gen_enqueue_valid_character_internal()
+   (or cw_gen_enqueue_valid_character_no_ics_internal() if @p no_ics is
+   true) enqueues in CW_GEN_QUEUE_MODE_TONES mode.
+
+   @p gen's parameters should be synchronized with
+   cw_gen_sync_parameters_internal() before call to this function.
+
+   @param[in] gen generator with durations and frequency of tones
+   @param[in] character valid character
+   @param[in] no_ics don't append inter-character-space to the character
+   @param[in,out] space_units_count count of units of space enqueued right before the character; on return: count of units of space at the end of the character
+   @param[out] tones buffer for at least CW_GEN_CHARACTER_N_TONES_MAX tones
+
+   @return count of tones put into @p tones
+*/
+static int cw_gen_character_to_tones_internal(const cw_gen_t * gen, char character, bool no_ics, int * space_units_count, cw_tone_t * tones)
+{
+	int n = 0;
+
 	if (' ' == character) {
-		/*
-		  In the context of this function adding ics after freshly enqueued
-		  iws would not be valid: iws should not be followed by ics.
-		  Therefore don't call cw_gen_enqueue_ics_internal(). Just return
-		  now.
+		const int iws_duration = cw_gen_iws_duration_internal(gen, *space_units_count);
+
+		/* Two halves of inter-word-space and adjustment space, as
+		   in cw_gen_enqueue_iws_internal(). */
+		CW_TONE_INIT(&tones[n], 0, iws_duration / 2, CW_SLOPE_MODE_NO_SLOPES);
+		n++;
+		CW_TONE_INIT(&tones[n], 0, iws_duration / 2, CW_SLOPE_MODE_NO_SLOPES);
+		n++;
+		if (gen->durations.adjustment_space_duration > 0) {
+			CW_TONE_INIT(&tones[n], 0, gen->durations.adjustment_space_duration, CW_SLOPE_MODE_NO_SLOPES);
+			n++;
+		}
+		*space_units_count = 0;
+		return n;
+	}
 
-		  Since cw_gen_enqueue_valid_character_no_ics_internal() called above
-		  has succeeded, return the success here.
-		*/
-		return CW_SUCCESS;
+	const char * representation = cw_character_to_representation_internal(character);
+	if (NULL == representation) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_GENERATOR, CW_DEBUG_ERROR,
+			      MSG_PREFIX "failed to find representation for character '%c'/%hhx", character, character);
+		*space_units_count = 0;
+		return 0;
 	}
 
-	/* This function will add enough units to form a full 3-Unit
-	   inter-character-space. */
-	if (CW_SUCCESS != cw_gen_enqueue_ics_internal(gen)) {
-		return CW_FAILURE;
+	/* Every mark is followed by inter-mark-space. */
+	for (int i = 0; representation[i] != '\0'; i++) {
+		const int duration = CW_DOT_REPRESENTATION == representation[i] ? gen->durations.dot_duration : gen->durations.dash_duration;
+		CW_TONE_INIT(&tones[n], gen->frequency, duration, CW_SLOPE_MODE_STANDARD_SLOPES);
+		tones[n].is_first = i == 0;
+		n++;
+		CW_TONE_INIT(&tones[n], 0, gen->durations.ims_duration, CW_SLOPE_MODE_NO_SLOPES);
+		n++;
 	}
+	*space_units_count = UNITS_PER_IMS;
 
-	return CW_SUCCESS;
+	if (!no_ics) {
+		const int ics_duration = cw_gen_ics_duration_internal(gen, *space_units_count);
+		CW_TONE_INIT(&tones[n], 0, ics_duration + gen->durations.additional_space_duration, CW_SLOPE_MODE_NO_SLOPES);
+		n++;
+		*space_units_count = UNITS_PER_ICS;
+	}
+
+	return n;
 }
 
 
 
 
-cw_ret_t cw_gen_enqueue_character(cw_gen_t * gen, char character)
+/**
+   @brief Expand a character dequeued from tone queue into Marks and Spaces
+
+   The character is expanded into the same tones that would be enqueued
+   for it in CW_GEN_QUEUE_MODE_TONES mode, but with durations and
+   frequency that are valid now. The tones are put into @p
+   gen->expansion.
+
+   @param[in] gen generator
+   @param[in] symbol entry of tone queue with character
+*/
+static void cw_gen_expand_symbol_internal(cw_gen_t * gen, const cw_tone_t * symbol)
 {
-	if (!cw_character_is_valid(character)) {
-		errno = ENOENT;
-		return CW_FAILURE;
-	}
+	cw_gen_sync_parameters_internal(gen);
 
-	/* This function adds inter-character-space at the end of character. */
-	if (CW_SUCCESS != cw_gen_enqueue_valid_character_internal(gen, character)) {
-		return CW_FAILURE;
+	int space_units_count = 0;
+	if (symbol->symbol_flags & CW_TONE_SYMBOL_AFTER_IMS) {
+		space_units_count = UNITS_PER_IMS;
+	} else if (symbol->symbol_flags & CW_TONE_SYMBOL_AFTER_ICS) {
+		space_units_count = UNITS_PER_ICS;
+	} else {
+		; /* Full inter-word-space. */
 	}
+	const bool no_ics = symbol->symbol_flags & CW_TONE_SYMBOL_NO_ICS;
 
-	return CW_SUCCESS;
+	gen->expansion.n_tones = cw_gen_character_to_tones_internal(gen, symbol->symbol, no_ics, &space_units_count, gen->expansion.tones);
+	gen->expansion.next = 0;
 }
 
 
 
 
-cw_ret_t cw_gen_enqueue_character_no_ics(cw_gen_t * gen, char character)
+/**
+   @brief Get next tone to be played by generator
+
+   Wrapper around cw_tq_dequeue_internal() that understands entries
+   enqueued in CW_GEN_QUEUE_MODE_CHARACTERS mode. A dequeued character
+   is expanded into tones, and the tones are returned one by one in
+   this and following calls. The tone queue is not accessed until all
+   tones of the character are returned.
+
+   Call this function only from code consuming tones of @p gen.
+
+   @param[in] gen generator
+   @param[out] tone next tone
+
+   @return state of tone queue, as returned by cw_tq_dequeue_internal(), with tones of expanded character counted as tones in queue
+*/
+static cw_queue_state_t cw_gen_dequeue_tone_internal(cw_gen_t * gen, cw_tone_t * tone)
 {
-	if (!cw_character_is_valid(character)) {
-		errno = ENOENT;
-		return CW_FAILURE;
+	if (gen->expansion.next < gen->expansion.n_tones
+	    && gen->expansion.n_flushes != __atomic_load_n(&gen->tq->n_flushes, __ATOMIC_SEQ_CST)) {
+		/* The queue has been flushed, tones of the character
+		   should be flushed too. */
+		gen->expansion.n_tones = 0;
+		gen->expansion.next = 0;
 	}
 
-	/* This function doesn't add inter-character-space at the end of character. */
-	if (CW_SUCCESS != cw_gen_enqueue_valid_character_no_ics_internal(gen, character)) {
-		return CW_FAILURE;
+	while (gen->expansion.next == gen->expansion.n_tones) {
+		/* Read before dequeueing, so that a flush done right
+		   after the dequeue is noticed in next call. */
+		const size_t n_flushes = __atomic_load_n(&gen->tq->n_flushes, __ATOMIC_SEQ_CST);
+		gen->sustained.n_dequeued = __atomic_load_n(&gen->tq->n_dequeued, __ATOMIC_ACQUIRE);
+
+		const cw_queue_state_t queue_state = cw_tq_dequeue_internal(gen->tq, tone);
+		if (CW_TQ_EMPTY == queue_state || 0 == tone->symbol) {
+			return queue_state;
+		}
+
+		gen->expansion.n_flushes = n_flushes;
+		cw_gen_expand_symbol_internal(gen, tone);
 	}
 
-	return CW_SUCCESS;
+	CW_TONE_COPY(tone, &gen->expansion.tones[gen->expansion.next]);
+	gen->expansion.next++;
+
+	if (gen->expansion.next < gen->expansion.n_tones || 0 != cw_tq_length_internal(gen->tq)) {
+		return CW_TQ_NONEMPTY;
+	} else {
+		return CW_TQ_JUST_EMPTIED;
+	}
 }
 
 
 
 
-cw_ret_t cw_gen_enqueue_string(cw_gen_t * gen, const char * string)
+/**
+   @brief Enter sustained state if the tone is a sustained "forever" tone
+
+   Tone queue returns a "forever" tone that is the last tone in the
+   queue without removing it from the queue. Until a new tone is
+   enqueued, every next dequeue would return the same tone and would
+   run value tracking and notifications for it again, once per
+   quantum of the tone. Instead of this the generator enters
+   sustained state, in which the tone is generated again and again
+   with no dequeues (see cw_gen_sustain_tone_internal()).
+
+   Call this function only from code consuming tones of @p gen, right
+   after dequeueing @p tone.
+
+   @param[in] gen generator
+   @param[in] tone tone that has been just dequeued
+   @param[in] queue_state state of tone queue returned by the dequeue
+*/
+static void cw_gen_sustain_begin_internal(cw_gen_t * gen, const cw_tone_t * tone, cw_queue_state_t queue_state)
 {
-	/* Check that the string is composed of valid characters. */
-	if (!cw_string_is_valid(string)) {
-		errno = ENOENT;
-		return CW_FAILURE;
+	if (!tone->is_forever || CW_TQ_NONEMPTY != queue_state || gen->expansion.next < gen->expansion.n_tones) {
+		return;
+	}
+	if (gen->sustained.n_dequeued != __atomic_load_n(&gen->tq->n_dequeued, __ATOMIC_ACQUIRE)) {
+		/* The "forever" tone has been removed from the queue
+		   because it was followed by other tone(s). The tone
+		   is played for the last time, and the next dequeue
+		   must return the next tone. */
+		return;
 	}
 
-	/* Send every character in the string. */
-	for (int i = 0; string[i] != '\0'; i++) {
-		/* This function adds inter-character-space at the end of character. */
-		if (CW_SUCCESS != cw_gen_enqueue_valid_character_internal(gen, string[i])) {
-			return CW_FAILURE;
-		}
+	/* Counters are read before length of queue: a tone enqueued
+	   after the check of length will change the counter. */
+	gen->sustained.n_enqueued = __atomic_load_n(&gen->tq->n_enqueued, __ATOMIC_ACQUIRE);
+	gen->sustained.n_flushes = __atomic_load_n(&gen->tq->n_flushes, __ATOMIC_ACQUIRE);
+	gen->sustained.n_removals = __atomic_load_n(&gen->tq->n_removals, __ATOMIC_ACQUIRE);
+	gen->sustained.active = 1 == cw_tq_length_internal(gen->tq);
+}
+
+
+
+
+/**
+   @brief Check if generator should keep generating sustained "forever" tone
+
+   The generator stays in sustained state as long as no tone is
+   enqueued, the tone queue is not flushed or modified, and the
+   generator is not being silenced. After the state is left, the
+   "forever" tone is dequeued in a regular way for the last time.
+
+   Call this function only from code consuming tones of @p gen.
+
+   @param[in] gen generator
+
+   @return true if the generator should generate next quantum of the "forever" tone
+   @return false otherwise
+*/
+static bool cw_gen_sustain_tone_internal(cw_gen_t * gen)
+{
+	if (!gen->sustained.active) {
+		return false;
 	}
 
-	return CW_SUCCESS;
+	if (!gen->silencing_initialized
+	    && gen->sustained.n_enqueued == __atomic_load_n(&gen->tq->n_enqueued, __ATOMIC_ACQUIRE)
+	    && gen->sustained.n_flushes == __atomic_load_n(&gen->tq->n_flushes, __ATOMIC_ACQUIRE)
+	    && gen->sustained.n_removals == __atomic_load_n(&gen->tq->n_removals, __ATOMIC_ACQUIRE)
+	    && 1 == cw_tq_length_internal(gen->tq)) {
+		return true;
+	}
+
+	gen->sustained.active = false;
+	return false;
 }
 
 
@@ -2757,11 +4343,18 @@ void cw_gen_sync_parameters_internal(cw_gen_t * gen)
 {
 	cw_assert (NULL != gen, MSG_PREFIX "generator is NULL");
 
+	/* Producers of tones may call the function concurrently. */
+	pthread_mutex_lock(&gen->parameters_mutex);
+
 	/* Do nothing if we are already synchronized. */
 	if (gen->parameters_in_sync) {
+		pthread_mutex_unlock(&gen->parameters_mutex);
 		return;
 	}
 
+	/* Durations of marks may change. */
+	cw_gen_mark_cache_invalidate_internal(gen);
+
 	/*
 	  Set the length of a Dot to be a Unit with any weighting
 	  adjustment, and the length of a Dash as three Dot lengths.
@@ -2821,6 +4414,8 @@ void cw_gen_sync_parameters_internal(cw_gen_t * gen)
 	/* Generator parameters are now in sync. */
 	gen->parameters_in_sync = true;
 
+	pthread_mutex_unlock(&gen->parameters_mutex);
+
 	return;
 }
 
@@ -3049,6 +4644,14 @@ cw_ret_t cw_gen_wait_for_queue_level(cw_gen_t * gen, size_t level)
 
 
 
+cw_ret_t cw_gen_wait_for_queue_level_timed(cw_gen_t * gen, size_t level, const struct timespec * deadline)
+{
+	return cw_tq_wait_for_level_timed_internal(gen->tq, level, deadline);
+}
+
+
+
+
 void cw_gen_flush_queue(cw_gen_t * gen)
 {
 	/* This function locks and unlocks mutex. */
@@ -3119,6 +4722,30 @@ cw_ret_t cw_gen_wait_for_end_of_current_tone(cw_gen_t * gen)
 
 
 
+cw_ret_t cw_gen_wait_for_end_of_current_tone_timed(cw_gen_t * gen, const struct timespec * deadline)
+{
+	return cw_tq_wait_for_end_of_current_tone_timed_internal(gen->tq, deadline);
+}
+
+
+
+
+int cw_gen_get_event_fd(cw_gen_t * gen, unsigned int events, size_t level)
+{
+	return cw_tq_get_event_fd_internal(gen->tq, events, level);
+}
+
+
+
+
+unsigned int cw_gen_read_events(cw_gen_t * gen)
+{
+	return cw_tq_read_events_internal(gen->tq);
+}
+
+
+
+
 bool cw_gen_is_queue_full(cw_gen_t const * gen)
 {
 	return cw_tq_is_full_internal(gen->tq);
@@ -3273,6 +4900,7 @@ void cw_gen_value_tracking_set_value_internal(cw_gen_t * gen, __attribute__((unu
 
 	/* Remember the new generator value. */
 	gen->value_tracking.value = value;
+	cw_tq_post_event_internal(gen->tq, CW_GEN_EVENT_VALUE);
 
 	/*
 	  In theory client code should register either a receiver (so
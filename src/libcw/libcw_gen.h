@@ -16,6 +16,8 @@
 #include <cwutils/cw_config.h>
 #include "libcw_alsa.h"
 #include "libcw_console.h"
+#include "libcw_data.h"
+#include "libcw_gen_slope.h"
 #include "libcw_key.h"
 #include "libcw_oss.h"
 #include "libcw_pa.h"
@@ -34,6 +36,14 @@
 
 
 
+/* Largest count of tones of a single character: Marks and
+   inter-mark-spaces of longest representation, and
+   inter-character-space. Inter-word-space (' ' character) takes up to
+   three tones. */
+#define CW_GEN_CHARACTER_N_TONES_MAX (2 * CW_DATA_MAX_REPRESENTATION_LENGTH + 1)
+
+
+
 /* Symbolic name for inter-mark-space. TODO: this should not be a space
    character. Space character is reserved for inter-character-space.*/
 enum { CW_SYMBOL_IMS = ' ' };
@@ -59,6 +69,33 @@ typedef struct {
 
 
 
+/* Count of entries in generator's cache of marks. Dot and dash of
+   current speed need two entries, the rest is for tones of other
+   durations or frequencies. */
+#define CW_GEN_MARK_CACHE_N_ENTRIES 4
+
+
+
+
+/**
+   @brief Samples of a mark, calculated once and then reused
+
+   The key of the entry is a set of parameters of the mark. Other
+   parameters (shape of slopes, volume, sample rate) are common for all
+   entries in generator's cache.
+*/
+typedef struct {
+	cw_sample_t * samples;       /**< Samples of the mark. NULL for unused entry. */
+	cw_sample_iter_t n_samples;  /**< Count of samples of the mark. */
+	int frequency;               /**< Frequency of the mark. [Hz] */
+	int rising_slope_n_samples;  /**< Count of samples in rising slope of the mark. */
+	int falling_slope_n_samples; /**< Count of samples in falling slope of the mark. */
+	unsigned int last_used;      /**< Value of cache's clock when the entry was used the last time. */
+} cw_gen_mark_cache_entry_t;
+
+
+
+
 struct cw_gen_struct {
 
 	/* Tone queue. */
@@ -89,7 +126,7 @@ struct cw_gen_struct {
 	int send_speed;     /* [wpm] */
 	int frequency;      /* The frequency of generated sound. [Hz] */
 	int volume_percent; /* Level of sound in percents of maximum allowable level. */
-	int volume_abs;     /* Level of sound in absolute terms; height of PCM samples. */
+	int volume_abs;     /* Level of sound in absolute terms; gain applied to PCM samples, see ->output_gain. */
 	int gap;            /* Inter-mark-space. [number of dot durations]. */
 	int weighting;      /* Dot/dash weighting. */
 
@@ -125,6 +162,10 @@ struct cw_gen_struct {
 	   This is a flag that shows when this needs to be done. */
 	bool parameters_in_sync;
 
+	/* Serializes recalculation of the parameters with reading them
+	   by producers of tones that run in different threads. */
+	pthread_mutex_t parameters_mutex;
+
 
 
 
@@ -207,6 +248,189 @@ struct cw_gen_struct {
 
 
 
+	/* Rendering of tones into memory of library's client, see
+	   cw_gen_render().
+
+	   When the generator renders tones, contents of full sound buffer
+	   are appended to this output buffer instead of being written to
+	   sound sink. The output buffer is owned by client code, it is
+	   stored here only for the duration of a call to cw_gen_render(). */
+	struct {
+		/* Output buffer, (re)allocated with realloc() when it's too
+		   small to hold more samples. */
+		cw_sample_t * samples;
+
+		/* Total size of the output buffer. [samples] */
+		size_t size;
+
+		/* Count of samples already put into the output buffer. */
+		size_t n_samples;
+
+		/* Set when the output buffer could not be expanded. */
+		bool failed;
+	} render;
+
+
+
+	/* Pull mode, see cw_gen_fill().
+
+	   During a call to cw_gen_fill() client's buffer is used as
+	   generator's sound buffer, and samples are calculated directly
+	   into it. A tone usually doesn't end exactly at the end of
+	   client's buffer, so the rest of the tone is kept here until next
+	   call to cw_gen_fill(). */
+	struct {
+		/* Tone with samples that didn't fit into client's buffer
+		   in previous call. Valid only if ->tone_pending is true. */
+		cw_tone_t tone;
+		bool tone_pending;
+
+		/* Was the last dequeued tone a "forever" tone? */
+		bool prev_tone_is_forever;
+
+		/* Set for the duration of a call to cw_gen_fill(). */
+		bool active;
+
+		/* Set when client's buffer has been completely filled. */
+		bool buffer_full;
+	} fill;
+
+
+
+	/* Mode of tone queue, see cw_gen_set_queue_mode(). */
+	cw_gen_queue_mode_t queue_mode;
+
+	/* Tones of character dequeued in character-level queue mode.
+
+	   A character is expanded into Marks and Spaces when it is
+	   dequeued, using durations and frequency valid at that moment.
+	   The tones are then returned one by one by
+	   cw_gen_dequeue_tone_internal(). Used only by the code consuming
+	   tones. */
+	struct {
+		cw_tone_t tones[CW_GEN_CHARACTER_N_TONES_MAX];
+		int n_tones;
+
+		/* Index of next tone to be returned. */
+		int next;
+
+		/* Value of cw_tone_queue_t::n_flushes at the time of
+		   expansion. Tones are discarded when the queue is
+		   flushed. */
+		size_t n_flushes;
+	} expansion;
+
+
+	/* Sustained state of generator, see
+	   cw_gen_sustain_tone_internal(). The generator keeps generating
+	   a "forever" tone that is the only tone in tone queue without
+	   dequeueing it again and again. Used only by the code consuming
+	   tones. */
+	struct {
+		bool active;
+
+		/* Values of counters of tone queue at the time of entering
+		   the state. A change of any of them ends the state. */
+		size_t n_enqueued;
+		size_t n_flushes;
+		size_t n_removals;
+
+		/* Value of tq->n_dequeued before the last dequeue from
+		   tone queue. Tone queue keeps a "forever" tone only
+		   when the tone is the only tone in the queue, and then
+		   the counter is not incremented by the dequeue. */
+		size_t n_dequeued;
+	} sustained;
+
+
+
+	/* Cache of samples of marks.
+
+	   Every dot (or every dash) enqueued at given speed is the same
+	   sequence of samples, as long as the sine wave of the mark starts
+	   with the same phase. Marks with rising slope start with
+	   amplitude zero, so they can always start with phase zero without
+	   audible clicks, and their samples can be calculated once and
+	   then copied to sound buffer.
+
+	   Entries are created and deleted only by the code consuming
+	   tones (generator's thread, or cw_gen_render()). Other threads
+	   invalidate the cache by incrementing ->generation when they
+	   change parameters of tones. */
+	struct {
+		cw_gen_mark_cache_entry_t entries[CW_GEN_MARK_CACHE_N_ENTRIES];
+
+		/* Incremented each time when entries become invalid.
+		   Accessed with atomic operations only. */
+		unsigned int generation;
+
+		/* Value of ->generation read by code consuming tones
+		   right before it has taken table of slope amplitudes
+		   (see cw_gen_tone_slope_sync_internal()). Samples
+		   calculated with the table are valid for this
+		   generation, but maybe not for a later one. */
+		unsigned int synced_generation;
+
+		/* Value of ->synced_generation at the time when
+		   existing entries were created. */
+		unsigned int entries_generation;
+
+		/* Incremented on each use of the cache, for finding least
+		   recently used entry. */
+		unsigned int clock;
+	} mark_cache;
+
+
+	/* Output gain stage.
+
+	   Samples of tones are calculated with full amplitude, and
+	   generator's volume (->volume_abs) is applied to whole sound
+	   buffer just before the buffer is pushed to sound sink. Change
+	   of volume doesn't require recalculation of slopes or of cached
+	   marks, and it is audible in the next buffer, not in the next
+	   tone.
+
+	   When ->volume_abs changes, the gain goes towards the new value
+	   in a short linear ramp, to avoid clicks.
+
+	   Used only by the code consuming tones. */
+	struct {
+		int current;   /* Gain applied to the last sample. In units of ->volume_abs. */
+		int target;    /* Value of ->volume_abs at which the ramp ends. */
+		int step;      /* Change of gain per sample during the ramp. */
+	} output_gain;
+
+
+	/* Wavetable for plateaus of long tones.
+
+	   Long tones ("forever" tones, or tones longer than one second,
+	   e.g. in QRSS) have long plateaus with constant amplitude. The
+	   table contains samples of an exact integer number of periods
+	   of sine wave, so samples of the plateau can be copied from the
+	   table over and over again instead of being calculated.
+
+	   Used only by the code consuming tones. */
+	struct {
+		cw_sample_t * samples;
+
+		/* Count of samples in the table. */
+		int n_samples;
+
+		/* Frequency of sine wave in the table. [Hz] */
+		int frequency;
+
+		/* Phase of first sample in the table. */
+		double phase;
+
+		/* Index of sample in the table that follows the last
+		   copied sample, and generator's phase offset at that
+		   sample. */
+		int position;
+		float position_phase;
+	} wavetable;
+
+
+
 	/* Tone parameters. */
 	/* Some parameters of tones (and of tones' slopes) are common
 	   for all tones generated in given time by a generator.
@@ -223,30 +447,37 @@ struct cw_gen_struct {
 
 		   This is why we have the slope duration in generator.
 
-		   n_amplitudes declared a bit below in this struct is
-		   a secondary parameter, derived from ->duration. */
+		   Count of samples in a slope is a secondary parameter,
+		   derived from ->duration, and kept in ->table. */
 		int duration; /* [us] */
 
 		/* Linear/raised cosine/sine/rectangle. */
 		int shape;
 
 		/* Table of amplitudes of every PCM sample of tone's
-		   slope.
-
-		   The values in amplitudes[] change from zero to max
-		   (at least for any sane slope shape), so naturally
-		   they can be used in forming rising slope. However
-		   they can be used in forming falling slope as well -
-		   just iterate the table from end to beginning.
-
-		   TODO: it seems that amplitudes can be
-		   integers. Investigate it. */
-		float * amplitudes;
-
-		/* This is a secondary parameter, derived from
-		   ->duration. n_amplitudes is useful when iterating over
-		   ->amplitudes[] or reallocing the ->amplitudes[]. */
-		int n_amplitudes;
+		   slope, shared with other generators that use the
+		   same shape and count of samples in slope. Amplitudes
+		   in the table are Q15 factors, independent of
+		   generator's volume: the volume is applied when
+		   samples are calculated.
+
+		   The table is published by cw_gen_set_tone_slope()
+		   with a single atomic store, so count of samples in
+		   slope and amplitudes always match. NULL when slopes
+		   have zero duration. */
+		cw_slope_table_t * table;
+
+		/* Table used by code calculating samples of tones
+		   (generator's thread, mixer, cw_gen_render()). The
+		   code takes ->table at the beginning of every tone,
+		   and holds its own reference to it, so a table
+		   replaced by cw_gen_set_tone_slope() in the middle of
+		   a tone isn't freed under the code's feet. */
+		cw_slope_table_t * consumer_table;
+
+		/* Serializes replacing of ->table with taking of
+		   ->table by consumer. */
+		pthread_mutex_t mutex;
 	} tone_slope;
 
 
@@ -414,6 +645,10 @@ struct cw_gen_struct {
 	  When enqueueing ims, ics or iws, increase the counter accordingly.
 	  When enqueueing a mark (dot or dash), reset the counter.
 	  On errors reset the counter.
+
+	  Characters and strings are enqueued together with update of
+	  the counter, under producer mutex of tone queue (see
+	  cw_tq_enqueue_many_counted_internal()).
 	*/
 	int space_units_count;
 };
@@ -499,6 +734,7 @@ cw_ret_t cw_gen_enqueue_sk_begin_space_internal(cw_gen_t * gen);
 cw_ret_t cw_gen_enqueue_ik_symbol_no_ims_internal(cw_gen_t * gen, char symbol);
 
 cw_ret_t cw_gen_silence_internal(cw_gen_t * gen);
+cw_ret_t cw_gen_set_sample_rate_internal(cw_gen_t * gen, unsigned int sample_rate);
 char * cw_gen_get_sound_system_label_internal(const cw_gen_t * gen, char * buffer, size_t size);
 
 void cw_generator_delete_internal(void);
@@ -41,10 +41,12 @@
 CW_STATIC_FUNC cw_ret_t cw_gen_new_open_internal(cw_gen_t * gen, const cw_gen_config_t * gen_conf);
 CW_STATIC_FUNC void * cw_gen_dequeue_and_generate_internal(void * arg);
 CW_STATIC_FUNC int    cw_gen_calculate_sine_wave_internal(cw_gen_t * gen, cw_tone_t * tone);
-CW_STATIC_FUNC int    cw_gen_calculate_sample_amplitude_internal(cw_gen_t * gen, const cw_tone_t * tone);
+#ifdef LIBCW_UNIT_TESTS
+int cw_gen_calculate_sine_wave_sinf_internal(cw_gen_t * gen, cw_tone_t * tone);
+int cw_gen_calculate_sample_amplitude_internal(cw_gen_t * gen, const cw_tone_t * tone);
+#endif
 CW_STATIC_FUNC int    cw_gen_write_to_soundcard_internal(cw_gen_t * gen, cw_tone_t * tone);
 CW_STATIC_FUNC cw_ret_t cw_gen_enqueue_valid_character_no_ics_internal(cw_gen_t * gen, char character);
-CW_STATIC_FUNC void   cw_gen_recalculate_slope_amplitudes_internal(cw_gen_t * gen);
 CW_STATIC_FUNC cw_ret_t cw_gen_join_thread_internal(cw_gen_t * gen);
 
 
@@ -0,0 +1,746 @@
+/*
+  Copyright (C) 2001-2006  Simon Baldwin (simon_baldwin@yahoo.com)
+  Copyright (C) 2011-2023  Kamil Ignacak (acerion@wp.pl)
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+
+/**
+   @file libcw_gen_kernels.c
+
+   @brief Kernels calculating samples of sine wave.
+
+   Every kernel calculates the same fragment of sine wave (see
+   cw_sine_kernel_t), but some kernels use SIMD instructions of CPU to
+   calculate many samples at once. The best kernel supported by CPU is
+   selected once, at load time of the library.
+
+   All kernels use the same algorithm: phase of a sine wave is advanced
+   by rotating a unit complex number (re, im) by a constant angle, and
+   im is the sine of the phase. SIMD kernels rotate many complex numbers
+   at once, each number calculating every N-th sample of sine wave.
+
+   Rounding errors in the rotations make the magnitude of the complex
+   numbers drift away from 1.0, so the magnitude is periodically brought
+   back to 1.0. First-order approximation of 1/|z| is good enough for
+   this, because the magnitude is always very close to 1.0.
+
+   Gain kernels multiply samples by generator's volume, in the same
+   instruction sets as sine wave kernels.
+*/
+
+
+
+
+#include <math.h>
+#include <stddef.h>
+
+
+
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LIBCW_GEN_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON)
+#define LIBCW_GEN_KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(LIBCW_GEN_KERNELS_X86) || defined(LIBCW_GEN_KERNELS_NEON)
+#define LIBCW_GEN_KERNELS_SIMD
+#endif
+
+
+
+
+#include "libcw_debug.h"
+#include "libcw_gen_kernels.h"
+#include "libcw_gen_slope.h"
+
+
+
+
+#define MSG_PREFIX "libcw/kernels: "
+
+
+
+
+extern cw_debug_t cw_debug_object;
+
+
+
+
+/* How often the magnitude of oscillator's complex numbers is brought
+   back to 1.0. [samples] */
+#define CW_SINE_KERNEL_RENORMALIZATION_PERIOD 64
+
+/* How often SIMD kernels seed their lanes with exact phase. Lanes
+   calculate in floats, and errors of phase would accumulate in long
+   fragments. [samples] */
+#define CW_SINE_KERNEL_BLOCK_N_SAMPLES 1024
+
+
+
+
+static __attribute__((constructor)) void cw_gen_kernels_constructor_internal(void);
+#ifdef LIBCW_GEN_KERNELS_X86
+static void cw_sine_kernel_sse2_internal(cw_sample_t * samples, int n_samples, const int16_t * amplitudes, float amplitude, double phase, double step);
+static void cw_sine_kernel_avx2_internal(cw_sample_t * samples, int n_samples, const int16_t * amplitudes, float amplitude, double phase, double step);
+static void cw_sine_kernel_sse2_block_internal(cw_sample_t * samples, int n_samples, const int16_t * amplitudes, float amplitude, double phase, double step);
+static void cw_sine_kernel_avx2_block_internal(cw_sample_t * samples, int n_samples, const int16_t * amplitudes, float amplitude, double phase, double step);
+static void cw_gain_kernel_sse2_internal(cw_sample_t * samples, int n_samples, int gain);
+static void cw_gain_kernel_avx2_internal(cw_sample_t * samples, int n_samples, int gain);
+#endif
+#ifdef LIBCW_GEN_KERNELS_NEON
+static void cw_sine_kernel_neon_internal(cw_sample_t * samples, int n_samples, const int16_t * amplitudes, float amplitude, double phase, double step);
+static void cw_sine_kernel_neon_block_internal(cw_sample_t * samples, int n_samples, const int16_t * amplitudes, float amplitude, double phase, double step);
+static void cw_gain_kernel_neon_internal(cw_sample_t * samples, int n_samples, int gain);
+#endif
+#ifdef LIBCW_GEN_KERNELS_SIMD
+static void cw_sine_kernel_blocks_internal(cw_sine_kernel_t block_kernel, cw_sample_t * samples, int n_samples, const int16_t * amplitudes, float amplitude, double phase, double step);
+static void cw_sine_kernel_seed_lanes_internal(float * re, float * im, int n_lanes, double phase, double step);
+static void cw_sine_kernel_tail_internal(cw_sample_t * samples, int n_samples, const int16_t * amplitudes, float amplitude, const float * im);
+#endif
+
+
+
+
+/* Kernels supported by CPU, best kernel first. Filled in library's
+   constructor. Terminated with guard element. */
+static cw_sine_kernel_desc_t g_supported_kernels[] = {
+	{ "scalar", cw_sine_kernel_scalar_internal, cw_gain_kernel_scalar_internal },
+	{ NULL, NULL, NULL },
+	{ NULL, NULL, NULL },
+	{ NULL, NULL, NULL },
+	{ NULL, NULL, NULL }, /* Guard. */
+};
+
+/* Kernel used by generators. Initialized with scalar kernel that is
+   supported everywhere, just in case if some code calls the kernel
+   before the constructor. */
+static cw_sine_kernel_t g_sine_kernel = cw_sine_kernel_scalar_internal;
+static cw_gain_kernel_t g_gain_kernel = cw_gain_kernel_scalar_internal;
+
+
+
+
+/**
+   @brief Get the best sine wave kernel supported by CPU
+
+   @return kernel function
+*/
+cw_sine_kernel_t cw_sine_kernel_get_internal(void)
+{
+	return g_sine_kernel;
+}
+
+
+
+
+/**
+   @brief Get the best gain kernel supported by CPU
+
+   @return kernel function
+*/
+cw_gain_kernel_t cw_gain_kernel_get_internal(void)
+{
+	return g_gain_kernel;
+}
+
+
+
+
+/**
+   @brief Get list of sine wave kernels supported by CPU
+
+   The list is ordered from the best (fastest) kernel to scalar kernel,
+   and is terminated with element with NULL function.
+
+   @return list of kernels
+*/
+const cw_sine_kernel_desc_t * cw_sine_kernels_supported_internal(void)
+{
+	return g_supported_kernels;
+}
+
+
+
+
+/**
+   @brief Scalar sine wave kernel
+
+   The kernel is supported on all CPUs. It is also a reference for other
+   kernels.
+
+   Arguments are described in description of cw_sine_kernel_t.
+*/
+void cw_sine_kernel_scalar_internal(cw_sample_t * samples, int n_samples, const int16_t * amplitudes, float amplitude, double phase, double step)
+{
+	const double step_re = cos(step);
+	const double step_im = sin(step);
+
+	double re = cos(phase);
+	double im = sin(phase);
+
+	const double scale = (double) amplitude / CW_SLOPE_Q15_ONE;
+
+	for (int i = 0; i < n_samples; i++) {
+		const double a = amplitudes ? scale * amplitudes[i] : (double) amplitude;
+		samples[i] = (cw_sample_t) (a * im);
+
+		/* Advance the phase to next sample. */
+		const double next_re = re * step_re - im * step_im;
+		const double next_im = re * step_im + im * step_re;
+		re = next_re;
+		im = next_im;
+
+		if (0 == (i + 1) % CW_SINE_KERNEL_RENORMALIZATION_PERIOD) {
+			const double gain = 1.5 - 0.5 * (re * re + im * im);
+			re *= gain;
+			im *= gain;
+		}
+	}
+
+	return;
+}
+
+
+
+
+/**
+   @brief Scalar gain kernel
+
+   Arguments are described in description of cw_gain_kernel_t.
+*/
+void cw_gain_kernel_scalar_internal(cw_sample_t * samples, int n_samples, int gain)
+{
+	for (int i = 0; i < n_samples; i++) {
+		samples[i] = (cw_sample_t) ((samples[i] * gain) >> 15);
+	}
+	return;
+}
+
+
+
+
+#ifdef LIBCW_GEN_KERNELS_SIMD
+
+
+
+
+/**
+   @brief Calculate fragment of sine wave in blocks
+
+   Split the fragment into blocks of CW_SINE_KERNEL_BLOCK_N_SAMPLES
+   samples, and calculate each block with @p block_kernel, starting with
+   exact phase of the first sample of the block.
+
+   Remaining arguments are described in description of cw_sine_kernel_t.
+
+   @param[in] block_kernel SIMD kernel calculating one block
+*/
+static void cw_sine_kernel_blocks_internal(cw_sine_kernel_t block_kernel, cw_sample_t * samples, int n_samples, const int16_t * amplitudes, float amplitude, double phase, double step)
+{
+	for (int i = 0; i < n_samples; i += CW_SINE_KERNEL_BLOCK_N_SAMPLES) {
+		int block_n_samples = n_samples - i;
+		if (block_n_samples > CW_SINE_KERNEL_BLOCK_N_SAMPLES) {
+			block_n_samples = CW_SINE_KERNEL_BLOCK_N_SAMPLES;
+		}
+		block_kernel(samples + i, block_n_samples, amplitudes ? amplitudes + i : NULL, amplitude, phase + step * i, step);
+	}
+
+	return;
+}
+
+
+
+
+/**
+   @brief Calculate initial state of lanes of SIMD kernel
+
+   Lane k calculates samples k, k + n_lanes, k + 2 * n_lanes, etc.
+
+   @param[out] re real parts of complex numbers of lanes
+   @param[out] im imaginary parts of complex numbers of lanes
+   @param[in] n_lanes count of lanes
+   @param[in] phase phase of first sample
+   @param[in] step step of phase between consecutive samples
+*/
+static void cw_sine_kernel_seed_lanes_internal(float * re, float * im, int n_lanes, double phase, double step)
+{
+	const double step_re = cos(step);
+	const double step_im = sin(step);
+
+	double r = cos(phase);
+	double i = sin(phase);
+
+	for (int k = 0; k < n_lanes; k++) {
+		re[k] = (float) r;
+		im[k] = (float) i;
+
+		const double next_r = r * step_re - i * step_im;
+		const double next_i = r * step_im + i * step_re;
+		r = next_r;
+		i = next_i;
+	}
+
+	return;
+}
+
+
+
+
+/**
+   @brief Calculate last samples of fragment in SIMD kernel
+
+   When count of samples isn't a multiple of count of samples calculated
+   in one iteration of SIMD kernel, then there are some samples left at
+   the end of the fragment. Sines of phases of these samples are already
+   calculated in lanes of the kernel.
+
+   @param[out] samples samples to calculate
+   @param[in] n_samples count of samples to calculate
+   @param[in] amplitudes Q15 factors of amplitude of samples, or NULL
+   @param[in] amplitude amplitude of samples, scaled by @p amplitudes if non-NULL
+   @param[in] im sines of phases of samples
+*/
+static void cw_sine_kernel_tail_internal(cw_sample_t * samples, int n_samples, const int16_t * amplitudes, float amplitude, const float * im)
+{
+	const float scale = amplitude / CW_SLOPE_Q15_ONE;
+	for (int i = 0; i < n_samples; i++) {
+		const float a = amplitudes ? scale * amplitudes[i] : amplitude;
+		samples[i] = (cw_sample_t) (a * im[i]);
+	}
+	return;
+}
+
+
+
+
+#endif /* #ifdef LIBCW_GEN_KERNELS_SIMD */
+
+
+
+
+#ifdef LIBCW_GEN_KERNELS_X86
+
+
+
+
+/**
+   @brief Calculate block of samples with SSE2 instructions
+
+   Two vectors of four lanes: 8 samples per iteration.
+
+   Arguments are described in description of cw_sine_kernel_t.
+*/
+__attribute__((target("sse2")))
+static void cw_sine_kernel_sse2_block_internal(cw_sample_t * samples, int n_samples, const int16_t * amplitudes, float amplitude, double phase, double step)
+{
+	enum { N_LANES = 8 };
+
+	float lanes_re[N_LANES];
+	float lanes_im[N_LANES];
+	cw_sine_kernel_seed_lanes_internal(lanes_re, lanes_im, N_LANES, phase, step);
+
+	__m128 re0 = _mm_loadu_ps(lanes_re);
+	__m128 re1 = _mm_loadu_ps(lanes_re + 4);
+	__m128 im0 = _mm_loadu_ps(lanes_im);
+	__m128 im1 = _mm_loadu_ps(lanes_im + 4);
+
+	/* Every iteration advances phase of each lane by N_LANES steps. */
+	const __m128 step_re = _mm_set1_ps((float) cos(N_LANES * step));
+	const __m128 step_im = _mm_set1_ps((float) sin(N_LANES * step));
+	const __m128 half = _mm_set1_ps(0.5F);
+	const __m128 one_and_half = _mm_set1_ps(1.5F);
+	const __m128 constant_amplitude = _mm_set1_ps(amplitude);
+	const __m128 scale = _mm_set1_ps(amplitude / CW_SLOPE_Q15_ONE);
+
+	int i = 0;
+	for (; i + N_LANES <= n_samples; i += N_LANES) {
+		__m128 a0 = constant_amplitude;
+		__m128 a1 = constant_amplitude;
+		if (amplitudes) {
+			/* Sign-extend eight Q15 factors to 32 bits. */
+			const __m128i q15 = _mm_loadu_si128((const __m128i *) (amplitudes + i));
+			a0 = _mm_mul_ps(scale, _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(q15, q15), 16)));
+			a1 = _mm_mul_ps(scale, _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(q15, q15), 16)));
+		}
+
+		const __m128i s0 = _mm_cvttps_epi32(_mm_mul_ps(a0, im0));
+		const __m128i s1 = _mm_cvttps_epi32(_mm_mul_ps(a1, im1));
+		_mm_storeu_si128((__m128i *) (samples + i), _mm_packs_epi32(s0, s1));
+
+		const __m128 next_re0 = _mm_sub_ps(_mm_mul_ps(re0, step_re), _mm_mul_ps(im0, step_im));
+		const __m128 next_im0 = _mm_add_ps(_mm_mul_ps(re0, step_im), _mm_mul_ps(im0, step_re));
+		const __m128 next_re1 = _mm_sub_ps(_mm_mul_ps(re1, step_re), _mm_mul_ps(im1, step_im));
+		const __m128 next_im1 = _mm_add_ps(_mm_mul_ps(re1, step_im), _mm_mul_ps(im1, step_re));
+		re0 = next_re0;
+		im0 = next_im0;
+		re1 = next_re1;
+		im1 = next_im1;
+
+		if (0 == (i + N_LANES) % CW_SINE_KERNEL_RENORMALIZATION_PERIOD) {
+			const __m128 gain0 = _mm_sub_ps(one_and_half, _mm_mul_ps(half, _mm_add_ps(_mm_mul_ps(re0, re0), _mm_mul_ps(im0, im0))));
+			const __m128 gain1 = _mm_sub_ps(one_and_half, _mm_mul_ps(half, _mm_add_ps(_mm_mul_ps(re1, re1), _mm_mul_ps(im1, im1))));
+			re0 = _mm_mul_ps(re0, gain0);
+			im0 = _mm_mul_ps(im0, gain0);
+			re1 = _mm_mul_ps(re1, gain1);
+			im1 = _mm_mul_ps(im1, gain1);
+		}
+	}
+
+	_mm_storeu_ps(lanes_im, im0);
+	_mm_storeu_ps(lanes_im + 4, im1);
+	cw_sine_kernel_tail_internal(samples + i, n_samples - i, amplitudes ? amplitudes + i : NULL, amplitude, lanes_im);
+
+	return;
+}
+
+
+
+
+/**
+   @brief Calculate block of samples with AVX2 instructions
+
+   Two vectors of eight lanes: 16 samples per iteration.
+
+   Arguments are described in description of cw_sine_kernel_t.
+*/
+__attribute__((target("avx2")))
+static void cw_sine_kernel_avx2_block_internal(cw_sample_t * samples, int n_samples, const int16_t * amplitudes, float amplitude, double phase, double step)
+{
+	enum { N_LANES = 16 };
+
+	float lanes_re[N_LANES];
+	float lanes_im[N_LANES];
+	cw_sine_kernel_seed_lanes_internal(lanes_re, lanes_im, N_LANES, phase, step);
+
+	__m256 re0 = _mm256_loadu_ps(lanes_re);
+	__m256 re1 = _mm256_loadu_ps(lanes_re + 8);
+	__m256 im0 = _mm256_loadu_ps(lanes_im);
+	__m256 im1 = _mm256_loadu_ps(lanes_im + 8);
+
+	/* Every iteration advances phase of each lane by N_LANES steps. */
+	const __m256 step_re = _mm256_set1_ps((float) cos(N_LANES * step));
+	const __m256 step_im = _mm256_set1_ps((float) sin(N_LANES * step));
+	const __m256 half = _mm256_set1_ps(0.5F);
+	const __m256 one_and_half = _mm256_set1_ps(1.5F);
+	const __m256 constant_amplitude = _mm256_set1_ps(amplitude);
+	const __m256 scale = _mm256_set1_ps(amplitude / CW_SLOPE_Q15_ONE);
+
+	int i = 0;
+	for (; i + N_LANES <= n_samples; i += N_LANES) {
+		__m256 a0 = constant_amplitude;
+		__m256 a1 = constant_amplitude;
+		if (amplitudes) {
+			const __m128i q15_0 = _mm_loadu_si128((const __m128i *) (amplitudes + i));
+			const __m128i q15_1 = _mm_loadu_si128((const __m128i *) (amplitudes + i + 8));
+			a0 = _mm256_mul_ps(scale, _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(q15_0)));
+			a1 = _mm256_mul_ps(scale, _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(q15_1)));
+		}
+
+		const __m256i s0 = _mm256_cvttps_epi32(_mm256_mul_ps(a0, im0));
+		const __m256i s1 = _mm256_cvttps_epi32(_mm256_mul_ps(a1, im1));
+		/* Packing works within 128-bit halves of vectors, so the
+		   result has to be reordered. */
+		const __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(s0, s1), 0xD8);
+		_mm256_storeu_si256((__m256i *) (samples + i), packed);
+
+		const __m256 next_re0 = _mm256_sub_ps(_mm256_mul_ps(re0, step_re), _mm256_mul_ps(im0, step_im));
+		const __m256 next_im0 = _mm256_add_ps(_mm256_mul_ps(re0, step_im), _mm256_mul_ps(im0, step_re));
+		const __m256 next_re1 = _mm256_sub_ps(_mm256_mul_ps(re1, step_re), _mm256_mul_ps(im1, step_im));
+		const __m256 next_im1 = _mm256_add_ps(_mm256_mul_ps(re1, step_im), _mm256_mul_ps(im1, step_re));
+		re0 = next_re0;
+		im0 = next_im0;
+		re1 = next_re1;
+		im1 = next_im1;
+
+		if (0 == (i + N_LANES) % CW_SINE_KERNEL_RENORMALIZATION_PERIOD) {
+			const __m256 gain0 = _mm256_sub_ps(one_and_half, _mm256_mul_ps(half, _mm256_add_ps(_mm256_mul_ps(re0, re0), _mm256_mul_ps(im0, im0))));
+			const __m256 gain1 = _mm256_sub_ps(one_and_half, _mm256_mul_ps(half, _mm256_add_ps(_mm256_mul_ps(re1, re1), _mm256_mul_ps(im1, im1))));
+			re0 = _mm256_mul_ps(re0, gain0);
+			im0 = _mm256_mul_ps(im0, gain0);
+			re1 = _mm256_mul_ps(re1, gain1);
+			im1 = _mm256_mul_ps(im1, gain1);
+		}
+	}
+
+	_mm256_storeu_ps(lanes_im, im0);
+	_mm256_storeu_ps(lanes_im + 8, im1);
+	cw_sine_kernel_tail_internal(samples + i, n_samples - i, amplitudes ? amplitudes + i : NULL, amplitude, lanes_im);
+
+	return;
+}
+
+
+
+
+/**
+   @brief SSE2 sine wave kernel
+
+   Arguments are described in description of cw_sine_kernel_t.
+*/
+static void cw_sine_kernel_sse2_internal(cw_sample_t * samples, int n_samples, const int16_t * amplitudes, float amplitude, double phase, double step)
+{
+	cw_sine_kernel_blocks_internal(cw_sine_kernel_sse2_block_internal, samples, n_samples, amplitudes, amplitude, phase, step);
+	return;
+}
+
+
+
+
+/**
+   @brief AVX2 sine wave kernel
+
+   Arguments are described in description of cw_sine_kernel_t.
+*/
+static void cw_sine_kernel_avx2_internal(cw_sample_t * samples, int n_samples, const int16_t * amplitudes, float amplitude, double phase, double step)
+{
+	cw_sine_kernel_blocks_internal(cw_sine_kernel_avx2_block_internal, samples, n_samples, amplitudes, amplitude, phase, step);
+	return;
+}
+
+
+
+
+/**
+   @brief SSE2 gain kernel
+
+   Arguments are described in description of cw_gain_kernel_t.
+*/
+__attribute__((target("sse2")))
+static void cw_gain_kernel_sse2_internal(cw_sample_t * samples, int n_samples, int gain)
+{
+	const __m128i g = _mm_set1_epi16((short) gain);
+
+	int i = 0;
+	for (; i + 8 <= n_samples; i += 8) {
+		const __m128i s = _mm_loadu_si128((const __m128i *) (samples + i));
+		/* Low and high halves of 32-bit products. */
+		const __m128i lo = _mm_mullo_epi16(s, g);
+		const __m128i hi = _mm_mulhi_epi16(s, g);
+		const __m128i p0 = _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), 15);
+		const __m128i p1 = _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), 15);
+		_mm_storeu_si128((__m128i *) (samples + i), _mm_packs_epi32(p0, p1));
+	}
+	cw_gain_kernel_scalar_internal(samples + i, n_samples - i, gain);
+
+	return;
+}
+
+
+
+
+/**
+   @brief AVX2 gain kernel
+
+   Arguments are described in description of cw_gain_kernel_t.
+*/
+__attribute__((target("avx2")))
+static void cw_gain_kernel_avx2_internal(cw_sample_t * samples, int n_samples, int gain)
+{
+	const __m256i g = _mm256_set1_epi16((short) gain);
+
+	int i = 0;
+	for (; i + 16 <= n_samples; i += 16) {
+		const __m256i s = _mm256_loadu_si256((const __m256i *) (samples + i));
+		const __m256i lo = _mm256_mullo_epi16(s, g);
+		const __m256i hi = _mm256_mulhi_epi16(s, g);
+		/* Unpacking and packing both work within 128-bit halves
+		   of vectors, so order of samples is preserved. */
+		const __m256i p0 = _mm256_srai_epi32(_mm256_unpacklo_epi16(lo, hi), 15);
+		const __m256i p1 = _mm256_srai_epi32(_mm256_unpackhi_epi16(lo, hi), 15);
+		_mm256_storeu_si256((__m256i *) (samples + i), _mm256_packs_epi32(p0, p1));
+	}
+	cw_gain_kernel_scalar_internal(samples + i, n_samples - i, gain);
+
+	return;
+}
+
+
+
+
+#endif /* #ifdef LIBCW_GEN_KERNELS_X86 */
+
+
+
+
+#ifdef LIBCW_GEN_KERNELS_NEON
+
+
+
+
+/**
+   @brief Calculate block of samples with NEON instructions
+
+   Two vectors of four lanes: 8 samples per iteration.
+
+   Arguments are described in description of cw_sine_kernel_t.
+*/
+static void cw_sine_kernel_neon_block_internal(cw_sample_t * samples, int n_samples, const int16_t * amplitudes, float amplitude, double phase, double step)
+{
+	enum { N_LANES = 8 };
+
+	float lanes_re[N_LANES];
+	float lanes_im[N_LANES];
+	cw_sine_kernel_seed_lanes_internal(lanes_re, lanes_im, N_LANES, phase, step);
+
+	float32x4_t re0 = vld1q_f32(lanes_re);
+	float32x4_t re1 = vld1q_f32(lanes_re + 4);
+	float32x4_t im0 = vld1q_f32(lanes_im);
+	float32x4_t im1 = vld1q_f32(lanes_im + 4);
+
+	/* Every iteration advances phase of each lane by N_LANES steps. */
+	const float32x4_t step_re = vdupq_n_f32((float) cos(N_LANES * step));
+	const float32x4_t step_im = vdupq_n_f32((float) sin(N_LANES * step));
+	const float32x4_t half = vdupq_n_f32(0.5F);
+	const float32x4_t one_and_half = vdupq_n_f32(1.5F);
+	const float32x4_t constant_amplitude = vdupq_n_f32(amplitude);
+	const float scale = amplitude / CW_SLOPE_Q15_ONE;
+
+	int i = 0;
+	for (; i + N_LANES <= n_samples; i += N_LANES) {
+		float32x4_t a0 = constant_amplitude;
+		float32x4_t a1 = constant_amplitude;
+		if (amplitudes) {
+			const int16x8_t q15 = vld1q_s16(amplitudes + i);
+			a0 = vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(q15))), scale);
+			a1 = vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(q15))), scale);
+		}
+
+		/* Conversion truncates towards zero, narrowing saturates. */
+		const int16x4_t s0 = vqmovn_s32(vcvtq_s32_f32(vmulq_f32(a0, im0)));
+		const int16x4_t s1 = vqmovn_s32(vcvtq_s32_f32(vmulq_f32(a1, im1)));
+		vst1q_s16(samples + i, vcombine_s16(s0, s1));
+
+		const float32x4_t next_re0 = vsubq_f32(vmulq_f32(re0, step_re), vmulq_f32(im0, step_im));
+		const float32x4_t next_im0 = vaddq_f32(vmulq_f32(re0, step_im), vmulq_f32(im0, step_re));
+		const float32x4_t next_re1 = vsubq_f32(vmulq_f32(re1, step_re), vmulq_f32(im1, step_im));
+		const float32x4_t next_im1 = vaddq_f32(vmulq_f32(re1, step_im), vmulq_f32(im1, step_re));
+		re0 = next_re0;
+		im0 = next_im0;
+		re1 = next_re1;
+		im1 = next_im1;
+
+		if (0 == (i + N_LANES) % CW_SINE_KERNEL_RENORMALIZATION_PERIOD) {
+			const float32x4_t gain0 = vsubq_f32(one_and_half, vmulq_f32(half, vaddq_f32(vmulq_f32(re0, re0), vmulq_f32(im0, im0))));
+			const float32x4_t gain1 = vsubq_f32(one_and_half, vmulq_f32(half, vaddq_f32(vmulq_f32(re1, re1), vmulq_f32(im1, im1))));
+			re0 = vmulq_f32(re0, gain0);
+			im0 = vmulq_f32(im0, gain0);
+			re1 = vmulq_f32(re1, gain1);
+			im1 = vmulq_f32(im1, gain1);
+		}
+	}
+
+	vst1q_f32(lanes_im, im0);
+	vst1q_f32(lanes_im + 4, im1);
+	cw_sine_kernel_tail_internal(samples + i, n_samples - i, amplitudes ? amplitudes + i : NULL, amplitude, lanes_im);
+
+	return;
+}
+
+
+
+
+/**
+   @brief NEON sine wave kernel
+
+   Arguments are described in description of cw_sine_kernel_t.
+*/
+static void cw_sine_kernel_neon_internal(cw_sample_t * samples, int n_samples, const int16_t * amplitudes, float amplitude, double phase, double step)
+{
+	cw_sine_kernel_blocks_internal(cw_sine_kernel_neon_block_internal, samples, n_samples, amplitudes, amplitude, phase, step);
+	return;
+}
+
+
+
+
+/**
+   @brief NEON gain kernel
+
+   Arguments are described in description of cw_gain_kernel_t.
+*/
+static void cw_gain_kernel_neon_internal(cw_sample_t * samples, int n_samples, int gain)
+{
+	int i = 0;
+	for (; i + 8 <= n_samples; i += 8) {
+		/* (2 * s * gain) >> 16. Gain is below 32768, so the result never saturates. */
+		vst1q_s16(samples + i, vqdmulhq_n_s16(vld1q_s16(samples + i), (int16_t) gain));
+	}
+	cw_gain_kernel_scalar_internal(samples + i, n_samples - i, gain);
+
+	return;
+}
+
+
+
+
+#endif /* #ifdef LIBCW_GEN_KERNELS_NEON */
+
+
+
+
+/**
+   @brief Select kernels supported by CPU
+*/
+void cw_gen_kernels_constructor_internal(void)
+{
+	int n = 0;
+
+#ifdef LIBCW_GEN_KERNELS_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		g_supported_kernels[n].name = "avx2";
+		g_supported_kernels[n].function = cw_sine_kernel_avx2_internal;
+		g_supported_kernels[n].gain = cw_gain_kernel_avx2_internal;
+		n++;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		g_supported_kernels[n].name = "sse2";
+		g_supported_kernels[n].function = cw_sine_kernel_sse2_internal;
+		g_supported_kernels[n].gain = cw_gain_kernel_sse2_internal;
+		n++;
+	}
+#endif
+
+#ifdef LIBCW_GEN_KERNELS_NEON
+	/* NEON is mandatory on CPUs for which the compiler generates NEON
+	   code. */
+	g_supported_kernels[n].name = "neon";
+	g_supported_kernels[n].function = cw_sine_kernel_neon_internal;
+	g_supported_kernels[n].gain = cw_gain_kernel_neon_internal;
+	n++;
+#endif
+
+	g_supported_kernels[n].name = "scalar";
+	g_supported_kernels[n].function = cw_sine_kernel_scalar_internal;
+	g_supported_kernels[n].gain = cw_gain_kernel_scalar_internal;
+	n++;
+
+	g_sine_kernel = g_supported_kernels[0].function;
+	g_gain_kernel = g_supported_kernels[0].gain;
+
+	cw_debug_msg (&cw_debug_object, CW_DEBUG_GENERATOR, CW_DEBUG_INFO,
+		      MSG_PREFIX "selected sine wave kernel: %s", g_supported_kernels[0].name);
+
+	return;
+}
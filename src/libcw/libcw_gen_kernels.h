@@ -0,0 +1,73 @@
+/*
+  This file is a part of unixcw project.
+  unixcw project is covered by GNU General Public License, version 2 or later.
+*/
+
+#ifndef H_LIBCW_GEN_KERNELS
+#define H_LIBCW_GEN_KERNELS
+
+
+
+
+#include <stdint.h>
+
+
+
+
+#include "libcw.h"
+
+
+
+
+/**
+   Function calculating a fragment of sine wave
+
+   The function puts into @p samples a fragment of sine wave with @p
+   n_samples samples:
+
+   samples[i] = a[i] * sin(phase + i * step)
+
+   where a[i] is @p amplitude scaled by Q15 factor amplitudes[i] (see
+   cw_slope_table_t) if @p amplitudes is non-NULL, or constant @p
+   amplitude otherwise. Values of samples are truncated towards zero.
+
+   Only the caller knows phase of the first sample and step of phase,
+   the function doesn't keep any state between calls.
+*/
+typedef void (* cw_sine_kernel_t)(cw_sample_t * samples, int n_samples, const int16_t * amplitudes, float amplitude, double phase, double step);
+
+
+
+
+/**
+   Function applying gain to samples
+
+   samples[i] = (samples[i] * gain) >> 15
+
+   @p gain is in range [0, 32767]. Gain of 1.0 (32768) is not supported:
+   the caller should simply not call the function.
+*/
+typedef void (* cw_gain_kernel_t)(cw_sample_t * samples, int n_samples, int gain);
+
+
+
+
+typedef struct {
+	const char * name;          /* Human-readable name, for debugs and tests. */
+	cw_sine_kernel_t function;
+	cw_gain_kernel_t gain;      /* Gain kernel using the same instruction set. */
+} cw_sine_kernel_desc_t;
+
+
+
+
+cw_sine_kernel_t cw_sine_kernel_get_internal(void);
+cw_gain_kernel_t cw_gain_kernel_get_internal(void);
+const cw_sine_kernel_desc_t * cw_sine_kernels_supported_internal(void);
+void cw_sine_kernel_scalar_internal(cw_sample_t * samples, int n_samples, const int16_t * amplitudes, float amplitude, double phase, double step);
+void cw_gain_kernel_scalar_internal(cw_sample_t * samples, int n_samples, int gain);
+
+
+
+
+#endif /* #ifndef H_LIBCW_GEN_KERNELS */
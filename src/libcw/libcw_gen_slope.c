@@ -0,0 +1,242 @@
+/*
+  Copyright (C) 2001-2006  Simon Baldwin (simon_baldwin@yahoo.com)
+  Copyright (C) 2011-2023  Kamil Ignacak (acerion@wp.pl)
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+
+/**
+   @file libcw_gen_slope.c
+
+   @brief Tables of amplitudes of tones' slopes, shared by generators.
+
+   A table depends only on shape of slopes and on count of samples in
+   a slope. Volume of generator is applied when samples are calculated.
+   Many generators with the same settings of slopes use the same
+   table, and change of volume of a generator doesn't require
+   recalculation of a table.
+
+   Tables are kept on a list guarded by a mutex, and are freed when the
+   last generator using a table stops using it.
+*/
+
+
+
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+
+
+
+#include "libcw.h"
+#include "libcw_debug.h"
+#include "libcw_gen_slope.h"
+
+
+
+
+#define MSG_PREFIX "libcw/slope: "
+
+/* Same as in libcw_gen.c. */
+static const float CW_PI = 3.14159265358979323846F;
+
+
+
+
+extern cw_debug_t cw_debug_object;
+
+
+
+
+static void cw_slope_table_calculate_internal(cw_slope_table_t * table);
+
+
+
+
+/* List of tables that are in use by at least one generator. */
+static cw_slope_table_t * g_slope_tables = NULL;
+static pthread_mutex_t g_slope_tables_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+
+/**
+   @brief Get table of amplitudes of slopes
+
+   Get a table for given @p shape and @p n_amplitudes. If no such table
+   exists yet, it is created. Every table received from this function
+   must be released with cw_slope_table_put_internal().
+
+   @param[in] shape shape of slopes, one of CW_TONE_SLOPE_SHAPE_* (other than rectangular)
+   @param[in] n_amplitudes count of samples in one slope, greater than zero
+
+   @return table on success
+   @return NULL on failure
+*/
+cw_slope_table_t * cw_slope_table_get_internal(int shape, int n_amplitudes)
+{
+	cw_assert (n_amplitudes > 0, MSG_PREFIX "invalid count of amplitudes: %d", n_amplitudes);
+
+	pthread_mutex_lock(&g_slope_tables_mutex);
+
+	cw_slope_table_t * table = g_slope_tables;
+	while (table) {
+		if (table->shape == shape && table->n_amplitudes == n_amplitudes) {
+			break;
+		}
+		table = table->next;
+	}
+
+	if (table) {
+		table->refcount++;
+	} else {
+		/* Amplitudes of rising slope, followed by amplitudes
+		   of falling slope. */
+		table = malloc(sizeof (cw_slope_table_t) + sizeof (int16_t) * 2 * (size_t) n_amplitudes);
+		if (table) {
+			table->shape = shape;
+			table->n_amplitudes = n_amplitudes;
+			table->refcount = 1;
+			cw_slope_table_calculate_internal(table);
+
+			table->next = g_slope_tables;
+			g_slope_tables = table;
+		} else {
+			cw_debug_msg (&cw_debug_object, CW_DEBUG_GENERATOR | CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
+				      MSG_PREFIX "failed to malloc() table of slope amplitudes");
+		}
+	}
+
+	pthread_mutex_unlock(&g_slope_tables_mutex);
+
+	return table;
+}
+
+
+
+
+/**
+   @brief Get another reference to table of amplitudes of slopes
+
+   Every reference must be released with cw_slope_table_put_internal().
+
+   @param[in] table table received from cw_slope_table_get_internal(), may be NULL
+*/
+void cw_slope_table_ref_internal(cw_slope_table_t * table)
+{
+	if (NULL == table) {
+		return;
+	}
+
+	pthread_mutex_lock(&g_slope_tables_mutex);
+	table->refcount++;
+	pthread_mutex_unlock(&g_slope_tables_mutex);
+
+	return;
+}
+
+
+
+
+/**
+   @brief Release table of amplitudes of slopes
+
+   The table is freed when the last user of the table releases it.
+
+   @param[in] table table received from cw_slope_table_get_internal(), may be NULL
+*/
+void cw_slope_table_put_internal(cw_slope_table_t * table)
+{
+	if (NULL == table) {
+		return;
+	}
+
+	pthread_mutex_lock(&g_slope_tables_mutex);
+
+	table->refcount--;
+	if (0 == table->refcount) {
+		cw_slope_table_t ** link = &g_slope_tables;
+		while (*link != table) {
+			link = &(*link)->next;
+		}
+		*link = table->next;
+		free(table);
+	}
+
+	pthread_mutex_unlock(&g_slope_tables_mutex);
+
+	return;
+}
+
+
+
+
+/**
+   @brief Calculate amplitudes of PCM samples that form tone's slopes
+
+   @param[in] table table with shape and count of amplitudes already set
+*/
+static void cw_slope_table_calculate_internal(cw_slope_table_t * table)
+{
+	const int n = table->n_amplitudes;
+
+	/* The values in amplitudes[] change from zero to max (at
+	   least for any sane slope shape), so naturally they can be
+	   used in forming rising slope. */
+	for (int i = 0; i < n; i++) {
+		double y = 0.0;
+
+		if (table->shape == CW_TONE_SLOPE_SHAPE_LINEAR) {
+			y = (double) i / n;
+
+		} else if (table->shape == CW_TONE_SLOPE_SHAPE_SINE) {
+			const double radian = i * ((double) CW_PI / 2.0) / n;
+			y = sin(radian);
+
+		} else if (table->shape == CW_TONE_SLOPE_SHAPE_RAISED_COSINE) {
+			const double radian = i * (double) CW_PI / n;
+			y = (1 - ((1 + cos(radian)) / 2));
+
+		} else if (table->shape == CW_TONE_SLOPE_SHAPE_RECTANGULAR) {
+			/* Rectangular slopes have zero duration, there is
+			   no table for them. */
+			cw_assert (0, MSG_PREFIX "we shouldn't be here, calculating rectangular slopes");
+
+		} else {
+			cw_assert (0, MSG_PREFIX "unsupported slope shape %d", table->shape);
+		}
+
+		long q15 = lround(y * CW_SLOPE_Q15_ONE);
+		if (q15 > INT16_MAX) {
+			q15 = INT16_MAX;
+		}
+		table->amplitudes[i] = (int16_t) q15;
+	}
+
+	/* Falling slope: the same amplitudes in reversed order, so that
+	   falling slope can be calculated by iterating the table from
+	   beginning to end. */
+	int16_t * falling_amplitudes = table->amplitudes + n;
+	for (int i = 0; i < n; i++) {
+		falling_amplitudes[i] = table->amplitudes[n - 1 - i];
+	}
+
+	return;
+}
@@ -0,0 +1,61 @@
+/*
+  This file is a part of unixcw project.
+  unixcw project is covered by GNU General Public License, version 2 or later.
+*/
+
+#ifndef H_LIBCW_GEN_SLOPE
+#define H_LIBCW_GEN_SLOPE
+
+
+
+
+#include <stdint.h>
+
+
+
+
+/* Amplitudes in slope tables are Q15 fixed-point numbers: a factor
+   of 1.0 (full volume) would be represented by this value. */
+#define CW_SLOPE_Q15_ONE 32768
+
+
+
+
+/**
+   Table of amplitudes of tone's slopes
+
+   The table doesn't depend on volume of generator: amplitudes are
+   factors in range [0, 1), in Q15 format. Samples of slopes are
+   calculated with the factors used as they are, at full scale
+   amplitude, and volume of a generator is applied to the samples
+   later, in generator's output gain stage.
+
+   The table is shared by all generators in the process that use the
+   same shape and duration (in samples) of slopes. Don't modify
+   contents of the table.
+*/
+typedef struct cw_slope_table_t {
+	int shape;                     /* CW_TONE_SLOPE_SHAPE_* */
+	int n_amplitudes;              /* Count of samples in one slope. */
+
+	int refcount;                  /* Count of users of the table. */
+	struct cw_slope_table_t * next;
+
+	/* The first n_amplitudes values change from zero to max (at
+	   least for any sane slope shape), and they are used in forming
+	   rising slope. They are followed by n_amplitudes values in
+	   reversed order, used in forming falling slope. */
+	int16_t amplitudes[];
+} cw_slope_table_t;
+
+
+
+
+cw_slope_table_t * cw_slope_table_get_internal(int shape, int n_amplitudes);
+void cw_slope_table_ref_internal(cw_slope_table_t * table);
+void cw_slope_table_put_internal(cw_slope_table_t * table);
+
+
+
+
+#endif /* #ifndef H_LIBCW_GEN_SLOPE */
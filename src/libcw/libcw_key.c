@@ -708,6 +708,11 @@ cw_ret_t cw_key_ik_update_graph_state_internal(volatile cw_key_t * key)
 		      cw_iambic_keyer_graph_states[key->ik.graph_state]);
 
 	key->ik.lock = false;
+
+	/* Let threads waiting for end of element or for idle keyer
+	   know about new graph state. */
+	cw_tq_notify_waiters_internal(key->gen->tq, CW_TQ_WAIT_KEY_GRAPH);
+
 	return CW_SUCCESS;
 }
 
@@ -1053,41 +1058,81 @@ bool cw_key_ik_is_busy_internal(const volatile cw_key_t * key)
    @return CW_SUCCESS
 */
 cw_ret_t cw_key_ik_wait_for_end_of_current_element(const volatile cw_key_t * key)
+{
+	return cw_key_ik_wait_for_end_of_current_element_timed(key, NULL);
+}
+
+
+
+
+/**
+   @brief Wait for end of element from the keyer, but not longer than until @p deadline
+
+   @p deadline is an absolute time of CLOCK_MONOTONIC clock. If @p
+   deadline is NULL, the function waits without time limit.
+
+   @exception ETIMEDOUT the deadline has passed before end of element
+
+   @param[in] key key on which to wait
+   @param[in] deadline absolute time (CLOCK_MONOTONIC) at which to stop waiting
+
+   @return CW_SUCCESS if the element has ended
+   @return CW_FAILURE if the deadline has passed
+*/
+cw_ret_t cw_key_ik_wait_for_end_of_current_element_timed(const volatile cw_key_t * key, const struct timespec * deadline)
 {
 	/* TODO: test and describe behaviour of function when the key is in IDLE state. */
 
+	bool timed_out = false;
+	cw_ret_t cwret = CW_SUCCESS;
+
 	/* First wait for the graph state to move to idle (or just do nothing
 	   if it's not), or to one of the after- graph states. */
-	pthread_mutex_lock(&key->gen->tq->wait_mutex);
+	cw_tq_waiter_lock_internal(key->gen->tq, CW_TQ_WAIT_KEY_GRAPH);
 	while (key->ik.graph_state != KS_IDLE
 	       && key->ik.graph_state != KS_AFTER_DOT_A
 	       && key->ik.graph_state != KS_AFTER_DOT_B
 	       && key->ik.graph_state != KS_AFTER_DASH_A
 	       && key->ik.graph_state != KS_AFTER_DASH_B) {
 
-		pthread_cond_wait(&key->gen->tq->wait_var, &key->gen->tq->wait_mutex);
+		if (timed_out) {
+			cwret = CW_FAILURE;
+			break;
+		}
+		timed_out = ETIMEDOUT == cw_tq_waiter_timedwait_internal(key->gen->tq, CW_TQ_WAIT_KEY_GRAPH, deadline);
 		/* cw_signal_wait_internal(); */ /* Old implementation was using signals. */ /* This code has been disabled some time before 2017-01-31. */
 	}
-	pthread_mutex_unlock(&key->gen->tq->wait_mutex);
+	cw_tq_waiter_unlock_internal(key->gen->tq, CW_TQ_WAIT_KEY_GRAPH);
+	if (CW_FAILURE == cwret) {
+		errno = ETIMEDOUT;
+		return cwret;
+	}
 
 
 	/* Now wait for the graph state to move to idle (unless it is, or was,
 	   already), or one of the in- graph states, at which point we know
 	   we're actually at the end of the element we were in when we
 	   entered this routine. */
-	pthread_mutex_lock(&key->gen->tq->wait_mutex);
+	cw_tq_waiter_lock_internal(key->gen->tq, CW_TQ_WAIT_KEY_GRAPH);
 	while (key->ik.graph_state != KS_IDLE
 	       && key->ik.graph_state != KS_IN_DOT_A
 	       && key->ik.graph_state != KS_IN_DOT_B
 	       && key->ik.graph_state != KS_IN_DASH_A
 	       && key->ik.graph_state != KS_IN_DASH_B) {
 
-		pthread_cond_wait(&key->gen->tq->wait_var, &key->gen->tq->wait_mutex);
+		if (timed_out) {
+			cwret = CW_FAILURE;
+			break;
+		}
+		timed_out = ETIMEDOUT == cw_tq_waiter_timedwait_internal(key->gen->tq, CW_TQ_WAIT_KEY_GRAPH, deadline);
 		/* cw_signal_wait_internal(); */ /* Old implementation was using signals. */ /* This code has been disabled some time before 2017-01-31. */
 	}
-	pthread_mutex_unlock(&key->gen->tq->wait_mutex);
+	cw_tq_waiter_unlock_internal(key->gen->tq, CW_TQ_WAIT_KEY_GRAPH);
+	if (CW_FAILURE == cwret) {
+		errno = ETIMEDOUT;
+	}
 
-	return CW_SUCCESS;
+	return cwret;
 }
 
 
@@ -1111,6 +1156,29 @@ cw_ret_t cw_key_ik_wait_for_end_of_current_element(const volatile cw_key_t * key
    @return CW_FAILURE on failure
 */
 cw_ret_t cw_key_ik_wait_for_keyer(volatile cw_key_t * key)
+{
+	return cw_key_ik_wait_for_keyer_timed(key, NULL);
+}
+
+
+
+
+/**
+   @brief Wait for the key to go into IDLE state, but not longer than until @p deadline
+
+   @p deadline is an absolute time of CLOCK_MONOTONIC clock. If @p
+   deadline is NULL, the function waits without time limit.
+
+   @exception EDEADLK either paddle value is CW_KEY_VALUE_CLOSED
+   @exception ETIMEDOUT the deadline has passed before the key went into IDLE state
+
+   @param[in] key key on which to wait
+   @param[in] deadline absolute time (CLOCK_MONOTONIC) at which to stop waiting
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+cw_ret_t cw_key_ik_wait_for_keyer_timed(volatile cw_key_t * key, const struct timespec * deadline)
 {
 	/* Check that neither paddle is CLOSED; if either is, then the
 	   signal cycle is going to continue forever, and we'll never
@@ -1123,15 +1191,25 @@ cw_ret_t cw_key_ik_wait_for_keyer(volatile cw_key_t * key)
 		return CW_FAILURE;
 	}
 
+	bool timed_out = false;
+	cw_ret_t cwret = CW_SUCCESS;
+
 	/* Wait for the keyer graph state to go idle. */
-	pthread_mutex_lock(&key->gen->tq->wait_mutex);
+	cw_tq_waiter_lock_internal(key->gen->tq, CW_TQ_WAIT_KEY_GRAPH);
 	while (key->ik.graph_state != KS_IDLE) {
-		pthread_cond_wait(&key->gen->tq->wait_var, &key->gen->tq->wait_mutex);
+		if (timed_out) {
+			cwret = CW_FAILURE;
+			break;
+		}
+		timed_out = ETIMEDOUT == cw_tq_waiter_timedwait_internal(key->gen->tq, CW_TQ_WAIT_KEY_GRAPH, deadline);
 		/* cw_signal_wait_internal(); */ /* Old implementation was using signals. */ /* This code has been disabled some time before 2017-01-31. */
 	}
-	pthread_mutex_unlock(&key->gen->tq->wait_mutex);
+	cw_tq_waiter_unlock_internal(key->gen->tq, CW_TQ_WAIT_KEY_GRAPH);
+	if (CW_FAILURE == cwret) {
+		errno = ETIMEDOUT;
+	}
 
-	return CW_SUCCESS;
+	return cwret;
 }
 
 
@@ -1190,6 +1268,10 @@ void cw_key_ik_reset_state_internal(volatile cw_key_t * key)
 	key->ik.curtis_mode_b = false;
 	key->ik.curtis_b_latch = false;
 
+	if (NULL != key->gen) {
+		cw_tq_notify_waiters_internal(key->gen->tq, CW_TQ_WAIT_KEY_GRAPH);
+	}
+
 	return;
 }
 
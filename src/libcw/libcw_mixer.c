@@ -0,0 +1,595 @@
+/*
+  Copyright (C) 2001-2006  Simon Baldwin (simon_baldwin@yahoo.com)
+  Copyright (C) 2011-2023  Kamil Ignacak (acerion@wp.pl)
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+
+/**
+   @file libcw_mixer.c
+
+   @brief Mixer of many generators played on one sound device.
+
+   Applications simulating e.g. a contest pile-up use tens of
+   generators at the same time. A started generator has its own thread
+   and its own sound device, which doesn't scale well. Generators
+   registered in a mixer aren't started. Instead the mixer's thread
+   pulls one period of samples from each of them with cw_gen_fill(),
+   sums the samples with generators' gains, and writes the sum to the
+   mixer's only sound device.
+
+   Samples of generators are accumulated in 32-bit integers, and are
+   saturated to range of cw_sample_t only once per period, after all
+   generators have been summed.
+*/
+
+
+
+
+#include "config.h"
+
+
+
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <sys/prctl.h> /* prctl() */
+#elif defined(__FreeBSD__)
+#include <pthread_np.h> /* pthread_set_name_np() */
+#endif
+
+
+
+
+#include "libcw2.h"
+#include "libcw_debug.h"
+#include "libcw_gen.h"
+#include "libcw_mixer.h"
+#include "libcw_utils.h"
+
+
+
+
+#define MSG_PREFIX "libcw/mixer: "
+
+
+
+
+extern cw_debug_t cw_debug_object;
+
+
+
+
+/* Size of period of mixer with Null sound system, which doesn't have
+   a sound buffer. The value is the same as used by PulseAudio sound
+   system. [samples] */
+static const int CW_MIXER_NULL_BUFFER_N_SAMPLES = 256;
+
+/* Gain factor of 1.0 in Q15 format. */
+static const int32_t CW_MIXER_GAIN_ONE = 32768;
+
+
+
+
+static void * cw_mixer_mix_and_write_internal(void * arg);
+static void cw_mixer_mix_internal(cw_mixer_t * mixer, int n_frames, int n_channels);
+static int cw_mixer_take_inputs_internal(cw_mixer_t * mixer);
+static int cw_mixer_find_input_internal(const cw_mixer_t * mixer, const cw_gen_t * gen);
+static cw_ret_t cw_mixer_set_input_gain_and_pan_internal(cw_mixer_input_t * input, int gain, int pan);
+
+
+
+
+cw_mixer_t * cw_mixer_new(const cw_gen_config_t * gen_conf)
+{
+	if (NULL == gen_conf || CW_AUDIO_CONSOLE == gen_conf->sound_system) {
+		/* Console can't play samples. */
+		errno = EINVAL;
+		return NULL;
+	}
+
+	cw_mixer_t * mixer = (cw_mixer_t *) calloc(1, sizeof (cw_mixer_t));
+	if (NULL == mixer) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR, MSG_PREFIX "calloc()");
+		errno = ENOMEM;
+		return NULL;
+	}
+	pthread_mutex_init(&mixer->mutex, NULL);
+	pthread_mutex_init(&mixer->mix_mutex, NULL);
+
+	mixer->output = cw_gen_new(gen_conf);
+	if (NULL == mixer->output) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_GENERATOR, CW_DEBUG_ERROR,
+			      MSG_PREFIX "failed to open sound device");
+		cw_mixer_delete(&mixer);
+		return NULL;
+	}
+	cw_gen_set_label(mixer->output, "mixer");
+	mixer->sample_rate = mixer->output->sample_rate;
+
+	if (NULL != mixer->output->buffer) {
+		mixer->buffer = mixer->output->buffer;
+		mixer->buffer_n_samples = mixer->output->buffer_n_samples;
+		mixer->own_buffer = false;
+	} else {
+		mixer->buffer_n_samples = CW_MIXER_NULL_BUFFER_N_SAMPLES;
+		mixer->buffer = (cw_sample_t *) calloc((size_t) mixer->buffer_n_samples, sizeof (cw_sample_t));
+		mixer->own_buffer = true;
+	}
+	mixer->scratch = (cw_sample_t *) calloc((size_t) mixer->buffer_n_samples, sizeof (cw_sample_t));
+	mixer->accumulator = (int32_t *) calloc(2 * (size_t) mixer->buffer_n_samples, sizeof (int32_t));
+	if (NULL == mixer->buffer || NULL == mixer->scratch || NULL == mixer->accumulator) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR, MSG_PREFIX "calloc()");
+		cw_mixer_delete(&mixer);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	return mixer;
+}
+
+
+
+
+void cw_mixer_delete(cw_mixer_t ** mixer)
+{
+	if (NULL == mixer || NULL == *mixer) {
+		return;
+	}
+
+	if ((*mixer)->thread.running) {
+		cw_mixer_stop(*mixer);
+	}
+
+	if ((*mixer)->own_buffer) {
+		free((*mixer)->buffer);
+	}
+	free((*mixer)->scratch);
+	free((*mixer)->accumulator);
+	free((*mixer)->inputs);
+	free((*mixer)->period_inputs);
+	cw_gen_delete(&(*mixer)->output);
+	pthread_mutex_destroy(&(*mixer)->mix_mutex);
+	pthread_mutex_destroy(&(*mixer)->mutex);
+
+	free(*mixer);
+	*mixer = NULL;
+
+	return;
+}
+
+
+
+
+cw_ret_t cw_mixer_start(cw_mixer_t * mixer)
+{
+	if (NULL == mixer) {
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+	if (mixer->thread.running) {
+		errno = EBUSY;
+		return CW_FAILURE;
+	}
+
+	mixer->do_mix = true;
+	const int rv = pthread_create(&mixer->thread.id, NULL, cw_mixer_mix_and_write_internal, (void *) mixer);
+	if (0 != rv) {
+		mixer->do_mix = false;
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
+			      MSG_PREFIX "failed to create mixer thread: '%s'", strerror(rv));
+		return CW_FAILURE;
+	}
+	mixer->thread.running = true;
+
+	return CW_SUCCESS;
+}
+
+
+
+
+cw_ret_t cw_mixer_stop(cw_mixer_t * mixer)
+{
+	if (NULL == mixer) {
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+	if (!mixer->thread.running) {
+		return CW_SUCCESS;
+	}
+
+	/* The thread notices the flag after writing current period to
+	   sound device. */
+	mixer->do_mix = false;
+	const int rv = pthread_join(mixer->thread.id, NULL);
+	if (0 != rv) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
+			      MSG_PREFIX "failed to join mixer thread: '%s'", strerror(rv));
+		return CW_FAILURE;
+	}
+	mixer->thread.running = false;
+
+	return CW_SUCCESS;
+}
+
+
+
+
+cw_ret_t cw_mixer_add_generator(cw_mixer_t * mixer, cw_gen_t * gen, int gain, int pan)
+{
+	if (NULL == mixer || NULL == gen) {
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+	if (gen->thread.running) {
+		/* Generator's thread would be dequeueing the same tones. */
+		errno = EBUSY;
+		return CW_FAILURE;
+	}
+
+	cw_mixer_input_t input = { .gen = gen };
+	if (CW_SUCCESS != cw_mixer_set_input_gain_and_pan_internal(&input, gain, pan)) {
+		return CW_FAILURE;
+	}
+
+	pthread_mutex_lock(&mixer->mutex);
+
+	if (-1 != cw_mixer_find_input_internal(mixer, gen)) {
+		pthread_mutex_unlock(&mixer->mutex);
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+
+	if (mixer->n_inputs == mixer->inputs_size) {
+		const int new_size = 0 == mixer->inputs_size ? 16 : 2 * mixer->inputs_size;
+		cw_mixer_input_t * new_inputs = (cw_mixer_input_t *) realloc(mixer->inputs, (size_t) new_size * sizeof (cw_mixer_input_t));
+		if (NULL == new_inputs) {
+			pthread_mutex_unlock(&mixer->mutex);
+			cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR, MSG_PREFIX "realloc()");
+			errno = ENOMEM;
+			return CW_FAILURE;
+		}
+		mixer->inputs = new_inputs;
+		mixer->inputs_size = new_size;
+	}
+
+	if (CW_SUCCESS != cw_gen_set_sample_rate_internal(gen, mixer->sample_rate)) {
+		pthread_mutex_unlock(&mixer->mutex);
+		return CW_FAILURE;
+	}
+	mixer->inputs[mixer->n_inputs++] = input;
+
+	pthread_mutex_unlock(&mixer->mutex);
+
+	return CW_SUCCESS;
+}
+
+
+
+
+cw_ret_t cw_mixer_remove_generator(cw_mixer_t * mixer, cw_gen_t * gen)
+{
+	if (NULL == mixer) {
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+
+	pthread_mutex_lock(&mixer->mutex);
+
+	const int i = cw_mixer_find_input_internal(mixer, gen);
+	if (-1 == i) {
+		pthread_mutex_unlock(&mixer->mutex);
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+	/* Order of inputs doesn't matter. */
+	mixer->inputs[i] = mixer->inputs[mixer->n_inputs - 1];
+	mixer->n_inputs--;
+
+	/* Current period may be mixed from a copy of inputs that still
+	   contains the generator. Unless we have been called from a
+	   callback of one of generators of the period, wait for the end
+	   of the period, so that client code can delete the generator
+	   right after this function returns. */
+	const bool wait_for_period = mixer->is_mixing && !pthread_equal(mixer->mixing_thread, pthread_self());
+
+	pthread_mutex_unlock(&mixer->mutex);
+
+	if (wait_for_period) {
+		pthread_mutex_lock(&mixer->mix_mutex);
+		pthread_mutex_unlock(&mixer->mix_mutex);
+	}
+
+	return CW_SUCCESS;
+}
+
+
+
+
+cw_ret_t cw_mixer_set_gain_and_pan(cw_mixer_t * mixer, cw_gen_t * gen, int gain, int pan)
+{
+	if (NULL == mixer) {
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+
+	pthread_mutex_lock(&mixer->mutex);
+
+	const int i = cw_mixer_find_input_internal(mixer, gen);
+	cw_ret_t cwret = CW_FAILURE;
+	if (-1 == i) {
+		errno = EINVAL;
+	} else {
+		cwret = cw_mixer_set_input_gain_and_pan_internal(&mixer->inputs[i], gain, pan);
+	}
+
+	pthread_mutex_unlock(&mixer->mutex);
+
+	return cwret;
+}
+
+
+
+
+unsigned int cw_mixer_get_sample_rate(const cw_mixer_t * mixer)
+{
+	if (NULL == mixer) {
+		errno = EINVAL;
+		return 0;
+	}
+	return mixer->sample_rate;
+}
+
+
+
+
+cw_ret_t cw_mixer_fill(cw_mixer_t * mixer, cw_sample_t * out, size_t n_frames)
+{
+	if (NULL == mixer || NULL == out) {
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+	if (mixer->thread.running) {
+		/* Mixer's thread would be pulling samples from the same
+		   generators. */
+		errno = EBUSY;
+		return CW_FAILURE;
+	}
+
+	pthread_mutex_lock(&mixer->mix_mutex);
+
+	/* Client's buffer may be larger than mixer's buffers. */
+	while (n_frames > 0) {
+		const int n = n_frames > (size_t) mixer->buffer_n_samples ? mixer->buffer_n_samples : (int) n_frames;
+		cw_mixer_mix_internal(mixer, n, 2);
+
+		for (int i = 0; i < 2 * n; i++) {
+			const int32_t sum = mixer->accumulator[i];
+			out[i] = (cw_sample_t) (sum > INT16_MAX ? INT16_MAX : (sum < INT16_MIN ? INT16_MIN : sum));
+		}
+		out += 2 * n;
+		n_frames -= (size_t) n;
+	}
+
+	pthread_mutex_unlock(&mixer->mix_mutex);
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   @brief Mix registered generators and write the mix to sound device
+
+   Thread function of started mixer.
+
+   @param[in] arg mixer (cast to (void *))
+
+   @return NULL pointer
+*/
+static void * cw_mixer_mix_and_write_internal(void * arg)
+{
+	cw_mixer_t * mixer = (cw_mixer_t *) arg;
+
+#if defined(__linux__)
+	prctl(PR_SET_NAME, "mixer", 0, 0, 0);
+#elif defined(__FreeBSD__)
+	pthread_set_name_np(pthread_self(), "mixer");
+#endif
+
+	/* Duration of one period of Null sound system. */
+	const int null_period_duration = (int) ((CW_USECS_PER_SEC * (int64_t) mixer->buffer_n_samples) / mixer->sample_rate);
+
+	while (mixer->do_mix) {
+		pthread_mutex_lock(&mixer->mix_mutex);
+
+		cw_mixer_mix_internal(mixer, mixer->buffer_n_samples, 1);
+		for (int i = 0; i < mixer->buffer_n_samples; i++) {
+			const int32_t sum = mixer->accumulator[i];
+			mixer->buffer[i] = (cw_sample_t) (sum > INT16_MAX ? INT16_MAX : (sum < INT16_MIN ? INT16_MIN : sum));
+		}
+
+		pthread_mutex_unlock(&mixer->mix_mutex);
+
+		/* This is a blocking write, it paces the loop. */
+		if (mixer->own_buffer) {
+			cw_usleep_internal(null_period_duration);
+		} else {
+			mixer->output->write_buffer_to_sound_device(mixer->output);
+		}
+	}
+
+	return NULL;
+}
+
+
+
+
+/**
+   @brief Sum samples of registered generators
+
+   Pull @p n_frames samples from each registered generator, and put
+   sums of the samples into mixer's accumulator. With two channels the
+   sums in the accumulator are interleaved (left, right).
+
+   Generators are filled without holding mixer's ->mutex, so
+   callbacks of generators can call functions of the mixer. Changes of
+   inputs made by the callbacks take effect in next period.
+
+   The function must be called with mixer's ->mix_mutex locked.
+
+   @param[in] mixer mixer
+   @param[in] n_frames count of frames to mix, not larger than mixer's buffer
+   @param[in] n_channels count of channels in the mix, 1 (mono) or 2 (stereo)
+*/
+static void cw_mixer_mix_internal(cw_mixer_t * mixer, int n_frames, int n_channels)
+{
+	int32_t * accumulator = mixer->accumulator;
+	const cw_sample_t * samples = mixer->scratch;
+
+	memset(accumulator, 0, (size_t) (n_channels * n_frames) * sizeof (int32_t));
+
+	const int n_inputs = cw_mixer_take_inputs_internal(mixer);
+	for (int g = 0; g < n_inputs; g++) {
+		const cw_mixer_input_t * input = &mixer->period_inputs[g];
+		cw_gen_fill(input->gen, mixer->scratch, (size_t) n_frames);
+
+		/* Each product is scaled back to range of cw_sample_t, so
+		   sums of products of even hundreds of generators fit in
+		   int32_t. */
+		if (1 == n_channels) {
+			const int32_t gain = input->gain_mono;
+			for (int i = 0; i < n_frames; i++) {
+				accumulator[i] += (samples[i] * gain) >> 15;
+			}
+		} else {
+			const int32_t gain_left = input->gain_left;
+			const int32_t gain_right = input->gain_right;
+			for (int i = 0; i < n_frames; i++) {
+				accumulator[2 * i] += (samples[i] * gain_left) >> 15;
+				accumulator[2 * i + 1] += (samples[i] * gain_right) >> 15;
+			}
+		}
+	}
+
+	pthread_mutex_lock(&mixer->mutex);
+	mixer->is_mixing = false;
+	pthread_mutex_unlock(&mixer->mutex);
+
+	return;
+}
+
+
+
+
+/**
+   @brief Copy mixer's inputs for mixing of one period
+
+   The function must be called with mixer's ->mix_mutex locked.
+
+   @param[in] mixer mixer
+
+   @return count of inputs copied to mixer's ->period_inputs
+*/
+static int cw_mixer_take_inputs_internal(cw_mixer_t * mixer)
+{
+	pthread_mutex_lock(&mixer->mutex);
+
+	if (mixer->period_inputs_size < mixer->n_inputs) {
+		cw_mixer_input_t * new_inputs = (cw_mixer_input_t *) realloc(mixer->period_inputs, (size_t) mixer->inputs_size * sizeof (cw_mixer_input_t));
+		if (NULL == new_inputs) {
+			cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR, MSG_PREFIX "realloc()");
+		} else {
+			mixer->period_inputs = new_inputs;
+			mixer->period_inputs_size = mixer->inputs_size;
+		}
+	}
+
+	/* Without memory for all inputs, mix as many of them as
+	   possible. */
+	const int n_inputs = mixer->n_inputs < mixer->period_inputs_size ? mixer->n_inputs : mixer->period_inputs_size;
+	if (n_inputs > 0) {
+		memcpy(mixer->period_inputs, mixer->inputs, (size_t) n_inputs * sizeof (cw_mixer_input_t));
+	}
+	mixer->is_mixing = true;
+	mixer->mixing_thread = pthread_self();
+
+	pthread_mutex_unlock(&mixer->mutex);
+
+	return n_inputs;
+}
+
+
+
+
+/**
+   @brief Find generator in mixer's inputs
+
+   @return index of generator's input
+   @return -1 if the generator is not registered in the mixer
+*/
+static int cw_mixer_find_input_internal(const cw_mixer_t * mixer, const cw_gen_t * gen)
+{
+	for (int i = 0; i < mixer->n_inputs; i++) {
+		if (mixer->inputs[i].gen == gen) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+
+
+/**
+   @brief Validate and set gain and pan of mixer's input
+
+   Calculate gain factors of mono mix and of channels of stereo mix.
+   Stereo uses constant power pan law.
+
+   @param[in,out] input input of mixer
+   @param[in] gain gain of input [percent]
+   @param[in] pan pan of input, -100 (left) to 100 (right)
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE if @p gain or @p pan is out of range
+*/
+static cw_ret_t cw_mixer_set_input_gain_and_pan_internal(cw_mixer_input_t * input, int gain, int pan)
+{
+	if (gain < 0 || gain > 100 || pan < -100 || pan > 100) {
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+
+	input->gain = gain;
+	input->pan = pan;
+
+	input->gain_mono = (gain * CW_MIXER_GAIN_ONE) / 100;
+
+	const double angle = (pan + 100) * (M_PI / 2.0) / 200.0;
+	input->gain_left = (int32_t) lround(input->gain_mono * cos(angle));
+	input->gain_right = (int32_t) lround(input->gain_mono * sin(angle));
+
+	return CW_SUCCESS;
+}
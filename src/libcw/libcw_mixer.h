@@ -0,0 +1,101 @@
+/*
+  This file is a part of unixcw project.
+  unixcw project is covered by GNU General Public License, version 2 or later.
+*/
+
+#ifndef H_LIBCW_MIXER
+#define H_LIBCW_MIXER
+
+
+
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+
+
+
+#include "libcw2.h"
+
+
+
+
+/**
+   Generator registered in mixer
+
+   Gains are Q15 factors: 32768 represents factor of 1.0.
+*/
+typedef struct {
+	cw_gen_t * gen;
+
+	int gain;  /* [percent] */
+	int pan;   /* -100 (left) to 100 (right) */
+
+	int32_t gain_mono;
+	int32_t gain_left;
+	int32_t gain_right;
+} cw_mixer_input_t;
+
+
+
+
+struct cw_mixer_struct {
+	/* Generator that owns mixer's sound device. The generator is
+	   never started, and its tone queue is not used. Mixed samples
+	   are written to the device with the generator's "write buffer
+	   to sound device" function. */
+	cw_gen_t * output;
+
+	/* Sample rate of mixer's sound device. Registered generators are
+	   switched to this sample rate. */
+	unsigned int sample_rate;
+
+	/* Buffer with mixed samples, written to sound device once per
+	   period. This is output->buffer, or (for Null sound system,
+	   which doesn't have a buffer) mixer's own buffer. */
+	cw_sample_t * buffer;
+	int buffer_n_samples;
+	bool own_buffer;
+
+	/* Registered generators. */
+	cw_mixer_input_t * inputs;
+	int n_inputs;
+	int inputs_size;   /* Count of allocated items in ->inputs. */
+
+	/* Samples of one generator in current period, and sums of
+	   samples of all generators in current period. The sums are
+	   saturated only once, when the period is complete. There is
+	   one sum per channel, so ->accumulator has room for two channels
+	   of ->buffer_n_samples samples. */
+	cw_sample_t * scratch;
+	int32_t * accumulator;
+
+	/* Guards ->inputs, ->is_mixing and ->mixing_thread. */
+	pthread_mutex_t mutex;
+
+	/* Copy of ->inputs, taken at the beginning of every period.
+	   Generators are filled and mixed from the copy without holding
+	   ->mutex, because cw_gen_fill() calls client's callbacks, and
+	   the callbacks may call functions of the mixer. */
+	cw_mixer_input_t * period_inputs;
+	int period_inputs_size;   /* Count of allocated items in ->period_inputs. */
+
+	/* Guards mixing of a period: ->period_inputs and all buffers. */
+	pthread_mutex_t mix_mutex;
+
+	/* Is any thread mixing a period right now, and which one. */
+	bool is_mixing;
+	pthread_t mixing_thread;
+
+	struct {
+		pthread_t id;
+		bool running;
+	} thread;
+	volatile bool do_mix;
+};
+
+
+
+
+#endif /* #ifndef H_LIBCW_MIXER */
@@ -42,11 +42,14 @@
    cw_rec_add_mark(): a function that is one level of abstraction above
    functions from first method.
 
-   Currently there is only one method of passing received data (characters)
-   from receiver to client code. This is done by client code periodically
-   polling the receiver with cw_rec_poll_representation() or
-   cw_rec_poll_character() (which itself is built on top of
-   cw_rec_poll_representation()).
+   There are three methods of passing received data (characters) from
+   receiver to client code. Client code can periodically poll the
+   receiver with cw_rec_poll_representation() or cw_rec_poll_character()
+   (which itself is built on top of cw_rec_poll_representation()). A
+   receiver in callback mode (see cw_rec_register_callback()) passes
+   characters to a callback on its own. Recordings of Marks and Spaces
+   can be decoded with cw_rec_decode_events(), or by a pool of receivers
+   (libcw_rec_pool.c) that decodes many channels on worker threads.
 
    Duration of Marks, Spaces and few other things is in microseconds [us].
 */
@@ -65,6 +68,7 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <sys/time.h> /* struct timeval */
+#include <time.h> /* clock_gettime() */
 #include <unistd.h>
 
 
@@ -123,11 +127,47 @@ static const char * cw_receiver_states[] = {
 
 
 
+/* Timestamp passed to receiver by client code: either a timeval
+   passed to one of "timeval" functions (may be NULL, then current
+   time is used), or a value passed to one of "_ns" functions. The
+   timeval is converted with cw_rec_timestamp_get_ns_internal() only
+   on paths that need the timestamp, so functions that don't need it
+   make no system calls and don't fail on invalid timestamp. */
+typedef struct {
+	const struct timeval * timeval;
+	bool is_ns;
+	int64_t ns;
+} cw_rec_timestamp_t;
+
+
+
+
 /* Functions handling averaging data structure in adaptive receiving
    mode. */
 static void cw_rec_update_average_internal(cw_rec_averaging_t * avg, int mark_duration);
 static void cw_rec_update_averages_internal(cw_rec_t * rec, int mark_duration, char mark);
 static void cw_rec_reset_average_internal(cw_rec_averaging_t * avg, int initial);
+static cw_ret_t cw_rec_add_mark_duration_internal(cw_rec_t * rec, int mark_duration);
+static bool cw_rec_decode_space_internal(cw_rec_t * rec, int space_duration, cw_rec_decode_callback_t callback, void * callback_arg);
+static void cw_rec_decode_stream_iws_internal(cw_rec_decode_stream_t * stream, cw_rec_decode_callback_t callback, void * callback_arg);
+static void cw_rec_decode_stream_run_internal(cw_rec_t * rec, cw_rec_decode_stream_t * stream, cw_rec_decode_callback_t callback, void * callback_arg);
+static int cw_rec_add_durations_internal(int duration1, int duration2);
+static cw_ret_t cw_rec_timestamp_get_ns_internal(const cw_rec_timestamp_t * timestamp, int64_t * timestamp_ns);
+static cw_ret_t cw_rec_mark_begin_internal(cw_rec_t * rec, const cw_rec_timestamp_t * timestamp);
+static cw_ret_t cw_rec_mark_end_internal(cw_rec_t * rec, const cw_rec_timestamp_t * timestamp);
+static cw_ret_t cw_rec_add_mark_internal(cw_rec_t * rec, const cw_rec_timestamp_t * timestamp, char mark);
+static cw_ret_t cw_rec_poll_representation_internal(cw_rec_t * rec, const cw_rec_timestamp_t * timestamp, char * representation, bool * is_end_of_word, bool * is_error);
+static cw_ret_t cw_rec_poll_character_internal(cw_rec_t * rec, const cw_rec_timestamp_t * timestamp, char * character, bool * is_end_of_word, bool * is_error);
+static cw_ret_t cw_rec_callback_mode_mark_begin_internal(cw_rec_t * rec, const cw_rec_timestamp_t * timestamp);
+static cw_ret_t cw_rec_callback_mode_mark_end_internal(cw_rec_t * rec, const cw_rec_timestamp_t * timestamp);
+static cw_ret_t cw_rec_callback_mode_add_mark_internal(cw_rec_t * rec, const cw_rec_timestamp_t * timestamp, char mark);
+static bool cw_rec_callback_mode_poll_internal(cw_rec_t * rec, int64_t timestamp_ns);
+static void cw_rec_callback_mode_arm_internal(cw_rec_t * rec, bool is_new_mark_end);
+static void * cw_rec_callback_mode_thread_fn(void * arg);
+static bool cw_rec_callback_mode_lock_internal(cw_rec_t * rec);
+static void cw_rec_callback_mode_unlock_internal(cw_rec_t * rec, bool is_locked);
+static int64_t cw_rec_monotonic_ns_internal(void);
+static void cw_rec_trie_next_internal(cw_rec_t * rec, char mark);
 
 
 
@@ -157,6 +197,7 @@ cw_rec_t * cw_rec_new(void)
 	}
 
 	rec->state = RS_IDLE;
+	rec->trie_node = CW_DATA_TRIE_ROOT;
 
 	rec->speed                      = CW_SPEED_INITIAL;
 	rec->tolerance                  = CW_TOLERANCE_INITIAL;
@@ -204,6 +245,8 @@ void cw_rec_delete(cw_rec_t ** rec)
 		return;
 	}
 
+	cw_rec_register_callback(*rec, NULL, NULL);
+
 	free(*rec);
 	*rec = (cw_rec_t *) NULL;
 
@@ -250,11 +293,13 @@ cw_ret_t cw_rec_set_speed(cw_rec_t * rec, int new_value)
 
 	const float diff = fabsf(((float) new_value) - rec->speed);
 	if (diff >= 0.5F) { /* TODO: verify this comparison. */
+		const bool is_locked = cw_rec_callback_mode_lock_internal(rec);
 		rec->speed = (float) new_value;
 
 		/* Changes of receive speed require resynchronization. */
 		rec->parameters_in_sync = false;
 		cw_rec_sync_parameters_internal(rec);
+		cw_rec_callback_mode_unlock_internal(rec, is_locked);
 	}
 
 	return CW_SUCCESS;
@@ -308,11 +353,13 @@ cw_ret_t cw_rec_set_tolerance(cw_rec_t * rec, int new_value)
 	}
 
 	if (new_value != rec->tolerance) {
+		const bool is_locked = cw_rec_callback_mode_lock_internal(rec);
 		rec->tolerance = new_value;
 
 		/* Changes of tolerance require resynchronization. */
 		rec->parameters_in_sync = false;
 		cw_rec_sync_parameters_internal(rec);
+		cw_rec_callback_mode_unlock_internal(rec, is_locked);
 	}
 
 	return CW_SUCCESS;
@@ -440,7 +487,9 @@ cw_ret_t cw_rec_set_noise_spike_threshold(cw_rec_t * rec, int new_value)
 		errno = EINVAL;
 		return CW_FAILURE;
 	}
+	const bool is_locked = cw_rec_callback_mode_lock_internal(rec);
 	rec->noise_spike_threshold = new_value;
+	cw_rec_callback_mode_unlock_internal(rec, is_locked);
 
 	return CW_SUCCESS;
 }
@@ -492,11 +541,13 @@ cw_ret_t cw_rec_set_gap(cw_rec_t * rec, int new_value)
 	}
 
 	if (new_value != rec->gap) {
+		const bool is_locked = cw_rec_callback_mode_lock_internal(rec);
 		rec->gap = new_value;
 
 		/* Changes of gap require resynchronization. */
 		rec->parameters_in_sync = false;
 		cw_rec_sync_parameters_internal(rec);
+		cw_rec_callback_mode_unlock_internal(rec, is_locked);
 	}
 
 	return CW_SUCCESS;
@@ -859,6 +910,7 @@ void cw_rec_set_adaptive_mode_internal(cw_rec_t * rec, bool adaptive)
 {
 	/* Look for change of adaptive receive state. */
 	if (rec->is_adaptive_receive_mode != adaptive) {
+		const bool is_locked = cw_rec_callback_mode_lock_internal(rec);
 
 		rec->is_adaptive_receive_mode = adaptive;
 
@@ -873,6 +925,8 @@ void cw_rec_set_adaptive_mode_internal(cw_rec_t * rec, bool adaptive)
 			cw_rec_reset_average_internal(&rec->dot_averaging, rec->dot_duration_ideal);
 			cw_rec_reset_average_internal(&rec->dash_averaging, rec->dash_duration_ideal);
 		}
+
+		cw_rec_callback_mode_unlock_internal(rec, is_locked);
 	}
 
 	return;
@@ -966,6 +1020,55 @@ bool cw_rec_get_adaptive_mode(const cw_rec_t * rec)
    @return CW_FAILURE otherwise
 */
 cw_ret_t cw_rec_mark_begin(cw_rec_t * rec, const struct timeval * timestamp)
+{
+	const cw_rec_timestamp_t ts = { .timeval = timestamp, .is_ns = false, .ns = 0 };
+	if (NULL == __atomic_load_n(&rec->callback_mode.callback, __ATOMIC_ACQUIRE)) {
+		return cw_rec_mark_begin_internal(rec, &ts);
+	} else {
+		return cw_rec_callback_mode_mark_begin_internal(rec, &ts);
+	}
+}
+
+
+
+
+/**
+   @brief Inform @p rec about beginning of a Mark, using nanosecond timestamp
+
+   Variant of cw_rec_mark_begin() that accepts a timestamp in
+   nanoseconds, e.g. a value of CLOCK_MONOTONIC clock or a value
+   calculated from a count of audio samples. The function doesn't
+   make any system calls.
+
+   Don't mix timestamps from different clocks in calls made for one
+   Morse code character.
+
+   @exception ERANGE invalid state of receiver was discovered.
+   @exception EINVAL @p timestamp_ns is negative
+
+   @param[in,out] rec receiver which to inform about beginning of Mark
+   @param[in] timestamp_ns timestamp of "beginning of Mark" event [nanoseconds]
+
+   @return CW_SUCCESS when no errors occurred
+   @return CW_FAILURE otherwise
+*/
+cw_ret_t cw_rec_mark_begin_ns(cw_rec_t * rec, int64_t timestamp_ns)
+{
+	const cw_rec_timestamp_t ts = { .timeval = NULL, .is_ns = true, .ns = timestamp_ns };
+	if (NULL == __atomic_load_n(&rec->callback_mode.callback, __ATOMIC_ACQUIRE)) {
+		return cw_rec_mark_begin_internal(rec, &ts);
+	} else {
+		return cw_rec_callback_mode_mark_begin_internal(rec, &ts);
+	}
+}
+
+
+
+
+/**
+   @brief Body of cw_rec_mark_begin() and cw_rec_mark_begin_ns(), without handling of callback mode
+*/
+static cw_ret_t cw_rec_mark_begin_internal(cw_rec_t * rec, const cw_rec_timestamp_t * timestamp)
 {
 #if REC_HAS_PENDING_INTER_WORD_SPACE_FLAG
 	if (rec->is_pending_inter_word_space) {
@@ -1008,20 +1111,21 @@ cw_ret_t cw_rec_mark_begin(cw_rec_t * rec, const struct timeval * timestamp)
 
 	/* Validate and save the timestamp, or get one and then save it.
 	   This is a timestamp of beginning of Mark. */
-	if (CW_SUCCESS != cw_timestamp_validate_internal(&rec->mark_start, timestamp)) {
-		errno = EINVAL;
+	int64_t timestamp_ns = 0;
+	if (CW_SUCCESS != cw_rec_timestamp_get_ns_internal(timestamp, &timestamp_ns)) {
 		return CW_FAILURE;
 	}
+	rec->mark_start_ns = timestamp_ns;
 
 	if (RS_INTER_MARK_SPACE == rec->state) {
 		/* Measure duration of inter-mark-space that is about to end
 		   (just for statistics).
 
-		   rec->mark_end is timestamp of end of previous Mark. It is
-		   set when receiver goes into inter-mark-space state by
+		   rec->mark_end_ns is timestamp of end of previous Mark. It
+		   is set when receiver goes into inter-mark-space state by
 		   cw_rec_mark_end() or by cw_rec_add_mark(). */
-		const int space_duration = cw_timestamp_compare_internal(&rec->mark_end,
-									 &rec->mark_start);
+		const int space_duration = cw_timestamp_compare_ns_internal(rec->mark_end_ns,
+									    rec->mark_start_ns);
 		cw_rec_duration_stats_update_internal(rec, CW_REC_STAT_INTER_MARK_SPACE, space_duration);
 
 		/* TODO: this may have been a very long space. Should
@@ -1062,6 +1166,53 @@ cw_ret_t cw_rec_mark_begin(cw_rec_t * rec, const struct timeval * timestamp)
    @return CW_FAILURE otherwise
 */
 cw_ret_t cw_rec_mark_end(cw_rec_t * rec, const struct timeval * timestamp)
+{
+	const cw_rec_timestamp_t ts = { .timeval = timestamp, .is_ns = false, .ns = 0 };
+	if (NULL == __atomic_load_n(&rec->callback_mode.callback, __ATOMIC_ACQUIRE)) {
+		return cw_rec_mark_end_internal(rec, &ts);
+	} else {
+		return cw_rec_callback_mode_mark_end_internal(rec, &ts);
+	}
+}
+
+
+
+
+/**
+   @brief Inform @p rec about end of a Mark, using nanosecond timestamp
+
+   Variant of cw_rec_mark_end() that accepts a timestamp in
+   nanoseconds. See cw_rec_mark_begin_ns().
+
+   @exception ERANGE invalid state of receiver was discovered (e.g. the call was not preceded by a cw_rec_mark_begin_ns() call)
+   @exception EINVAL @p timestamp_ns is negative
+   @exception ENOENT function can't tell from duration of the Mark if it's Dot or Dash,
+   @exception ENOMEM the receiver's representation buffer is full
+   @exception EAGAIN the Mark has been classified as noise spike and rejected
+
+   @param[in,out] rec receiver which to inform about end of Mark
+   @param[in] timestamp_ns timestamp of "end of Mark" event [nanoseconds]
+
+   @return CW_SUCCESS when no errors occurred
+   @return CW_FAILURE otherwise
+*/
+cw_ret_t cw_rec_mark_end_ns(cw_rec_t * rec, int64_t timestamp_ns)
+{
+	const cw_rec_timestamp_t ts = { .timeval = NULL, .is_ns = true, .ns = timestamp_ns };
+	if (NULL == __atomic_load_n(&rec->callback_mode.callback, __ATOMIC_ACQUIRE)) {
+		return cw_rec_mark_end_internal(rec, &ts);
+	} else {
+		return cw_rec_callback_mode_mark_end_internal(rec, &ts);
+	}
+}
+
+
+
+
+/**
+   @brief Body of cw_rec_mark_end() and cw_rec_mark_end_ns(), without handling of callback mode
+*/
+static cw_ret_t cw_rec_mark_end_internal(cw_rec_t * rec, const cw_rec_timestamp_t * timestamp)
 {
 	/* The receiver state is expected to be inside of a Mark, otherwise
 	   there is nothing to end. */
@@ -1076,24 +1227,18 @@ cw_ret_t cw_rec_mark_end(cw_rec_t * rec, const struct timeval * timestamp)
 
 	/* Take a safe copy of the current end timestamp, in case we need
 	   to put it back if we decide this Mark is really just noise. */
-	struct timeval saved_end_timestamp = rec->mark_end;
+	const int64_t saved_end_timestamp_ns = rec->mark_end_ns;
 
 	/* Save the timestamp passed in, or get one. */
-	if (CW_SUCCESS != cw_timestamp_validate_internal(&rec->mark_end, timestamp)) {
-		errno = EINVAL;
+	int64_t timestamp_ns = 0;
+	if (CW_SUCCESS != cw_rec_timestamp_get_ns_internal(timestamp, &timestamp_ns)) {
 		return CW_FAILURE;
 	}
+	rec->mark_end_ns = timestamp_ns;
 
 	/* Compare the timestamps to determine the duration of the Mark. */
-	const int mark_duration = cw_timestamp_compare_internal(&rec->mark_start,
-								&rec->mark_end);
-
-#if 0
-	fprintf(stderr, "------- mark duration: %ld.%ld - %ld.%ld = %d ms\n",
-		rec->mark_end.tv_sec, rec->mark_end.tv_usec,
-		rec->mark_start.tv_sec, rec->mark_start.tv_usec,
-		mark_duration);
-#endif
+	const int mark_duration = cw_timestamp_compare_ns_internal(rec->mark_start_ns,
+								   rec->mark_end_ns);
 
 	if (rec->noise_spike_threshold > 0
 	    && mark_duration <= rec->noise_spike_threshold) {
@@ -1114,7 +1259,7 @@ cw_ret_t cw_rec_mark_end(cw_rec_t * rec, const struct timeval * timestamp)
 
 		/* Put the end-of-mark timestamp back to how it was when we
 		   came in to the routine. */
-		rec->mark_end = saved_end_timestamp;
+		rec->mark_end_ns = saved_end_timestamp_ns;
 
 		cw_debug_msg (&cw_debug_object, CW_DEBUG_KEYING, CW_DEBUG_INFO,
 			      MSG_PREFIX "'%s': mark_end: '%d [us]' Mark identified as spike noise (threshold = '%d [us]')",
@@ -1126,7 +1271,31 @@ cw_ret_t cw_rec_mark_end(cw_rec_t * rec, const struct timeval * timestamp)
 	}
 
 
-	/* This was not a noise. At this point, we have to make a
+	/* This was not a noise. */
+	return cw_rec_add_mark_duration_internal(rec, mark_duration);
+}
+
+
+
+
+/**
+   @brief Identify a Mark of given duration and add it to representation buffer
+
+   Second half of cw_rec_mark_end(), used also by
+   cw_rec_decode_events().
+
+   @exception ENOENT function can't tell from duration of the Mark if it's Dot or Dash,
+   @exception ENOMEM the receiver's representation buffer is full
+
+   @param[in,out] rec receiver
+   @param[in] mark_duration duration of Mark that is not a noise spike
+
+   @return CW_SUCCESS when no errors occurred
+   @return CW_FAILURE otherwise
+*/
+static cw_ret_t cw_rec_add_mark_duration_internal(cw_rec_t * rec, int mark_duration)
+{
+	/* At this point, we have to make a
 	   decision about the Mark just received.  We'll use a routine
 	   that compares duration of a Mark against pre-calculated Dot
 	   and Dash duration ranges to tell us what it thinks this Mark
@@ -1165,6 +1334,8 @@ cw_ret_t cw_rec_mark_end(cw_rec_t * rec, const struct timeval * timestamp)
 
 	/* Add the Mark to the receiver's representation buffer. */
 	rec->representation[rec->representation_ind++] = mark;
+	rec->representation[rec->representation_ind] = '\0';
+	cw_rec_trie_next_internal(rec, mark);
 
 	/* Until we complete the whole character (all Dots and Dashes), this
 	   will print only part of representation. */
@@ -1418,6 +1589,52 @@ void cw_rec_update_averages_internal(cw_rec_t * rec, int mark_duration, char mar
    @return CW_FAILURE on failure
 */
 cw_ret_t cw_rec_add_mark(cw_rec_t * rec, const struct timeval * timestamp, char mark)
+{
+	const cw_rec_timestamp_t ts = { .timeval = timestamp, .is_ns = false, .ns = 0 };
+	if (NULL == __atomic_load_n(&rec->callback_mode.callback, __ATOMIC_ACQUIRE)) {
+		return cw_rec_add_mark_internal(rec, &ts, mark);
+	} else {
+		return cw_rec_callback_mode_add_mark_internal(rec, &ts, mark);
+	}
+}
+
+
+
+
+/**
+   @brief Add Dot or Dash to receiver's representation buffer, using nanosecond timestamp
+
+   Variant of cw_rec_add_mark() that accepts a timestamp of "end of
+   mark" event in nanoseconds. See cw_rec_mark_begin_ns().
+
+   @exception ERANGE invalid state of receiver was discovered.
+   @exception EINVAL @p timestamp_ns is negative
+   @exception ENOMEM the receiver's representation buffer is full
+
+   @param[in,out] rec receiver
+   @param[in] timestamp_ns timestamp of "end of mark" event [nanoseconds]
+   @param[in] mark Mark to be inserted into receiver's representation buffer
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+cw_ret_t cw_rec_add_mark_ns(cw_rec_t * rec, int64_t timestamp_ns, char mark)
+{
+	const cw_rec_timestamp_t ts = { .timeval = NULL, .is_ns = true, .ns = timestamp_ns };
+	if (NULL == __atomic_load_n(&rec->callback_mode.callback, __ATOMIC_ACQUIRE)) {
+		return cw_rec_add_mark_internal(rec, &ts, mark);
+	} else {
+		return cw_rec_callback_mode_add_mark_internal(rec, &ts, mark);
+	}
+}
+
+
+
+
+/**
+   @brief Body of cw_rec_add_mark() and cw_rec_add_mark_ns(), without handling of callback mode
+*/
+static cw_ret_t cw_rec_add_mark_internal(cw_rec_t * rec, const cw_rec_timestamp_t * timestamp, char mark)
 {
 	/* The receiver's state is expected to be idle or
 	   inter-mark-space in order to use this routine. */
@@ -1453,13 +1670,16 @@ cw_ret_t cw_rec_add_mark(cw_rec_t * rec, const struct timeval * timestamp, char
 	   called later look at the time since the last end of Mark
 	   to determine whether we are at the end of a word, or just
 	   at the end of a character. */
-	if (CW_SUCCESS != cw_timestamp_validate_internal(&rec->mark_end, timestamp)) {
-		errno = EINVAL;
+	int64_t timestamp_ns = 0;
+	if (CW_SUCCESS != cw_rec_timestamp_get_ns_internal(timestamp, &timestamp_ns)) {
 		return CW_FAILURE;
 	}
+	rec->mark_end_ns = timestamp_ns;
 
 	/* Add the mark to the receiver's representation buffer. */
 	rec->representation[rec->representation_ind++] = mark;
+	rec->representation[rec->representation_ind] = '\0';
+	cw_rec_trie_next_internal(rec, mark);
 
 	/* We just added a Mark to the receiver's buffer.  As in
 	   cw_rec_mark_end(): if the buffer is full full, then we have to do
@@ -1527,7 +1747,7 @@ cw_ret_t cw_rec_add_mark(cw_rec_t * rec, const struct timeval * timestamp, char
    @param[in] timestamp (may be NULL)
    @param[out] representation representation of character from receiver's buffer
    @param[out] is_end_of_word flag indicating if receiver is at end of word (may be NULL)
-   @param[out] is_error flag indicating whether receiver is in error state (may be NULL)
+   @param[out] is_error flag indicating whether receiver is in error state, or whether the representation can't form a valid character (may be NULL)
 
    @return CW_SUCCESS if a correct representation has been returned through @p representation
    @return CW_FAILURE otherwise
@@ -1537,6 +1757,54 @@ cw_ret_t cw_rec_poll_representation(cw_rec_t * rec,
 				    char * representation,
 				    bool * is_end_of_word,
 				    bool * is_error)
+{
+	const cw_rec_timestamp_t ts = { .timeval = timestamp, .is_ns = false, .ns = 0 };
+	return cw_rec_poll_representation_internal(rec, &ts, representation, is_end_of_word, is_error);
+}
+
+
+
+
+/**
+   @brief Try to poll fully received representation from receiver, using nanosecond timestamp
+
+   Variant of cw_rec_poll_representation() that accepts a timestamp
+   in nanoseconds. See cw_rec_mark_begin_ns().
+
+   @exception ERANGE invalid state of receiver was discovered
+   @exception EINVAL @p timestamp_ns is negative
+   @exception EAGAIN function called too early, representation not ready yet
+
+   @param[in,out] rec receiver
+   @param[in] timestamp_ns current time [nanoseconds]
+   @param[out] representation representation of character from receiver's buffer
+   @param[out] is_end_of_word flag indicating if receiver is at end of word (may be NULL)
+   @param[out] is_error flag indicating whether receiver is in error state, or whether the representation can't form a valid character (may be NULL)
+
+   @return CW_SUCCESS if a correct representation has been returned through @p representation
+   @return CW_FAILURE otherwise
+*/
+cw_ret_t cw_rec_poll_representation_ns(cw_rec_t * rec,
+				       int64_t timestamp_ns,
+				       char * representation,
+				       bool * is_end_of_word,
+				       bool * is_error)
+{
+	const cw_rec_timestamp_t ts = { .timeval = NULL, .is_ns = true, .ns = timestamp_ns };
+	return cw_rec_poll_representation_internal(rec, &ts, representation, is_end_of_word, is_error);
+}
+
+
+
+
+/**
+   @brief Body of cw_rec_poll_representation() and cw_rec_poll_representation_ns()
+*/
+static cw_ret_t cw_rec_poll_representation_internal(cw_rec_t * rec,
+						    const cw_rec_timestamp_t * timestamp,
+						    char * representation,
+						    bool * is_end_of_word,
+						    bool * is_error)
 {
 	if (RS_EOW_GAP == rec->state || RS_EOW_GAP_ERR == rec->state) {
 
@@ -1585,13 +1853,12 @@ cw_ret_t cw_rec_poll_representation(cw_rec_t * rec,
 	   To see which case is true, calculate duration of this Space
 	   by comparing current/given timestamp with end of last
 	   Mark. */
-	struct timeval now_timestamp;
-	if (CW_SUCCESS != cw_timestamp_validate_internal(&now_timestamp, timestamp)) {
-		errno = EINVAL;
+	int64_t timestamp_ns = 0;
+	if (CW_SUCCESS != cw_rec_timestamp_get_ns_internal(timestamp, &timestamp_ns)) {
 		return CW_FAILURE;
 	}
 
-	const int space_duration = cw_timestamp_compare_internal(&rec->mark_end, &now_timestamp);
+	const int space_duration = cw_timestamp_compare_ns_internal(rec->mark_end_ns, timestamp_ns);
 	if (INT_MAX == space_duration) {
 		cw_debug_msg (&cw_debug_object, CW_DEBUG_RECEIVE_STATES, CW_DEBUG_ERROR,
 			      MSG_PREFIX "'%s': poll: space duration == INT_MAX", rec->label);
@@ -1702,7 +1969,9 @@ void cw_rec_poll_representation_ics_internal(cw_rec_t * rec,
 		*is_end_of_word = false;
 	}
 	if (is_error) {
-		*is_error = (RS_EOC_GAP_ERR == rec->state);
+		/* Representation that can't form a valid character is
+		   an error too. */
+		*is_error = (RS_EOC_GAP_ERR == rec->state) || 0 == rec->trie_node;
 	}
 
 	/* Append representation from receiver's buffer to caller's buffer. */
@@ -1764,7 +2033,7 @@ void cw_rec_poll_representation_iws_internal(cw_rec_t * rec,
 		*is_end_of_word = true;
 	}
 	if (is_error) {
-		*is_error = (RS_EOW_GAP_ERR == rec->state);
+		*is_error = (RS_EOW_GAP_ERR == rec->state) || 0 == rec->trie_node;
 	}
 
 	/* Append representation from receiver's buffer to caller's buffer. */
@@ -1824,6 +2093,55 @@ cw_ret_t cw_rec_poll_character(cw_rec_t * rec,
 			       char * character,
 			       bool * is_end_of_word,
 			       bool * is_error)
+{
+	const cw_rec_timestamp_t ts = { .timeval = timestamp, .is_ns = false, .ns = 0 };
+	return cw_rec_poll_character_internal(rec, &ts, character, is_end_of_word, is_error);
+}
+
+
+
+
+/**
+   @brief Try to poll fully received character from receiver, using nanosecond timestamp
+
+   Variant of cw_rec_poll_character() that accepts a timestamp in
+   nanoseconds. See cw_rec_mark_begin_ns().
+
+   @exception ERANGE invalid state of receiver was discovered.
+   @exception EINVAL @p timestamp_ns is negative
+   @exception EAGAIN function called too early, character not ready yet
+   @exception ENOENT function can't convert representation retrieved from receiver into a character
+
+   @param[in,out] rec receiver
+   @param[in] timestamp_ns current time [nanoseconds]
+   @param[out] character character received by receiver
+   @param[out] is_end_of_word flag indicating if receiver is at end of word (may be NULL)
+   @param[out] is_error flag indicating whether receiver is in error state (may be NULL)
+
+   @return CW_SUCCESS if a character has been recognized by receiver and is returned through @p character
+   @return CW_FAILURE otherwise
+*/
+cw_ret_t cw_rec_poll_character_ns(cw_rec_t * rec,
+				  int64_t timestamp_ns,
+				  char * character,
+				  bool * is_end_of_word,
+				  bool * is_error)
+{
+	const cw_rec_timestamp_t ts = { .timeval = NULL, .is_ns = true, .ns = timestamp_ns };
+	return cw_rec_poll_character_internal(rec, &ts, character, is_end_of_word, is_error);
+}
+
+
+
+
+/**
+   @brief Body of cw_rec_poll_character() and cw_rec_poll_character_ns()
+*/
+static cw_ret_t cw_rec_poll_character_internal(cw_rec_t * rec,
+					       const cw_rec_timestamp_t * timestamp,
+					       char * character,
+					       bool * is_end_of_word,
+					       bool * is_error)
 {
 	/* TODO: in theory we don't need these intermediate bool
 	   variables, since is_end_of_word and is_error won't be
@@ -1834,15 +2152,16 @@ cw_ret_t cw_rec_poll_character(cw_rec_t * rec,
 	char representation[CW_REC_REPRESENTATION_CAPACITY + 1];
 
 	/* See if we can obtain a representation from receiver. */
-	cw_ret_t cwret = cw_rec_poll_representation(rec, timestamp,
-						    representation,
-						    &end_of_word, &error);
+	cw_ret_t cwret = cw_rec_poll_representation_internal(rec, timestamp,
+							     representation,
+							     &end_of_word, &error);
 	if (CW_SUCCESS != cwret) {
 		return CW_FAILURE;
 	}
 
-	/* Look up the representation using the lookup functions. */
-	int looked_up = cw_representation_to_character_internal(representation);
+	/* The receiver has walked the trie of representations while
+	   receiving Marks, so the character is already known. */
+	const int looked_up = cw_data_trie_character_internal(rec->trie_node);
 	if (0 == looked_up) {
 		errno = ENOENT;
 		return CW_FAILURE;
@@ -1881,6 +2200,761 @@ cw_ret_t cw_rec_poll_character(cw_rec_t * rec,
 
 
 
+cw_ret_t cw_rec_decode_events(cw_rec_t * rec, const cw_rec_event_t * events, size_t n_events, cw_rec_decode_callback_t callback, void * callback_arg)
+{
+	if (NULL == rec || NULL == callback || (NULL == events && 0 != n_events)) {
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+	for (size_t i = 0; i < n_events; i++) {
+		if (events[i].duration < 0) {
+			errno = EINVAL;
+			return CW_FAILURE;
+		}
+	}
+
+	cw_rec_decode_stream_t stream;
+	cw_rec_decode_stream_init_internal(rec, &stream);
+	cw_rec_decode_stream_push_internal(rec, &stream, events, n_events, callback, callback_arg);
+	cw_rec_decode_stream_end_internal(rec, &stream, callback, callback_arg);
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   @brief Start decoding of a stream of Marks and Spaces
+
+   State of @p rec is reset, so the stream begins with a new
+   character.
+
+   @param[in,out] rec receiver
+   @param[out] stream state of decoding of the stream
+*/
+void cw_rec_decode_stream_init_internal(cw_rec_t * rec, cw_rec_decode_stream_t * stream)
+{
+	cw_rec_reset_state(rec);
+
+	stream->has_run = false;
+	stream->run_is_mark = false;
+	stream->run_duration = 0;
+	stream->space_duration = 0;
+	stream->is_pending_iws = false;
+}
+
+
+
+
+/**
+   @brief Decode next part of a stream of Marks and Spaces
+
+   The last run of events of the same kind in @p events is not
+   decoded yet: it may be continued by next part of the stream. It is
+   decoded by next call of this function or by
+   cw_rec_decode_stream_end_internal().
+
+   Durations in @p events must be already validated by caller.
+
+   @param[in,out] rec receiver
+   @param[in,out] stream state of decoding of the stream
+   @param[in] events Marks and Spaces to decode
+   @param[in] n_events count of items in @p events
+   @param[in] callback callback receiving decoded characters
+   @param[in] callback_arg argument passed to @p callback
+*/
+void cw_rec_decode_stream_push_internal(cw_rec_t * rec, cw_rec_decode_stream_t * stream, const cw_rec_event_t * events, size_t n_events, cw_rec_decode_callback_t callback, void * callback_arg)
+{
+	for (size_t i = 0; i < n_events; i++) {
+		/* Consecutive events of the same kind make one Mark or one
+		   Space. */
+		if (stream->has_run && events[i].is_mark == stream->run_is_mark) {
+			stream->run_duration = cw_rec_add_durations_internal(stream->run_duration, events[i].duration);
+			continue;
+		}
+
+		cw_rec_decode_stream_run_internal(rec, stream, callback, callback_arg);
+		stream->has_run = true;
+		stream->run_is_mark = events[i].is_mark;
+		stream->run_duration = events[i].duration;
+	}
+}
+
+
+
+
+/**
+   @brief Finish decoding of a stream of Marks and Spaces
+
+   No more Marks will come, so the last Space is treated as
+   inter-word-space and the last character is always passed to
+   @p callback (or, if the character has been already passed by
+   cw_rec_decode_stream_flush_internal(), a ' ' character ending the
+   word is passed). State of @p rec and of @p stream is reset, so the
+   stream can be followed by a new one.
+
+   @param[in,out] rec receiver
+   @param[in,out] stream state of decoding of the stream
+   @param[in] callback callback receiving decoded characters
+   @param[in] callback_arg argument passed to @p callback
+*/
+void cw_rec_decode_stream_end_internal(cw_rec_t * rec, cw_rec_decode_stream_t * stream, cw_rec_decode_callback_t callback, void * callback_arg)
+{
+	cw_rec_decode_stream_run_internal(rec, stream, callback, callback_arg);
+	if (stream->is_pending_iws) {
+		cw_rec_decode_stream_iws_internal(stream, callback, callback_arg);
+	}
+	cw_rec_decode_space_internal(rec, INT_MAX, callback, callback_arg);
+
+	cw_rec_decode_stream_init_internal(rec, stream);
+}
+
+
+
+
+/**
+   @brief Decode Space at the end of passed part of a stream
+
+   The last run of events passed with
+   cw_rec_decode_stream_push_internal() is not decoded until it is
+   known that it has ended. If the run is a Space, the Space may be
+   already long enough to be classified. Call this function after
+   pushing a part of stream to pass a character to @p callback as soon
+   as the Space after it becomes longer than shortest
+   inter-character-space, instead of waiting for next Mark.
+
+   Like in callback mode of receiver, a character that has been passed
+   to @p callback with is_end_of_word set to false is followed by a
+   ' ' character with empty representation and is_end_of_word set to
+   true if the Space becomes longer than longest
+   inter-character-space.
+
+   @param[in,out] rec receiver
+   @param[in,out] stream state of decoding of the stream
+   @param[in] callback callback receiving decoded characters
+   @param[in] callback_arg argument passed to @p callback
+*/
+void cw_rec_decode_stream_flush_internal(cw_rec_t * rec, cw_rec_decode_stream_t * stream, cw_rec_decode_callback_t callback, void * callback_arg)
+{
+	if (stream->has_run && stream->run_is_mark) {
+		return;
+	}
+	const int space_duration = stream->has_run
+		? cw_rec_add_durations_internal(stream->space_duration, stream->run_duration)
+		: stream->space_duration;
+
+	/* Synchronize parameters if required */
+	cw_rec_sync_parameters_internal(rec);
+
+	if (RS_IDLE == rec->state) {
+		if (stream->is_pending_iws && space_duration > rec->ics_duration_max) {
+			cw_rec_decode_stream_iws_internal(stream, callback, callback_arg);
+		}
+		return;
+	}
+
+	if (space_duration < rec->ics_duration_min
+	    && RS_EOC_GAP_ERR != rec->state
+	    && RS_EOW_GAP_ERR != rec->state) {
+		/* Still inside of a character, or too early to tell. Don't
+		   let cw_rec_decode_space_internal() count the Space as
+		   inter-mark-space: the Space may be continued. */
+		return;
+	}
+
+	stream->is_pending_iws = cw_rec_decode_space_internal(rec, space_duration, callback, callback_arg);
+}
+
+
+
+
+/**
+   @brief Pass ' ' character ending a word to @p callback
+
+   @param[in,out] stream state of decoding of the stream
+   @param[in] callback callback receiving decoded characters
+   @param[in] callback_arg argument passed to @p callback
+*/
+static void cw_rec_decode_stream_iws_internal(cw_rec_decode_stream_t * stream, cw_rec_decode_callback_t callback, void * callback_arg)
+{
+	stream->is_pending_iws = false;
+	callback(callback_arg, ' ', "", true, false);
+}
+
+
+
+
+/**
+   @brief Decode a complete run of events of the same kind
+
+   @param[in,out] rec receiver
+   @param[in,out] stream state of decoding of the stream
+   @param[in] callback callback receiving decoded characters
+   @param[in] callback_arg argument passed to @p callback
+*/
+static void cw_rec_decode_stream_run_internal(cw_rec_t * rec, cw_rec_decode_stream_t * stream, cw_rec_decode_callback_t callback, void * callback_arg)
+{
+	if (!stream->has_run) {
+		return;
+	}
+	stream->has_run = false;
+
+	const int duration = stream->run_duration;
+	if (!stream->run_is_mark) {
+		stream->space_duration = cw_rec_add_durations_internal(stream->space_duration, duration);
+		return;
+	}
+
+	if (rec->noise_spike_threshold > 0 && duration <= rec->noise_spike_threshold) {
+		/* Noise spike is ignored. Like in cw_rec_mark_end(), the
+		   time of spike becomes a part of Space around it. */
+		stream->space_duration = cw_rec_add_durations_internal(stream->space_duration, duration);
+		return;
+	}
+
+	/* Beginning of Mark ends the Space. */
+	if (stream->is_pending_iws) {
+		/* Character before the Space has been already passed to
+		   callback by cw_rec_decode_stream_flush_internal(). */
+		cw_rec_sync_parameters_internal(rec);
+		if (stream->space_duration > rec->ics_duration_max) {
+			cw_rec_decode_stream_iws_internal(stream, callback, callback_arg);
+		}
+		stream->is_pending_iws = false;
+	}
+	cw_rec_decode_space_internal(rec, stream->space_duration, callback, callback_arg);
+	stream->space_duration = 0;
+
+	/* Errors are reflected in state of receiver, and are reported
+	   together with representation at the end of next Space. */
+	cw_rec_add_mark_duration_internal(rec, duration);
+}
+
+
+
+
+/**
+   @brief Handle end of Space in decoded stream of Marks and Spaces
+
+   Depending on duration of the Space the function either does
+   nothing (the Space is inter-mark-space), or passes a complete
+   character to @p callback (the Space is inter-character-space or
+   inter-word-space) and resets state of receiver.
+
+   @param[in,out] rec receiver
+   @param[in] space_duration duration of the Space
+   @param[in] callback callback receiving characters
+   @param[in] callback_arg argument of callback
+
+   @return true if a character has been passed to @p callback with is_end_of_word set to false
+   @return false otherwise
+*/
+static bool cw_rec_decode_space_internal(cw_rec_t * rec, int space_duration, cw_rec_decode_callback_t callback, void * callback_arg)
+{
+	if (RS_IDLE == rec->state) {
+		/* Space before first Mark of a character. */
+		return false;
+	}
+
+	char representation[CW_REC_REPRESENTATION_CAPACITY + 1];
+	bool is_end_of_word = false;
+	bool is_error = false;
+
+	/* Synchronize parameters if required */
+	cw_rec_sync_parameters_internal(rec);
+
+	/* The same classification of Space as in
+	   cw_rec_poll_representation(). Unlike there, a character in
+	   one of error states is completed by any Space. */
+	if (RS_EOW_GAP_ERR == rec->state || space_duration > rec->ics_duration_max) {
+		cw_rec_poll_representation_iws_internal(rec, representation, &is_end_of_word, &is_error);
+	} else if (space_duration >= rec->ics_duration_min || RS_EOC_GAP_ERR == rec->state) {
+		cw_rec_poll_representation_ics_internal(rec, space_duration, representation, &is_end_of_word, &is_error);
+	} else {
+		/* Still inside of a character. */
+		cw_rec_duration_stats_update_internal(rec, CW_REC_STAT_INTER_MARK_SPACE, space_duration);
+		return false;
+	}
+
+	const int character = cw_data_trie_character_internal(rec->trie_node);
+	callback(callback_arg, (char) character, representation, is_end_of_word, is_error);
+
+	cw_rec_reset_state(rec);
+
+	return !is_end_of_word;
+}
+
+
+
+
+/**
+   @brief Add two durations, saturating at INT_MAX
+*/
+static int cw_rec_add_durations_internal(int duration1, int duration2)
+{
+	return duration1 > INT_MAX - duration2 ? INT_MAX : duration1 + duration2;
+}
+
+
+
+
+/**
+   @brief Get value of timestamp passed by client code, in nanoseconds
+
+   Timeval is validated (or current time is taken if it is NULL) and
+   converted with cw_timestamp_to_ns_internal().
+
+   @exception EINVAL @p timestamp is invalid
+
+   @param[in] timestamp timestamp passed by client code
+   @param[out] timestamp_ns value of the timestamp [nanoseconds]
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+static cw_ret_t cw_rec_timestamp_get_ns_internal(const cw_rec_timestamp_t * timestamp, int64_t * timestamp_ns)
+{
+	if (timestamp->is_ns) {
+		if (timestamp->ns < 0) {
+			errno = EINVAL;
+			return CW_FAILURE;
+		}
+		*timestamp_ns = timestamp->ns;
+		return CW_SUCCESS;
+	}
+
+	if (CW_SUCCESS != cw_timestamp_to_ns_internal(timestamp_ns, timestamp->timeval)) {
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   @brief Register a callback receiving characters from @p rec
+
+   Registering a non-NULL @p callback puts @p rec into callback
+   mode. In this mode client code doesn't have to poll the receiver:
+   after each end of Mark (cw_rec_mark_end(), cw_rec_add_mark() and
+   their _ns variants) an internal thread of the receiver arms a timer
+   (CLOCK_MONOTONIC) at the end of shortest inter-character-space. When
+   the timer expires, the character is passed to @p callback with
+   @p is_end_of_word set to false. If no new Mark begins before the
+   end of longest inter-character-space, @p callback is called again
+   with ' ' character, empty representation and @p is_end_of_word set
+   to true. The thread doesn't wake up while no Marks are received.
+
+   The timer measures the Space from the moment of the call that
+   ended the Mark, so timestamps passed to the receiver should
+   advance at the pace of real time. If they don't (e.g. they are
+   calculated from samples of a recording that is processed faster
+   than real time), a character is passed to @p callback at the latest
+   when next Mark begins.
+
+   In callback mode the receiver resets its state after each
+   character, so don't call cw_rec_reset_state() and poll
+   functions. The callback is called with internal lock of @p rec
+   held, so it must not call functions of @p rec. Setters of
+   parameters of @p rec take the lock too, so they don't change the
+   parameters while the thread of receiver is using them.
+
+   Register the callback before passing Marks to the receiver.
+   Passing NULL @p callback ends callback mode. Callback mode is also
+   ended by cw_rec_delete().
+
+   @exception EINVAL @p rec is NULL
+   @exception EAGAIN the thread of receiver can't be created
+
+   @param[in,out] rec receiver
+   @param[in] callback callback receiving characters (may be NULL)
+   @param[in] callback_arg argument passed to @p callback
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+cw_ret_t cw_rec_register_callback(cw_rec_t * rec, cw_rec_decode_callback_t callback, void * callback_arg)
+{
+	if (NULL == rec) {
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+
+	if (NULL != __atomic_load_n(&rec->callback_mode.callback, __ATOMIC_ACQUIRE)) {
+		/* Callback mode is already active. */
+		if (NULL != callback) {
+			pthread_mutex_lock(&rec->callback_mode.mutex);
+			__atomic_store_n(&rec->callback_mode.callback, callback, __ATOMIC_RELEASE);
+			rec->callback_mode.callback_arg = callback_arg;
+			pthread_mutex_unlock(&rec->callback_mode.mutex);
+			return CW_SUCCESS;
+		}
+
+		pthread_mutex_lock(&rec->callback_mode.mutex);
+		rec->callback_mode.do_stop = true;
+		pthread_cond_signal(&rec->callback_mode.cond);
+		pthread_mutex_unlock(&rec->callback_mode.mutex);
+		pthread_join(rec->callback_mode.thread, NULL);
+
+		__atomic_store_n(&rec->callback_mode.callback, NULL, __ATOMIC_RELEASE);
+		rec->callback_mode.callback_arg = NULL;
+		pthread_cond_destroy(&rec->callback_mode.cond);
+		pthread_mutex_destroy(&rec->callback_mode.mutex);
+
+		cw_rec_reset_state(rec);
+		return CW_SUCCESS;
+	}
+
+	if (NULL == callback) {
+		/* Callback mode is not active, nothing to end. */
+		return CW_SUCCESS;
+	}
+
+	pthread_mutex_init(&rec->callback_mode.mutex, NULL);
+	pthread_condattr_t cond_attr;
+	pthread_condattr_init(&cond_attr);
+	pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&rec->callback_mode.cond, &cond_attr);
+	pthread_condattr_destroy(&cond_attr);
+
+	rec->callback_mode.do_stop = false;
+	rec->callback_mode.is_armed = false;
+	rec->callback_mode.is_pending_iws = false;
+	rec->callback_mode.callback_arg = callback_arg;
+	cw_rec_reset_state(rec);
+
+	const int rv = pthread_create(&rec->callback_mode.thread, NULL, cw_rec_callback_mode_thread_fn, rec);
+	if (0 != rv) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_RECEIVE_STATES, CW_DEBUG_ERROR,
+			      MSG_PREFIX "'%s': register callback: failed to create thread: %d", rec->label, rv);
+		pthread_cond_destroy(&rec->callback_mode.cond);
+		pthread_mutex_destroy(&rec->callback_mode.mutex);
+		errno = EAGAIN;
+		return CW_FAILURE;
+	}
+
+	/* Setting the callback turns on callback mode in receive
+	   functions and in setters of parameters, so do it after
+	   everything is ready. The thread reads the callback only
+	   under the mutex. */
+	pthread_mutex_lock(&rec->callback_mode.mutex);
+	__atomic_store_n(&rec->callback_mode.callback, callback, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&rec->callback_mode.mutex);
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   @brief cw_rec_mark_begin() and cw_rec_mark_begin_ns() in callback mode
+
+   If Space that ends with beginning of this Mark is long enough, a
+   character is passed to callback before the Mark is added.
+*/
+static cw_ret_t cw_rec_callback_mode_mark_begin_internal(cw_rec_t * rec, const cw_rec_timestamp_t * timestamp)
+{
+	/* The timestamp is needed to poll the receiver, so it is
+	   converted here, once for both uses. */
+	int64_t timestamp_ns = 0;
+	if (CW_SUCCESS != cw_rec_timestamp_get_ns_internal(timestamp, &timestamp_ns)) {
+		return CW_FAILURE;
+	}
+	const cw_rec_timestamp_t ts = { .timeval = NULL, .is_ns = true, .ns = timestamp_ns };
+
+	pthread_mutex_lock(&rec->callback_mode.mutex);
+
+	cw_rec_callback_mode_poll_internal(rec, timestamp_ns);
+	if (rec->callback_mode.is_pending_iws) {
+		/* The character was passed to callback, and the new Mark
+		   begins next character in the same word. */
+		rec->callback_mode.is_pending_iws = false;
+		cw_rec_reset_state(rec);
+	}
+	rec->callback_mode.is_armed = false;
+
+	const cw_ret_t cwret = cw_rec_mark_begin_internal(rec, &ts);
+	const int saved_errno = errno;
+
+	pthread_mutex_unlock(&rec->callback_mode.mutex);
+
+	errno = saved_errno;
+	return cwret;
+}
+
+
+
+
+/**
+   @brief cw_rec_mark_end() and cw_rec_mark_end_ns() in callback mode
+*/
+static cw_ret_t cw_rec_callback_mode_mark_end_internal(cw_rec_t * rec, const cw_rec_timestamp_t * timestamp)
+{
+	pthread_mutex_lock(&rec->callback_mode.mutex);
+
+	const cw_ret_t cwret = cw_rec_mark_end_internal(rec, timestamp);
+	const int saved_errno = errno;
+
+	/* Mark rejected as noise spike doesn't end previous
+	   inter-mark-space, so the timer is armed again for that
+	   Space. */
+	const bool is_noise_spike = CW_SUCCESS != cwret && EAGAIN == saved_errno;
+	cw_rec_callback_mode_arm_internal(rec, !is_noise_spike);
+
+	pthread_mutex_unlock(&rec->callback_mode.mutex);
+
+	errno = saved_errno;
+	return cwret;
+}
+
+
+
+
+/**
+   @brief cw_rec_add_mark() and cw_rec_add_mark_ns() in callback mode
+*/
+static cw_ret_t cw_rec_callback_mode_add_mark_internal(cw_rec_t * rec, const cw_rec_timestamp_t * timestamp, char mark)
+{
+	int64_t timestamp_ns = 0;
+	if (CW_SUCCESS != cw_rec_timestamp_get_ns_internal(timestamp, &timestamp_ns)) {
+		return CW_FAILURE;
+	}
+	const cw_rec_timestamp_t ts = { .timeval = NULL, .is_ns = true, .ns = timestamp_ns };
+
+	pthread_mutex_lock(&rec->callback_mode.mutex);
+
+	/* Added Mark ends at @p timestamp, but there is no better
+	   approximation of beginning of the Mark. */
+	cw_rec_callback_mode_poll_internal(rec, timestamp_ns);
+	if (rec->callback_mode.is_pending_iws) {
+		rec->callback_mode.is_pending_iws = false;
+		cw_rec_reset_state(rec);
+	}
+
+	const cw_ret_t cwret = cw_rec_add_mark_internal(rec, &ts, mark);
+	const int saved_errno = errno;
+
+	cw_rec_callback_mode_arm_internal(rec, true);
+
+	pthread_mutex_unlock(&rec->callback_mode.mutex);
+
+	errno = saved_errno;
+	return cwret;
+}
+
+
+
+
+/**
+   @brief Arm the timer of callback mode after end of Mark
+
+   Function must be called with callback mode's mutex locked.
+
+   @param[in,out] rec receiver
+   @param[in] is_new_mark_end whether a new end of Mark has been registered by receiver
+*/
+static void cw_rec_callback_mode_arm_internal(cw_rec_t * rec, bool is_new_mark_end)
+{
+	if (is_new_mark_end) {
+		rec->callback_mode.mark_end_monotonic_ns = cw_rec_monotonic_ns_internal();
+	}
+	rec->callback_mode.is_armed = RS_IDLE != rec->state && RS_MARK != rec->state;
+	pthread_cond_signal(&rec->callback_mode.cond);
+}
+
+
+
+
+/**
+   @brief Pass a character to callback if Space has been long enough
+
+   Function must be called with callback mode's mutex locked.
+
+   @param[in,out] rec receiver
+   @param[in] timestamp_ns current time (in time base of timestamps passed to receiver)
+
+   @return true if state of receiver's callback mode has changed
+   @return false otherwise
+*/
+static bool cw_rec_callback_mode_poll_internal(cw_rec_t * rec, int64_t timestamp_ns)
+{
+	if (!rec->callback_mode.is_armed) {
+		return false;
+	}
+
+	char representation[CW_REC_REPRESENTATION_CAPACITY + 1] = { 0 };
+	bool is_end_of_word = false;
+	bool is_error = false;
+	if (CW_SUCCESS != cw_rec_poll_representation_ns(rec, timestamp_ns, representation, &is_end_of_word, &is_error)) {
+		/* Still in inter-mark-space. */
+		return false;
+	}
+
+	if (rec->callback_mode.is_pending_iws) {
+		if (!is_end_of_word) {
+			/* Still in inter-character-space. */
+			return false;
+		}
+		rec->callback_mode.callback(rec->callback_mode.callback_arg, ' ', "", true, false);
+	} else {
+		const int character = cw_data_trie_character_internal(rec->trie_node);
+		rec->callback_mode.callback(rec->callback_mode.callback_arg, (char) character, representation, is_end_of_word, is_error);
+		if (!is_end_of_word) {
+			/* Wait for end of inter-character-space. */
+			rec->callback_mode.is_pending_iws = true;
+			return true;
+		}
+	}
+
+	rec->callback_mode.is_pending_iws = false;
+	rec->callback_mode.is_armed = false;
+	cw_rec_reset_state(rec);
+
+	return true;
+}
+
+
+
+
+/**
+   @brief Thread function of receiver's callback mode
+
+   The thread sleeps until the timer is armed, and then until the end
+   of inter-character-space or inter-word-space.
+
+   @param[in] arg receiver
+
+   @return NULL
+*/
+static void * cw_rec_callback_mode_thread_fn(void * arg)
+{
+	cw_rec_t * rec = (cw_rec_t *) arg;
+
+	pthread_mutex_lock(&rec->callback_mode.mutex);
+	while (!rec->callback_mode.do_stop) {
+		if (!rec->callback_mode.is_armed) {
+			pthread_cond_wait(&rec->callback_mode.cond, &rec->callback_mode.mutex);
+			continue;
+		}
+
+		cw_rec_sync_parameters_internal(rec);
+		const int space_duration = rec->callback_mode.is_pending_iws
+			? cw_rec_add_durations_internal(rec->ics_duration_max, 1)
+			: rec->ics_duration_min;
+		const int64_t deadline_ns = rec->callback_mode.mark_end_monotonic_ns + (int64_t) space_duration * 1000;
+
+		const int64_t now_ns = cw_rec_monotonic_ns_internal();
+		if (now_ns < deadline_ns) {
+			const struct timespec deadline = { .tv_sec = deadline_ns / CW_NSECS_PER_SEC, .tv_nsec = deadline_ns % CW_NSECS_PER_SEC };
+			pthread_cond_timedwait(&rec->callback_mode.cond, &rec->callback_mode.mutex, &deadline);
+			/* Timer may have been re-armed or disarmed in the meantime. */
+			continue;
+		}
+
+		/* Translate current time to time base of timestamps passed to receiver. */
+		const int64_t timestamp_ns = rec->mark_end_ns + (now_ns - rec->callback_mode.mark_end_monotonic_ns);
+		if (!cw_rec_callback_mode_poll_internal(rec, timestamp_ns)) {
+			/* Don't spin if the Space can't be classified. */
+			rec->callback_mode.is_armed = false;
+		}
+	}
+	pthread_mutex_unlock(&rec->callback_mode.mutex);
+
+	return NULL;
+}
+
+
+
+
+/**
+   @brief Lock the mutex of callback mode if callback mode is active
+
+   Setters of receiver's parameters lock the mutex, so that the thread
+   of callback mode doesn't read the parameters while they are being
+   changed.
+
+   @param[in,out] rec receiver
+
+   @return true if the mutex has been locked
+   @return false otherwise
+*/
+static bool cw_rec_callback_mode_lock_internal(cw_rec_t * rec)
+{
+	if (NULL == __atomic_load_n(&rec->callback_mode.callback, __ATOMIC_ACQUIRE)) {
+		return false;
+	}
+	pthread_mutex_lock(&rec->callback_mode.mutex);
+	return true;
+}
+
+
+
+
+/**
+   @brief Unlock the mutex locked by cw_rec_callback_mode_lock_internal()
+
+   @param[in,out] rec receiver
+   @param[in] is_locked value returned by cw_rec_callback_mode_lock_internal()
+*/
+static void cw_rec_callback_mode_unlock_internal(cw_rec_t * rec, bool is_locked)
+{
+	if (is_locked) {
+		pthread_mutex_unlock(&rec->callback_mode.mutex);
+	}
+}
+
+
+
+
+/**
+   @brief Get current time of CLOCK_MONOTONIC clock
+
+   @return current time [nanoseconds]
+*/
+static int64_t cw_rec_monotonic_ns_internal(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t) now.tv_sec * CW_NSECS_PER_SEC + now.tv_nsec;
+}
+
+
+
+
+/**
+   @brief Advance receiver's walk of trie of representations by one Mark
+
+   Once the walk fails, representation received so far can't form a
+   valid character, and this is known without waiting for the end of
+   the character. The receiver still accepts Marks until the end of
+   the character, so that the character's boundary is kept, and the
+   character is reported with is_error flag set by poll functions and
+   to callbacks.
+
+   @param[in,out] rec receiver
+   @param[in] mark Mark added to representation
+*/
+static void cw_rec_trie_next_internal(cw_rec_t * rec, char mark)
+{
+	if (0 == rec->trie_node) {
+		/* The walk has already failed. */
+		return;
+	}
+
+	rec->trie_node = cw_data_trie_next_internal(rec->trie_node, mark);
+	if (0 == rec->trie_node) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_RECEIVE_STATES, CW_DEBUG_INFO,
+			      MSG_PREFIX "'%s': representation '%s' can't form a valid character", rec->label, rec->representation);
+	}
+}
+
+
+
+
 /**
    @internal
    @reviewed 2020-08-11
@@ -1888,8 +2962,9 @@ cw_ret_t cw_rec_poll_character(cw_rec_t * rec,
 */
 void cw_rec_reset_state(cw_rec_t * rec)
 {
-	memset(rec->representation, 0, sizeof (rec->representation));
+	rec->representation[0] = '\0';
 	rec->representation_ind = 0;
+	rec->trie_node = CW_DATA_TRIE_ROOT;
 
 #if REC_HAS_PENDING_INTER_WORD_SPACE_FLAG
 	rec->is_pending_inter_word_space = false;
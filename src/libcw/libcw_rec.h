@@ -9,8 +9,9 @@
 
 
 
+#include <pthread.h>
 #include <stdbool.h>
-#include <sys/time.h> /* struct timeval */
+#include <stdint.h> /* int64_t */
 
 
 
@@ -160,9 +161,11 @@ struct cw_rec_struct {
 
 
 
-	/* Retained timestamps of mark's begin and end. */
-	struct timeval mark_start;
-	struct timeval mark_end;
+	/* Retained timestamps of mark's begin and end [nanoseconds].
+	   Timestamps passed as struct timeval are converted to this
+	   form by cw_timestamp_to_ns_internal(). */
+	int64_t mark_start_ns;
+	int64_t mark_end_ns;
 
 	/* Buffer for received representation (dots/dashes). This is a
 	   fixed-length buffer, filled in as tone on/off timings are
@@ -174,6 +177,11 @@ struct cw_rec_struct {
 	char representation[CW_REC_REPRESENTATION_CAPACITY + 1];
 	int representation_ind;
 
+	/* Node of trie of representations reached with Marks received
+	   so far (see cw_data_trie_next_internal()). Zero if the Marks
+	   can't form a valid character. */
+	unsigned int trie_node;
+
 
 
 	/* Receiver's low-level timing parameters */
@@ -241,12 +249,46 @@ struct cw_rec_struct {
 	bool is_pending_inter_word_space;
 #endif
 
+	/* Callback mode, see cw_rec_register_callback(). Receive
+	   functions and setters of parameters check the callback
+	   (atomically) without locking the mutex: the callback is
+	   non-NULL only while the thread is running. While it is
+	   non-NULL, the setters change parameters under the mutex. */
+	struct {
+		cw_rec_decode_callback_t callback;
+		void * callback_arg;
+
+		pthread_t thread;
+		pthread_mutex_t mutex;
+		pthread_cond_t cond;
+		bool do_stop;
+
+		bool is_armed;                   /* Is the timer armed? */
+		int64_t mark_end_monotonic_ns;   /* CLOCK_MONOTONIC time at which last Mark has ended. [ns] */
+		bool is_pending_iws;             /* Character has been passed to callback, inter-word-space may follow. */
+	} callback_mode;
+
 	char label[LIBCW_OBJECT_INSTANCE_LABEL_SIZE];
 };
 
 
 
 
+/* State of decoding of a stream of Marks and Spaces that is passed
+   to receiver in many parts. Consecutive events of the same kind may
+   be split between parts, so the last run of events of a part is kept
+   until it is known that the run has ended. */
+typedef struct {
+	bool has_run;          /* Is there a run of events that may be continued by next part? */
+	bool run_is_mark;      /* Kind of events in the run. */
+	int run_duration;      /* Duration of the run. [microseconds] */
+	int space_duration;    /* Duration of Space since end of last Mark added to representation. [microseconds] */
+	bool is_pending_iws;   /* Character has been passed to callback before end of Space, inter-word-space may follow. */
+} cw_rec_decode_stream_t;
+
+
+
+
 /* Other helper functions. */
 void cw_rec_reset_parameters_internal(cw_rec_t * rec);
 void cw_rec_sync_parameters_internal(cw_rec_t * rec);
@@ -271,6 +313,11 @@ int cw_rec_get_receive_buffer_capacity_internal(void);
 
 void cw_rec_set_state_internal(cw_rec_t * rec, cw_rec_state_t new_state);
 
+void cw_rec_decode_stream_init_internal(cw_rec_t * rec, cw_rec_decode_stream_t * stream);
+void cw_rec_decode_stream_push_internal(cw_rec_t * rec, cw_rec_decode_stream_t * stream, const cw_rec_event_t * events, size_t n_events, cw_rec_decode_callback_t callback, void * callback_arg);
+void cw_rec_decode_stream_flush_internal(cw_rec_t * rec, cw_rec_decode_stream_t * stream, cw_rec_decode_callback_t callback, void * callback_arg);
+void cw_rec_decode_stream_end_internal(cw_rec_t * rec, cw_rec_decode_stream_t * stream, cw_rec_decode_callback_t callback, void * callback_arg);
+
 
 
 
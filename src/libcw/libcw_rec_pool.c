@@ -0,0 +1,553 @@
+/*
+  Copyright (C) 2011-2023  Kamil Ignacak (acerion@wp.pl)
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU General Public License
+  as published by the Free Software Foundation; either version 2
+  of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along
+  with this program; if not, write to the Free Software Foundation, Inc.,
+  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+
+/**
+   @file libcw_rec_pool.c
+
+   @brief Pool of receivers decoding many independent streams of Marks
+   and Spaces.
+
+   Each channel of the pool has its own receiver. Events (Marks and
+   Spaces, see cw_rec_event_t) of a channel are queued to one of
+   worker threads of the pool, and are decoded by the worker with the
+   same code that is used by cw_rec_decode_events(). Channels are
+   assigned to workers with a simple hash (channel % n_workers), so
+   events of one channel are always decoded in order, and channels
+   are spread evenly between workers.
+
+   Duration of Marks and Spaces is in microseconds [us].
+*/
+
+
+
+
+#include "config.h"
+
+
+
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h> /* sysconf() */
+
+
+
+
+#include "libcw2.h"
+#include "libcw_debug.h"
+#include "libcw_rec.h"
+#include "libcw_rec_pool.h"
+
+
+
+
+#define MSG_PREFIX "libcw/rec pool: "
+
+
+
+
+extern cw_debug_t cw_debug_object;
+
+
+
+
+static void cw_rec_pool_stop_workers_internal(cw_rec_pool_t * pool);
+static cw_ret_t cw_rec_pool_enqueue_internal(cw_rec_pool_t * pool, cw_rec_pool_job_t * job);
+static void * cw_rec_pool_worker_fn(void * arg);
+static void cw_rec_pool_process_job_internal(cw_rec_pool_worker_t * worker, const cw_rec_pool_job_t * job);
+static void cw_rec_pool_decode_callback_internal(void * arg, char character, const char * representation, bool is_end_of_word, bool is_error);
+
+
+
+
+/**
+   @brief Create new pool of receivers
+
+   Function creates @p n_channels receivers (with cw_rec_new()) and
+   @p n_workers threads decoding events of the channels.
+
+   @p callback is called by worker threads for every character
+   received in any channel. Characters of one channel are passed to
+   the callback in order, always from the same thread, but characters
+   of different channels may be passed to the callback at the same
+   time from different threads. The callback must not call functions
+   of the pool.
+
+   @exception EINVAL @p n_channels is zero or @p callback is NULL
+   @exception ENOMEM memory can't be allocated
+   @exception EAGAIN worker thread can't be created
+
+   @param[in] n_channels count of channels
+   @param[in] n_workers count of worker threads; zero means count of online processors
+   @param[in] callback callback receiving characters
+   @param[in] callback_arg argument passed to @p callback
+
+   @return pointer to new pool on success
+   @return NULL on failure
+*/
+cw_rec_pool_t * cw_rec_pool_new(size_t n_channels, size_t n_workers, cw_rec_pool_callback_t callback, void * callback_arg)
+{
+	if (0 == n_channels || NULL == callback) {
+		errno = EINVAL;
+		return (cw_rec_pool_t *) NULL;
+	}
+
+	if (0 == n_workers) {
+		const long n_processors = sysconf(_SC_NPROCESSORS_ONLN);
+		n_workers = n_processors > 0 ? (size_t) n_processors : 1;
+	}
+	if (n_workers > n_channels) {
+		/* Extra workers would have no channels. */
+		n_workers = n_channels;
+	}
+
+	cw_rec_pool_t * pool = (cw_rec_pool_t *) calloc(1, sizeof (cw_rec_pool_t));
+	if (NULL == pool) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
+			      MSG_PREFIX "calloc()");
+		errno = ENOMEM;
+		return (cw_rec_pool_t *) NULL;
+	}
+	pool->callback = callback;
+	pool->callback_arg = callback_arg;
+
+	pool->channels = (cw_rec_pool_channel_t *) calloc(n_channels, sizeof (cw_rec_pool_channel_t));
+	pool->workers = (cw_rec_pool_worker_t *) calloc(n_workers, sizeof (cw_rec_pool_worker_t));
+	if (NULL == pool->channels || NULL == pool->workers) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
+			      MSG_PREFIX "calloc()");
+		cw_rec_pool_delete(&pool);
+		errno = ENOMEM;
+		return (cw_rec_pool_t *) NULL;
+	}
+
+	for (size_t i = 0; i < n_channels; i++) {
+		cw_rec_pool_channel_t * channel = &pool->channels[i];
+		channel->pool = pool;
+		channel->index = i;
+		channel->rec = cw_rec_new();
+		if (NULL == channel->rec) {
+			cw_rec_pool_delete(&pool);
+			errno = ENOMEM;
+			return (cw_rec_pool_t *) NULL;
+		}
+		pool->n_channels++;
+		cw_rec_decode_stream_init_internal(channel->rec, &channel->stream);
+	}
+
+	for (size_t i = 0; i < n_workers; i++) {
+		cw_rec_pool_worker_t * worker = &pool->workers[i];
+		pthread_mutex_init(&worker->mutex, NULL);
+		pthread_cond_init(&worker->job_cond, NULL);
+		pthread_cond_init(&worker->idle_cond, NULL);
+		worker->channels = pool->channels;
+		pool->n_workers++;
+
+		const int rv = pthread_create(&worker->thread, NULL, cw_rec_pool_worker_fn, worker);
+		if (0 != rv) {
+			cw_debug_msg (&cw_debug_object, CW_DEBUG_RECEIVE_STATES, CW_DEBUG_ERROR,
+				      MSG_PREFIX "failed to create worker thread #%zu: %d", i, rv);
+			cw_rec_pool_delete(&pool);
+			errno = EAGAIN;
+			return (cw_rec_pool_t *) NULL;
+		}
+		worker->is_thread_created = true;
+	}
+
+	return pool;
+}
+
+
+
+
+/**
+   @brief Delete a pool of receivers
+
+   Worker threads are stopped, events that haven't been decoded yet
+   are discarded, and all receivers of the pool are deleted. Call
+   cw_rec_pool_wait() before this function to decode all events.
+
+   @param[in,out] pool pointer to pool
+*/
+void cw_rec_pool_delete(cw_rec_pool_t ** pool)
+{
+	if (NULL == pool) {
+		return;
+	}
+	if (NULL == *pool) {
+		return;
+	}
+
+	cw_rec_pool_stop_workers_internal(*pool);
+
+	for (size_t i = 0; i < (*pool)->n_workers; i++) {
+		cw_rec_pool_worker_t * worker = &(*pool)->workers[i];
+		cw_rec_pool_job_t * job = worker->head;
+		while (job) {
+			cw_rec_pool_job_t * next = job->next;
+			free(job);
+			job = next;
+		}
+		pthread_cond_destroy(&worker->idle_cond);
+		pthread_cond_destroy(&worker->job_cond);
+		pthread_mutex_destroy(&worker->mutex);
+	}
+	free((*pool)->workers);
+
+	for (size_t i = 0; i < (*pool)->n_channels; i++) {
+		cw_rec_delete(&(*pool)->channels[i].rec);
+	}
+	free((*pool)->channels);
+
+	free(*pool);
+	*pool = (cw_rec_pool_t *) NULL;
+
+	return;
+}
+
+
+
+
+/**
+   @brief Get receiver of given channel
+
+   Use the receiver to configure decoding of the channel (speed,
+   tolerance, adaptive mode, etc.). Configure the receiver before
+   passing events of the channel to the pool, or after
+   cw_rec_pool_wait(): the receiver is used by a worker thread while
+   the events are decoded.
+
+   Don't delete the receiver, it is owned by @p pool.
+
+   @exception EINVAL @p pool is NULL or @p channel is out of range
+
+   @param[in] pool pool of receivers
+   @param[in] channel channel of the pool
+
+   @return receiver of given channel on success
+   @return NULL on failure
+*/
+cw_rec_t * cw_rec_pool_get_receiver(cw_rec_pool_t * pool, size_t channel)
+{
+	if (NULL == pool || channel >= pool->n_channels) {
+		errno = EINVAL;
+		return (cw_rec_t *) NULL;
+	}
+	return pool->channels[channel].rec;
+}
+
+
+
+
+/**
+   @brief Pass events of given channel to the pool
+
+   Events are copied and queued to the worker handling @p channel. The
+   function doesn't wait for the events to be decoded. Queue of the
+   worker is bounded: when it is full, the function fails with EAGAIN
+   and the events are not queued, so the caller should pass them again
+   later (e.g. after cw_rec_pool_wait()).
+
+   Events of a channel can be passed in many calls, and split in any
+   place: consecutive events of the same kind are merged into one
+   Mark or one Space also across calls. A character is passed to
+   callback of the pool as soon as the Space after it, passed to the
+   pool so far, is long enough to be inter-character-space. If the
+   Space then turns out to be inter-word-space, a ' ' character with
+   empty representation and is_end_of_word set is passed to the
+   callback, like in cw_rec_register_callback().
+
+   @exception EINVAL @p pool is NULL, @p channel is out of range, @p events is NULL and @p n_events is not zero, or one of events has negative duration
+   @exception ENOMEM memory can't be allocated
+   @exception EAGAIN queue of worker handling @p channel is full
+
+   @param[in] pool pool of receivers
+   @param[in] channel channel of the pool
+   @param[in] events Marks and Spaces of the channel
+   @param[in] n_events count of items in @p events
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+cw_ret_t cw_rec_pool_push_events(cw_rec_pool_t * pool, size_t channel, const cw_rec_event_t * events, size_t n_events)
+{
+	if (NULL == pool || channel >= pool->n_channels || (NULL == events && 0 != n_events)) {
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+	for (size_t i = 0; i < n_events; i++) {
+		if (events[i].duration < 0) {
+			errno = EINVAL;
+			return CW_FAILURE;
+		}
+	}
+	if (0 == n_events) {
+		return CW_SUCCESS;
+	}
+
+	cw_rec_pool_job_t * job = (cw_rec_pool_job_t *) malloc(sizeof (cw_rec_pool_job_t) + n_events * sizeof (cw_rec_event_t));
+	if (NULL == job) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
+			      MSG_PREFIX "malloc()");
+		errno = ENOMEM;
+		return CW_FAILURE;
+	}
+	job->next = NULL;
+	job->channel = channel;
+	job->is_end_of_stream = false;
+	job->n_events = n_events;
+	memcpy(job->events, events, n_events * sizeof (cw_rec_event_t));
+
+	return cw_rec_pool_enqueue_internal(pool, job);
+}
+
+
+
+
+/**
+   @brief Inform the pool about end of stream of given channel
+
+   The last Space of the channel is treated as inter-word-space, so
+   the last character of the channel (or ' ' character ending the
+   word, if the character has been already passed) is passed to
+   callback of the pool. Receiver of the channel is reset, and next events of the
+   channel begin a new stream.
+
+   @exception EINVAL @p pool is NULL or @p channel is out of range
+   @exception ENOMEM memory can't be allocated
+   @exception EAGAIN queue of worker handling @p channel is full
+
+   @param[in] pool pool of receivers
+   @param[in] channel channel of the pool
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+cw_ret_t cw_rec_pool_end_stream(cw_rec_pool_t * pool, size_t channel)
+{
+	if (NULL == pool || channel >= pool->n_channels) {
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+
+	cw_rec_pool_job_t * job = (cw_rec_pool_job_t *) malloc(sizeof (cw_rec_pool_job_t));
+	if (NULL == job) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
+			      MSG_PREFIX "malloc()");
+		errno = ENOMEM;
+		return CW_FAILURE;
+	}
+	job->next = NULL;
+	job->channel = channel;
+	job->is_end_of_stream = true;
+	job->n_events = 0;
+
+	return cw_rec_pool_enqueue_internal(pool, job);
+}
+
+
+
+
+/**
+   @brief Wait until all events passed to the pool are decoded
+
+   @exception EINVAL @p pool is NULL
+
+   @param[in] pool pool of receivers
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+cw_ret_t cw_rec_pool_wait(cw_rec_pool_t * pool)
+{
+	if (NULL == pool) {
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+
+	for (size_t i = 0; i < pool->n_workers; i++) {
+		cw_rec_pool_worker_t * worker = &pool->workers[i];
+		pthread_mutex_lock(&worker->mutex);
+		while (worker->head || worker->is_busy) {
+			pthread_cond_wait(&worker->idle_cond, &worker->mutex);
+		}
+		pthread_mutex_unlock(&worker->mutex);
+	}
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   @brief Queue a job to the worker handling job's channel
+
+   @exception EAGAIN queue of the worker is full
+
+   @param[in] pool pool of receivers
+   @param[in] job job to queue; the worker takes ownership of the job, also on failure
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+static cw_ret_t cw_rec_pool_enqueue_internal(cw_rec_pool_t * pool, cw_rec_pool_job_t * job)
+{
+	cw_rec_pool_worker_t * worker = &pool->workers[job->channel % pool->n_workers];
+
+	pthread_mutex_lock(&worker->mutex);
+	if (worker->n_jobs >= CW_REC_POOL_WORKER_QUEUE_CAPACITY) {
+		pthread_mutex_unlock(&worker->mutex);
+		free(job);
+		errno = EAGAIN;
+		return CW_FAILURE;
+	}
+	worker->n_jobs++;
+	if (worker->tail) {
+		worker->tail->next = job;
+	} else {
+		worker->head = job;
+	}
+	worker->tail = job;
+	pthread_cond_signal(&worker->job_cond);
+	pthread_mutex_unlock(&worker->mutex);
+
+	return CW_SUCCESS;
+}
+
+
+
+
+/**
+   @brief Stop and join worker threads of the pool
+
+   @param[in] pool pool of receivers
+*/
+static void cw_rec_pool_stop_workers_internal(cw_rec_pool_t * pool)
+{
+	for (size_t i = 0; i < pool->n_workers; i++) {
+		cw_rec_pool_worker_t * worker = &pool->workers[i];
+		pthread_mutex_lock(&worker->mutex);
+		worker->do_stop = true;
+		pthread_cond_signal(&worker->job_cond);
+		pthread_mutex_unlock(&worker->mutex);
+	}
+	for (size_t i = 0; i < pool->n_workers; i++) {
+		cw_rec_pool_worker_t * worker = &pool->workers[i];
+		if (worker->is_thread_created) {
+			pthread_join(worker->thread, NULL);
+			worker->is_thread_created = false;
+		}
+	}
+}
+
+
+
+
+/**
+   @brief Thread function of worker of the pool
+
+   The worker takes all queued jobs at once, so that producers and
+   the worker contend for worker's mutex once per batch of jobs, not
+   once per job.
+
+   @param[in] arg worker
+
+   @return NULL
+*/
+static void * cw_rec_pool_worker_fn(void * arg)
+{
+	cw_rec_pool_worker_t * worker = (cw_rec_pool_worker_t *) arg;
+
+	pthread_mutex_lock(&worker->mutex);
+	while (!worker->do_stop) {
+		if (NULL == worker->head) {
+			worker->is_busy = false;
+			pthread_cond_broadcast(&worker->idle_cond);
+			pthread_cond_wait(&worker->job_cond, &worker->mutex);
+			continue;
+		}
+
+		cw_rec_pool_job_t * job = worker->head;
+		worker->head = NULL;
+		worker->tail = NULL;
+		worker->n_jobs = 0;
+		worker->is_busy = true;
+		pthread_mutex_unlock(&worker->mutex);
+
+		while (job) {
+			cw_rec_pool_job_t * next = job->next;
+			cw_rec_pool_process_job_internal(worker, job);
+			free(job);
+			job = next;
+		}
+
+		pthread_mutex_lock(&worker->mutex);
+	}
+	worker->is_busy = false;
+	pthread_cond_broadcast(&worker->idle_cond);
+	pthread_mutex_unlock(&worker->mutex);
+
+	return NULL;
+}
+
+
+
+
+/**
+   @brief Decode events of a job
+
+   @param[in] worker worker processing the job
+   @param[in] job job to process
+*/
+static void cw_rec_pool_process_job_internal(cw_rec_pool_worker_t * worker, const cw_rec_pool_job_t * job)
+{
+	cw_rec_pool_channel_t * channel = &worker->channels[job->channel];
+
+	if (job->is_end_of_stream) {
+		cw_rec_decode_stream_end_internal(channel->rec, &channel->stream, cw_rec_pool_decode_callback_internal, channel);
+	} else {
+		cw_rec_decode_stream_push_internal(channel->rec, &channel->stream, job->events, job->n_events, cw_rec_pool_decode_callback_internal, channel);
+		cw_rec_decode_stream_flush_internal(channel->rec, &channel->stream, cw_rec_pool_decode_callback_internal, channel);
+	}
+}
+
+
+
+
+/**
+   @brief Pass character decoded in a channel to callback of the pool
+
+   @param[in] arg channel of the pool
+   @param[in] character received character
+   @param[in] representation representation of the character
+   @param[in] is_end_of_word the character is followed by inter-word-space
+   @param[in] is_error receiver was in error state when receiving the character
+*/
+static void cw_rec_pool_decode_callback_internal(void * arg, char character, const char * representation, bool is_end_of_word, bool is_error)
+{
+	const cw_rec_pool_channel_t * channel = (const cw_rec_pool_channel_t *) arg;
+	const cw_rec_pool_t * pool = channel->pool;
+	pool->callback(pool->callback_arg, channel->index, character, representation, is_end_of_word, is_error);
+}
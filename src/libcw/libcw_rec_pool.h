@@ -0,0 +1,96 @@
+/*
+  This file is a part of unixcw project.
+  unixcw project is covered by GNU General Public License, version 2 or later.
+*/
+
+#ifndef H_LIBCW_REC_POOL
+#define H_LIBCW_REC_POOL
+
+
+
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+
+
+
+#include "libcw2.h"
+#include "libcw_rec.h"
+
+
+
+
+/* Maximal count of jobs waiting in queue of one worker. Producers
+   that push events faster than the worker decodes them get EAGAIN
+   instead of growing the queue without limit. */
+#define CW_REC_POOL_WORKER_QUEUE_CAPACITY 4096
+
+
+
+
+/* Events of one channel, waiting in worker's queue. */
+typedef struct cw_rec_pool_job_struct {
+	struct cw_rec_pool_job_struct * next;
+
+	size_t channel;
+	bool is_end_of_stream;   /* End of stream of the channel, there are no events in this job. */
+
+	size_t n_events;
+	cw_rec_event_t events[]; /* Copy of events passed to cw_rec_pool_push_events(). */
+} cw_rec_pool_job_t;
+
+
+
+
+/* Receiver of one channel and state of decoding of its stream. */
+typedef struct {
+	cw_rec_pool_t * pool;
+	size_t index;
+
+	cw_rec_t * rec;
+	cw_rec_decode_stream_t stream;
+} cw_rec_pool_channel_t;
+
+
+
+
+/* Worker thread with its own queue of jobs. Channel N is always
+   handled by worker N % n_workers, so events of a channel are decoded
+   in order, by one thread at a time. */
+typedef struct {
+	pthread_t thread;
+	bool is_thread_created;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t job_cond;   /* Signalled when a job is added, or when the worker should stop. */
+	pthread_cond_t idle_cond;  /* Signalled when the worker has processed all its jobs. */
+
+	cw_rec_pool_job_t * head;
+	cw_rec_pool_job_t * tail;
+	size_t n_jobs;             /* Count of jobs in the queue. */
+	bool is_busy;              /* Is the worker processing jobs taken from the queue? */
+	bool do_stop;
+
+	cw_rec_pool_channel_t * channels; /* All channels of pool, the worker uses only its own. */
+} cw_rec_pool_worker_t;
+
+
+
+
+struct cw_rec_pool_struct {
+	cw_rec_pool_channel_t * channels;
+	size_t n_channels;
+
+	cw_rec_pool_worker_t * workers;
+	size_t n_workers;
+
+	cw_rec_pool_callback_t callback;
+	void * callback_arg;
+};
+
+
+
+
+#endif /* #ifndef H_LIBCW_REC_POOL */
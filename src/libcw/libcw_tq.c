@@ -32,8 +32,10 @@
    queue.
 
 
-   The tone queue (the circular list) is implemented using constant
-   size table.
+   The tone queue (the circular list) is implemented using a table
+   allocated at capacity of the queue. Tones are stored in the table in
+   compact form (cw_tq_tone_t), and are converted into cw_tone_t when
+   they are dequeued.
 
 
    Explanation of "forever" tone:
@@ -62,15 +64,71 @@
    Tone queue data type is not visible to user of library's API. Tone
    queue is an integral part of a generator. Generator data type is
    visible to user of library's API.
+
+
+   Concurrency:
+
+   Tone queue is a single-producer/single-consumer ring. Producer is
+   code that enqueues tones, consumer is generator that dequeues tones.
+   Each side owns its index and its counter of tones: producer writes a
+   tone at tail and then increments tq->n_enqueued, consumer reads a tone
+   at head and then increments tq->n_dequeued. Length of queue is a
+   difference of the two counters. Neither side writes to the other
+   side's fields, so the ring doesn't need read-modify-write operations,
+   and a generator is never blocked by a client code that is enqueueing
+   tones.
+
+   Producers are serialized by tq->producer_mutex, which is uncontended
+   when there is just one producer. Operations that modify the whole queue
+   (flush, removal of last character) take the producer mutex and wait
+   for consumer to leave dequeue function.
+
+   tq->n_dequeued only grows: flush counts removed tones as dequeued.
+   tq->n_enqueued grows too, with one exception: removal of last
+   character takes its tones back by lowering tq->n_enqueued, but never
+   below tq->n_dequeued. At any moment n_dequeued <= n_enqueued, so length
+   of queue calculated from n_dequeued read first and n_enqueued read
+   later is never negative. A value of tq->n_enqueued remembered earlier
+   may however be seen again after a removal followed by an enqueue, so
+   the counter alone can't tell that contents of queue have changed.
+   Every removal increments tq->n_removals for this reason.
+
+   There may be many producers (e.g. a keyer thread, a macro playback
+   thread and an UI thread using the same generator). To keep their
+   characters from interleaving, code enqueueing characters puts tones
+   into producer's own staging buffer (cw_tq_staging_t), and commits
+   whole characters with cw_tq_enqueue_many_internal(). The producer
+   mutex is then taken once per a few characters, not once per tone.
+
+   Wait channels (tq->wait_channels) are used only for sleeping. There is
+   a separate channel for each kind of event (new tone is available,
+   level of queue has dropped, tone has ended, iambic keyer's graph has
+   changed), so that an event wakes up only threads interested in it.
+   Waiting functions register themselves in a channel, and queue
+   operations broadcast a notification on a channel only when there is
+   a registered waiter.
+
+   Client code that doesn't want to block a thread in a wait can watch
+   a file descriptor of tone queue (eventfd on Linux, a pipe elsewhere)
+   with poll() or epoll. The descriptor is written to only when a watched
+   event happens while no other event is pending, so a burst of events
+   costs a single write().
 */
 
 
 
 
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h> /* "PRIu32" */
 #include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
 
 
 
@@ -82,6 +140,7 @@
 #include "libcw_signal.h"
 #include "libcw_tq.h"
 #include "libcw_tq_internal.h"
+#include "libcw_utils.h"
 
 
 
@@ -140,6 +199,16 @@ extern cw_debug_t cw_debug_object_dev;
 
 
 
+static void cw_tq_exclusive_begin_internal(cw_tone_queue_t * tq);
+static void cw_tq_exclusive_end_internal(cw_tone_queue_t * tq);
+static cw_queue_state_t cw_tq_dequeue_state_internal(cw_tone_queue_t * tq, cw_tone_t * tone, bool * call_callback);
+static void cw_tq_wake_waiters_internal(cw_tone_queue_t * tq, cw_tq_wait_channel_id_t channel);
+static uint64_t cw_tq_monotonic_ns_internal(void);
+static void cw_tq_stats_empty_end_internal(cw_tone_queue_t * tq);
+
+
+
+
 /* Not used anymore. 2015.02.22. */
 #if 0
 /* Remember that tail and head are of unsigned type.  Make sure that
@@ -180,13 +249,33 @@ cw_tone_queue_t * cw_tq_new_internal(void)
 		return (cw_tone_queue_t *) NULL;
 	}
 
-	pthread_mutex_init(&tq->wait_mutex, NULL);
-	pthread_mutex_lock(&tq->wait_mutex);
-	pthread_cond_init(&tq->wait_var, NULL);
+	/* Deadlines of timed waits are given in monotonic clock, so that
+	   they aren't affected by changes of system time. */
+	pthread_condattr_t cond_attr;
+	pthread_condattr_init(&cond_attr);
+	pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+	for (int i = 0; i < CW_TQ_WAIT_CHANNELS_COUNT; i++) {
+		pthread_mutex_init(&tq->wait_channels[i].mutex, NULL);
+		pthread_cond_init(&tq->wait_channels[i].cond, &cond_attr);
+		tq->wait_channels[i].n_waiters = 0;
+	}
+	pthread_condattr_destroy(&cond_attr);
+	pthread_mutex_init(&tq->producer_mutex, NULL);
+	pthread_mutex_init(&tq->event_fd_mutex, NULL);
+	tq->event_fd = -1;
+	tq->event_fd_write = -1;
+	tq->event_mask = 0;
+	tq->event_level = 0;
+	tq->events_pending = 0;
+	tq->exclusive = false;
+	tq->consumer_active = false;
 
 	tq->head = 0;
 	tq->tail = 0;
-	tq->len = 0;
+	tq->n_enqueued = 0;
+	tq->n_dequeued = 0;
+	tq->n_flushes = 0;
+	tq->n_removals = 0;
 	tq->state = CW_TQ_EMPTY;
 
 	tq->low_water_mark = 0;
@@ -195,10 +284,14 @@ cw_tone_queue_t * cw_tq_new_internal(void)
 
 	tq->gen = (cw_gen_t *) NULL; /* This field will be set by generator code. */
 
-	cw_ret_t cwret = cw_tq_set_capacity_internal(tq, CW_TONE_QUEUE_CAPACITY_MAX, CW_TONE_QUEUE_HIGH_WATER_MARK_MAX);
-	cw_assert (CW_SUCCESS == cwret, MSG_PREFIX "new: failed to set initial capacity of tq");
-
-	pthread_mutex_unlock(&tq->wait_mutex);
+	tq->queue = (cw_tq_tone_t *) NULL; /* Allocated when capacity is set. */
+	tq->capacity = 0;
+	if (CW_SUCCESS != cw_tq_set_capacity_internal(tq, CW_TONE_QUEUE_CAPACITY_MAX, CW_TONE_QUEUE_HIGH_WATER_MARK_MAX)) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_TONE_QUEUE, CW_DEBUG_ERROR,
+			      MSG_PREFIX "new: failed to set initial capacity of tq");
+		cw_tq_delete_internal(&tq);
+		return (cw_tone_queue_t *) NULL;
+	}
 
 	return tq;
 }
@@ -246,9 +339,21 @@ void cw_tq_delete_internal(cw_tone_queue_t ** tq)
 	   by function called _destroy().
 
 	   So don't call pthread_cond_destroy(). */
-	//pthread_cond_destroy(&(*tq)->wait_var);
-	pthread_mutex_destroy(&(*tq)->wait_mutex);
+	for (int i = 0; i < CW_TQ_WAIT_CHANNELS_COUNT; i++) {
+		//pthread_cond_destroy(&(*tq)->wait_channels[i].cond);
+		pthread_mutex_destroy(&(*tq)->wait_channels[i].mutex);
+	}
+	pthread_mutex_destroy(&(*tq)->producer_mutex);
+
+	if (-1 != (*tq)->event_fd) {
+		if ((*tq)->event_fd_write != (*tq)->event_fd) {
+			close((*tq)->event_fd_write);
+		}
+		close((*tq)->event_fd);
+	}
+	pthread_mutex_destroy(&(*tq)->event_fd_mutex);
 
+	free((*tq)->queue);
 	free(*tq);
 	*tq = (cw_tone_queue_t *) NULL;
 
@@ -269,22 +374,30 @@ void cw_tq_delete_internal(cw_tone_queue_t ** tq)
 */
 void cw_tq_make_empty_internal(cw_tone_queue_t * tq)
 {
-	pthread_mutex_lock(&tq->wait_mutex);
+	cw_tq_exclusive_begin_internal(tq);
 	bool broadcast = false;
-	if (tq->len > 0 || tq->state != CW_TQ_EMPTY) {
+	if (tq->n_enqueued != tq->n_dequeued || tq->state != CW_TQ_EMPTY) {
 		broadcast = true;
 	}
+	const size_t len_before = tq->n_enqueued - tq->n_dequeued;
 
 	tq->head = 0;
 	tq->tail = 0;
-	tq->len = 0;
-	tq->state = CW_TQ_EMPTY;
+	/* Consumer's counter only grows, so that length of queue
+	   calculated from counters read at different moments is never
+	   negative. Removed tones are counted as dequeued. */
+	__atomic_store_n(&tq->n_dequeued, tq->n_enqueued, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&tq->state, CW_TQ_EMPTY, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&tq->n_flushes, tq->n_flushes + 1, __ATOMIC_SEQ_CST);
+	cw_tq_exclusive_end_internal(tq);
 
 	if (broadcast) {
 		//fprintf(stderr, "[II] " MSG_PREFIX "%s:%d broadcast on 'make empty'\n", __func__, __LINE__);
-		pthread_cond_broadcast(&tq->wait_var);
+		cw_tq_notify_waiters_internal(tq, CW_TQ_WAIT_LEVEL);
+		cw_tq_notify_waiters_internal(tq, CW_TQ_WAIT_TONE_END);
+		cw_tq_post_event_internal(tq, CW_GEN_EVENT_QUEUE_EMPTY
+					  | (len_before > tq->event_level ? CW_GEN_EVENT_LEVEL : 0));
 	}
-	pthread_mutex_unlock(&tq->wait_mutex);
 
 	return;
 }
@@ -292,6 +405,48 @@ void cw_tq_make_empty_internal(cw_tone_queue_t * tq)
 
 
 
+/**
+   @brief Get exclusive access to tone queue
+
+   Lock out producers, and wait for consumer to leave dequeue function.
+   Until cw_tq_exclusive_end_internal() is called, consumer dequeues
+   tones only under producer mutex.
+
+   @param[in] tq tone queue
+*/
+static void cw_tq_exclusive_begin_internal(cw_tone_queue_t * tq)
+{
+	pthread_mutex_lock(&tq->producer_mutex);
+
+	/* Pairs with setting of ->consumer_active in
+	   cw_tq_dequeue_internal(). Both sides first set their flag, then
+	   check the other side's flag, so at most one of them proceeds
+	   without the mutex. */
+	__atomic_store_n(&tq->exclusive, true, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&tq->consumer_active, __ATOMIC_SEQ_CST)) {
+		/* Consumer is in the middle of dequeueing a single tone.
+		   This won't take long. */
+		sched_yield();
+	}
+}
+
+
+
+
+/**
+   @brief Release exclusive access to tone queue
+
+   @param[in] tq tone queue
+*/
+static void cw_tq_exclusive_end_internal(cw_tone_queue_t * tq)
+{
+	__atomic_store_n(&tq->exclusive, false, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&tq->producer_mutex);
+}
+
+
+
+
 /**
    @brief Set capacity and high water mark for queue
 
@@ -312,7 +467,13 @@ void cw_tq_make_empty_internal(cw_tone_queue_t * tq)
 
    @p high_water_mark must be no larger than @p capacity.
 
+   Storage of tones is allocated at @p capacity. When the capacity is
+   changed, the storage is reallocated and tones in the queue are
+   discarded, so the function should be called for empty queue (e.g.
+   right after the queue is created).
+
    @exception EINVAL any of the two parameters (@p capacity or @p high_water_mark) is invalid.
+   @exception ENOMEM storage for tones can't be allocated
 
    @internal
    @reviewed 2020-07-28
@@ -354,7 +515,25 @@ cw_ret_t cw_tq_set_capacity_internal(cw_tone_queue_t * tq, size_t capacity, size
 		return CW_FAILURE;
 	}
 
-	tq->capacity = capacity;
+	if (capacity != tq->capacity) {
+		cw_tq_tone_t * queue = (cw_tq_tone_t *) calloc(capacity, sizeof (cw_tq_tone_t));
+		if (NULL == queue) {
+			cw_debug_msg (&cw_debug_object, CW_DEBUG_STDLIB, CW_DEBUG_ERROR,
+				      MSG_PREFIX "set capacity: failed to calloc() storage of tones");
+			errno = ENOMEM;
+			return CW_FAILURE;
+		}
+
+		cw_tq_exclusive_begin_internal(tq);
+		free(tq->queue);
+		tq->queue = queue;
+		tq->capacity = capacity;
+		tq->head = 0;
+		tq->tail = 0;
+		__atomic_store_n(&tq->n_dequeued, tq->n_enqueued, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&tq->state, CW_TQ_EMPTY, __ATOMIC_SEQ_CST);
+		cw_tq_exclusive_end_internal(tq);
+	}
 	tq->high_water_mark = high_water_mark;
 
 	return CW_SUCCESS;
@@ -421,11 +600,36 @@ size_t cw_tq_get_high_water_mark_internal(const cw_tone_queue_t * tq)
 */
 size_t cw_tq_length_internal(cw_tone_queue_t * tq)
 {
-	pthread_mutex_lock(&tq->wait_mutex);
-	const size_t len = tq->len;
-	pthread_mutex_unlock(&tq->wait_mutex);
+	/* Read consumer's counter first. Consumer may dequeue more tones
+	   in the meantime, but never more than producer has enqueued.
+	   Removal of last character may lower producer's counter, but
+	   not below consumer's counter. */
+	const size_t n_dequeued = __atomic_load_n(&tq->n_dequeued, __ATOMIC_ACQUIRE);
+	return __atomic_load_n(&tq->n_enqueued, __ATOMIC_ACQUIRE) - n_dequeued;
+}
+
+
+
+
+/**
+   @brief Get current state of tone queue
+
+   Queue that has any tones is in CW_TQ_NONEMPTY state. State of queue
+   without tones depends on whether a last tone has been dequeued in the
+   most recent call to dequeue function (CW_TQ_JUST_EMPTIED) or not
+   (CW_TQ_EMPTY).
+
+   @param[in] tq tone queue
 
-	return len;
+   @return current state of tone queue
+*/
+cw_queue_state_t cw_tq_get_state_internal(const cw_tone_queue_t * tq)
+{
+	const size_t n_dequeued = __atomic_load_n(&tq->n_dequeued, __ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&tq->n_enqueued, __ATOMIC_ACQUIRE) != n_dequeued) {
+		return CW_TQ_NONEMPTY;
+	}
+	return __atomic_load_n(&tq->state, __ATOMIC_ACQUIRE);
 }
 
 
@@ -481,6 +685,47 @@ size_t cw_tq_next_index_internal(const cw_tone_queue_t * tq, size_t ind)
 
 
 
+/**
+   @brief Store tone in tone queue's record
+
+   @param[out] record record in storage of tone queue
+   @param[in] tone tone with valid frequency and duration
+*/
+void cw_tq_tone_pack_internal(cw_tq_tone_t * record, const cw_tone_t * tone)
+{
+	record->duration = (int32_t) tone->duration;
+	record->frequency = (uint16_t) tone->frequency;
+	record->slope_mode = (uint8_t) tone->slope_mode;
+	record->flags = (uint8_t) ((tone->is_forever ? CW_TQ_TONE_FOREVER : 0) | (tone->is_first ? CW_TQ_TONE_FIRST : 0));
+	record->debug_id = tone->debug_id;
+	record->symbol = tone->symbol;
+	record->symbol_flags = tone->symbol_flags;
+}
+
+
+
+
+/**
+   @brief Get tone from tone queue's record
+
+   Fields of @p tone that are calculated by generator are set to zero.
+
+   @param[out] tone tone to be played by generator
+   @param[in] record record in storage of tone queue
+*/
+void cw_tq_tone_unpack_internal(cw_tone_t * tone, const cw_tq_tone_t * record)
+{
+	CW_TONE_INIT(tone, record->frequency, record->duration, (cw_tone_slope_mode_t) record->slope_mode);
+	tone->is_forever = record->flags & CW_TQ_TONE_FOREVER;
+	tone->is_first = record->flags & CW_TQ_TONE_FIRST;
+	tone->debug_id = record->debug_id;
+	tone->symbol = record->symbol;
+	tone->symbol_flags = record->symbol_flags;
+}
+
+
+
+
 /**
    @brief Dequeue a tone from tone queue
 
@@ -516,37 +761,31 @@ size_t cw_tq_next_index_internal(const cw_tone_queue_t * tq, size_t ind)
 */
 cw_queue_state_t cw_tq_dequeue_internal(cw_tone_queue_t * tq, cw_tone_t * tone)
 {
-	pthread_mutex_lock(&tq->wait_mutex);
-
 	bool call_callback = false;
-	const size_t len_before = tq->len;
+	const size_t n_dequeued_before = tq->n_dequeued;
 	const cw_queue_state_t state_before = tq->state;
-
-	switch (tq->state) {
-	case CW_TQ_EMPTY:
-		/* Ignore calls if queue is empty. */
-		break;
-
-	case CW_TQ_JUST_EMPTIED:
-		/* There are no more tones to dequeue, but we still need to
-		   update the state. */
-		tq->state = CW_TQ_EMPTY;
-		break;
-
-	case CW_TQ_NONEMPTY:
-		cw_assert (tq->len > 0, MSG_PREFIX "dequeue: tone queue is CW_TQ_NONEMPTY, but tq->len = %zu\n", tq->len);
-		call_callback = cw_tq_dequeue_sub_internal(tq, tone);
-		if (0 == tq->len) {
-			tq->state = CW_TQ_JUST_EMPTIED;
-		}
-		break;
-	default:
-		cw_debug_msg (&cw_debug_object, CW_DEBUG_TONE_QUEUE, CW_DEBUG_ERROR,
-			      MSG_PREFIX "unexpected queue state %d", tq->state);
-		break;
+	cw_queue_state_t queue_state;
+
+	/* Pairs with setting of ->exclusive in
+	   cw_tq_exclusive_begin_internal(). */
+	__atomic_store_n(&tq->consumer_active, true, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&tq->exclusive, __ATOMIC_SEQ_CST)) {
+		/* Some other thread is modifying whole queue. Step back and
+		   dequeue after the modification is completed. */
+		__atomic_store_n(&tq->consumer_active, false, __ATOMIC_SEQ_CST);
+
+		pthread_mutex_lock(&tq->producer_mutex);
+		queue_state = cw_tq_dequeue_state_internal(tq, tone, &call_callback);
+		pthread_mutex_unlock(&tq->producer_mutex);
+	} else {
+		queue_state = cw_tq_dequeue_state_internal(tq, tone, &call_callback);
+
+		/* Sequentially consistent store also orders the changes of
+		   queue made above before the check of count of waiters
+		   below. */
+		__atomic_store_n(&tq->consumer_active, false, __ATOMIC_SEQ_CST);
 	}
 
-	const cw_queue_state_t queue_state = tq->state;
 #if 0
 	/* Verbose debug. */
 	cw_debug_msg (&cw_debug_object, CW_DEBUG_TONE_QUEUE, CW_DEBUG_DEBUG
@@ -554,12 +793,13 @@ cw_queue_state_t cw_tq_dequeue_internal(cw_tone_queue_t * tq, cw_tone_t * tone)
 		      queue_state, tone->frequency, tone->duration);
 #endif
 
-	if (len_before != tq->len || state_before != tq->state) {
+	if (n_dequeued_before != tq->n_dequeued) {
 		//fprintf(stderr, "[II] " MSG_PREFIX "%s:%d broadcast on 'dequeue'\n", __func__, __LINE__);
-		pthread_cond_broadcast(&tq->wait_var);
+		cw_tq_wake_waiters_internal(tq, CW_TQ_WAIT_LEVEL);
+	}
+	if (n_dequeued_before != tq->n_dequeued || state_before != queue_state) {
+		cw_tq_wake_waiters_internal(tq, CW_TQ_WAIT_TONE_END);
 	}
-
-	pthread_mutex_unlock(&tq->wait_mutex);
 
 	/* Since client's callback can use libcw functions
 	   that call pthread_mutex_lock(&tq->...), we should
@@ -575,6 +815,56 @@ cw_queue_state_t cw_tq_dequeue_internal(cw_tone_queue_t * tq, cw_tone_t * tone)
 
 
 
+/**
+   @brief Dequeue a tone, update state of queue
+
+   This is a part of cw_tq_dequeue_internal() that is executed without
+   interference from other operations that modify the whole queue. Producer
+   may still be enqueueing new tones in the background.
+
+   @param[in] tq tone queue to dequeue tone from
+   @param[out] tone dequeued tone
+   @param[out] call_callback whether low water callback should be called
+
+   @return current state of tone queue (state after dequeueing current tone)
+*/
+static cw_queue_state_t cw_tq_dequeue_state_internal(cw_tone_queue_t * tq, cw_tone_t * tone, bool * call_callback)
+{
+	cw_queue_state_t queue_state = CW_TQ_EMPTY;
+
+	if (__atomic_load_n(&tq->n_enqueued, __ATOMIC_ACQUIRE) == tq->n_dequeued) {
+		/* There are no more tones to dequeue. Queue that has just
+		   been emptied goes to CW_TQ_EMPTY state, calls on queue that
+		   is already empty are ignored. */
+		queue_state = CW_TQ_EMPTY;
+	} else {
+		*call_callback = cw_tq_dequeue_sub_internal(tq, tone);
+		queue_state = __atomic_load_n(&tq->n_enqueued, __ATOMIC_ACQUIRE) == tq->n_dequeued ? CW_TQ_JUST_EMPTIED : CW_TQ_NONEMPTY;
+
+		/* Clock is read only when queue is drained and when
+		   first tone arrives in drained queue. */
+		cw_tq_stats_empty_end_internal(tq);
+		if (CW_TQ_JUST_EMPTIED == queue_state) {
+			__atomic_add_fetch(&tq->stats.n_drains, 1, __ATOMIC_RELAXED);
+			__atomic_store_n(&tq->stats.empty_since_ns, cw_tq_monotonic_ns_internal(), __ATOMIC_RELAXED);
+		}
+	}
+
+	/* Most of dequeues don't change the state, so don't write it (and
+	   don't pay for the barrier) without need. */
+	if (queue_state != tq->state) {
+		__atomic_store_n(&tq->state, queue_state, __ATOMIC_SEQ_CST);
+		if (CW_TQ_JUST_EMPTIED == queue_state) {
+			cw_tq_post_event_internal(tq, CW_GEN_EVENT_QUEUE_EMPTY);
+		}
+	}
+
+	return queue_state;
+}
+
+
+
+
 /**
    @brief Handle dequeueing of tone from non-empty tone queue
 
@@ -604,9 +894,12 @@ cw_queue_state_t cw_tq_dequeue_internal(cw_tone_queue_t * tq, cw_tone_t * tone)
 */
 bool cw_tq_dequeue_sub_internal(cw_tone_queue_t * tq, cw_tone_t * tone)
 {
-	CW_TONE_COPY(tone, &(tq->queue[tq->head]));
+	cw_tq_tone_unpack_internal(tone, &tq->queue[tq->head]);
+
+	/* Used to check if we passed tq's low level watermark. */
+	const size_t tq_len_before = __atomic_load_n(&tq->n_enqueued, __ATOMIC_ACQUIRE) - tq->n_dequeued;
 
-	if (tone->is_forever && tq->len == 1) {
+	if (tone->is_forever && tq_len_before == 1) {
 		/* Don't permanently remove the last tone that is
 		   "forever" tone in queue. Keep it in tq until client
 		   code adds next tone (this means possibly waiting
@@ -622,17 +915,13 @@ bool cw_tq_dequeue_sub_internal(cw_tone_queue_t * tq, cw_tone_t * tone)
 		return false;
 	}
 
-	/* Used to check if we passed tq's low level watermark. */
-	const size_t tq_len_before = tq->len;
-
-	/* Dequeue. We already have the tone, now update tq's state. */
-	tq->head = cw_tq_next_index_internal(tq, tq->head);
-	tq->len--;
-
-	if (tq->len == 0) {
-		/* Verify basic property of empty tq. */
-		cw_assert (tq->head == tq->tail, MSG_PREFIX "dequeue sub: head: %zu, tail: %zu", tq->head, tq->tail);
-	}
+	/* Dequeue. We already have the tone, now update tq's state. The
+	   increment of counter gives the slot back to producer, so it must
+	   be the last step. */
+	__atomic_store_n(&tq->head, cw_tq_next_index_internal(tq, tq->head), __ATOMIC_RELEASE);
+	__atomic_store_n(&tq->n_dequeued, tq->n_dequeued + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&tq->stats.n_dequeued, tq->stats.n_dequeued + 1, __ATOMIC_RELAXED);
+	const size_t tq_len = tq_len_before - 1;
 
 
 #if 0   /* Disabled because these debug messages produce lots of output
@@ -641,7 +930,7 @@ bool cw_tq_dequeue_sub_internal(cw_tone_queue_t * tq, cw_tone_t * tone)
 		      MSG_PREFIX "dequeue sub: dequeue tone %d us, %d Hz", tone->duration, tone->frequency);
 	cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_TONE_QUEUE, CW_DEBUG_DEBUG,
 		      MSG_PREFIX "dequeue sub: head = %zu, tail = %zu, length = %zu -> %zu",
-		      tq->head, tq->tail, tq_len_before, tq->len);
+		      tq->head, tq->tail, tq_len_before, tq_len);
 #endif
 
 	/* You can remove this assert in future. It is only temporary,
@@ -656,12 +945,20 @@ bool cw_tq_dequeue_sub_internal(cw_tone_queue_t * tq, cw_tone_t * tone)
 		   redundant, but for some reason it is necessary. Be
 		   very, very careful when modifying this. */
 		if (tq_len_before > tq->low_water_mark
-		    && tq->len <= tq->low_water_mark) {
+		    && tq_len <= tq->low_water_mark) {
 
 			call_callback = true;
 		}
 	}
 
+	/* The same condition for event watched through tq's file
+	   descriptor. */
+	if (tq_len_before > tq->event_level
+	    && tq_len <= tq->event_level) {
+
+		cw_tq_post_event_internal(tq, CW_GEN_EVENT_LEVEL);
+	}
+
 	return call_callback;
 }
 
@@ -698,26 +995,104 @@ bool cw_tq_dequeue_sub_internal(cw_tone_queue_t * tq, cw_tone_t * tone)
 */
 cw_ret_t cw_tq_enqueue_internal(cw_tone_queue_t * tq, const cw_tone_t * tone)
 {
-	cw_assert (tq, MSG_PREFIX "enqueue: tone queue is null");
 	cw_assert (tone, MSG_PREFIX "enqueue: tone is null");
 
+	return cw_tq_enqueue_many_internal(tq, tone, 1);
+}
+
+
+
+
+/**
+   @brief Add a sequence of tones to tone queue
+
+   Either all tones from @p tones are added to the queue, or none of
+   them. The tones are checked, the space in the queue is reserved, and
+   the tones are handed over to consumer of the queue in one step, so
+   consumer never sees only a part of the sequence. Consumer waiting for
+   new tones is woken up once per sequence.
+
+   Values of tones are checked in the same way as in
+   cw_tq_enqueue_internal(). Tones with duration equal to zero are
+   skipped.
+
+   @exception EINVAL invalid values of any tone in @p tones
+   @exception EAGAIN tones not enqueued because there is not enough free space in tone queue
+
+   @param[in] tq tone queue to enqueue to
+   @param[in] tones tones to enqueue
+   @param[in] n_tones count of tones in @p tones
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+cw_ret_t cw_tq_enqueue_many_internal(cw_tone_queue_t * tq, const cw_tone_t * tones, size_t n_tones)
+{
+	return cw_tq_enqueue_many_counted_internal(tq, tones, n_tones, NULL, -1, 0);
+}
+
+
+
+
+/**
+   @brief Add a sequence of tones to tone queue, updating producer's counter of units of space
+
+   Works like cw_tq_enqueue_many_internal(), but additionally checks
+   and updates @p space_units_counter under producer mutex of queue,
+   so that the counter always describes the tones that are at the end
+   of the queue, even when many producers enqueue tones at the same
+   time.
+
+   If @p assumed is not -1 and the counter is different from it, the
+   tones are not enqueued: they were calculated for a different end of
+   queue, and the caller should calculate them again. When the tones are
+   enqueued, the counter is set to @p updated. When there is not enough
+   space in the queue, the counter is reset to zero.
+
+   @exception EINVAL invalid values of any tone in @p tones
+   @exception EAGAIN tones not enqueued because there is not enough free space in tone queue
+   @exception ESTALE tones not enqueued because @p space_units_counter is different than @p assumed
+
+   @param[in] tq tone queue to enqueue to
+   @param[in] tones tones to enqueue
+   @param[in] n_tones count of tones in @p tones
+   @param[in,out] space_units_counter producer's counter of units of space, may be NULL
+   @param[in] assumed value of counter for which @p tones were calculated, or -1
+   @param[in] updated value of counter after @p tones are enqueued
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+cw_ret_t cw_tq_enqueue_many_counted_internal(cw_tone_queue_t * tq, const cw_tone_t * tones, size_t n_tones, int * space_units_counter, int assumed, int updated)
+{
+	cw_assert (tq, MSG_PREFIX "enqueue: tone queue is null");
+	cw_assert (tones || 0 == n_tones, MSG_PREFIX "enqueue: tones are null");
+
 	/* Check the arguments given for realistic values. */
-	if (tone->frequency < CW_FREQUENCY_MIN
-	    || tone->frequency > CW_FREQUENCY_MAX) {
+	size_t n_nonempty = 0;
+	for (size_t i = 0; i < n_tones; i++) {
+		const cw_tone_t * tone = &tones[i];
+		if (tone->frequency < CW_FREQUENCY_MIN
+		    || tone->frequency > CW_FREQUENCY_MAX) {
+
+			errno = EINVAL;
+			return CW_FAILURE;
+		}
 
-		errno = EINVAL;
-		return CW_FAILURE;
-	}
+		if (tone->duration < 0) {
+			errno = EINVAL;
+			return CW_FAILURE;
+		}
 
-	if (tone->duration < 0) {
-		errno = EINVAL;
-		return CW_FAILURE;
+		if (tone->duration != 0 || 0 != tone->symbol) {
+			n_nonempty++;
+		}
 	}
 
-	if (tone->duration == 0) {
-		/* Drop empty tone. It won't be played anyway, and for
+	if (0 == n_nonempty) {
+		/* Drop empty tones. They won't be played anyway, and for
 		   now there are no other good reasons to enqueue
-		   it. While it may happen in higher-level code to
+		   them. While it may happen in higher-level code to
 		   create such tone, but there is no need to spend
 		   time on it here. */
 		cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_TONE_QUEUE, CW_DEBUG_INFO,
@@ -726,48 +1101,165 @@ cw_ret_t cw_tq_enqueue_internal(cw_tone_queue_t * tq, const cw_tone_t * tone)
 	}
 
 
-	pthread_mutex_lock(&tq->wait_mutex);
+	if (0 != pthread_mutex_trylock(&tq->producer_mutex)) {
+		/* Clock is read only when the mutex is contended. */
+		const uint64_t wait_start = cw_tq_monotonic_ns_internal();
+		pthread_mutex_lock(&tq->producer_mutex);
+		__atomic_add_fetch(&tq->stats.lock_wait_ns, cw_tq_monotonic_ns_internal() - wait_start, __ATOMIC_RELAXED);
+	}
+
+	if (NULL != space_units_counter && -1 != assumed && assumed != *space_units_counter) {
+		/* Another producer has enqueued its tones after the
+		   tones were calculated. */
+		pthread_mutex_unlock(&tq->producer_mutex);
+		errno = ESTALE;
+		return CW_FAILURE;
+	}
 
-	if (tq->len == tq->capacity) {
-		/* Tone queue is full. */
+	const size_t len = tq->n_enqueued - __atomic_load_n(&tq->n_dequeued, __ATOMIC_ACQUIRE);
+	if (len + n_nonempty > tq->capacity) {
+		/* Not enough space in tone queue. */
 
+		__atomic_add_fetch(&tq->stats.n_rejected, 1, __ATOMIC_RELAXED);
+		if (NULL != space_units_counter) {
+			/* Reset on error. */
+			__atomic_store_n(space_units_counter, 0, __ATOMIC_RELAXED);
+		}
 		errno = EAGAIN;
 		cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_TONE_QUEUE, CW_DEBUG_ERROR,
-			      MSG_PREFIX "enqueue: can't enqueue tone, tq is full");
-		pthread_mutex_unlock(&tq->wait_mutex);
+			      MSG_PREFIX "enqueue: can't enqueue %zu tone(s), tq is full", n_nonempty);
+		pthread_mutex_unlock(&tq->producer_mutex);
 
 		return CW_FAILURE;
 	}
 
 
-	// cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_TONE_QUEUE, CW_DEBUG_DEBUG, MSG_PREFIX "enqueue: enqueue tone %d us, %d Hz", tone->duration, tone->frequency);
+	// cw_debug_msg (&cw_debug_object_dev, CW_DEBUG_TONE_QUEUE, CW_DEBUG_DEBUG, MSG_PREFIX "enqueue: enqueue %zu tones", n_nonempty);
 
-	/* Enqueue the new tone.
+	/* Enqueue the new tones.
 
 	   Notice that tail is incremented after adding a tone. This
 	   means that for empty tq new tone is inserted at index
 	   tail == head (which should be kind of obvious). */
-	tq->queue[tq->tail] = *tone;
+	for (size_t i = 0; i < n_tones; i++) {
+		if (tones[i].duration == 0 && 0 == tones[i].symbol) {
+			continue;
+		}
+		cw_tq_tone_pack_internal(&tq->queue[tq->tail], &tones[i]);
+		tq->tail = cw_tq_next_index_internal(tq, tq->tail);
+	}
+
+	/* The increment of counter hands the tones over to consumer, so
+	   it must be the last step. */
+	__atomic_store_n(&tq->n_enqueued, tq->n_enqueued + n_nonempty, __ATOMIC_RELEASE);
+
+	if (NULL != space_units_counter) {
+		__atomic_store_n(space_units_counter, updated, __ATOMIC_RELAXED);
+	}
+
+	/* Statistics are written by producers only under the mutex. */
+	__atomic_store_n(&tq->stats.n_enqueued, tq->stats.n_enqueued + n_nonempty, __ATOMIC_RELAXED);
+	if (len + n_nonempty > tq->stats.max_length) {
+		__atomic_store_n(&tq->stats.max_length, len + n_nonempty, __ATOMIC_RELAXED);
+	}
+
+	/* Waiters for new tones register themselves under producer mutex
+	   (see cw_tq_waiter_lock_internal()), so either we see a waiter
+	   here, or the waiter will see the new tones. */
+	cw_tq_wait_channel_t * channel = &tq->wait_channels[CW_TQ_WAIT_TONE_AVAILABLE];
+	const bool wake = 0 != __atomic_load_n(&channel->n_waiters, __ATOMIC_RELAXED);
 
-	tq->tail = cw_tq_next_index_internal(tq, tq->tail);
-	tq->len++;
-	tq->state = CW_TQ_NONEMPTY;
+	pthread_mutex_unlock(&tq->producer_mutex);
 
 	/*
-	  tq->len and perhaps tq->state have changed. Signal this fact
+	  Length and state of queue have changed. Signal this fact
 	  to listeners.
 
 	  A loop in cw_gen_dequeue_and_generate_internal() function
 	  may await for the queue to be filled with new tones to
 	  dequeue and play.  It waits for a notification from tq that
-	  there are some new tones in tone queue. We will need to use
-	  pthread_cond_broadcast() to make sure the notification
-	  reaches all listeners.
+	  there are some new tones in tone queue.
 	*/
-	// fprintf(stderr, "[II] " MSG_PREFIX "%s:%d broadcast on 'enqueue'\n", __func__, __LINE__);
-	pthread_cond_broadcast(&tq->wait_var);
+	if (wake) {
+		// fprintf(stderr, "[II] " MSG_PREFIX "%s:%d broadcast on 'enqueue'\n", __func__, __LINE__);
+		pthread_mutex_lock(&channel->mutex);
+		pthread_cond_broadcast(&channel->cond);
+		pthread_mutex_unlock(&channel->mutex);
+	}
+
+	return CW_SUCCESS;
+}
+
 
-	pthread_mutex_unlock(&tq->wait_mutex);
+
+
+/**
+   @brief Initialize staging buffer of producer of tones
+
+   @param[out] staging staging buffer to initialize
+*/
+void cw_tq_staging_init_internal(cw_tq_staging_t * staging)
+{
+	staging->n_tones = 0;
+	staging->n_complete = 0;
+	staging->space_units_counter = NULL;
+	staging->space_units_count_assumed = -1;
+	staging->space_units_count = 0;
+}
+
+
+
+
+/**
+   @brief Put a tone into producer's staging buffer
+
+   The tone is not visible to consumer of @p tq until it is committed.
+   Tones of complete characters are committed when the buffer becomes
+   full; a tone with ->is_first flag set begins a new character. Call
+   cw_tq_commit_internal() to commit the rest of staged tones.
+
+   A character that is longer than the buffer is committed in parts.
+   Such commits don't update producer's counter of units of space
+   (cw_tq_staging_t::space_units_counter), so a producer that uses the
+   counter must commit its tones before the buffer becomes full.
+
+   If committing fails, all staged tones are discarded.
+
+   @exception EINVAL invalid values of staged tone
+   @exception EAGAIN staged tones not enqueued because there is not enough free space in tone queue
+
+   @param[in] tq tone queue to which the tones will be committed
+   @param[in,out] staging producer's staging buffer
+   @param[in] tone tone to stage
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+cw_ret_t cw_tq_stage_internal(cw_tone_queue_t * tq, cw_tq_staging_t * staging, const cw_tone_t * tone)
+{
+	if (tone->is_first) {
+		staging->n_complete = staging->n_tones;
+	}
+
+	if (staging->n_tones == CW_TQ_STAGING_CAPACITY) {
+		const size_t n = staging->n_complete > 0 ? staging->n_complete : staging->n_tones;
+		if (CW_SUCCESS != cw_tq_enqueue_many_internal(tq, staging->tones, n)) {
+			staging->n_tones = 0;
+			staging->n_complete = 0;
+			return CW_FAILURE;
+		}
+
+		/* Move beginning of incomplete character to the beginning
+		   of the buffer. */
+		for (size_t i = n; i < staging->n_tones; i++) {
+			CW_TONE_COPY(&staging->tones[i - n], &staging->tones[i]);
+		}
+		staging->n_tones -= n;
+		staging->n_complete = 0;
+	}
+
+	CW_TONE_COPY(&staging->tones[staging->n_tones], tone);
+	staging->n_tones++;
 
 	return CW_SUCCESS;
 }
@@ -775,6 +1267,41 @@ cw_ret_t cw_tq_enqueue_internal(cw_tone_queue_t * tq, const cw_tone_t * tone)
 
 
 
+/**
+   @brief Commit all tones from producer's staging buffer to tone queue
+
+   Either all staged tones are enqueued, or none of them. In both cases
+   the staging buffer is empty when the function returns.
+
+   Producer's counter of units of space (if set in @p staging) is
+   checked and updated in the same way as in
+   cw_tq_enqueue_many_counted_internal().
+
+   @exception EINVAL invalid values of staged tones
+   @exception EAGAIN staged tones not enqueued because there is not enough free space in tone queue
+   @exception ESTALE staged tones not enqueued because they were calculated for different value of producer's counter of units of space
+
+   @param[in] tq tone queue to commit to
+   @param[in,out] staging producer's staging buffer
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+cw_ret_t cw_tq_commit_internal(cw_tone_queue_t * tq, cw_tq_staging_t * staging)
+{
+	const cw_ret_t cwret = cw_tq_enqueue_many_counted_internal(tq, staging->tones, staging->n_tones,
+								   staging->space_units_counter,
+								   staging->space_units_count_assumed,
+								   staging->space_units_count);
+	staging->n_tones = 0;
+	staging->n_complete = 0;
+	staging->space_units_count_assumed = -1;
+	return cwret;
+}
+
+
+
+
 /**
    @brief Register callback for low queue state
 
@@ -843,7 +1370,32 @@ cw_ret_t cw_tq_register_low_level_callback_internal(cw_tone_queue_t * tq, cw_que
 */
 cw_ret_t cw_tq_wait_for_end_of_current_tone_internal(cw_tone_queue_t * tq)
 {
-	pthread_mutex_lock(&tq->wait_mutex);
+	return cw_tq_wait_for_end_of_current_tone_timed_internal(tq, NULL);
+}
+
+
+
+
+/**
+   @brief Wait for the current tone to complete, but not longer than until @p deadline
+
+   @p deadline is an absolute time of CLOCK_MONOTONIC clock. If @p
+   deadline is NULL, the function waits without time limit.
+
+   @exception ETIMEDOUT the deadline has passed before end of tone
+
+   @param[in] tq tone queue to wait on
+   @param[in] deadline absolute time (CLOCK_MONOTONIC) at which to stop waiting
+
+   @return CW_SUCCESS if the tone has ended
+   @return CW_FAILURE if the deadline has passed
+*/
+cw_ret_t cw_tq_wait_for_end_of_current_tone_timed_internal(cw_tone_queue_t * tq, const struct timespec * deadline)
+{
+	bool timed_out = false;
+	cw_ret_t cwret = CW_SUCCESS;
+
+	cw_tq_waiter_lock_internal(tq, CW_TQ_WAIT_TONE_END);
 	/* According to man page, spurious wakeups of pthread_cond_wait() may
 	   occur.  Call the function in loop with two conditions to work
 	   around these wakeups.
@@ -866,16 +1418,20 @@ cw_ret_t cw_tq_wait_for_end_of_current_tone_internal(cw_tone_queue_t * tq)
 	   Spurious wakeups noticed on:
 	   Intel Celeron 430, Ubuntu 18.04.5 x86_64, kernel 5.4.0-47
 
-	   TODO: check that our usage of wait_mutex in this
-	   function and in other tq functions allows us to safely get
-	   tq->head. */
+	   tq->head is written by consumer without channel's mutex, so it is read
+	   here with atomic load. */
 
 	/* Wait for the queue index to change or the dequeue to go completely empty. */
-	const size_t check_tq_head = tq->head;
-	while (tq->head == check_tq_head && tq->state != CW_TQ_EMPTY) {
-		pthread_cond_wait(&tq->wait_var, &tq->wait_mutex);
+	const size_t check_tq_head = __atomic_load_n(&tq->head, __ATOMIC_ACQUIRE);
+	while (__atomic_load_n(&tq->head, __ATOMIC_ACQUIRE) == check_tq_head
+	       && CW_TQ_EMPTY != cw_tq_get_state_internal(tq)) {
+		if (timed_out) {
+			cwret = CW_FAILURE;
+			break;
+		}
+		timed_out = ETIMEDOUT == cw_tq_waiter_timedwait_internal(tq, CW_TQ_WAIT_TONE_END, deadline);
 	}
-	pthread_mutex_unlock(&tq->wait_mutex);
+	cw_tq_waiter_unlock_internal(tq, CW_TQ_WAIT_TONE_END);
 
 
 #if 0   /* Original implementation using signals. */ /* This code has been disabled some time before 2017-01-30. */
@@ -885,7 +1441,10 @@ cw_ret_t cw_tq_wait_for_end_of_current_tone_internal(cw_tone_queue_t * tq)
 		cw_signal_wait_internal();
 	}
 #endif
-	return CW_SUCCESS;
+	if (CW_FAILURE == cwret) {
+		errno = ETIMEDOUT;
+	}
+	return cwret;
 }
 
 
@@ -918,12 +1477,43 @@ cw_ret_t cw_tq_wait_for_end_of_current_tone_internal(cw_tone_queue_t * tq)
 */
 cw_ret_t cw_tq_wait_for_level_internal(cw_tone_queue_t * tq, size_t level)
 {
+	return cw_tq_wait_for_level_timed_internal(tq, level, NULL);
+}
+
+
+
+
+/**
+   @brief Wait for the tone queue to drain to @p level, but not longer than until @p deadline
+
+   @p deadline is an absolute time of CLOCK_MONOTONIC clock. If @p
+   deadline is NULL, the function waits without time limit.
+
+   @exception ETIMEDOUT the deadline has passed before the queue has
+   drained to @p level
+
+   @param[in] tq tone queue to wait on
+   @param[in] level low level in queue, at which to return
+   @param[in] deadline absolute time (CLOCK_MONOTONIC) at which to stop waiting
+
+   @return CW_SUCCESS if the queue has drained to @p level
+   @return CW_FAILURE if the deadline has passed
+*/
+cw_ret_t cw_tq_wait_for_level_timed_internal(cw_tone_queue_t * tq, size_t level, const struct timespec * deadline)
+{
+	bool timed_out = false;
+	cw_ret_t cwret = CW_SUCCESS;
+
 	/* Wait until the queue length is at or below given level. */
-	pthread_mutex_lock(&tq->wait_mutex);
-	while (tq->len > level) {
-		pthread_cond_wait(&tq->wait_var, &tq->wait_mutex);
+	cw_tq_waiter_lock_internal(tq, CW_TQ_WAIT_LEVEL);
+	while (cw_tq_length_internal(tq) > level) {
+		if (timed_out) {
+			cwret = CW_FAILURE;
+			break;
+		}
+		timed_out = ETIMEDOUT == cw_tq_waiter_timedwait_internal(tq, CW_TQ_WAIT_LEVEL, deadline);
 	}
-	pthread_mutex_unlock(&tq->wait_mutex);
+	cw_tq_waiter_unlock_internal(tq, CW_TQ_WAIT_LEVEL);
 
 
 #if 0   /* Original implementation using signals. */  /* This code has been disabled some time before 2017-01-30. */
@@ -932,7 +1522,10 @@ cw_ret_t cw_tq_wait_for_level_internal(cw_tone_queue_t * tq, size_t level)
 		cw_signal_wait_internal();
 	}
 #endif
-	return CW_SUCCESS;
+	if (CW_FAILURE == cwret) {
+		errno = ETIMEDOUT;
+	}
+	return cwret;
 }
 
 
@@ -957,8 +1550,8 @@ cw_ret_t cw_tq_wait_for_level_internal(cw_tone_queue_t * tq, size_t level)
 */
 bool cw_tq_is_full_internal(const cw_tone_queue_t * tq)
 {
-	/* TODO: shouldn't we lock tq when making the comparison? */
-	return tq->len == tq->capacity;
+	const size_t n_dequeued = __atomic_load_n(&tq->n_dequeued, __ATOMIC_ACQUIRE);
+	return __atomic_load_n(&tq->n_enqueued, __ATOMIC_ACQUIRE) - n_dequeued == tq->capacity;
 }
 
 
@@ -1018,8 +1611,7 @@ void cw_tq_flush_internal(cw_tone_queue_t * tq)
 */
 bool cw_tq_is_nonempty_internal(const cw_tone_queue_t * tq)
 {
-	/* TODO: shouldn't we lock tq when making the comparison? */
-	return CW_TQ_NONEMPTY == tq->state;
+	return CW_TQ_NONEMPTY == cw_tq_get_state_internal(tq);
 }
 
 
@@ -1048,32 +1640,450 @@ cw_ret_t cw_tq_remove_last_character_internal(cw_tone_queue_t * tq)
 {
 	cw_ret_t cwret = CW_FAILURE;
 
-	pthread_mutex_lock(&tq->wait_mutex);
+	cw_tq_exclusive_begin_internal(tq);
 
-	size_t len = tq->len;
+	const size_t len_before = tq->n_enqueued - tq->n_dequeued;
+	size_t len = len_before;
 	size_t idx = tq->tail;
 	bool is_found = false;
 
 	while (len > 0) {
 		--len;
 		idx = cw_tq_prev_index_internal(tq, idx);
-		if (tq->queue[idx].is_first) {
+		if (tq->queue[idx].flags & CW_TQ_TONE_FIRST) {
 			is_found = true;
 			break;
 		}
 	}
 
 	if (is_found) {
-		tq->len = len;
+		/* The only place where producer's counter goes down.
+		   Consumer is kept out of dequeue, so its counter doesn't
+		   change, and the new value is not smaller than it. */
 		tq->tail = idx;
+		__atomic_store_n(&tq->n_removals, tq->n_removals + 1, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&tq->n_enqueued, tq->n_dequeued + len, __ATOMIC_SEQ_CST);
 		cwret = CW_SUCCESS;
 
-		if (0 == tq->len) {
-			tq->state = CW_TQ_JUST_EMPTIED;
+		if (0 == len) {
+			__atomic_store_n(&tq->state, CW_TQ_JUST_EMPTIED, __ATOMIC_SEQ_CST);
 		}
 	}
 
-	pthread_mutex_unlock(&tq->wait_mutex);
+	cw_tq_exclusive_end_internal(tq);
+
+	if (is_found) {
+		cw_tq_notify_waiters_internal(tq, CW_TQ_WAIT_LEVEL);
+		cw_tq_notify_waiters_internal(tq, CW_TQ_WAIT_TONE_END);
+		cw_tq_post_event_internal(tq, (0 == len ? CW_GEN_EVENT_QUEUE_EMPTY : 0)
+					  | (len_before > tq->event_level && len <= tq->event_level ? CW_GEN_EVENT_LEVEL : 0));
+	}
 
 	return cwret;
 }
+
+
+
+
+/**
+   @brief Lock mutex of tone queue's wait channel and register as a waiter
+
+   Use this function instead of locking mutex of a channel directly when
+   you want to wait on the channel. Events are broadcast on a channel
+   only when there are registered waiters.
+
+   The waiter must check its wait condition after calling this function,
+   and call cw_tq_waiter_wait_internal() as long as the condition is not
+   met. Call cw_tq_waiter_unlock_internal() when the wait is over.
+
+   @param[in] tq tone queue
+   @param[in] channel channel on which to wait
+*/
+void cw_tq_waiter_lock_internal(cw_tone_queue_t * tq, cw_tq_wait_channel_id_t channel)
+{
+	cw_tq_wait_channel_t * ch = &tq->wait_channels[channel];
+
+	pthread_mutex_lock(&ch->mutex);
+
+	if (CW_TQ_WAIT_TONE_AVAILABLE == channel) {
+		/* Register under producer mutex: producer checks count of
+		   waiters while holding the mutex, so it can't miss us. */
+		pthread_mutex_lock(&tq->producer_mutex);
+		__atomic_add_fetch(&ch->n_waiters, 1, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&tq->producer_mutex);
+	} else {
+		__atomic_add_fetch(&ch->n_waiters, 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+
+
+
+/**
+   @brief Sleep until an event is broadcast on tone queue's wait channel
+
+   Call this function between cw_tq_waiter_lock_internal() and
+   cw_tq_waiter_unlock_internal(). The function may return on spurious
+   wakeup, so call it in a loop that checks the wait condition.
+
+   @param[in] tq tone queue
+   @param[in] channel channel on which to wait
+*/
+void cw_tq_waiter_wait_internal(cw_tone_queue_t * tq, cw_tq_wait_channel_id_t channel)
+{
+	cw_tq_wait_channel_t * ch = &tq->wait_channels[channel];
+	pthread_cond_wait(&ch->cond, &ch->mutex);
+}
+
+
+
+
+/**
+   @brief Sleep until an event is broadcast on tone queue's wait channel, or until @p deadline
+
+   Variant of cw_tq_waiter_wait_internal() with time limit. @p deadline
+   is an absolute time of CLOCK_MONOTONIC clock. If @p deadline is NULL,
+   the function waits without time limit.
+
+   @param[in] tq tone queue
+   @param[in] channel channel on which to wait
+   @param[in] deadline absolute time (CLOCK_MONOTONIC) at which to stop waiting
+
+   @return ETIMEDOUT if the deadline has passed
+   @return zero otherwise
+*/
+int cw_tq_waiter_timedwait_internal(cw_tone_queue_t * tq, cw_tq_wait_channel_id_t channel, const struct timespec * deadline)
+{
+	cw_tq_wait_channel_t * ch = &tq->wait_channels[channel];
+	if (NULL == deadline) {
+		pthread_cond_wait(&ch->cond, &ch->mutex);
+		return 0;
+	}
+	return pthread_cond_timedwait(&ch->cond, &ch->mutex, deadline);
+}
+
+
+
+
+/**
+   @brief Unregister as a waiter and unlock mutex of tone queue's wait channel
+
+   @param[in] tq tone queue
+   @param[in] channel channel on which the wait is over
+*/
+void cw_tq_waiter_unlock_internal(cw_tone_queue_t * tq, cw_tq_wait_channel_id_t channel)
+{
+	cw_tq_wait_channel_t * ch = &tq->wait_channels[channel];
+	__atomic_sub_fetch(&ch->n_waiters, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&ch->mutex);
+}
+
+
+
+
+/**
+   @brief Wake up threads waiting on tone queue's wait channel
+
+   The function is cheap when nobody waits on the channel: it doesn't
+   touch channel's mutex and condition variable at all.
+
+   @param[in] tq tone queue
+   @param[in] channel channel on which to broadcast
+*/
+void cw_tq_notify_waiters_internal(cw_tone_queue_t * tq, cw_tq_wait_channel_id_t channel)
+{
+	/* The fence orders the change of state (made by caller with
+	   non-atomic writes) before the check of count of waiters. */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	cw_tq_wake_waiters_internal(tq, channel);
+}
+
+
+
+
+/**
+   @brief Wake up threads waiting on any of tone queue's wait channels
+
+   Use this function when a waiting thread may need to notice a change
+   that is not an event of any channel, e.g. termination of generator.
+
+   @param[in] tq tone queue
+*/
+void cw_tq_notify_all_waiters_internal(cw_tone_queue_t * tq)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	for (int i = 0; i < CW_TQ_WAIT_CHANNELS_COUNT; i++) {
+		cw_tq_wake_waiters_internal(tq, (cw_tq_wait_channel_id_t) i);
+	}
+}
+
+
+
+
+/**
+   @brief Wake up threads waiting on tone queue's wait channel
+
+   Variant of cw_tq_notify_waiters_internal() for queue operations that
+   have ended their changes of queue with sequentially consistent atomic
+   operation. A waiter registers itself before checking the state, so
+   either we see the waiter here, or the waiter sees the new state.
+
+   @param[in] tq tone queue
+   @param[in] channel channel on which to broadcast
+*/
+static void cw_tq_wake_waiters_internal(cw_tone_queue_t * tq, cw_tq_wait_channel_id_t channel)
+{
+	cw_tq_wait_channel_t * ch = &tq->wait_channels[channel];
+	if (0 == __atomic_load_n(&ch->n_waiters, __ATOMIC_SEQ_CST)) {
+		return;
+	}
+
+	pthread_mutex_lock(&ch->mutex);
+	pthread_cond_broadcast(&ch->cond);
+	pthread_mutex_unlock(&ch->mutex);
+}
+
+
+
+
+/**
+   @brief Get file descriptor that becomes readable on events of tone queue
+
+   See cw_gen_get_event_fd() for description of arguments and of return
+   values.
+
+   @param[in] tq tone queue to watch
+   @param[in] events events to watch, ORed CW_GEN_EVENT_* values
+   @param[in] level level of tone queue for CW_GEN_EVENT_LEVEL event
+
+   @return file descriptor on success
+   @return -1 on failure
+*/
+int cw_tq_get_event_fd_internal(cw_tone_queue_t * tq, unsigned int events, size_t level)
+{
+	if (level >= tq->capacity) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&tq->event_fd_mutex);
+
+	if (-1 == tq->event_fd) {
+#if defined(__linux__)
+		const int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (-1 == fd) {
+			cw_debug_msg (&cw_debug_object, CW_DEBUG_TONE_QUEUE, CW_DEBUG_ERROR,
+				      MSG_PREFIX "get event fd: failed to create eventfd: %s", strerror(errno));
+			pthread_mutex_unlock(&tq->event_fd_mutex);
+			return -1;
+		}
+		tq->event_fd_write = fd;
+		__atomic_store_n(&tq->event_fd, fd, __ATOMIC_RELEASE);
+#else
+		int fds[2] = { -1, -1 };
+		if (0 != pipe(fds)) {
+			cw_debug_msg (&cw_debug_object, CW_DEBUG_TONE_QUEUE, CW_DEBUG_ERROR,
+				      MSG_PREFIX "get event fd: failed to create pipe: %s", strerror(errno));
+			pthread_mutex_unlock(&tq->event_fd_mutex);
+			return -1;
+		}
+		for (int i = 0; i < 2; i++) {
+			const int flags = fcntl(fds[i], F_GETFL);
+			if (-1 == flags
+			    || -1 == fcntl(fds[i], F_SETFL, flags | O_NONBLOCK)
+			    || -1 == fcntl(fds[i], F_SETFD, FD_CLOEXEC)) {
+
+				const int saved_errno = errno;
+				cw_debug_msg (&cw_debug_object, CW_DEBUG_TONE_QUEUE, CW_DEBUG_ERROR,
+					      MSG_PREFIX "get event fd: failed to set flags of pipe: %s", strerror(saved_errno));
+				close(fds[0]);
+				close(fds[1]);
+				errno = saved_errno;
+				pthread_mutex_unlock(&tq->event_fd_mutex);
+				return -1;
+			}
+		}
+		tq->event_fd_write = fds[1];
+		__atomic_store_n(&tq->event_fd, fds[0], __ATOMIC_RELEASE);
+#endif
+	}
+
+	tq->event_level = level;
+	/* Release: code posting an event that sees the mask also sees the
+	   descriptor. */
+	__atomic_store_n(&tq->event_mask, events & CW_GEN_EVENT_ALL, __ATOMIC_RELEASE);
+
+	pthread_mutex_unlock(&tq->event_fd_mutex);
+
+	return tq->event_fd;
+}
+
+
+
+
+/**
+   @brief Get events of tone queue that have happened since previous call
+
+   @param[in] tq tone queue to watch
+
+   @return ORed CW_GEN_EVENT_* values
+*/
+unsigned int cw_tq_read_events_internal(cw_tone_queue_t * tq)
+{
+	if (-1 == __atomic_load_n(&tq->event_fd, __ATOMIC_ACQUIRE)) {
+		return 0;
+	}
+
+	/* Drain the descriptor before taking pending events. In reverse
+	   order an event posted between the two steps would be pending
+	   with non-readable descriptor. */
+	uint64_t buf[8];
+	while (0 < read(tq->event_fd, buf, sizeof (buf))) {
+		;
+	}
+
+	return __atomic_exchange_n(&tq->events_pending, 0, __ATOMIC_ACQ_REL);
+}
+
+
+
+
+/**
+   @brief Post event(s) to file descriptor of tone queue
+
+   Events that are not watched by client are ignored. The descriptor is
+   written to only if there were no pending events.
+
+   @param[in] tq tone queue
+   @param[in] event ORed CW_GEN_EVENT_* values
+*/
+void cw_tq_post_event_internal(cw_tone_queue_t * tq, unsigned int event)
+{
+	event &= __atomic_load_n(&tq->event_mask, __ATOMIC_ACQUIRE);
+	if (0 == event) {
+		return;
+	}
+
+	if (0 != __atomic_fetch_or(&tq->events_pending, event, __ATOMIC_ACQ_REL)) {
+		/* Descriptor is already readable. */
+		return;
+	}
+
+#if defined(__linux__)
+	const uint64_t value = 1;
+#else
+	const char value = 1;
+#endif
+	/* EAGAIN on full pipe or eventfd counter is not a problem: the
+	   descriptor is readable anyway. */
+	if (-1 == write(tq->event_fd_write, &value, sizeof (value)) && EAGAIN != errno) {
+		cw_debug_msg (&cw_debug_object, CW_DEBUG_TONE_QUEUE, CW_DEBUG_ERROR,
+			      MSG_PREFIX "post event: failed to write to event fd: %s", strerror(errno));
+	}
+}
+
+
+
+
+/**
+   @brief Get statistics of tone queue
+
+   See cw_gen_get_queue_stats().
+
+   @param[in] tq tone queue
+   @param[out] stats statistics of tone queue
+*/
+void cw_tq_get_stats_internal(const cw_tone_queue_t * tq, cw_gen_queue_stats_t * stats)
+{
+	stats->n_enqueued = __atomic_load_n(&tq->stats.n_enqueued, __ATOMIC_RELAXED);
+	stats->n_dequeued = __atomic_load_n(&tq->stats.n_dequeued, __ATOMIC_RELAXED);
+	stats->n_rejected = __atomic_load_n(&tq->stats.n_rejected, __ATOMIC_RELAXED);
+	stats->max_length = __atomic_load_n(&tq->stats.max_length, __ATOMIC_RELAXED);
+	stats->n_drains = __atomic_load_n(&tq->stats.n_drains, __ATOMIC_RELAXED);
+
+	uint64_t empty_ns = __atomic_load_n(&tq->stats.empty_ns, __ATOMIC_RELAXED);
+	const uint64_t empty_since_ns = __atomic_load_n(&tq->stats.empty_since_ns, __ATOMIC_RELAXED);
+	if (0 != empty_since_ns) {
+		/* Queue is drained right now. */
+		const uint64_t now = cw_tq_monotonic_ns_internal();
+		if (now > empty_since_ns) {
+			empty_ns += now - empty_since_ns;
+		}
+	}
+	stats->empty_usecs = empty_ns / 1000;
+	stats->lock_wait_usecs = __atomic_load_n(&tq->stats.lock_wait_ns, __ATOMIC_RELAXED) / 1000;
+}
+
+
+
+
+/**
+   @brief Count enqueue call rejected because tone queue was full
+
+   For rejections made by callers of tone queue, e.g. because of
+   high water mark of queue. Rejections made by
+   cw_tq_enqueue_many_internal() are counted by the function itself.
+
+   @param[in] tq tone queue
+*/
+void cw_tq_stats_rejected_internal(cw_tone_queue_t * tq)
+{
+	__atomic_add_fetch(&tq->stats.n_rejected, 1, __ATOMIC_RELAXED);
+}
+
+
+
+
+/**
+   @brief Stop measuring time of drained queue
+
+   Consumer calls this function when it stops dequeueing tones
+   (i.e. when generator is stopped), because time spent by idle
+   generator with empty queue is not a period of drained queue.
+
+   @param[in] tq tone queue
+*/
+void cw_tq_stats_consumer_stopped_internal(cw_tone_queue_t * tq)
+{
+	cw_tq_stats_empty_end_internal(tq);
+}
+
+
+
+
+/**
+   @brief Add current period of drained queue to statistics of queue
+
+   Called only by consumer.
+
+   @param[in] tq tone queue
+*/
+static void cw_tq_stats_empty_end_internal(cw_tone_queue_t * tq)
+{
+	const uint64_t empty_since_ns = tq->stats.empty_since_ns;
+	if (0 == empty_since_ns) {
+		return;
+	}
+
+	const uint64_t now = cw_tq_monotonic_ns_internal();
+	__atomic_store_n(&tq->stats.empty_since_ns, 0, __ATOMIC_RELAXED);
+	if (now > empty_since_ns) {
+		__atomic_add_fetch(&tq->stats.empty_ns, now - empty_since_ns, __ATOMIC_RELAXED);
+	}
+}
+
+
+
+
+/**
+   @brief Get current time of monotonic clock, in nanoseconds
+
+   @return current time (never zero)
+*/
+static uint64_t cw_tq_monotonic_ns_internal(void)
+{
+	struct timespec now = { 0 };
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	const uint64_t ns = (uint64_t) now.tv_sec * CW_NSECS_PER_SEC + (uint64_t) now.tv_nsec;
+	return 0 == ns ? 1 : ns;
+}
@@ -17,6 +17,7 @@
 #include <pthread.h>    /* pthread_mutex_t */
 #include <stdbool.h>    /* bool */
 #include <stdint.h>     /* uint32_t */
+#include <time.h>       /* struct timespec */
 
 
 
@@ -190,11 +191,33 @@ typedef struct {
 
 	/* Useful for marking individual tones during debugging. */
 	char debug_id;
+
+	/* Character-level queue mode (see cw_gen_set_queue_mode()): the
+	   entry is not a tone but a character, expanded into Marks and
+	   Spaces by generator when it is dequeued. Zero for regular
+	   tones. */
+	char symbol;
+
+	/* Flags of character in ->symbol, CW_TONE_SYMBOL_* values. */
+	unsigned char symbol_flags;
 } cw_tone_t;
 
 
 
 
+enum {
+	/* Don't add inter-character-space after the character. */
+	CW_TONE_SYMBOL_NO_ICS    = 1 << 0,
+
+	/* Spaces enqueued right before the character. Needed to
+	   calculate duration of inter-word-space (' ' character). */
+	CW_TONE_SYMBOL_AFTER_IMS = 1 << 1,
+	CW_TONE_SYMBOL_AFTER_ICS = 1 << 2
+};
+
+
+
+
 
 /* Set values of tone's fields. Some field are set with values given
    as arguments to the macro. Other are initialized with default
@@ -213,6 +236,8 @@ typedef struct {
 		(m_tone)->rising_slope_n_samples  = 0;			\
 		(m_tone)->falling_slope_n_samples = 0;			\
 		(m_tone)->debug_id                = 0;			\
+		(m_tone)->symbol                  = 0;			\
+		(m_tone)->symbol_flags            = 0;			\
 	}
 
 
@@ -230,34 +255,181 @@ typedef struct {
 		(m_dest)->rising_slope_n_samples  = (m_source)->rising_slope_n_samples; \
 		(m_dest)->falling_slope_n_samples = (m_source)->falling_slope_n_samples; \
 		(m_dest)->debug_id                = (m_source)->debug_id; \
+		(m_dest)->symbol                  = (m_source)->symbol; \
+		(m_dest)->symbol_flags            = (m_source)->symbol_flags; \
 	};
 
 
 
 
 
+/* Channels on which threads wait for events in tone queue. An event wakes
+   up only threads waiting on channel of the event. */
+typedef enum {
+	/* A tone has been enqueued. Generator with empty queue waits
+	   for this. */
+	CW_TQ_WAIT_TONE_AVAILABLE = 0,
+
+	/* Count of tones in queue has decreased. */
+	CW_TQ_WAIT_LEVEL,
+
+	/* Generator has ended playing a tone and has dequeued a next
+	   one, or the queue has gone empty. */
+	CW_TQ_WAIT_TONE_END,
+
+	/* Graph state of iambic keyer using the queue's generator has
+	   changed. */
+	CW_TQ_WAIT_KEY_GRAPH,
+
+	CW_TQ_WAIT_CHANNELS_COUNT
+} cw_tq_wait_channel_id_t;
+
+
+
+
+typedef struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+
+	/* Count of threads waiting (or about to wait) on ->cond. See
+	   cw_tq_waiter_lock_internal(). */
+	int n_waiters;
+} cw_tq_wait_channel_t;
+
+
+
+
+/* Values of cw_tq_tone_t::flags. */
+enum {
+	CW_TQ_TONE_FOREVER = 1 << 0,   /* cw_tone_t::is_forever */
+	CW_TQ_TONE_FIRST   = 1 << 1    /* cw_tone_t::is_first */
+};
+
+
+
+
+/* Tone as it is stored in tone queue.
+
+   Only fields set by code enqueueing a tone are stored, in 12 bytes.
+   Fields calculated by generator (counts of samples) exist only in
+   cw_tone_t, into which the record is converted when it is dequeued.
+   Frequency fits into 16 bits because enqueue function accepts only
+   frequencies from CW_FREQUENCY_MIN-CW_FREQUENCY_MAX range. */
+typedef struct {
+	int32_t duration;       /* [us] */
+	uint16_t frequency;     /* [Hz] */
+	uint8_t slope_mode;     /* cw_tone_slope_mode_t */
+	uint8_t flags;          /* CW_TQ_TONE_* values. */
+	char debug_id;
+	char symbol;
+	unsigned char symbol_flags;
+} cw_tq_tone_t;
+
+
+
+
+/* Count of tones that a producer can stage before they are committed
+   to tone queue. Enough for a few characters. */
+#define CW_TQ_STAGING_CAPACITY 64
+
+
+
+
+/* Staging buffer of a producer of tones.
+
+   A producer puts tones into its own staging buffer with
+   cw_tq_stage_internal(), and the tones are moved to tone queue in
+   batches of whole characters (a character begins with a tone with
+   ->is_first flag set). Characters enqueued by different producers
+   don't interleave, and a producer takes the producer mutex of queue
+   once per batch instead of once per tone.
+
+   The buffer is usually a local variable of a function that enqueues
+   characters. */
+typedef struct {
+	cw_tone_t tones[CW_TQ_STAGING_CAPACITY];
+	size_t n_tones;
+
+	/* Count of tones of complete characters: tones before the first
+	   tone of last (possibly incomplete) character. */
+	size_t n_complete;
+
+	/* Producer's counter of units of space at the end of tone queue
+	   (see cw_gen_t::space_units_count), or NULL. The counter is
+	   read and updated by cw_tq_commit_internal() under producer
+	   mutex of queue. */
+	int * space_units_counter;
+
+	/* Value of the counter that the staged tones were calculated
+	   for, or -1 if the staged tones don't depend on it. */
+	int space_units_count_assumed;
+
+	/* Count of units of space at the end of staged tones. */
+	int space_units_count;
+} cw_tq_staging_t;
+
+
+
+
 struct cw_gen_struct;
 
 typedef struct {
-	volatile cw_tone_t queue[CW_TONE_QUEUE_CAPACITY_MAX];
+	/* Tone queue is a ring shared by one producer (code enqueueing
+	   tones) and one consumer (generator dequeueing tones). Producer
+	   and consumer don't lock each other out: slots of ring are
+	   handed over with atomic updates of ->n_enqueued and
+	   ->n_dequeued. See libcw_tq.c for details.
+
+	   The storage has ->capacity slots, and is reallocated when the
+	   capacity is changed. */
+	cw_tq_tone_t * queue;
 
 	/* Tail index of tone queue. Index of last (newest) inserted
 	   tone, index of tone to be dequeued from the list as a last
 	   one.
 
-	   The index is incremented *after* adding a tone to queue. */
-	volatile size_t tail;
+	   The index is incremented *after* adding a tone to queue.
+
+	   Written only by producer. */
+	size_t tail;
 
 	/* Head index of tone queue. Index of first (oldest) tone
 	   inserted to the queue. Index of the tone to be dequeued
-	   from the queue as a first one. */
-	volatile size_t head;
+	   from the queue as a first one.
 
+	   Written only by consumer. */
+	size_t head;
+
+	/* State returned by last dequeue. Written only by consumer. Use
+	   cw_tq_get_state_internal() to get current state of queue. */
 	cw_queue_state_t state;
 
 	size_t capacity;
 	size_t high_water_mark;
-	size_t len;
+
+	/* Counts of tones enqueued (written only by producer) and dequeued
+	   (written only by consumer) since creation of queue. Their
+	   difference is a count of tones in queue. Use
+	   cw_tq_length_internal() to get it.
+
+	   Flush and removal of last character also write the counters,
+	   with consumer kept out of dequeue. ->n_dequeued only grows.
+	   ->n_enqueued is lowered by removal of last character, so it
+	   can't be used alone to detect changes of contents of queue.
+	   See libcw_tq.c for details. */
+	size_t n_enqueued;
+	size_t n_dequeued;
+
+	/* Count of flushes of queue. Consumer that keeps tones outside
+	   of the queue (see cw_gen_t::expansion) discards them when the
+	   count changes. */
+	size_t n_flushes;
+
+	/* Count of removals of last character from queue. Together
+	   with ->n_enqueued it tells consumer that contents of queue
+	   have changed: a removal followed by an enqueue gives
+	   ->n_enqueued its old value. */
+	size_t n_removals;
 
 	/* It's useful to have the tone queue dequeue function call
 	   a client-supplied callback routine when the amount of data
@@ -268,10 +440,50 @@ typedef struct {
 	void     * low_water_callback_arg;
 
 
+	/* Serializes producers. With one producer the mutex is never
+	   contended. Consumer never locks it, except when it has to give
+	   way to an operation that modifies the whole queue (flush,
+	   removal of last character). */
+	pthread_mutex_t producer_mutex;
+
+	/* Set by operation that modifies the whole queue, when it waits
+	   for consumer to get out of dequeue function. */
+	bool exclusive;
+
+	/* Set by consumer when it is in dequeue function. */
+	bool consumer_active;
+
 	/* Inter-thread communication. Used to broadcast queue events to
-	   waiting functions. */
-	pthread_cond_t wait_var;
-	pthread_mutex_t wait_mutex;
+	   waiting functions, one channel per kind of event. Queue
+	   operations don't touch mutex and condition variable of a
+	   channel as long as nobody waits on the channel. */
+	cw_tq_wait_channel_t wait_channels[CW_TQ_WAIT_CHANNELS_COUNT];
+
+	/* Pollable file descriptor for events of generator, see
+	   cw_gen_get_event_fd(). ->event_fd is a read end, and
+	   ->event_fd_write is a write end (the same descriptor if
+	   eventfd is used). Both are -1 until a client asks for the
+	   descriptor. */
+	int event_fd;
+	int event_fd_write;
+	unsigned int event_mask;      /* Events watched by client. */
+	size_t event_level;           /* Level for CW_GEN_EVENT_LEVEL. */
+	unsigned int events_pending;  /* Events not read by client yet. */
+	pthread_mutex_t event_fd_mutex;
+
+	/* Statistics of queue, see cw_gen_get_queue_stats(). They are
+	   updated and read with atomic operations, so reading them
+	   never blocks producers or consumer. */
+	struct {
+		uint64_t n_enqueued;
+		uint64_t n_dequeued;
+		uint64_t n_rejected;
+		size_t max_length;
+		uint64_t n_drains;
+		uint64_t empty_ns;
+		uint64_t empty_since_ns; /* Start of current period of drained queue, zero if queue isn't drained. Written only by consumer. */
+		uint64_t lock_wait_ns;
+	} stats;
 
 	/* Generator associated with a tone queue. */
 	struct cw_gen_struct * gen;
@@ -288,17 +500,41 @@ void              cw_tq_flush_internal(cw_tone_queue_t * tq);
 size_t cw_tq_capacity_internal(const cw_tone_queue_t * tq);
 size_t cw_tq_length_internal(cw_tone_queue_t * tq);
 cw_ret_t cw_tq_enqueue_internal(cw_tone_queue_t * tq, const cw_tone_t * tone);
+cw_ret_t cw_tq_enqueue_many_internal(cw_tone_queue_t * tq, const cw_tone_t * tones, size_t n_tones);
+cw_ret_t cw_tq_enqueue_many_counted_internal(cw_tone_queue_t * tq, const cw_tone_t * tones, size_t n_tones, int * space_units_counter, int assumed, int updated);
 cw_queue_state_t cw_tq_dequeue_internal(cw_tone_queue_t * tq, cw_tone_t * tone);
 
+void cw_tq_staging_init_internal(cw_tq_staging_t * staging);
+cw_ret_t cw_tq_stage_internal(cw_tone_queue_t * tq, cw_tq_staging_t * staging, const cw_tone_t * tone);
+cw_ret_t cw_tq_commit_internal(cw_tone_queue_t * tq, cw_tq_staging_t * staging);
+
 cw_ret_t cw_tq_wait_for_level_internal(cw_tone_queue_t * tq, size_t level);
+cw_ret_t cw_tq_wait_for_level_timed_internal(cw_tone_queue_t * tq, size_t level, const struct timespec * deadline);
 cw_ret_t cw_tq_register_low_level_callback_internal(cw_tone_queue_t * tq, cw_queue_low_callback_t callback_func, void * callback_arg, size_t level);
 bool cw_tq_is_nonempty_internal(const cw_tone_queue_t * tq);
 cw_ret_t cw_tq_wait_for_end_of_current_tone_internal(cw_tone_queue_t * tq);
+cw_ret_t cw_tq_wait_for_end_of_current_tone_timed_internal(cw_tone_queue_t * tq, const struct timespec * deadline);
 void cw_tq_reset_internal(cw_tone_queue_t * tq);
 bool cw_tq_is_full_internal(const cw_tone_queue_t * tq);
+cw_queue_state_t cw_tq_get_state_internal(const cw_tone_queue_t * tq);
+
+void cw_tq_waiter_lock_internal(cw_tone_queue_t * tq, cw_tq_wait_channel_id_t channel);
+void cw_tq_waiter_wait_internal(cw_tone_queue_t * tq, cw_tq_wait_channel_id_t channel);
+int cw_tq_waiter_timedwait_internal(cw_tone_queue_t * tq, cw_tq_wait_channel_id_t channel, const struct timespec * deadline);
+void cw_tq_waiter_unlock_internal(cw_tone_queue_t * tq, cw_tq_wait_channel_id_t channel);
+void cw_tq_notify_waiters_internal(cw_tone_queue_t * tq, cw_tq_wait_channel_id_t channel);
+void cw_tq_notify_all_waiters_internal(cw_tone_queue_t * tq);
+
+int cw_tq_get_event_fd_internal(cw_tone_queue_t * tq, unsigned int events, size_t level);
+unsigned int cw_tq_read_events_internal(cw_tone_queue_t * tq);
+void cw_tq_post_event_internal(cw_tone_queue_t * tq, unsigned int event);
 
 cw_ret_t cw_tq_remove_last_character_internal(cw_tone_queue_t * tq);
 
+void cw_tq_get_stats_internal(const cw_tone_queue_t * tq, cw_gen_queue_stats_t * stats);
+void cw_tq_stats_rejected_internal(cw_tone_queue_t * tq);
+void cw_tq_stats_consumer_stopped_internal(cw_tone_queue_t * tq);
+
 
 
 
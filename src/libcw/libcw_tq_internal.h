@@ -26,6 +26,8 @@ CW_STATIC_FUNC size_t cw_tq_prev_index_internal(const cw_tone_queue_t * tq, size
 CW_STATIC_FUNC size_t cw_tq_next_index_internal(const cw_tone_queue_t * tq, size_t ind);
 CW_STATIC_FUNC bool   cw_tq_dequeue_sub_internal(cw_tone_queue_t * tq, cw_tone_t * tone);
 CW_STATIC_FUNC void   cw_tq_make_empty_internal(cw_tone_queue_t * tq);
+CW_STATIC_FUNC void   cw_tq_tone_pack_internal(cw_tq_tone_t * record, const cw_tone_t * tone);
+CW_STATIC_FUNC void   cw_tq_tone_unpack_internal(cw_tone_t * tone, const cw_tq_tone_t * record);
 
 
 
@@ -451,6 +451,73 @@ int cw_timestamp_compare_internal(const struct timeval * earlier, const struct t
 
 
 
+/**
+   @brief Compare two nanosecond timestamps
+
+   Nanosecond variant of cw_timestamp_compare_internal(). Return the
+   difference between timestamps in microseconds, clamped to INT_MAX.
+   Like in cw_timestamp_compare_internal(), a negative difference is
+   also clamped to INT_MAX.
+
+   @param[in] earlier_ns earlier (older) timestamp to compare [nanoseconds]
+   @param[in] later_ns later (newer) timestamp to compare [nanoseconds]
+
+   @return difference between timestamps (in microseconds)
+*/
+int cw_timestamp_compare_ns_internal(int64_t earlier_ns, int64_t later_ns)
+{
+	/* Check the order before dividing: difference smaller than
+	   1 microsecond would be truncated to zero. */
+	if (later_ns < earlier_ns) {
+		return INT_MAX;
+	}
+
+	/* Both timestamps are non-negative, so the subtraction
+	   can't overflow. */
+	const int64_t delta_usec = (later_ns - earlier_ns) / 1000;
+	if (delta_usec > INT_MAX) {
+		return INT_MAX;
+	}
+	return (int) delta_usec;
+}
+
+
+
+
+/**
+   @brief Convert timeval timestamp into nanosecond timestamp
+
+   The @p in_timestamp is validated (or current time is taken if it
+   is NULL) with cw_timestamp_validate_internal(), and is then put
+   into @p out_ns.
+
+   @exception EINVAL @p in_timestamp is invalid or can't be represented in nanoseconds
+
+   @param[out] out_ns converted timestamp [nanoseconds]
+   @param[in] in_timestamp timestamp to be converted (may be NULL)
+
+   @return CW_SUCCESS on success
+   @return CW_FAILURE on failure
+*/
+cw_ret_t cw_timestamp_to_ns_internal(int64_t * out_ns, const struct timeval * in_timestamp)
+{
+	struct timeval timestamp;
+	if (CW_SUCCESS != cw_timestamp_validate_internal(&timestamp, in_timestamp)) {
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+	if (timestamp.tv_sec > INT64_MAX / CW_NSECS_PER_SEC - 1) {
+		errno = EINVAL;
+		return CW_FAILURE;
+	}
+
+	*out_ns = (int64_t) timestamp.tv_sec * CW_NSECS_PER_SEC + (int64_t) timestamp.tv_usec * 1000;
+	return CW_SUCCESS;
+}
+
+
+
+
 
 /* Morse code controls and timing parameters. */
 
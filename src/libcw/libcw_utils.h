@@ -27,12 +27,15 @@ extern "C"
 
 
 #define CW_USECS_PER_SEC (1 * 1000 * 1000)  /**< Microseconds in a second. */
+#define CW_NSECS_PER_SEC (1 * 1000 * 1000 * 1000)  /**< Nanoseconds in a second. */
 
 
 
 
 int cw_timestamp_compare_internal(const struct timeval * earlier, const struct timeval * later);
 cw_ret_t cw_timestamp_validate_internal(struct timeval * out_timestamp, const struct timeval * in_timestamp);
+int cw_timestamp_compare_ns_internal(int64_t earlier_ns, int64_t later_ns);
+cw_ret_t cw_timestamp_to_ns_internal(int64_t * out_ns, const struct timeval * in_timestamp);
 void cw_usecs_to_timespec_internal(struct timespec * ts, int usecs);
 
 
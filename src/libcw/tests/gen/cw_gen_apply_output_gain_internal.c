@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2001-2006  Simon Baldwin (simon_baldwin@yahoo.com)
+ * Copyright (C) 2011-2023  Kamil Ignacak (acerion@wp.pl)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+
+
+
+/**
+   @file cw_gen_apply_output_gain_internal.c
+
+   Test of generator's output gain stage.
+*/
+
+
+
+
+#include <stdlib.h>
+
+#include "common.h"
+#include "libcw_gen.h"
+#include "libcw_tq.h"
+#include "cw_gen_apply_output_gain_internal.h"
+
+
+
+
+#define TONE_DURATION 100000 /* [us] */
+
+
+
+
+static int render_tone(cw_test_executor_t * cte, cw_gen_t * gen, cw_sample_t ** samples, size_t * size, size_t * n_samples);
+static int peak(const cw_sample_t * samples, size_t first, size_t last);
+
+
+
+
+/**
+   @brief Render a single tone without slopes
+
+   @return 0 on success
+   @return -1 on failure
+*/
+static int render_tone(cw_test_executor_t * cte, cw_gen_t * gen, cw_sample_t ** samples, size_t * size, size_t * n_samples)
+{
+	cw_tone_t tone;
+	CW_TONE_INIT(&tone, gen->frequency, TONE_DURATION, CW_SLOPE_MODE_NO_SLOPES);
+	cw_tq_enqueue_internal(gen->tq, &tone);
+
+	if (CW_SUCCESS != cw_gen_render(gen, samples, size, n_samples)) {
+		kite_log(cte, LOG_ERR, "failed to render tone");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+
+/**
+   @brief Get max absolute value of samples in range [first, last)
+*/
+static int peak(const cw_sample_t * samples, size_t first, size_t last)
+{
+	int result = 0;
+	for (size_t i = first; i < last; i++) {
+		const int value = abs(samples[i]);
+		if (value > result) {
+			result = value;
+		}
+	}
+	return result;
+}
+
+
+
+
+/**
+   @brief Test generator's output gain stage
+
+   Volume of generator is applied to rendered samples. Change of volume
+   doesn't invalidate cache of marks, and the new volume is reached
+   after a short ramp at the beginning of the next sound buffer.
+
+   @param cte test executor
+
+   @return cwt_retv_ok if execution of the test was carried out without interruptions
+   @return cwt_retv_err if execution of the test had to be aborted
+*/
+cwt_retv test_cw_gen_apply_output_gain_internal(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, __func__);
+
+	cw_gen_t * gen = cw_gen_new(&cte->current_gen_conf);
+	if (NULL == gen) {
+		cte->log_error(cte, "%s:%d: Failed to create tested generator\n", __func__, __LINE__);
+		return cwt_retv_err;
+	}
+
+	cw_sample_t * samples = NULL;
+	size_t size = 0;
+	size_t n_samples = 0;
+
+	/* Ramp from initial volume to 50% happens during first tone. */
+	cw_gen_set_volume(gen, 50);
+	if (0 != render_tone(cte, gen, &samples, &size, &n_samples)) {
+		free(samples);
+		cw_gen_delete(&gen);
+		return cwt_retv_err;
+	}
+	const int half_volume_peak = peak(samples, n_samples / 2, n_samples);
+	cte->expect_op_int(cte, 16300, "<=", half_volume_peak, "peak at volume 50%% (lower bound)");
+	cte->expect_op_int(cte, 16384, ">=", half_volume_peak, "peak at volume 50%% (upper bound)");
+
+
+	const unsigned int generation = gen->mark_cache.generation;
+	LIBCW_TEST_FUT(cw_gen_set_volume)(gen, 100);
+	cte->expect_op_int(cte, generation, "==", gen->mark_cache.generation, "change of volume doesn't invalidate cache of marks");
+
+	if (0 != render_tone(cte, gen, &samples, &size, &n_samples)) {
+		free(samples);
+		cw_gen_delete(&gen);
+		return cwt_retv_err;
+	}
+
+	/* Ramp lasts 5 ms: at the beginning of the tone the gain is
+	   still close to previous volume. */
+	const int ramp_start_peak = peak(samples, 0, 24);
+	cte->expect_op_int(cte, 19000, ">", ramp_start_peak, "peak at the beginning of ramp");
+
+	const int full_volume_peak = peak(samples, n_samples / 2, n_samples);
+	cte->expect_op_int(cte, 32700, "<=", full_volume_peak, "peak at volume 100%%");
+
+	free(samples);
+	cw_gen_delete(&gen);
+
+	cte->print_test_footer(cte, __func__);
+
+	return cwt_retv_ok;
+}
@@ -0,0 +1,18 @@
+#ifndef _LIBCW_TESTS_CW_GEN_APPLY_OUTPUT_GAIN_INTERNAL_H_
+#define _LIBCW_TESTS_CW_GEN_APPLY_OUTPUT_GAIN_INTERNAL_H_
+
+
+
+
+#include "test_framework.h"
+
+
+
+
+cwt_retv test_cw_gen_apply_output_gain_internal(cw_test_executor_t * cte);
+
+
+
+
+#endif /* #ifndef _LIBCW_TESTS_CW_GEN_APPLY_OUTPUT_GAIN_INTERNAL_H_ */
+
@@ -0,0 +1,263 @@
+/*
+ * Copyright (C) 2001-2006  Simon Baldwin (simon_baldwin@yahoo.com)
+ * Copyright (C) 2011-2023  Kamil Ignacak (acerion@wp.pl)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+
+
+
+/**
+   @file cw_gen_calculate_sine_wave_internal.c
+
+   Test of cw_gen_calculate_sine_wave_internal()
+*/
+
+
+
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "common.h"
+#include "libcw_gen.h"
+#include "libcw_gen_internal.h"
+#include "libcw_utils.h"
+#include "cw_gen_calculate_sine_wave_internal.h"
+
+
+
+
+/* Sizes of consecutive buffer subareas filled by tested functions. Various
+   sizes test that phase of sine wave stays continuous between subareas of
+   any size. */
+static const int g_subarea_sizes[] = { 1, 7, 256, 33, 1024, 2, 500, 64, 65, 1000 };
+#define N_SUBAREA_SIZES ((int) (sizeof (g_subarea_sizes) / sizeof (g_subarea_sizes[0])))
+
+#define BUFFER_N_SAMPLES 1024
+
+
+
+
+typedef int (* sine_wave_function_t)(cw_gen_t * gen, cw_tone_t * tone);
+static int calculate_sine_wave(cw_gen_t * gen, cw_tone_t * tones, int n_tones, sine_wave_function_t function, cw_sample_t * output);
+static int calculate_sine_wave_duration(cw_gen_t * gen, cw_tone_t * tones, int n_tones, sine_wave_function_t function, cw_sample_t * output);
+static int max_deviation(const cw_sample_t * expected, const cw_sample_t * received, int n_samples);
+
+
+
+
+/**
+   @brief Calculate samples of @p n_tones tones with given function
+
+   The samples are calculated in subareas of generator's buffer of sizes
+   taken from g_subarea_sizes[], and are copied to @p output.
+
+   @return count of calculated samples
+*/
+static int calculate_sine_wave(cw_gen_t * gen, cw_tone_t * tones, int n_tones, sine_wave_function_t function, cw_sample_t * output)
+{
+	gen->phase_offset = 0.0F;
+
+	int n = 0;
+	int s = 0;
+	for (int t = 0; t < n_tones; t++) {
+		cw_tone_t * tone = &tones[t];
+		tone->sample_iterator = 0;
+
+		while (tone->sample_iterator < tone->n_samples) {
+			int size = g_subarea_sizes[s++ % N_SUBAREA_SIZES];
+			if (size > tone->n_samples - tone->sample_iterator) {
+				size = (int) (tone->n_samples - tone->sample_iterator);
+			}
+			gen->buffer_sub_start = 0;
+			gen->buffer_sub_stop = size - 1;
+
+			const int calculated = function(gen, tone);
+			memcpy(output + n, gen->buffer, (size_t) calculated * sizeof (cw_sample_t));
+			n += calculated;
+		}
+	}
+
+	return n;
+}
+
+
+
+
+/**
+   @brief Measure time of calculation of samples of @p n_tones tones
+
+   @return the shortest time of few calculations [us], at least 1
+*/
+static int calculate_sine_wave_duration(cw_gen_t * gen, cw_tone_t * tones, int n_tones, sine_wave_function_t function, cw_sample_t * output)
+{
+	int best = INT_MAX;
+	for (int i = 0; i < 5; i++) {
+		struct timeval start;
+		struct timeval stop;
+		gettimeofday(&start, NULL);
+		calculate_sine_wave(gen, tones, n_tones, function, output);
+		gettimeofday(&stop, NULL);
+
+		const int duration = cw_timestamp_compare_internal(&start, &stop) + 1; /* +1 to avoid division by zero. */
+		if (duration < best) {
+			best = duration;
+		}
+	}
+	return best;
+}
+
+
+
+
+/**
+   @brief Get the largest difference between values of samples
+
+   @return max deviation
+*/
+static int max_deviation(const cw_sample_t * expected, const cw_sample_t * received, int n_samples)
+{
+	int result = 0;
+	for (int i = 0; i < n_samples; i++) {
+		const int deviation = abs(expected[i] - received[i]);
+		if (deviation > result) {
+			result = deviation;
+		}
+	}
+	return result;
+}
+
+
+
+
+/**
+   @brief Test cw_gen_calculate_sine_wave_internal()
+
+   Compare samples calculated by the oscillator with samples calculated
+   with sinf() for every sample, and compare speed of the two
+   implementations.
+
+   @param cte test executor
+
+   @return cwt_retv_ok if execution of the test was carried out without interruptions
+   @return cwt_retv_err if execution of the test had to be aborted
+*/
+cwt_retv test_cw_gen_calculate_sine_wave_internal(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, __func__);
+
+	/* Tested generator. The generator isn't started, the test only
+	   uses it as a container of parameters of sine wave. */
+	cw_gen_t * gen = cw_gen_new(&cte->current_gen_conf);
+	if (NULL == gen) {
+		cte->log_error(cte, "%s:%d: Failed to create tested generator\n", __func__, __LINE__);
+		return cwt_retv_err;
+	}
+
+	/* Null and Console sound systems don't have a buffer, so let's use
+	   our own. */
+	cw_sample_t * original_buffer = gen->buffer;
+	const int original_buffer_n_samples = gen->buffer_n_samples;
+	cw_sample_t buffer[BUFFER_N_SAMPLES] = { 0 };
+	gen->buffer = buffer;
+	gen->buffer_n_samples = BUFFER_N_SAMPLES;
+
+	const int n_samples = 10 * gen->sample_rate; /* 10 seconds of sound. */
+	cw_sample_t * expected = (cw_sample_t *) calloc((size_t) n_samples, sizeof (cw_sample_t));
+	cw_sample_t * received = (cw_sample_t *) calloc((size_t) n_samples, sizeof (cw_sample_t));
+	cte->assert2(cte, expected && received, "failed to allocate buffers for samples");
+
+	/* Test: tones with constant amplitude, so that the test is about
+	   the sine wave, not about slopes. Plateaus of tones longer than
+	   one second are copied from generator's wavetable instead of
+	   being calculated (see test_cw_gen_wavetable_internal()), so the
+	   tones here are one second long. */
+	const int frequencies[] = { CW_FREQUENCY_MIN + 1, 440, CW_FREQUENCY_INITIAL, 1234, CW_FREQUENCY_MAX };
+	for (size_t f = 0; f < sizeof (frequencies) / sizeof (frequencies[0]); f++) {
+		cw_tone_t tone;
+		CW_TONE_INIT(&tone, frequencies[f], 0, CW_SLOPE_MODE_NO_SLOPES);
+		tone.n_samples = gen->sample_rate;
+
+		/* The best of few runs, to reduce impact of other processes
+		   running on the machine. */
+		const int sinf_duration = calculate_sine_wave_duration(gen, &tone, 1, cw_gen_calculate_sine_wave_sinf_internal, expected);
+		const int oscillator_duration = calculate_sine_wave_duration(gen, &tone, 1, LIBCW_TEST_FUT(cw_gen_calculate_sine_wave_internal), received);
+		const int deviation = max_deviation(expected, received, (int) tone.n_samples);
+
+		cte->log_info(cte, "frequency %4d Hz: sinf(): %.1f Msamples/s, oscillator: %.1f Msamples/s, max deviation: %d\n",
+			      frequencies[f],
+			      (double) tone.n_samples / sinf_duration,
+			      (double) tone.n_samples / oscillator_duration,
+			      deviation);
+
+		/* sinf() works on floats, so in reference samples there
+		   are errors too. Deviations of few units (out of 32767)
+		   are inaudible. */
+		cte->expect_op_int(cte, 4, ">=", deviation, "max deviation for %d Hz", frequencies[f]);
+		cte->expect_op_double(cte, 1.0, "<", 1.0 * sinf_duration / oscillator_duration,
+				      "speed gain for %d Hz: %.2f", frequencies[f], 1.0 * sinf_duration / oscillator_duration);
+	}
+
+
+	/* Test: Morse code, i.e. marks with slopes and spaces, the way
+	   generator calculates them. */
+	{
+		const int unit = 60000; /* Duration of dot at 20 WPM. [us] */
+		const int slope_n_samples = ((gen->sample_rate / 100) * gen->tone_slope.duration) / 10000;
+		cw_tone_t tones[40];
+		int total_n_samples = 0;
+		for (int t = 0; t < 40; t++) {
+			const bool is_mark = 0 == t % 2;
+			const int duration = (0 == t % 3 ? 3 : 1) * unit;
+			CW_TONE_INIT(&tones[t], is_mark ? CW_FREQUENCY_INITIAL : 0, duration, is_mark ? CW_SLOPE_MODE_STANDARD_SLOPES : CW_SLOPE_MODE_NO_SLOPES);
+			tones[t].n_samples = ((gen->sample_rate / 100) * duration) / 10000;
+			if (is_mark) {
+				tones[t].rising_slope_n_samples = slope_n_samples;
+				tones[t].falling_slope_n_samples = slope_n_samples;
+			}
+			total_n_samples += (int) tones[t].n_samples;
+		}
+		cte->assert2(cte, total_n_samples <= n_samples, "buffers are too small for %d samples", total_n_samples);
+
+		const int sinf_duration = calculate_sine_wave_duration(gen, tones, 40, cw_gen_calculate_sine_wave_sinf_internal, expected);
+		const int oscillator_duration = calculate_sine_wave_duration(gen, tones, 40, LIBCW_TEST_FUT(cw_gen_calculate_sine_wave_internal), received);
+		const int deviation = max_deviation(expected, received, total_n_samples);
+
+		cte->log_info(cte, "Morse code: sinf(): %.1f Msamples/s, oscillator: %.1f Msamples/s, max deviation: %d\n",
+			      (double) total_n_samples / sinf_duration,
+			      (double) total_n_samples / oscillator_duration,
+			      deviation);
+
+		cte->expect_op_int(cte, 4, ">=", deviation, "max deviation for Morse code");
+		cte->expect_op_double(cte, 1.0, "<", 1.0 * sinf_duration / oscillator_duration,
+				      "speed gain for Morse code: %.2f", 1.0 * sinf_duration / oscillator_duration);
+	}
+
+	free(expected);
+	free(received);
+
+	gen->buffer = original_buffer;
+	gen->buffer_n_samples = original_buffer_n_samples;
+	cw_gen_delete(&gen);
+
+	cte->print_test_footer(cte, __func__);
+
+	return cwt_retv_ok;
+}
@@ -0,0 +1,18 @@
+#ifndef _LIBCW_TESTS_CW_GEN_CALCULATE_SINE_WAVE_INTERNAL_H_
+#define _LIBCW_TESTS_CW_GEN_CALCULATE_SINE_WAVE_INTERNAL_H_
+
+
+
+
+#include "test_framework.h"
+
+
+
+
+cwt_retv test_cw_gen_calculate_sine_wave_internal(cw_test_executor_t * cte);
+
+
+
+
+#endif /* #ifndef _LIBCW_TESTS_CW_GEN_CALCULATE_SINE_WAVE_INTERNAL_H_ */
+
@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) 2001-2006  Simon Baldwin (simon_baldwin@yahoo.com)
+ * Copyright (C) 2011-2023  Kamil Ignacak (acerion@wp.pl)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+
+
+
+/**
+   @file cw_gen_mark_cache_internal.c
+
+   Test of generator's cache of marks.
+*/
+
+
+
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "libcw_gen.h"
+#include "libcw_gen_internal.h"
+#include "libcw_tq.h"
+#include "cw_gen_mark_cache_internal.h"
+
+
+
+
+#define MARK_DURATION  60000 /* [us] */
+#define SPACE_DURATION 60000 /* [us] */
+
+
+
+
+static int render_marks(cw_test_executor_t * cte, cw_gen_t * gen, cw_sample_t ** samples, size_t * size, int * mark_n_samples, int * space_n_samples);
+static int reference_mark_deviation(cw_gen_t * gen, const cw_sample_t * mark, int n_samples);
+static int render_space(cw_test_executor_t * cte, cw_gen_t * gen, cw_sample_t ** samples, size_t * size);
+
+
+
+
+/**
+   @brief Render two marks separated and followed by spaces
+
+   @return 0 on success
+   @return -1 on failure
+*/
+static int render_marks(cw_test_executor_t * cte, cw_gen_t * gen, cw_sample_t ** samples, size_t * size, int * mark_n_samples, int * space_n_samples)
+{
+	for (int i = 0; i < 2; i++) {
+		cw_tone_t tone;
+		CW_TONE_INIT(&tone, gen->frequency, MARK_DURATION, CW_SLOPE_MODE_STANDARD_SLOPES);
+		cw_tq_enqueue_internal(gen->tq, &tone);
+		CW_TONE_INIT(&tone, 0, SPACE_DURATION, CW_SLOPE_MODE_NO_SLOPES);
+		cw_tq_enqueue_internal(gen->tq, &tone);
+	}
+
+	*mark_n_samples = (int) (((gen->sample_rate / 100) * MARK_DURATION) / 10000);
+	*space_n_samples = (int) (((gen->sample_rate / 100) * SPACE_DURATION) / 10000);
+
+	size_t n_samples = 0;
+	if (CW_SUCCESS != cw_gen_render(gen, samples, size, &n_samples)) {
+		kite_log(cte, LOG_ERR, "failed to render marks");
+		return -1;
+	}
+	if (n_samples != (size_t) (2 * (*mark_n_samples + *space_n_samples))) {
+		kite_log(cte, LOG_ERR, "unexpected count of rendered samples: %zu", n_samples);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+
+/**
+   @brief Render a single space
+
+   @return 0 on success
+   @return -1 on failure
+*/
+static int render_space(cw_test_executor_t * cte, cw_gen_t * gen, cw_sample_t ** samples, size_t * size)
+{
+	cw_tone_t tone;
+	CW_TONE_INIT(&tone, 0, SPACE_DURATION, CW_SLOPE_MODE_NO_SLOPES);
+	cw_tq_enqueue_internal(gen->tq, &tone);
+
+	size_t n_samples = 0;
+	if (CW_SUCCESS != cw_gen_render(gen, samples, size, &n_samples)) {
+		kite_log(cte, LOG_ERR, "failed to render space");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+
+/**
+   @brief Compare samples of a mark with samples calculated with sinf()
+
+   The reference samples are calculated with current parameters of
+   generator, starting with phase zero.
+
+   @return max deviation between samples, or INT_MAX on errors
+*/
+static int reference_mark_deviation(cw_gen_t * gen, const cw_sample_t * mark, int n_samples)
+{
+	cw_sample_t * reference = (cw_sample_t *) calloc((size_t) n_samples, sizeof (cw_sample_t));
+	if (NULL == reference) {
+		return INT_MAX;
+	}
+
+	const int slope_n_samples = (int) (((gen->sample_rate / 100) * gen->tone_slope.duration) / 10000);
+	cw_tone_t tone;
+	CW_TONE_INIT(&tone, gen->frequency, MARK_DURATION, CW_SLOPE_MODE_STANDARD_SLOPES);
+	tone.n_samples = n_samples;
+	tone.rising_slope_n_samples = slope_n_samples;
+	tone.falling_slope_n_samples = slope_n_samples;
+
+	/* Calculate all samples in one subarea of a buffer. */
+	cw_sample_t * original_buffer = gen->buffer;
+	const int original_buffer_n_samples = gen->buffer_n_samples;
+	gen->buffer = reference;
+	gen->buffer_n_samples = n_samples;
+	gen->buffer_sub_start = 0;
+	gen->buffer_sub_stop = n_samples - 1;
+	gen->phase_offset = 0.0F;
+
+	cw_gen_calculate_sine_wave_sinf_internal(gen, &tone);
+
+	gen->buffer = original_buffer;
+	gen->buffer_n_samples = original_buffer_n_samples;
+	gen->buffer_sub_start = 0;
+	gen->buffer_sub_stop = 0;
+
+	int result = 0;
+	for (int i = 0; i < n_samples; i++) {
+		/* Reference samples have full amplitude, rendered samples
+		   have generator's volume applied by output gain stage. */
+		const int expected = reference[i] * gen->volume_abs / 32768;
+		const int deviation = abs(expected - mark[i]);
+		if (deviation > result) {
+			result = deviation;
+		}
+	}
+
+	free(reference);
+	return result;
+}
+
+
+
+
+/**
+   @brief Test generator's cache of marks
+
+   Marks with rising slope are calculated once, and then their samples
+   are taken from the cache. Test that samples from the cache are
+   correct, and that the cache is invalidated when parameters of tones
+   change. Change of volume doesn't invalidate the cache, but the
+   rendered marks must have the new volume.
+
+   @param cte test executor
+
+   @return cwt_retv_ok if execution of the test was carried out without interruptions
+   @return cwt_retv_err if execution of the test had to be aborted
+*/
+cwt_retv test_cw_gen_mark_cache_internal(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, __func__);
+
+	/* Tested generator. The generator isn't started, its tones are
+	   rendered into memory. */
+	cw_gen_t * gen = cw_gen_new(&cte->current_gen_conf);
+	if (NULL == gen) {
+		cte->log_error(cte, "%s:%d: Failed to create tested generator\n", __func__, __LINE__);
+		return cwt_retv_err;
+	}
+
+	cw_sample_t * samples = NULL;
+	size_t size = 0;
+	int mark_n_samples = 0;
+	int space_n_samples = 0;
+
+	/* Each iteration changes a parameter of tones that should
+	   invalidate the cache. */
+	for (int i = 0; i < 5; i++) {
+		const char * label = "";
+		switch (i) {
+		case 0:
+			label = "initial parameters";
+			break;
+		case 1:
+			label = "changed volume";
+			cw_gen_set_volume(gen, 30);
+			/* Let the output gain reach new volume before the
+			   marks are rendered. */
+			if (0 != render_space(cte, gen, &samples, &size)) {
+				free(samples);
+				cw_gen_delete(&gen);
+				return cwt_retv_err;
+			}
+			break;
+		case 2:
+			label = "changed slope";
+			cw_gen_set_tone_slope(gen, CW_TONE_SLOPE_SHAPE_LINEAR, 3000);
+			break;
+		case 3:
+			/* Same count of samples in slopes, new table of
+			   amplitudes. */
+			label = "changed shape of slope";
+			cw_gen_set_tone_slope(gen, CW_TONE_SLOPE_SHAPE_SINE, 3000);
+			break;
+		case 4:
+			label = "changed frequency";
+			cw_gen_set_frequency(gen, 1234);
+			break;
+		default:
+			break;
+		}
+
+		if (0 != render_marks(cte, gen, &samples, &size, &mark_n_samples, &space_n_samples)) {
+			free(samples);
+			cw_gen_delete(&gen);
+			return cwt_retv_err;
+		}
+
+		const cw_sample_t * mark1 = samples;
+		const cw_sample_t * mark2 = samples + mark_n_samples + space_n_samples;
+
+		/* Second mark is taken from the cache. */
+		const int differs = memcmp(mark1, mark2, (size_t) mark_n_samples * sizeof (cw_sample_t));
+		cte->expect_op_int(cte, 0, "==", differs, "%s: marks are identical", label);
+
+		const int deviation = reference_mark_deviation(gen, mark1, mark_n_samples);
+		cte->expect_op_int(cte, 4, ">=", deviation, "%s: deviation from reference mark", label);
+	}
+
+	free(samples);
+	cw_gen_delete(&gen);
+
+	cte->print_test_footer(cte, __func__);
+
+	return cwt_retv_ok;
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2001-2006  Simon Baldwin (simon_baldwin@yahoo.com)
+ * Copyright (C) 2011-2023  Kamil Ignacak (acerion@wp.pl)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+
+
+
+/**
+   @file cw_gen_slope_table_internal.c
+
+   Test of tables of slope amplitudes shared by generators.
+*/
+
+
+
+
+#include <stdlib.h>
+
+#include "common.h"
+#include "libcw_gen.h"
+#include "libcw_gen_slope.h"
+#include "cw_gen_slope_table_internal.h"
+
+
+
+
+static void test_slope_table_contents(cw_test_executor_t * cte, const cw_slope_table_t * table);
+
+
+
+
+/**
+   @brief Test contents of a table of slope amplitudes
+
+   Rising slope starts at zero and doesn't decrease, all values are
+   valid Q15 factors, and falling slope is the rising slope in reversed
+   order.
+*/
+static void test_slope_table_contents(cw_test_executor_t * cte, const cw_slope_table_t * table)
+{
+	const int n = table->n_amplitudes;
+
+	bool rising_ok = 0 == table->amplitudes[0];
+	for (int i = 1; i < n; i++) {
+		if (table->amplitudes[i] < table->amplitudes[i - 1]) {
+			rising_ok = false;
+		}
+	}
+	cte->expect_op_int(cte, true, "==", rising_ok, "shape %d, %d amplitudes: rising slope", table->shape, n);
+
+	bool falling_ok = true;
+	for (int i = 0; i < n; i++) {
+		if (table->amplitudes[n + i] != table->amplitudes[n - 1 - i]) {
+			falling_ok = false;
+		}
+	}
+	cte->expect_op_int(cte, true, "==", falling_ok, "shape %d, %d amplitudes: falling slope", table->shape, n);
+
+	return;
+}
+
+
+
+
+/**
+   @brief Test tables of slope amplitudes
+
+   Generators with the same shape and duration of slopes share one
+   table. Change of volume doesn't change the table.
+
+   @param cte test executor
+
+   @return cwt_retv_ok if execution of the test was carried out without interruptions
+   @return cwt_retv_err if execution of the test had to be aborted
+*/
+cwt_retv test_cw_gen_slope_table_internal(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, __func__);
+
+	/* Tables requested directly. */
+	{
+		cw_slope_table_t * table1 = LIBCW_TEST_FUT(cw_slope_table_get_internal)(CW_TONE_SLOPE_SHAPE_RAISED_COSINE, 240);
+		cw_slope_table_t * table2 = LIBCW_TEST_FUT(cw_slope_table_get_internal)(CW_TONE_SLOPE_SHAPE_RAISED_COSINE, 240);
+		cw_slope_table_t * table3 = LIBCW_TEST_FUT(cw_slope_table_get_internal)(CW_TONE_SLOPE_SHAPE_LINEAR, 240);
+		cw_slope_table_t * table4 = LIBCW_TEST_FUT(cw_slope_table_get_internal)(CW_TONE_SLOPE_SHAPE_RAISED_COSINE, 241);
+		if (NULL == table1 || NULL == table2 || NULL == table3 || NULL == table4) {
+			cte->log_error(cte, "%s:%d: Failed to get slope tables\n", __func__, __LINE__);
+			return cwt_retv_err;
+		}
+
+		cte->expect_op_int(cte, true, "==", table1 == table2, "the same shape and duration: shared table");
+		cte->expect_op_int(cte, 2, "==", table1->refcount, "the same shape and duration: reference count");
+		cte->expect_op_int(cte, true, "==", table1 != table3, "different shape: separate table");
+		cte->expect_op_int(cte, true, "==", table1 != table4, "different duration: separate table");
+
+		test_slope_table_contents(cte, table1);
+		test_slope_table_contents(cte, table3);
+		test_slope_table_contents(cte, table4);
+
+		/* Values of raised cosine close to the end of rising slope are
+		   close to max of Q15. */
+		cte->expect_op_int(cte, 32000, "<", table1->amplitudes[239], "raised cosine: last amplitude of rising slope");
+
+		LIBCW_TEST_FUT(cw_slope_table_put_internal)(table2);
+		cte->expect_op_int(cte, 1, "==", table1->refcount, "reference count after put");
+
+		cw_slope_table_put_internal(table1);
+		cw_slope_table_put_internal(table3);
+		cw_slope_table_put_internal(table4);
+	}
+
+
+	/* Tables used by generators. */
+	{
+		cw_gen_t * gen1 = cw_gen_new(&cte->current_gen_conf);
+		cw_gen_t * gen2 = cw_gen_new(&cte->current_gen_conf);
+		if (NULL == gen1 || NULL == gen2) {
+			cte->log_error(cte, "%s:%d: Failed to create generators\n", __func__, __LINE__);
+			cw_gen_delete(&gen1);
+			cw_gen_delete(&gen2);
+			return cwt_retv_err;
+		}
+
+		const cw_slope_table_t * table = gen1->tone_slope.table;
+		cte->expect_op_int(cte, true, "==", NULL != table, "generator has slope table");
+		cte->expect_op_int(cte, true, "==", table == gen2->tone_slope.table, "generators share slope table");
+
+		cw_gen_set_volume(gen1, 30);
+		cte->expect_op_int(cte, true, "==", table == gen1->tone_slope.table, "change of volume doesn't change slope table");
+
+		cw_gen_set_tone_slope(gen2, CW_TONE_SLOPE_SHAPE_SINE, -1);
+		cte->expect_op_int(cte, true, "==", table != gen2->tone_slope.table, "change of slope shape changes slope table");
+
+		cw_gen_set_tone_slope(gen2, CW_TONE_SLOPE_SHAPE_RECTANGULAR, 0);
+		cte->expect_op_int(cte, true, "==", NULL == gen2->tone_slope.table, "rectangular slopes have no slope table");
+
+		cw_gen_set_tone_slope(gen2, CW_TONE_SLOPE_SHAPE_RAISED_COSINE, gen1->tone_slope.duration);
+		cte->expect_op_int(cte, true, "==", table == gen2->tone_slope.table, "generators share slope table again");
+
+		cw_gen_delete(&gen1);
+		cw_gen_delete(&gen2);
+	}
+
+	cte->print_test_footer(cte, __func__);
+
+	return cwt_retv_ok;
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2001-2006  Simon Baldwin (simon_baldwin@yahoo.com)
+ * Copyright (C) 2011-2023  Kamil Ignacak (acerion@wp.pl)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+
+
+
+/**
+   @file cw_gen_wavetable_internal.c
+
+   Test of generator's wavetable for plateaus of long tones.
+*/
+
+
+
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "common.h"
+#include "libcw_gen.h"
+#include "libcw_tq.h"
+#include "cw_gen_wavetable_internal.h"
+
+
+
+
+/* Long enough to use the wavetable, and not a multiple of period of
+   any tested frequency. */
+#define LONG_TONE_DURATION 2345678 /* [us] */
+
+
+
+
+/**
+   @brief Test generator's wavetable for plateaus of long tones
+
+   Render long tones, and compare their plateaus with ideal sine wave.
+   Test that count of rendered samples is exact, and that phase of sine
+   wave is continuous over many repetitions of the wavetable and
+   between consecutive tones.
+
+   @param cte test executor
+
+   @return cwt_retv_ok if execution of the test was carried out without interruptions
+   @return cwt_retv_err if execution of the test had to be aborted
+*/
+cwt_retv test_cw_gen_wavetable_internal(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, __func__);
+
+	cw_gen_t * gen = cw_gen_new(&cte->current_gen_conf);
+	if (NULL == gen) {
+		cte->log_error(cte, "%s:%d: Failed to create tested generator\n", __func__, __LINE__);
+		return cwt_retv_err;
+	}
+
+	const int frequencies[] = { 800, 1234, 777 };
+	cw_sample_t * samples = NULL;
+	size_t size = 0;
+
+	for (size_t f = 0; f < sizeof (frequencies) / sizeof (frequencies[0]); f++) {
+		const int frequency = frequencies[f];
+		cw_gen_set_frequency(gen, frequency);
+
+		/* First tone starts with rising slope, so its sine wave
+		   starts with phase zero. Second tone continues the sine
+		   wave of the first one. */
+		cw_tone_t tone;
+		CW_TONE_INIT(&tone, frequency, LONG_TONE_DURATION, CW_SLOPE_MODE_RISING_SLOPE);
+		cw_tq_enqueue_internal(gen->tq, &tone);
+		CW_TONE_INIT(&tone, frequency, LONG_TONE_DURATION, CW_SLOPE_MODE_FALLING_SLOPE);
+		cw_tq_enqueue_internal(gen->tq, &tone);
+
+		size_t n_samples = 0;
+		if (CW_SUCCESS != cw_gen_render(gen, &samples, &size, &n_samples)) {
+			cte->log_error(cte, "%s:%d: Failed to render tones\n", __func__, __LINE__);
+			free(samples);
+			cw_gen_delete(&gen);
+			return cwt_retv_err;
+		}
+
+		const size_t tone_n_samples = (size_t) (((gen->sample_rate / 100) * LONG_TONE_DURATION) / 10000);
+		cte->expect_op_int(cte, 2 * tone_n_samples, "==", n_samples, "%d Hz: count of samples", frequency);
+
+		cte->expect_op_int(cte, true, "==", NULL != gen->wavetable.samples, "%d Hz: wavetable has been used", frequency);
+		cte->expect_op_int(cte, frequency, "==", gen->wavetable.frequency, "%d Hz: frequency of wavetable", frequency);
+		cte->expect_op_int(cte, (int) gen->sample_rate, ">=", gen->wavetable.n_samples, "%d Hz: size of wavetable", frequency);
+
+		/* Skip rising slope of first tone and falling slope of
+		   second tone. */
+		const size_t slope_n_samples = (size_t) (((gen->sample_rate / 100) * gen->tone_slope.duration) / 10000);
+		int max_deviation = 0;
+		for (size_t i = slope_n_samples; i < n_samples - slope_n_samples; i++) {
+			const double phase = 2.0 * M_PI * (double) (((size_t) frequency * i) % gen->sample_rate) / gen->sample_rate;
+			const int full_scale = (int) (32767.0 * sin(phase));
+			const int expected = full_scale * gen->volume_abs / 32768;
+			const int deviation = abs(expected - samples[i]);
+			if (deviation > max_deviation) {
+				max_deviation = deviation;
+			}
+		}
+		cte->expect_op_int(cte, 4, ">=", max_deviation, "%d Hz: deviation from ideal sine wave", frequency);
+	}
+
+	free(samples);
+	cw_gen_delete(&gen);
+
+	cte->print_test_footer(cte, __func__);
+
+	return cwt_retv_ok;
+}
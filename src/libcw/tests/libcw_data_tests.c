@@ -236,6 +236,64 @@ int test_cw_representation_to_character_internal(cw_test_executor_t * cte)
 
 
 
+/**
+   Verify that walking the trie of representations agrees with
+   lookups of whole representations.
+
+   All representations made of 1 to CW_DATA_MAX_REPRESENTATION_LENGTH + 1
+   Dots and Dashes are walked from the root of the trie.
+*/
+int test_cw_data_trie_internal(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, __func__);
+
+	bool prefix_failure = false;
+	bool character_failure = false;
+
+	for (size_t length = 1; length <= CW_DATA_MAX_REPRESENTATION_LENGTH + 1; length++) {
+		for (unsigned int bits = 0; bits < (1U << length); bits++) {
+			char representation[CW_DATA_MAX_REPRESENTATION_LENGTH + 2] = { 0 };
+			unsigned int node = CW_DATA_TRIE_ROOT;
+			for (size_t i = 0; i < length; i++) {
+				representation[i] = (bits & (1U << (length - 1 - i))) ? CW_DASH_REPRESENTATION : CW_DOT_REPRESENTATION;
+				node = LIBCW_TEST_FUT(cw_data_trie_next_internal)(node, representation[i]);
+			}
+
+			/* Node is valid only if some representation starts
+			   with the walked representation. */
+			bool is_prefix = false;
+			for (const cw_entry_t * cw_entry = CW_TABLE; cw_entry->character; cw_entry++) {
+				if (0 == strncmp(cw_entry->representation, representation, length)) {
+					is_prefix = true;
+					break;
+				}
+			}
+			if (!cte->expect_op_int_errors_only(cte, is_prefix, "==", 0 != node, "trie node for '%s'", representation)) {
+				prefix_failure = true;
+				break;
+			}
+
+			const int char_trie = LIBCW_TEST_FUT(cw_data_trie_character_internal)(node);
+			const int char_direct = cw_representation_to_character_direct_internal(representation);
+			if (!cte->expect_op_int_errors_only(cte, char_direct, "==", char_trie, "trie vs. direct method: '%s'", representation)) {
+				character_failure = true;
+				break;
+			}
+		}
+	}
+
+	cte->expect_op_int(cte, false, "==", prefix_failure, "trie: prefixes");
+	cte->expect_op_int(cte, false, "==", character_failure, "trie: characters");
+	cte->expect_op_int(cte, 0, "==", LIBCW_TEST_FUT(cw_data_trie_next_internal)(CW_DATA_TRIE_ROOT, 'x'), "trie: invalid mark");
+
+	cte->print_test_footer(cte, __func__);
+
+	return 0;
+}
+
+
+
+
 /**
    Testing speed gain between function using direct method, and
    function with fast lookup table.  Test is preformed by using timer
@@ -16,6 +16,7 @@
 
 int test_cw_representation_to_hash_internal(cw_test_executor_t * cte);
 int test_cw_representation_to_character_internal(cw_test_executor_t * cte);
+int test_cw_data_trie_internal(cw_test_executor_t * cte);
 int test_cw_representation_to_character_internal_speed_gain(cw_test_executor_t * cte);
 
 cwt_retv test_data_main_table_get_count(cw_test_executor_t * cte);
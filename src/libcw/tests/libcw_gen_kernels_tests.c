@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2001-2006  Simon Baldwin (simon_baldwin@yahoo.com)
+ * Copyright (C) 2011-2023  Kamil Ignacak (acerion@wp.pl)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+
+
+
+#include "libcw.h"
+
+
+
+
+#include "libcw_gen_kernels.h"
+#include "libcw_gen_kernels_tests.h"
+#include "libcw_utils.h"
+#include "test_framework.h"
+
+
+
+
+#define KERNELS_N_SAMPLES 48000
+
+
+
+
+/**
+   @brief Test sine wave kernels supported by CPU
+
+   Compare samples calculated by every kernel supported by CPU with
+   samples calculated by scalar kernel, for fragments of different sizes
+   (so that tails of SIMD kernels are tested too), and for constant and
+   non-constant amplitudes. Report speed of kernels.
+*/
+int test_cw_sine_kernels_internal(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, __func__);
+
+	cw_sample_t * expected = (cw_sample_t *) calloc(KERNELS_N_SAMPLES, sizeof (cw_sample_t));
+	cw_sample_t * received = (cw_sample_t *) calloc(KERNELS_N_SAMPLES, sizeof (cw_sample_t));
+	int16_t * amplitudes = (int16_t *) calloc(KERNELS_N_SAMPLES, sizeof (int16_t));
+	cte->assert2(cte, expected && received && amplitudes, "failed to allocate buffers");
+
+	/* Q15 factors of amplitude looking like a rising slope of a
+	   tone, followed by plateau. */
+	for (int i = 0; i < KERNELS_N_SAMPLES; i++) {
+		amplitudes[i] = (int16_t) (i < 1000 ? 32767 * i / 1000 : 32767);
+	}
+
+	const double step = 2.0 * M_PI * 800.0 / 48000.0;
+	const double phase = 1.0;
+	const int sizes[] = { 0, 1, 7, 8, 15, 16, 17, 63, 64, 65, 255, 256, 1000, KERNELS_N_SAMPLES };
+
+	const cw_sine_kernel_desc_t * kernels = cw_sine_kernels_supported_internal();
+	cte->expect_op_int(cte, true, "==", NULL != kernels[0].function, "at least one kernel is supported");
+
+	for (const cw_sine_kernel_desc_t * kernel = kernels; kernel->function; kernel++) {
+
+		int max_deviation = 0;
+		for (size_t s = 0; s < sizeof (sizes) / sizeof (sizes[0]); s++) {
+			for (int constant = 0; constant < 2; constant++) {
+				const int16_t * a = constant ? NULL : amplitudes;
+				cw_sine_kernel_scalar_internal(expected, sizes[s], a, 20000.0F, phase, step);
+				LIBCW_TEST_FUT(kernel->function)(received, sizes[s], a, 20000.0F, phase, step);
+
+				for (int i = 0; i < sizes[s]; i++) {
+					const int deviation = abs(expected[i] - received[i]);
+					if (deviation > max_deviation) {
+						max_deviation = deviation;
+					}
+				}
+			}
+		}
+		/* SIMD kernels calculate in floats, scalar kernel in doubles. */
+		cte->expect_op_int(cte, 2, ">=", max_deviation, "kernel %s: max deviation from scalar kernel: %d", kernel->name, max_deviation);
+
+
+		struct timeval start;
+		struct timeval stop;
+		const int loops = 20;
+
+		gettimeofday(&start, NULL);
+		for (int i = 0; i < loops; i++) {
+			cw_sine_kernel_scalar_internal(expected, KERNELS_N_SAMPLES, amplitudes, 20000.0F, phase, step);
+		}
+		gettimeofday(&stop, NULL);
+		const int scalar_duration = cw_timestamp_compare_internal(&start, &stop) + 1; /* +1 to avoid division by zero. */
+
+		gettimeofday(&start, NULL);
+		for (int i = 0; i < loops; i++) {
+			kernel->function(received, KERNELS_N_SAMPLES, amplitudes, 20000.0F, phase, step);
+		}
+		gettimeofday(&stop, NULL);
+		const int kernel_duration = cw_timestamp_compare_internal(&start, &stop) + 1;
+
+		cte->log_info(cte, "kernel %s: %.1f Msamples/s, scalar kernel: %.1f Msamples/s\n",
+			      kernel->name,
+			      1.0 * loops * KERNELS_N_SAMPLES / kernel_duration,
+			      1.0 * loops * KERNELS_N_SAMPLES / scalar_duration);
+	}
+
+	free(expected);
+	free(received);
+	free(amplitudes);
+
+	cte->print_test_footer(cte, __func__);
+
+	return 0;
+}
+
+
+
+
+/**
+   @brief Test gain kernels supported by CPU
+
+   Compare samples calculated by every gain kernel supported by CPU
+   with samples calculated by scalar gain kernel, for fragments of
+   different sizes and for different gains.
+*/
+int test_cw_gain_kernels_internal(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, __func__);
+
+	cw_sample_t * input = (cw_sample_t *) calloc(KERNELS_N_SAMPLES, sizeof (cw_sample_t));
+	cw_sample_t * expected = (cw_sample_t *) calloc(KERNELS_N_SAMPLES, sizeof (cw_sample_t));
+	cw_sample_t * received = (cw_sample_t *) calloc(KERNELS_N_SAMPLES, sizeof (cw_sample_t));
+	cte->assert2(cte, input && expected && received, "failed to allocate buffers");
+
+	/* Full range of values of samples, including extreme values. */
+	for (int i = 0; i < KERNELS_N_SAMPLES; i++) {
+		input[i] = (cw_sample_t) (-32768 + ((int64_t) i * 65535) / (KERNELS_N_SAMPLES - 1));
+	}
+
+	const int sizes[] = { 0, 1, 7, 8, 15, 16, 17, 255, 1000, KERNELS_N_SAMPLES };
+	const int gains[] = { 0, 1, 16384, 22937, 32767 };
+
+	for (const cw_sine_kernel_desc_t * kernel = cw_sine_kernels_supported_internal(); kernel->function; kernel++) {
+		int n_differences = 0;
+		for (size_t s = 0; s < sizeof (sizes) / sizeof (sizes[0]); s++) {
+			for (size_t g = 0; g < sizeof (gains) / sizeof (gains[0]); g++) {
+				memcpy(expected, input, KERNELS_N_SAMPLES * sizeof (cw_sample_t));
+				memcpy(received, input, KERNELS_N_SAMPLES * sizeof (cw_sample_t));
+				cw_gain_kernel_scalar_internal(expected, sizes[s], gains[g]);
+				LIBCW_TEST_FUT(kernel->gain)(received, sizes[s], gains[g]);
+				if (0 != memcmp(expected, received, KERNELS_N_SAMPLES * sizeof (cw_sample_t))) {
+					n_differences++;
+				}
+			}
+		}
+		/* Integer arithmetic, results must be identical. */
+		cte->expect_op_int(cte, 0, "==", n_differences, "gain kernel %s: results identical to scalar kernel", kernel->name);
+	}
+
+	free(input);
+	free(expected);
+	free(received);
+
+	cte->print_test_footer(cte, __func__);
+
+	return 0;
+}
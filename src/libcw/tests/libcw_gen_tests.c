@@ -22,8 +22,11 @@
 
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <limits.h> /* UCHAR_MAX */
 #include <errno.h>
+#include <poll.h>
 #include <unistd.h>
 
 
@@ -38,6 +41,7 @@
 #include "libcw_debug.h"
 #include "libcw_gen.h"
 #include "libcw_gen_tests.h"
+#include "libcw_tq_internal.h"
 #include "libcw_utils.h"
 #include "test_framework.h"
 #include <cw_easy_rec.h>
@@ -55,6 +59,7 @@ extern const char * test_invalid_strings[];
 
 static cwt_retv test_cw_gen_new_start_stop_delete_sub(cw_test_executor_t * cte, const char * function_name, bool do_new, bool do_start, bool do_stop, bool do_delete);
 static int test_cw_gen_forever_sub(cw_test_executor_t * cte, int seconds, bool * pass);
+static void test_cw_gen_fill_value_tracking_callback(void * callback_arg, int state);
 
 
 
@@ -1255,3 +1260,837 @@ cwt_retv test_cw_gen_enqueue_string(cw_test_executor_t * cte)
 
 
 
+
+
+
+
+/**
+   @brief Test rendering of tones into memory
+
+   Tones are rendered with a generator that is not started. Test checks
+   that samples of all tones from tone queue are rendered, that marks and
+   spaces end up in right places of output buffer, and that rendering is
+   much faster than playing the tones.
+*/
+cwt_retv test_cw_gen_render(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, __func__);
+
+	cw_gen_t * gen = NULL;
+	if (0 != gen_setup(cte, &gen)) {
+		cte->log_error(cte, "%s:%d: Failed to create generator\n", __func__, __LINE__);
+		return cwt_retv_err;
+	}
+
+
+	/* Test: render known tones into buffer allocated by library. */
+	{
+		const int n_tones = 10;
+		const int duration = 50000; /* [us] */
+		for (int i = 0; i < n_tones; i++) {
+			cw_tone_t tone;
+			CW_TONE_INIT(&tone, (i % 2) ? 0 : 800, duration, CW_SLOPE_MODE_STANDARD_SLOPES);
+			cw_tq_enqueue_internal(gen->tq, &tone);
+		}
+
+		cw_sample_t * samples = NULL;
+		size_t size = 0;
+		size_t n_samples = 0;
+		const cw_ret_t cwret = LIBCW_TEST_FUT(cw_gen_render)(gen, &samples, &size, &n_samples);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, "render: cwret");
+		cte->expect_valid_pointer(cte, samples, "render: samples");
+
+		/* Same formula as used by generator. */
+		const size_t tone_n_samples = (size_t) (((int64_t) (gen->sample_rate / 100) * duration) / 10000);
+		cte->expect_op_int(cte, (int) (n_tones * tone_n_samples), "==", (int) n_samples, "render: count of samples");
+		cte->expect_op_int(cte, true, "==", size >= n_samples, "render: size of buffer");
+		cte->expect_op_int(cte, 0, "==", (int) cw_gen_get_queue_length(gen), "render: queue is drained");
+
+		bool mark_failure = true;
+		bool space_failure = false;
+		if (NULL != samples && n_samples == n_tones * tone_n_samples) {
+			for (size_t i = 0; i < n_samples; i++) {
+				const bool is_mark = 0 == (i / tone_n_samples) % 2;
+				if (is_mark && 0 != samples[i]) {
+					mark_failure = false;
+				}
+				if (!is_mark && 0 != samples[i]) {
+					space_failure = true;
+				}
+			}
+		}
+		cte->expect_op_int(cte, false, "==", mark_failure, "render: marks are not silent");
+		cte->expect_op_int(cte, false, "==", space_failure, "render: spaces are silent");
+
+		free(samples);
+	}
+
+
+	/* Test: render a text into buffer provided by caller. The buffer is
+	   large enough, so it shouldn't be reallocated. */
+	{
+		const size_t buffer_size = 20 * 48000;
+		cw_sample_t * buffer = (cw_sample_t *) malloc(buffer_size * sizeof (cw_sample_t));
+		cte->assert2(cte, buffer, "render: failed to allocate buffer");
+
+		cw_gen_enqueue_string(gen, "PARIS ");
+
+		cw_sample_t * samples = buffer;
+		size_t size = buffer_size;
+		size_t n_samples = 0;
+		const cw_ret_t cwret = LIBCW_TEST_FUT(cw_gen_render)(gen, &samples, &size, &n_samples);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, "render: caller's buffer: cwret");
+		cte->expect_op_int(cte, true, "==", buffer == samples, "render: caller's buffer: not reallocated");
+		cte->expect_op_int(cte, (int) buffer_size, "==", (int) size, "render: caller's buffer: size");
+		cte->expect_op_int(cte, true, "==", n_samples > 0, "render: caller's buffer: count of samples");
+
+		free(samples);
+	}
+
+
+	/* Test: compare time of rendering with duration of rendered sound. */
+	{
+		for (int i = 0; i < 20; i++) {
+			cw_gen_enqueue_string(gen, "PARIS ");
+		}
+
+		cw_sample_t * samples = NULL;
+		size_t size = 0;
+		size_t n_samples = 0;
+
+		struct timeval start;
+		struct timeval stop;
+		gettimeofday(&start, NULL);
+		const cw_ret_t cwret = LIBCW_TEST_FUT(cw_gen_render)(gen, &samples, &size, &n_samples);
+		gettimeofday(&stop, NULL);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, "render: speed: cwret");
+
+		const double render_duration = cw_timestamp_compare_internal(&start, &stop) + 1; /* [us]. +1 to avoid division by zero. */
+		const double sound_duration = (1.0 * CW_USECS_PER_SEC * n_samples) / gen->sample_rate; /* [us] */
+		const double gain = sound_duration / render_duration;
+		cte->expect_op_double(cte, 100.0, "<", gain, "render: speed: rendering faster than real time by %.1f", gain);
+
+		free(samples);
+	}
+
+	gen_destroy(&gen);
+
+	cte->print_test_footer(cte, __func__);
+
+	return cwt_retv_ok;
+}
+
+
+
+
+/**
+   @brief Count changes of generator's value to "closed"
+*/
+static void test_cw_gen_fill_value_tracking_callback(void * callback_arg, int state)
+{
+	int * n_closed = (int *) callback_arg;
+	if (CW_KEY_VALUE_CLOSED == state) {
+		(*n_closed)++;
+	}
+}
+
+
+
+
+/**
+   @brief Test filling of client's buffers with samples (pull mode)
+
+   Samples of a text are pulled from generator in chunks of different
+   sizes, and are compared with samples of the same text rendered by
+   another generator with cw_gen_render(). Test also checks that key
+   value tracking works in pull mode, and that client's buffer is
+   filled with silence when tone queue is empty.
+*/
+cwt_retv test_cw_gen_fill(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, __func__);
+
+	cw_gen_t * gen = NULL;
+	cw_gen_t * reference_gen = NULL;
+	if (0 != gen_setup(cte, &gen) || 0 != gen_setup(cte, &reference_gen)) {
+		cte->log_error(cte, "%s:%d: Failed to create generators\n", __func__, __LINE__);
+		gen_destroy(&gen);
+		gen_destroy(&reference_gen);
+		return cwt_retv_err;
+	}
+
+	const char * text = "PARIS ";
+	const int expected_n_marks = 4 + 2 + 3 + 2 + 3; /* Marks of "PARIS". */
+
+	cw_sample_t * reference = NULL;
+	size_t reference_size = 0;
+	size_t reference_n_samples = 0;
+	cw_gen_enqueue_string(reference_gen, text);
+	if (CW_SUCCESS != cw_gen_render(reference_gen, &reference, &reference_size, &reference_n_samples)) {
+		cte->log_error(cte, "%s:%d: Failed to render reference samples\n", __func__, __LINE__);
+		free(reference);
+		gen_destroy(&gen);
+		gen_destroy(&reference_gen);
+		return cwt_retv_err;
+	}
+
+
+	/* Test: pull samples in chunks of sizes typical for audio
+	   callbacks, and in chunks of odd sizes. */
+	{
+		int n_closed = 0;
+		cw_gen_register_value_tracking_callback_internal(gen, test_cw_gen_fill_value_tracking_callback, &n_closed);
+		cw_gen_enqueue_string(gen, text);
+
+		/* A bit more than reference, to test padding with silence. */
+		const size_t n_samples = reference_n_samples + 1000;
+		cw_sample_t * samples = (cw_sample_t *) calloc(n_samples, sizeof (cw_sample_t));
+		cte->assert2(cte, samples, "fill: failed to allocate buffer");
+
+		const size_t chunk_sizes[] = { 64, 1, 1000, 37, 256, 4800, 3 };
+		const size_t n_chunk_sizes = sizeof (chunk_sizes) / sizeof (chunk_sizes[0]);
+		bool fill_failure = false;
+		size_t i = 0;
+		size_t c = 0;
+		while (i < n_samples) {
+			size_t chunk = chunk_sizes[c++ % n_chunk_sizes];
+			if (i + chunk > n_samples) {
+				chunk = n_samples - i;
+			}
+			if (CW_SUCCESS != LIBCW_TEST_FUT(cw_gen_fill)(gen, samples + i, chunk)) {
+				fill_failure = true;
+				break;
+			}
+			i += chunk;
+		}
+		cte->expect_op_int(cte, false, "==", fill_failure, "fill: cwret");
+
+		const int differs = memcmp(reference, samples, reference_n_samples * sizeof (cw_sample_t));
+		cte->expect_op_int(cte, 0, "==", differs, "fill: samples identical to rendered samples");
+
+		bool silence_failure = false;
+		for (size_t k = reference_n_samples; k < n_samples; k++) {
+			if (0 != samples[k]) {
+				silence_failure = true;
+			}
+		}
+		cte->expect_op_int(cte, false, "==", silence_failure, "fill: silence after end of tones");
+		cte->expect_op_int(cte, 0, "==", (int) cw_gen_get_queue_length(gen), "fill: queue is drained");
+		cte->expect_op_int(cte, expected_n_marks, "==", n_closed, "fill: count of marks seen by value tracking");
+
+		cw_gen_register_value_tracking_callback_internal(gen, NULL, NULL);
+		free(samples);
+	}
+
+
+	/* Test: invalid arguments. */
+	{
+		cw_sample_t sample = 0;
+		const cw_ret_t cwret = LIBCW_TEST_FUT(cw_gen_fill)(gen, NULL, 1);
+		cte->expect_op_int(cte, CW_FAILURE, "==", cwret, "fill: NULL buffer");
+
+		const cw_ret_t cwret2 = LIBCW_TEST_FUT(cw_gen_fill)(NULL, &sample, 1);
+		cte->expect_op_int(cte, CW_FAILURE, "==", cwret2, "fill: NULL generator");
+	}
+
+	free(reference);
+	gen_destroy(&gen);
+	gen_destroy(&reference_gen);
+
+	cte->print_test_footer(cte, __func__);
+
+	return cwt_retv_ok;
+}
+
+
+
+
+
+/**
+   @brief Test generating of "forever" tones in sustained state
+
+   Straight key enqueues "forever" tones. Generator should keep
+   generating them without dequeueing them again, and should leave
+   sustained state as soon as next tone is enqueued.
+*/
+cwt_retv test_cw_gen_sustained_tone(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, __func__);
+
+	cw_gen_t * gen = NULL;
+	if (0 != gen_setup(cte, &gen)) {
+		cte->log_error(cte, "%s:%d: Failed to create generator\n", __func__, __LINE__);
+		return cwt_retv_err;
+	}
+
+	int n_closed = 0;
+	cw_gen_register_value_tracking_callback_internal(gen, test_cw_gen_fill_value_tracking_callback, &n_closed);
+
+	const size_t n_samples = 4800;
+	cw_sample_t * samples = (cw_sample_t *) calloc(n_samples, sizeof (cw_sample_t));
+	cte->assert2(cte, samples, "sustained tone: failed to allocate buffer");
+
+
+	/* Test: key down. */
+	{
+		cw_gen_enqueue_sk_begin_mark_internal(gen);
+		for (int i = 0; i < 5; i++) {
+			LIBCW_TEST_FUT(cw_gen_fill)(gen, samples, n_samples);
+		}
+		bool is_silent = true;
+		for (size_t k = 0; k < n_samples; k++) {
+			if (0 != samples[k]) {
+				is_silent = false;
+			}
+		}
+		cte->expect_op_int(cte, true, "==", gen->sustained.active, "key down: sustained state");
+		cte->expect_op_int(cte, 1, "==", (int) cw_gen_get_queue_length(gen), "key down: forever tone in queue");
+		cte->expect_op_int(cte, false, "==", is_silent, "key down: mark is generated");
+		cte->expect_op_int(cte, 1, "==", n_closed, "key down: count of marks seen by value tracking");
+	}
+
+
+	/* Test: key up. */
+	{
+		cw_gen_enqueue_sk_begin_space_internal(gen);
+		LIBCW_TEST_FUT(cw_gen_fill)(gen, samples, n_samples);
+		cte->expect_op_int(cte, 1, "==", (int) cw_gen_get_queue_length(gen), "key up: silent forever tone in queue");
+
+		LIBCW_TEST_FUT(cw_gen_fill)(gen, samples, n_samples);
+		bool is_silent = true;
+		for (size_t k = 0; k < n_samples; k++) {
+			if (0 != samples[k]) {
+				is_silent = false;
+			}
+		}
+		cte->expect_op_int(cte, true, "==", gen->sustained.active, "key up: sustained state");
+		cte->expect_op_int(cte, true, "==", is_silent, "key up: space is generated");
+		cte->expect_op_int(cte, 1, "==", n_closed, "key up: count of marks seen by value tracking");
+	}
+
+
+	/* Test: tone enqueued after the "forever" tone is dequeued, and
+	   the "forever" tone is not sustained anymore. */
+	{
+		cw_tone_t tone;
+		CW_TONE_INIT(&tone, 0, 10000, CW_SLOPE_MODE_NO_SLOPES);
+		cw_tq_enqueue_internal(gen->tq, &tone);
+		for (int i = 0; i < 3; i++) {
+			LIBCW_TEST_FUT(cw_gen_fill)(gen, samples, n_samples);
+		}
+		cte->expect_op_int(cte, false, "==", gen->sustained.active, "next tone: sustained state");
+		cte->expect_op_int(cte, 0, "==", (int) cw_gen_get_queue_length(gen), "next tone: queue is empty");
+	}
+
+	/* Test: removal of last character followed by an enqueue ends
+	   sustained state, although count of enqueued tones is the
+	   same as before the removal. */
+	{
+		cw_tone_t tone;
+		CW_TONE_INIT(&tone, gen->frequency, gen->quantum_duration, CW_SLOPE_MODE_NO_SLOPES);
+		tone.is_forever = true;
+		tone.is_first = true;
+		cw_tq_enqueue_internal(gen->tq, &tone);
+		LIBCW_TEST_FUT(cw_gen_fill)(gen, samples, n_samples);
+		LIBCW_TEST_FUT(cw_gen_fill)(gen, samples, n_samples);
+		cte->expect_op_int(cte, true, "==", gen->sustained.active, "remove last: sustained state");
+
+		/* Replace the mark with a space. */
+		cw_gen_remove_last_character(gen);
+		CW_TONE_INIT(&tone, 0, gen->quantum_duration, CW_SLOPE_MODE_NO_SLOPES);
+		tone.is_forever = true;
+		cw_tq_enqueue_internal(gen->tq, &tone);
+		LIBCW_TEST_FUT(cw_gen_fill)(gen, samples, n_samples);
+		LIBCW_TEST_FUT(cw_gen_fill)(gen, samples, n_samples);
+		bool is_silent = true;
+		for (size_t k = 0; k < n_samples; k++) {
+			if (0 != samples[k]) {
+				is_silent = false;
+			}
+		}
+		cte->expect_op_int(cte, true, "==", is_silent, "remove last: new tone is generated");
+		cte->expect_op_int(cte, 1, "==", (int) cw_gen_get_queue_length(gen), "remove last: new tone in queue");
+		cw_gen_flush_queue(gen);
+		LIBCW_TEST_FUT(cw_gen_fill)(gen, samples, n_samples);
+	}
+
+	/* Sustained state for the test of flush. */
+	cw_gen_enqueue_sk_begin_space_internal(gen);
+	LIBCW_TEST_FUT(cw_gen_fill)(gen, samples, n_samples);
+	LIBCW_TEST_FUT(cw_gen_fill)(gen, samples, n_samples);
+
+
+	/* Test: flush of queue ends sustained state. */
+	{
+		cw_gen_flush_queue(gen);
+		LIBCW_TEST_FUT(cw_gen_fill)(gen, samples, n_samples);
+		cte->expect_op_int(cte, false, "==", gen->sustained.active, "flush: sustained state");
+		cte->expect_op_int(cte, 0, "==", (int) cw_gen_get_queue_length(gen), "flush: queue is empty");
+	}
+
+	cw_gen_register_value_tracking_callback_internal(gen, NULL, NULL);
+	free(samples);
+	gen_destroy(&gen);
+
+	cte->print_test_footer(cte, __func__);
+
+	return cwt_retv_ok;
+}
+
+
+
+
+/**
+   @brief Check if file descriptor is readable, without waiting
+*/
+static bool test_cw_gen_event_fd_is_readable(int fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN, .revents = 0 };
+	return 1 == poll(&pfd, 1, 0) && (pfd.revents & POLLIN);
+}
+
+
+
+
+/**
+   @brief Test generator's event file descriptor
+
+   Tones are pulled from generator with cw_gen_fill(), and the test
+   checks that the descriptor becomes readable, and that it reports
+   the events that have happened.
+*/
+cwt_retv test_cw_gen_event_fd(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, __func__);
+
+	cw_gen_t * gen = NULL;
+	if (0 != gen_setup(cte, &gen)) {
+		cte->log_error(cte, "%s:%d: Failed to create generator\n", __func__, __LINE__);
+		return cwt_retv_err;
+	}
+
+	cw_sample_t samples[256];
+	const size_t n_samples = sizeof (samples) / sizeof (samples[0]);
+
+
+	/* Test: invalid level. */
+	{
+		const int fd = LIBCW_TEST_FUT(cw_gen_get_event_fd)(gen, CW_GEN_EVENT_ALL, CW_TONE_QUEUE_CAPACITY_MAX);
+		cte->expect_op_int(cte, -1, "==", fd, "event fd: invalid level");
+	}
+
+
+	const int fd = LIBCW_TEST_FUT(cw_gen_get_event_fd)(gen, CW_GEN_EVENT_LEVEL | CW_GEN_EVENT_QUEUE_EMPTY, 2);
+	cte->expect_op_int(cte, 0, "<=", fd, "event fd: get descriptor");
+	const int fd2 = LIBCW_TEST_FUT(cw_gen_get_event_fd)(gen, CW_GEN_EVENT_ALL, 2);
+	cte->expect_op_int(cte, fd, "==", fd2, "event fd: second call returns the same descriptor");
+	cte->expect_op_int(cte, false, "==", test_cw_gen_event_fd_is_readable(fd), "event fd: not readable initially");
+
+
+	/* Test: enqueueing doesn't trigger any event, the first dequeued
+	   tone triggers "tone end" and "value" events. */
+	{
+		cw_gen_enqueue_string(gen, "EEE"); /* Dot and ICS for each character. */
+		cte->expect_op_int(cte, false, "==", test_cw_gen_event_fd_is_readable(fd), "event fd: not readable after enqueue");
+
+		LIBCW_TEST_FUT(cw_gen_fill)(gen, samples, 1);
+		cte->expect_op_int(cte, true, "==", test_cw_gen_event_fd_is_readable(fd), "event fd: readable after dequeue");
+		const unsigned int events = LIBCW_TEST_FUT(cw_gen_read_events)(gen);
+		cte->expect_op_int(cte, CW_GEN_EVENT_TONE_END | CW_GEN_EVENT_VALUE, "==", (int) events, "event fd: events after first dequeue");
+		cte->expect_op_int(cte, false, "==", test_cw_gen_event_fd_is_readable(fd), "event fd: not readable after reading events");
+		cte->expect_op_int(cte, 0, "==", (int) cw_gen_read_events(gen), "event fd: no events after reading events");
+	}
+
+
+	/* Test: draining the queue triggers "level" and "queue empty"
+	   events. */
+	{
+		unsigned int events = 0;
+		while (0 != cw_gen_get_queue_length(gen)) {
+			LIBCW_TEST_FUT(cw_gen_fill)(gen, samples, n_samples);
+			events |= cw_gen_read_events(gen);
+		}
+		/* Dequeue the last tone. */
+		LIBCW_TEST_FUT(cw_gen_fill)(gen, samples, n_samples);
+		events |= cw_gen_read_events(gen);
+
+		cte->expect_op_int(cte, CW_GEN_EVENT_ALL, "==", (int) events, "event fd: events after draining the queue");
+	}
+
+
+	/* Test: events that are not watched don't make the descriptor
+	   readable. */
+	{
+		cw_gen_get_event_fd(gen, CW_GEN_EVENT_QUEUE_EMPTY, 0);
+		cw_gen_enqueue_string(gen, "E");
+		LIBCW_TEST_FUT(cw_gen_fill)(gen, samples, 1);
+		cte->expect_op_int(cte, false, "==", test_cw_gen_event_fd_is_readable(fd), "event fd: not readable after unwatched events");
+
+		cw_gen_flush_queue(gen);
+		cte->expect_op_int(cte, true, "==", test_cw_gen_event_fd_is_readable(fd), "event fd: readable after flush");
+		cte->expect_op_int(cte, CW_GEN_EVENT_QUEUE_EMPTY, "==", (int) cw_gen_read_events(gen), "event fd: events after flush");
+	}
+
+	gen_destroy(&gen);
+
+	cte->print_test_footer(cte, __func__);
+
+	return cwt_retv_ok;
+}
+
+
+
+
+/**
+   @brief Render given text with generator, return rendered samples
+
+   Returned buffer is owned by caller.
+*/
+static cw_sample_t * test_cw_gen_queue_mode_render(cw_gen_t * gen, const char * text, size_t * n_samples)
+{
+	cw_sample_t * samples = NULL;
+	size_t size = 0;
+	*n_samples = 0;
+	if (CW_SUCCESS != cw_gen_enqueue_string(gen, text)
+	    || CW_SUCCESS != cw_gen_render(gen, &samples, &size, n_samples)) {
+		free(samples);
+		return NULL;
+	}
+	return samples;
+}
+
+
+
+
+/**
+   @brief Test character-level mode of generator's tone queue
+
+   Samples of a text enqueued as characters are compared with samples
+   of the same text enqueued as tones. Test also checks that change of
+   speed applies to characters that are already in queue, and that
+   flushing of queue discards the rest of character that is being
+   played.
+*/
+cwt_retv test_cw_gen_queue_mode(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, __func__);
+
+	cw_gen_t * gen = NULL;
+	cw_gen_t * reference_gen = NULL;
+	if (0 != gen_setup(cte, &gen) || 0 != gen_setup(cte, &reference_gen)) {
+		cte->log_error(cte, "%s:%d: Failed to create generators\n", __func__, __LINE__);
+		gen_destroy(&gen);
+		gen_destroy(&reference_gen);
+		return cwt_retv_err;
+	}
+
+
+	/* Test: setting and getting of mode. */
+	{
+		cw_gen_queue_mode_t mode = CW_GEN_QUEUE_MODE_CHARACTERS;
+		cw_gen_get_queue_mode(gen, &mode);
+		cte->expect_op_int(cte, CW_GEN_QUEUE_MODE_TONES, "==", mode, "queue mode: default mode");
+
+		const cw_ret_t cwret = LIBCW_TEST_FUT(cw_gen_set_queue_mode)(gen, (cw_gen_queue_mode_t) 100);
+		cte->expect_op_int(cte, CW_FAILURE, "==", cwret, "queue mode: invalid mode");
+
+		const cw_ret_t cwret2 = LIBCW_TEST_FUT(cw_gen_set_queue_mode)(gen, CW_GEN_QUEUE_MODE_CHARACTERS);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret2, "queue mode: set mode");
+		const cw_ret_t cwret3 = LIBCW_TEST_FUT(cw_gen_get_queue_mode)(gen, &mode);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret3, "queue mode: get mode");
+		cte->expect_op_int(cte, CW_GEN_QUEUE_MODE_CHARACTERS, "==", mode, "queue mode: mode read back");
+
+		const cw_ret_t cwret4 = LIBCW_TEST_FUT(cw_gen_set_queue_mode)(NULL, CW_GEN_QUEUE_MODE_TONES);
+		cte->expect_op_int(cte, CW_FAILURE, "==", cwret4, "queue mode: set mode of NULL generator");
+		const cw_ret_t cwret5 = LIBCW_TEST_FUT(cw_gen_get_queue_mode)(NULL, &mode);
+		cte->expect_op_int(cte, CW_FAILURE, "==", cwret5, "queue mode: get mode of NULL generator");
+		const cw_ret_t cwret6 = LIBCW_TEST_FUT(cw_gen_get_queue_mode)(gen, NULL);
+		cte->expect_op_int(cte, CW_FAILURE, "==", cwret6, "queue mode: get mode into NULL");
+	}
+
+
+	/* Test: characters are stored as single entries, and are played
+	   in the same way as in the default mode. Multiple spaces test
+	   calculation of inter-word-spaces. */
+	{
+		const char * text = "PARIS  PARIS 5/";
+
+		cw_gen_enqueue_string(gen, text);
+		cte->expect_op_int(cte, (int) strlen(text), "==", (int) cw_gen_get_queue_length(gen), "queue mode: one entry per character");
+		cw_tq_flush_internal(gen->tq);
+
+		size_t reference_n_samples = 0;
+		cw_sample_t * reference = test_cw_gen_queue_mode_render(reference_gen, text, &reference_n_samples);
+		size_t n_samples = 0;
+		cw_sample_t * samples = test_cw_gen_queue_mode_render(gen, text, &n_samples);
+
+		cte->expect_op_int(cte, true, "==", NULL != reference && NULL != samples, "queue mode: render");
+		cte->expect_op_int(cte, (int) reference_n_samples, "==", (int) n_samples, "queue mode: count of samples");
+		const bool identical = NULL != reference && NULL != samples && n_samples == reference_n_samples
+			&& 0 == memcmp(reference, samples, n_samples * sizeof (cw_sample_t));
+		cte->expect_op_int(cte, true, "==", identical, "queue mode: samples identical to samples of tones");
+
+		free(reference);
+		free(samples);
+	}
+
+
+	/* Test: change of speed applies to characters already in queue. */
+	{
+		const char * text = "EISH5 T";
+		const int speed = cw_gen_get_speed(gen) * 2 <= CW_SPEED_MAX ? cw_gen_get_speed(gen) * 2 : CW_SPEED_MIN;
+
+		cw_gen_enqueue_string(gen, text);
+		cw_gen_set_speed(gen, speed);
+
+		cw_sample_t * samples = NULL;
+		size_t size = 0;
+		size_t n_samples = 0;
+		cw_gen_render(gen, &samples, &size, &n_samples);
+
+		cw_gen_set_speed(reference_gen, speed);
+		size_t reference_n_samples = 0;
+		cw_sample_t * reference = test_cw_gen_queue_mode_render(reference_gen, text, &reference_n_samples);
+
+		cte->expect_op_int(cte, (int) reference_n_samples, "==", (int) n_samples, "queue mode: speed change: count of samples");
+
+		free(reference);
+		free(samples);
+	}
+
+
+	/* Test: flushing of queue discards the rest of a character that
+	   has already been dequeued and expanded. */
+	{
+		cw_gen_enqueue_string(gen, "00");
+
+		cw_sample_t chunk[64];
+		cw_gen_fill(gen, chunk, sizeof (chunk) / sizeof (chunk[0]));
+		cte->expect_op_int(cte, 1, "==", (int) cw_gen_get_queue_length(gen), "queue mode: flush: first character dequeued");
+
+		cw_tq_flush_internal(gen->tq);
+
+		/* The rest of current tone (first Dash), and then only
+		   silence. */
+		const size_t n_samples = gen->sample_rate * 2;
+		cw_sample_t * samples = (cw_sample_t *) calloc(n_samples, sizeof (cw_sample_t));
+		cte->assert2(cte, samples, "queue mode: flush: failed to allocate buffer");
+		cw_gen_fill(gen, samples, n_samples);
+
+		const size_t dash_n_samples = (size_t) (((int64_t) (gen->sample_rate / 100) * gen->durations.dash_duration) / 10000);
+		bool silence_failure = false;
+		for (size_t i = dash_n_samples; i < n_samples; i++) {
+			if (0 != samples[i]) {
+				silence_failure = true;
+			}
+		}
+		cte->expect_op_int(cte, false, "==", silence_failure, "queue mode: flush: silence after flush");
+
+		free(samples);
+	}
+
+	gen_destroy(&gen);
+	gen_destroy(&reference_gen);
+
+	cte->print_test_footer(cte, __func__);
+
+	return cwt_retv_ok;
+}
+
+
+
+
+/**
+   @brief Test enqueueing of string with cw_gen_enqueue_string_atomic()
+
+   Samples of a string enqueued in one step are compared with samples
+   of the same string enqueued character by character. Test also checks
+   that a string that doesn't fit into tone queue is not enqueued at
+   all.
+*/
+cwt_retv test_cw_gen_enqueue_string_atomic(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, __func__);
+
+	cw_gen_t * gen = NULL;
+	cw_gen_t * reference_gen = NULL;
+	if (0 != gen_setup(cte, &gen) || 0 != gen_setup(cte, &reference_gen)) {
+		cte->log_error(cte, "%s:%d: Failed to create generators\n", __func__, __LINE__);
+		gen_destroy(&gen);
+		gen_destroy(&reference_gen);
+		return cwt_retv_err;
+	}
+
+
+	/* Test: the same samples as for cw_gen_enqueue_string(), in both
+	   modes of tone queue. */
+	const cw_gen_queue_mode_t modes[] = { CW_GEN_QUEUE_MODE_TONES, CW_GEN_QUEUE_MODE_CHARACTERS };
+	for (size_t m = 0; m < sizeof (modes) / sizeof (modes[0]); m++) {
+		const char * text = "PARIS  paris 73?";
+		cw_gen_set_queue_mode(gen, modes[m]);
+
+		const cw_ret_t cwret = LIBCW_TEST_FUT(cw_gen_enqueue_string_atomic)(gen, text);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, "atomic string: mode %d: cwret", modes[m]);
+		if (CW_GEN_QUEUE_MODE_CHARACTERS == modes[m]) {
+			cte->expect_op_int(cte, (int) strlen(text), "==", (int) cw_gen_get_queue_length(gen), "atomic string: mode %d: one entry per character", modes[m]);
+		}
+
+		cw_sample_t * samples = NULL;
+		size_t size = 0;
+		size_t n_samples = 0;
+		cw_gen_render(gen, &samples, &size, &n_samples);
+
+		cw_sample_t * reference = NULL;
+		size_t reference_size = 0;
+		size_t reference_n_samples = 0;
+		cw_gen_enqueue_string(reference_gen, text);
+		cw_gen_render(reference_gen, &reference, &reference_size, &reference_n_samples);
+
+		cte->expect_op_int(cte, (int) reference_n_samples, "==", (int) n_samples, "atomic string: mode %d: count of samples", modes[m]);
+		const bool identical = NULL != reference && NULL != samples && n_samples == reference_n_samples
+			&& 0 == memcmp(reference, samples, n_samples * sizeof (cw_sample_t));
+		cte->expect_op_int(cte, true, "==", identical, "atomic string: mode %d: samples", modes[m]);
+
+		free(samples);
+		free(reference);
+	}
+	cw_gen_set_queue_mode(gen, CW_GEN_QUEUE_MODE_TONES);
+
+
+	/* Test: string that doesn't fit into tone queue is not enqueued
+	   at all. */
+	{
+		cw_tq_set_capacity_internal(gen->tq, 30, 30);
+		cw_gen_enqueue_string(gen, "E"); /* Dot, ims, ics. */
+		const int length = (int) cw_gen_get_queue_length(gen);
+
+		errno = 0;
+		const cw_ret_t cwret = LIBCW_TEST_FUT(cw_gen_enqueue_string_atomic)(gen, "PARIS");
+		cte->expect_op_int(cte, CW_FAILURE, "==", cwret, "too long string: cwret");
+		cte->expect_op_int(cte, EAGAIN, "==", errno, "too long string: errno");
+		cte->expect_op_int(cte, length, "==", (int) cw_gen_get_queue_length(gen), "too long string: queue unchanged");
+
+		const cw_ret_t cwret2 = LIBCW_TEST_FUT(cw_gen_enqueue_string_atomic)(gen, "TEST");
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret2, "short string: cwret");
+		cw_tq_flush_internal(gen->tq);
+	}
+
+
+	/* Test: string that fits into tone queue, but not under its high
+	   water mark, is rejected, and the rejection is counted. So is a
+	   string with more characters than the high water mark. */
+	{
+		cw_tq_set_capacity_internal(gen->tq, 30, 10);
+		const char * strings[] = { "TEST", "EEEEEEEEEEEE" };
+		for (size_t i = 0; i < sizeof (strings) / sizeof (strings[0]); i++) {
+			cw_gen_queue_stats_t before;
+			cw_gen_get_queue_stats(gen, &before);
+
+			errno = 0;
+			const cw_ret_t cwret = LIBCW_TEST_FUT(cw_gen_enqueue_string_atomic)(gen, strings[i]);
+			cte->expect_op_int(cte, CW_FAILURE, "==", cwret, "high water mark: string %zu: cwret", i);
+			cte->expect_op_int(cte, EAGAIN, "==", errno, "high water mark: string %zu: errno", i);
+			cte->expect_op_int(cte, 0, "==", (int) cw_gen_get_queue_length(gen), "high water mark: string %zu: queue unchanged", i);
+
+			cw_gen_queue_stats_t after;
+			cw_gen_get_queue_stats(gen, &after);
+			cte->expect_op_int(cte, (int) (before.n_rejected + 1), "==", (int) after.n_rejected, "high water mark: string %zu: rejection is counted", i);
+		}
+		cw_tq_set_capacity_internal(gen->tq, CW_TONE_QUEUE_CAPACITY_MAX, CW_TONE_QUEUE_HIGH_WATER_MARK_MAX);
+	}
+
+
+	/* Test: invalid string. */
+	{
+		errno = 0;
+		const cw_ret_t cwret = LIBCW_TEST_FUT(cw_gen_enqueue_string_atomic)(gen, "PARIS\x01");
+		cte->expect_op_int(cte, CW_FAILURE, "==", cwret, "invalid string: cwret");
+		cte->expect_op_int(cte, ENOENT, "==", errno, "invalid string: errno");
+		cte->expect_op_int(cte, 0, "==", (int) cw_gen_get_queue_length(gen), "invalid string: queue unchanged");
+	}
+
+	gen_destroy(&gen);
+	gen_destroy(&reference_gen);
+
+	cte->print_test_footer(cte, __func__);
+
+	return cwt_retv_ok;
+}
+
+
+
+
+/**
+   @brief Test statistics of generator's tone queue
+*/
+cwt_retv test_cw_gen_get_queue_stats(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, __func__);
+
+	cw_gen_t * gen = NULL;
+	if (0 != gen_setup(cte, &gen)) {
+		cte->log_error(cte, "%s:%d: Failed to create generator\n", __func__, __LINE__);
+		return cwt_retv_err;
+	}
+
+	cw_gen_queue_stats_t stats;
+
+
+	/* Test: invalid arguments. */
+	{
+		errno = 0;
+		const cw_ret_t cwret = LIBCW_TEST_FUT(cw_gen_get_queue_stats)(NULL, &stats);
+		cte->expect_op_int(cte, CW_FAILURE, "==", cwret, "NULL generator: cwret");
+		cte->expect_op_int(cte, EINVAL, "==", errno, "NULL generator: errno");
+	}
+
+
+	/* Test: new generator. */
+	{
+		const cw_ret_t cwret = LIBCW_TEST_FUT(cw_gen_get_queue_stats)(gen, &stats);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, "new generator: cwret");
+		cte->expect_op_int(cte, 0, "==", (int) (stats.n_enqueued + stats.n_dequeued + stats.n_rejected), "new generator: counters");
+		cte->expect_op_int(cte, 0, "==", (int) (stats.max_length + stats.n_drains + stats.empty_usecs), "new generator: queue never drained");
+	}
+
+
+	/* Test: enqueueing until the queue is full. */
+	{
+		cw_tq_set_capacity_internal(gen->tq, 30, 20);
+		int i = 0;
+		while (i < 100 && CW_SUCCESS == cw_gen_enqueue_character(gen, 'E')) {
+			i++;
+		}
+		const int length = (int) cw_gen_get_queue_length(gen);
+
+		LIBCW_TEST_FUT(cw_gen_get_queue_stats)(gen, &stats);
+		cte->expect_op_int(cte, length, "==", (int) stats.n_enqueued, "full queue: enqueued");
+		cte->expect_op_int(cte, 1, "==", (int) stats.n_rejected, "full queue: rejected");
+		cte->expect_op_int(cte, length, "==", (int) stats.max_length, "full queue: max length");
+		cte->expect_op_int(cte, 0, "==", (int) stats.n_dequeued, "full queue: dequeued");
+	}
+
+
+	/* Test: draining the queue. */
+	{
+		cw_sample_t * samples = NULL;
+		size_t size = 0;
+		size_t n_samples = 0;
+		cw_gen_render(gen, &samples, &size, &n_samples);
+		free(samples);
+
+		const int delay_usecs = 20 * 1000;
+		usleep(delay_usecs);
+
+		LIBCW_TEST_FUT(cw_gen_get_queue_stats)(gen, &stats);
+		cte->expect_op_int(cte, (int) stats.n_enqueued, "==", (int) stats.n_dequeued, "drained queue: dequeued");
+		cte->expect_op_int(cte, 1, "==", (int) stats.n_drains, "drained queue: drains");
+		cte->expect_op_int(cte, delay_usecs, "<=", (int) stats.empty_usecs, "drained queue: time of drained queue");
+	}
+
+	gen_destroy(&gen);
+
+	cte->print_test_footer(cte, __func__);
+
+	return cwt_retv_ok;
+}
@@ -29,6 +29,13 @@ int test_cw_gen_enqueue_primitives(cw_test_executor_t * cte);
 int test_cw_gen_enqueue_representations(cw_test_executor_t * cte);
 int test_cw_gen_enqueue_character(cw_test_executor_t * cte);
 int test_cw_gen_enqueue_string(cw_test_executor_t * cte);
+int test_cw_gen_render(cw_test_executor_t * cte);
+int test_cw_gen_fill(cw_test_executor_t * cte);
+int test_cw_gen_sustained_tone(cw_test_executor_t * cte);
+int test_cw_gen_event_fd(cw_test_executor_t * cte);
+int test_cw_gen_queue_mode(cw_test_executor_t * cte);
+int test_cw_gen_enqueue_string_atomic(cw_test_executor_t * cte);
+int test_cw_gen_get_queue_stats(cw_test_executor_t * cte);
 
 
 
@@ -0,0 +1,381 @@
+/*
+ * Copyright (C) 2001-2006  Simon Baldwin (simon_baldwin@yahoo.com)
+ * Copyright (C) 2011-2023  Kamil Ignacak (acerion@wp.pl)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+
+
+
+#include "libcw2.h"
+
+
+
+
+#include "common.h"
+#include "libcw_gen.h"
+#include "libcw_mixer_tests.h"
+#include "libcw_utils.h"
+#include "test_framework.h"
+
+
+
+
+#define MIXER_TEST_N_FRAMES 48000
+
+
+
+
+typedef struct {
+	cw_mixer_t * mixer;
+	cw_gen_t * gen1;
+	cw_gen_t * gen2;
+	int n_calls;
+	bool failure;
+} mixer_callback_data_t;
+
+
+
+
+static cw_gen_t * input_gen_new(cw_test_executor_t * cte, int frequency, int volume, unsigned int sample_rate);
+static void mixer_changing_callback(void * arg);
+
+
+
+
+/**
+   @brief Create generator that will be a source of samples for mixer
+
+   The generator uses Null sound system, its samples are pulled with
+   cw_gen_fill().
+*/
+static cw_gen_t * input_gen_new(cw_test_executor_t * cte, int frequency, int volume, unsigned int sample_rate)
+{
+	cw_gen_config_t gen_conf = cte->current_gen_conf;
+	gen_conf.sound_system = CW_AUDIO_NULL;
+
+	cw_gen_t * gen = cw_gen_new(&gen_conf);
+	if (NULL == gen) {
+		return NULL;
+	}
+	cw_gen_set_speed(gen, cte->config->send_speed);
+	cw_gen_set_frequency(gen, frequency);
+	cw_gen_set_volume(gen, volume);
+	cw_gen_set_sample_rate_internal(gen, sample_rate);
+
+	return gen;
+}
+
+
+
+
+/**
+   @brief Low-level callback of generator that changes inputs of mixer
+
+   The callback is called while mixer pulls samples of the generator.
+*/
+static void mixer_changing_callback(void * arg)
+{
+	mixer_callback_data_t * data = (mixer_callback_data_t *) arg;
+	data->n_calls++;
+
+	if (CW_SUCCESS != cw_mixer_set_gain_and_pan(data->mixer, data->gen1, 50, 0)) {
+		data->failure = true;
+	}
+	if (CW_SUCCESS != cw_mixer_remove_generator(data->mixer, data->gen2)) {
+		data->failure = true;
+	}
+	if (CW_SUCCESS != cw_mixer_add_generator(data->mixer, data->gen2, 100, 0)) {
+		data->failure = true;
+	}
+}
+
+
+
+
+/**
+   @brief Test pulling stereo mix of generators from mixer
+
+   Samples pulled from mixer are compared with samples pulled directly
+   from identical generators. Test checks that generators are panned to
+   correct channels, that their gains are applied, and that sums of
+   samples are saturated.
+*/
+cwt_retv test_cw_mixer_fill(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, __func__);
+
+	if (CW_AUDIO_CONSOLE == cte->current_gen_conf.sound_system) {
+		cw_mixer_t * mixer = LIBCW_TEST_FUT(cw_mixer_new)(&cte->current_gen_conf);
+		cte->expect_null_pointer(cte, mixer, "mixer with Console sound system");
+		cte->print_test_footer(cte, __func__);
+		return cwt_retv_ok;
+	}
+
+	cw_mixer_t * mixer = LIBCW_TEST_FUT(cw_mixer_new)(&cte->current_gen_conf);
+	if (NULL == mixer) {
+		cte->log_error(cte, "%s:%d: Failed to create mixer\n", __func__, __LINE__);
+		return cwt_retv_err;
+	}
+	const unsigned int sample_rate = cw_mixer_get_sample_rate(mixer);
+
+	cw_sample_t * out = (cw_sample_t *) calloc(2 * MIXER_TEST_N_FRAMES, sizeof (cw_sample_t));
+	cw_sample_t * reference1 = (cw_sample_t *) calloc(MIXER_TEST_N_FRAMES, sizeof (cw_sample_t));
+	cw_sample_t * reference2 = (cw_sample_t *) calloc(MIXER_TEST_N_FRAMES, sizeof (cw_sample_t));
+	cte->assert2(cte, out && reference1 && reference2, "failed to allocate buffers");
+
+	/* Generators in mixer, and their references. */
+	cw_gen_t * gen1 = input_gen_new(cte, 600, 70, 8000);
+	cw_gen_t * gen2 = input_gen_new(cte, 900, 70, 8000);
+	cw_gen_t * ref1 = input_gen_new(cte, 600, 70, sample_rate);
+	cw_gen_t * ref2 = input_gen_new(cte, 900, 70, sample_rate);
+	cte->assert2(cte, gen1 && gen2 && ref1 && ref2, "failed to create generators");
+
+
+	/* Test: two generators panned hard left and hard right. */
+	{
+		cw_ret_t cwret = LIBCW_TEST_FUT(cw_mixer_add_generator)(mixer, gen1, 100, -100);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, "add first generator");
+		cwret = LIBCW_TEST_FUT(cw_mixer_add_generator)(mixer, gen2, 50, 100);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, "add second generator");
+		cte->expect_op_int(cte, (int) sample_rate, "==", (int) gen1->sample_rate, "generator uses sample rate of mixer");
+
+		cw_gen_enqueue_string(gen1, "PARIS");
+		cw_gen_enqueue_string(gen2, "CQ");
+		cw_gen_enqueue_string(ref1, "PARIS");
+		cw_gen_enqueue_string(ref2, "CQ");
+
+		cwret = LIBCW_TEST_FUT(cw_mixer_fill)(mixer, out, MIXER_TEST_N_FRAMES);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, "fill: cwret");
+		cw_gen_fill(ref1, reference1, MIXER_TEST_N_FRAMES);
+		cw_gen_fill(ref2, reference2, MIXER_TEST_N_FRAMES);
+
+		bool left_failure = false;
+		bool right_failure = false;
+		bool sound_failure = true;
+		for (int i = 0; i < MIXER_TEST_N_FRAMES; i++) {
+			if (out[2 * i] != reference1[i]) {
+				left_failure = true;
+			}
+			/* Gain of 50% of the second generator. */
+			if (out[2 * i + 1] != (reference2[i] * 16384) >> 15) {
+				right_failure = true;
+			}
+			if (0 != out[2 * i] && 0 != out[2 * i + 1]) {
+				sound_failure = false;
+			}
+		}
+		cte->expect_op_int(cte, false, "==", sound_failure, "fill: both channels have sound");
+		cte->expect_op_int(cte, false, "==", left_failure, "fill: left channel has first generator");
+		cte->expect_op_int(cte, false, "==", right_failure, "fill: right channel has second generator with gain");
+	}
+
+
+	/* Test: sums of samples are saturated. Two identical generators
+	   at full volume in the center of the mix are louder than
+	   maximum value of a sample. */
+	{
+		cw_gen_set_volume(gen1, 100);
+		cw_gen_set_volume(gen2, 100);
+		cw_gen_set_volume(ref1, 100);
+		cw_gen_set_frequency(gen2, 600);
+		cw_mixer_set_gain_and_pan(mixer, gen1, 100, 0);
+		cw_mixer_set_gain_and_pan(mixer, gen2, 100, 0);
+
+		/* Let output gain stages reach new volume, and let
+		   generators end their current tones. */
+		cw_gen_flush_queue(gen1);
+		cw_gen_flush_queue(gen2);
+		cw_gen_flush_queue(ref1);
+		cw_mixer_fill(mixer, out, MIXER_TEST_N_FRAMES);
+		cw_gen_fill(ref1, reference1, MIXER_TEST_N_FRAMES);
+
+		cw_gen_enqueue_mark_internal(gen1, CW_DASH_REPRESENTATION, true);
+		cw_gen_enqueue_mark_internal(gen2, CW_DASH_REPRESENTATION, true);
+		cw_gen_enqueue_mark_internal(ref1, CW_DASH_REPRESENTATION, true);
+		cw_mixer_fill(mixer, out, MIXER_TEST_N_FRAMES);
+		cw_gen_fill(ref1, reference1, MIXER_TEST_N_FRAMES);
+
+		int n_saturated = 0;
+		bool saturation_failure = false;
+		for (int i = 0; i < MIXER_TEST_N_FRAMES; i++) {
+			/* Gain in the center of the mix is 1/sqrt(2), so the
+			   sum is sqrt(2) times louder than one generator. */
+			if (reference1[i] > 23300) {
+				n_saturated++;
+				if (INT16_MAX != out[2 * i] || INT16_MAX != out[2 * i + 1]) {
+					saturation_failure = true;
+				}
+			} else if (reference1[i] < -23300) {
+				n_saturated++;
+				if (INT16_MIN != out[2 * i] || INT16_MIN != out[2 * i + 1]) {
+					saturation_failure = true;
+				}
+			}
+		}
+		cte->expect_op_int(cte, 0, "<", n_saturated, "saturation: count of saturated samples");
+		cte->expect_op_int(cte, false, "==", saturation_failure, "saturation: saturated samples");
+	}
+
+
+	/* Test: callback of generator calls functions of mixer while the
+	   mixer pulls samples of the generator. */
+	{
+		mixer_callback_data_t data = { .mixer = mixer, .gen1 = gen1, .gen2 = gen2, .n_calls = 0, .failure = false };
+		cw_gen_register_low_level_callback(gen1, mixer_changing_callback, &data, 1);
+
+		cw_gen_enqueue_string(gen1, "E");
+		cw_ret_t cwret = LIBCW_TEST_FUT(cw_mixer_fill)(mixer, out, MIXER_TEST_N_FRAMES);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, "callback: fill");
+		cte->expect_op_int(cte, 0, "<", data.n_calls, "callback: callback has been called");
+		cte->expect_op_int(cte, false, "==", data.failure, "callback: mixer functions called from callback");
+
+		cw_gen_register_low_level_callback(gen1, NULL, NULL, 0);
+	}
+
+
+	/* Test: invalid arguments. */
+	{
+		cw_ret_t cwret = LIBCW_TEST_FUT(cw_mixer_add_generator)(mixer, gen1, 100, 0);
+		cte->expect_op_int(cte, CW_FAILURE, "==", cwret, "add generator twice");
+		cwret = LIBCW_TEST_FUT(cw_mixer_set_gain_and_pan)(mixer, gen1, 101, 0);
+		cte->expect_op_int(cte, CW_FAILURE, "==", cwret, "invalid gain");
+		cwret = LIBCW_TEST_FUT(cw_mixer_set_gain_and_pan)(mixer, gen1, 100, -101);
+		cte->expect_op_int(cte, CW_FAILURE, "==", cwret, "invalid pan");
+		cwret = LIBCW_TEST_FUT(cw_mixer_remove_generator)(mixer, ref1);
+		cte->expect_op_int(cte, CW_FAILURE, "==", cwret, "remove generator that isn't in mixer");
+		cwret = LIBCW_TEST_FUT(cw_mixer_remove_generator)(mixer, gen1);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, "remove generator");
+		cwret = LIBCW_TEST_FUT(cw_mixer_remove_generator)(mixer, gen2);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, "remove generator");
+
+		bool null_failure = false;
+		null_failure = null_failure || CW_FAILURE != LIBCW_TEST_FUT(cw_mixer_start)(NULL);
+		null_failure = null_failure || CW_FAILURE != LIBCW_TEST_FUT(cw_mixer_stop)(NULL);
+		null_failure = null_failure || CW_FAILURE != LIBCW_TEST_FUT(cw_mixer_add_generator)(NULL, gen1, 100, 0);
+		null_failure = null_failure || CW_FAILURE != LIBCW_TEST_FUT(cw_mixer_remove_generator)(NULL, gen1);
+		null_failure = null_failure || CW_FAILURE != LIBCW_TEST_FUT(cw_mixer_set_gain_and_pan)(NULL, gen1, 100, 0);
+		null_failure = null_failure || CW_FAILURE != LIBCW_TEST_FUT(cw_mixer_fill)(NULL, out, 1);
+		cte->expect_op_int(cte, false, "==", null_failure, "NULL mixer");
+	}
+
+	cw_mixer_delete(&mixer);
+	cw_gen_delete(&gen1);
+	cw_gen_delete(&gen2);
+	cw_gen_delete(&ref1);
+	cw_gen_delete(&ref2);
+	free(out);
+	free(reference1);
+	free(reference2);
+
+	cte->print_test_footer(cte, __func__);
+
+	return cwt_retv_ok;
+}
+
+
+
+
+/**
+   @brief Test playing of many generators by started mixer
+
+   Tones enqueued in many generators registered in started mixer should
+   be played in real time.
+*/
+cwt_retv test_cw_mixer_start_stop(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, __func__);
+
+	if (CW_AUDIO_CONSOLE == cte->current_gen_conf.sound_system) {
+		cte->print_test_footer(cte, __func__);
+		return cwt_retv_ok;
+	}
+
+	cw_mixer_t * mixer = cw_mixer_new(&cte->current_gen_conf);
+	if (NULL == mixer) {
+		cte->log_error(cte, "%s:%d: Failed to create mixer\n", __func__, __LINE__);
+		return cwt_retv_err;
+	}
+
+	enum { n_gens = 20 };
+	cw_gen_t * gens[n_gens] = { 0 };
+	for (int i = 0; i < n_gens; i++) {
+		gens[i] = input_gen_new(cte, 400 + 25 * i, 50, cw_mixer_get_sample_rate(mixer));
+		cte->assert2(cte, gens[i], "failed to create generator %d", i);
+	}
+
+	/* Half of generators is added before mixer is started. */
+	for (int i = 0; i < n_gens / 2; i++) {
+		cw_mixer_add_generator(mixer, gens[i], 5, -100 + 10 * i);
+	}
+
+	cw_ret_t cwret = LIBCW_TEST_FUT(cw_mixer_start)(mixer);
+	cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, "start");
+
+	cw_sample_t sample = 0;
+	cwret = LIBCW_TEST_FUT(cw_mixer_fill)(mixer, &sample, 1);
+	cte->expect_op_int(cte, CW_FAILURE, "==", cwret, "fill in started mixer");
+
+	/* Generators can be added to started mixer. */
+	for (int i = n_gens / 2; i < n_gens; i++) {
+		cwret = LIBCW_TEST_FUT(cw_mixer_add_generator)(mixer, gens[i], 5, -100 + 10 * i);
+		cte->expect_op_int_errors_only(cte, CW_SUCCESS, "==", cwret, "add generator %d to started mixer", i);
+	}
+
+	for (int i = 0; i < n_gens; i++) {
+		cw_gen_enqueue_string(gens[i], "E");
+	}
+
+	/* A dot at default speed is much shorter than a second. */
+	struct timeval start;
+	struct timeval now;
+	gettimeofday(&start, NULL);
+	bool played = false;
+	for (int k = 0; k < 100 && !played; k++) {
+		cw_usleep_internal(20 * 1000);
+		played = true;
+		for (int i = 0; i < n_gens; i++) {
+			if (0 != cw_gen_get_queue_length(gens[i])) {
+				played = false;
+			}
+		}
+	}
+	gettimeofday(&now, NULL);
+	cte->expect_op_int(cte, true, "==", played, "tones of all generators are played");
+	cte->log_info(cte, "Generators played tones in %d us\n", cw_timestamp_compare_internal(&start, &now));
+
+	cwret = LIBCW_TEST_FUT(cw_mixer_stop)(mixer);
+	cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, "stop");
+
+	for (int i = 0; i < n_gens; i++) {
+		cw_mixer_remove_generator(mixer, gens[i]);
+		cw_gen_delete(&gens[i]);
+	}
+	cw_mixer_delete(&mixer);
+
+	cte->print_test_footer(cte, __func__);
+
+	return cwt_retv_ok;
+}
@@ -0,0 +1,23 @@
+/*
+  This file is a part of unixcw project.  unixcw project is covered by
+  GNU General Public License, version 2 or later.
+*/
+
+#ifndef _LIBCW_MIXER_TESTS_H_
+#define _LIBCW_MIXER_TESTS_H_
+
+
+
+
+#include "test_framework.h"
+
+
+
+
+int test_cw_mixer_fill(cw_test_executor_t * cte);
+int test_cw_mixer_start_stop(cw_test_executor_t * cte);
+
+
+
+
+#endif /* #ifndef _LIBCW_MIXER_TESTS_H_ */
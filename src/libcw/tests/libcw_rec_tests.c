@@ -23,6 +23,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <errno.h>
+#include <limits.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
@@ -36,10 +37,12 @@
 #include "libcw.h"
 #include "libcw2.h"
 
+#include "libcw_data.h"
 #include "libcw_debug.h"
 #include "libcw_key.h"
 #include "libcw_rec.h"
 #include "libcw_rec_internal.h"
+#include "libcw_rec_pool.h"
 #include "libcw_rec_tests.h"
 #include "libcw_tq.h"
 #include "libcw_utils.h"
@@ -398,6 +401,665 @@ int test_cw_rec_test_with_varying_speeds(cw_test_executor_t * cte)
 
 
 
+typedef struct {
+	const cw_rec_test_vector * vec;
+	size_t n_received;
+	bool failure;
+} test_cw_rec_decode_events_data_t;
+
+
+
+
+/**
+   @brief Compare characters decoded by cw_rec_decode_events() with test vector
+*/
+static void test_cw_rec_decode_events_callback(void * arg, char character, const char * representation, bool is_end_of_word, bool is_error)
+{
+	test_cw_rec_decode_events_data_t * data = (test_cw_rec_decode_events_data_t *) arg;
+	if (data->n_received == data->vec->n_points_valid) {
+		data->failure = true;
+		return;
+	}
+
+	const cw_rec_test_point * point = data->vec->points[data->n_received];
+	data->n_received++;
+
+	/* End of events is always an end of word. */
+	const bool expected_end_of_word = point->is_last_in_word || data->n_received == data->vec->n_points_valid;
+
+	if (character != point->character
+	    || 0 != strcmp(representation, point->representation)
+	    || is_end_of_word != expected_end_of_word
+	    || is_error) {
+
+		data->failure = true;
+	}
+}
+
+
+
+
+/**
+   @brief Decode whole test vector with cw_rec_decode_events()
+
+   @return true on failure
+   @return false otherwise
+*/
+static bool test_cw_rec_decode_events_vector(cw_test_executor_t * cte, cw_rec_t * rec, const cw_rec_test_vector * vec)
+{
+	size_t n_events = 0;
+	for (size_t i = 0; i < vec->n_points_valid; i++) {
+		n_events += vec->points[i]->n_tone_durations;
+	}
+	cw_rec_event_t * events = (cw_rec_event_t *) calloc(n_events, sizeof (cw_rec_event_t));
+	cte->assert2(cte, events, "decode events: failed to allocate events\n");
+
+	size_t e = 0;
+	for (size_t i = 0; i < vec->n_points_valid; i++) {
+		const cw_rec_test_point * point = vec->points[i];
+		for (int tone = 0; point->tone_durations[tone] > 0; tone++) {
+			events[e].is_mark = 0 == tone % 2;
+			events[e].duration = point->tone_durations[tone];
+			e++;
+		}
+	}
+
+	test_cw_rec_decode_events_data_t data = { .vec = vec, .n_received = 0, .failure = false };
+	const cw_ret_t cwret = LIBCW_TEST_FUT(cw_rec_decode_events)(rec, events, e, test_cw_rec_decode_events_callback, &data);
+	free(events);
+
+	return CW_SUCCESS != cwret || data.failure || data.n_received != vec->n_points_valid;
+}
+
+
+
+
+/**
+   @brief Test decoding of recorded Marks and Spaces with cw_rec_decode_events()
+*/
+int test_cw_rec_decode_events(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, __func__);
+
+	cw_rec_t * rec = cw_rec_new();
+	cte->assert2(cte, rec, "decode events: failed to create new receiver\n");
+
+
+	/* Test: the same data as in test with constant speeds. */
+	{
+		bool failure = false;
+		for (int speed = CW_SPEED_MIN; speed <= CW_SPEED_MAX && !failure; speed++) {
+			const cw_variation_params variation_params = { .speed = speed, .speed_min = 0, .speed_max = 0 };
+			cw_rec_test_vector * vec = cw_rec_test_vector_factory(cte, cw_characters_list_new_random, cw_send_speeds_new_constant, &variation_params);
+			cte->assert2(cte, vec, "decode events: failed to generate test vector\n");
+
+			cw_rec_reset_statistics(rec);
+			cw_rec_set_speed(rec, speed);
+			cw_rec_disable_adaptive_mode(rec);
+			failure = test_cw_rec_decode_events_vector(cte, rec, vec);
+
+			cw_rec_test_vector_delete(&vec);
+		}
+		cte->expect_op_int(cte, false, "==", failure, "decode events: constant speeds");
+	}
+
+
+	/* Test: the same data as in test with varying speeds. */
+	{
+		const cw_variation_params variation_params = { .speed = 0, .speed_min = CW_SPEED_MIN, .speed_max = CW_SPEED_MAX };
+		cw_rec_test_vector * vec = cw_rec_test_vector_factory(cte, cw_characters_list_new_basic, cw_send_speeds_new_varying_sine, &variation_params);
+		cte->assert2(cte, vec, "decode events: failed to generate test vector\n");
+
+		cw_rec_reset_statistics(rec);
+		cw_rec_set_speed(rec, CW_SPEED_MAX);
+		cw_rec_enable_adaptive_mode(rec);
+		const bool failure = test_cw_rec_decode_events_vector(cte, rec, vec);
+		cte->expect_op_int(cte, false, "==", failure, "decode events: varying speeds");
+
+		cw_rec_test_vector_delete(&vec);
+	}
+
+
+	/* Test: noise spike is a part of Space around it. Two halves of
+	   the Space make together inter-character-space. */
+	{
+		cw_rec_disable_adaptive_mode(rec);
+		cw_rec_set_speed(rec, 12);
+		cw_rec_set_noise_spike_threshold(rec, 10000);
+		const cw_rec_event_t events[] = {
+			{ true,  100000 },
+			{ false, 130000 },
+			{ true,    5000 }, /* Noise spike. */
+			{ false, 130000 },
+			{ true,  100000 },
+		};
+		cw_rec_test_vector * vec = cw_rec_test_vector_new(cte, 2);
+		cte->assert2(cte, vec, "decode events: failed to allocate test vector\n");
+		for (size_t i = 0; i < 2; i++) {
+			vec->points[i]->character = 'E';
+			vec->points[i]->representation = strdup(".");
+			vec->points[i]->is_last_in_word = false;
+		}
+		vec->n_points_valid = 2;
+
+		test_cw_rec_decode_events_data_t data = { .vec = vec, .n_received = 0, .failure = false };
+		const cw_ret_t cwret = LIBCW_TEST_FUT(cw_rec_decode_events)(rec, events, sizeof (events) / sizeof (events[0]), test_cw_rec_decode_events_callback, &data);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, "decode events: noise spike: cwret");
+		cte->expect_op_int(cte, 2, "==", (int) data.n_received, "decode events: noise spike: count of characters");
+		cte->expect_op_int(cte, false, "==", data.failure, "decode events: noise spike: characters");
+
+		cw_rec_test_vector_delete(&vec);
+	}
+
+
+	/* Test: invalid arguments. */
+	{
+		const cw_rec_event_t events[] = { { true, 100000 }, { false, -1 } };
+		test_cw_rec_decode_events_data_t data = { .vec = NULL, .n_received = 0, .failure = false };
+
+		errno = 0;
+		const cw_ret_t cwret = LIBCW_TEST_FUT(cw_rec_decode_events)(rec, events, 2, test_cw_rec_decode_events_callback, &data);
+		cte->expect_op_int(cte, CW_FAILURE, "==", cwret, "decode events: negative duration: cwret");
+		cte->expect_op_int(cte, EINVAL, "==", errno, "decode events: negative duration: errno");
+
+		const cw_ret_t cwret2 = LIBCW_TEST_FUT(cw_rec_decode_events)(NULL, events, 1, test_cw_rec_decode_events_callback, &data);
+		cte->expect_op_int(cte, CW_FAILURE, "==", cwret2, "decode events: NULL receiver: cwret");
+	}
+
+	cw_rec_delete(&rec);
+
+	cte->print_test_footer(cte, __func__);
+
+	return 0;
+}
+
+
+
+
+/**
+   @brief Test receiver's functions accepting nanosecond timestamps
+*/
+int test_cw_rec_ns_timestamps(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, __func__);
+
+	cw_rec_t * rec = cw_rec_new();
+	cte->assert2(cte, rec, "ns timestamps: failed to create new receiver\n");
+
+
+	/* Test: receiving characters sent with varying speeds. Start
+	   with a large timestamp, as if taken from a long-running
+	   CLOCK_MONOTONIC clock. */
+	{
+		const cw_variation_params variation_params = { .speed = 0, .speed_min = CW_SPEED_MIN, .speed_max = CW_SPEED_MAX };
+		cw_rec_test_vector * vec = cw_rec_test_vector_factory(cte, cw_characters_list_new_basic, cw_send_speeds_new_varying_sine, &variation_params);
+		cte->assert2(cte, vec, "ns timestamps: failed to generate test vector\n");
+
+		cw_rec_reset_statistics(rec);
+		cw_rec_set_speed(rec, CW_SPEED_MAX);
+		cw_rec_enable_adaptive_mode(rec);
+
+		int64_t timestamp_ns = (int64_t) 1000000 * CW_NSECS_PER_SEC;
+		bool failure = false;
+		for (size_t i = 0; i < vec->n_points_valid && !failure; i++) {
+			const cw_rec_test_point * point = vec->points[i];
+			for (int tone = 0; point->tone_durations[tone] > 0 && !failure; tone++) {
+				const cw_ret_t cwret = (tone % 2)
+					? LIBCW_TEST_FUT(cw_rec_mark_end_ns)(rec, timestamp_ns)
+					: LIBCW_TEST_FUT(cw_rec_mark_begin_ns)(rec, timestamp_ns);
+				failure = CW_SUCCESS != cwret;
+				timestamp_ns += (int64_t) point->tone_durations[tone] * 1000;
+			}
+			if (failure) {
+				break;
+			}
+
+			char character = 0;
+			bool is_end_of_word = false;
+			bool is_error = false;
+			const cw_ret_t cwret = LIBCW_TEST_FUT(cw_rec_poll_character_ns)(rec, timestamp_ns, &character, &is_end_of_word, &is_error);
+			failure = CW_SUCCESS != cwret
+				|| character != point->character
+				|| is_end_of_word != point->is_last_in_word
+				|| is_error;
+			cw_rec_reset_state(rec);
+		}
+		cte->expect_op_int(cte, false, "==", failure, "ns timestamps: varying speeds");
+
+		cw_rec_test_vector_delete(&vec);
+	}
+
+
+	/* Test: adding Marks and polling representation. */
+	{
+		cw_rec_disable_adaptive_mode(rec);
+		cw_rec_set_speed(rec, 12); /* Dot = 100000 [us]. */
+		cw_rec_reset_state(rec);
+
+		const int64_t timestamp_ns = 5 * (int64_t) CW_NSECS_PER_SEC;
+		cte->expect_op_int(cte, CW_SUCCESS, "==", LIBCW_TEST_FUT(cw_rec_add_mark_ns)(rec, timestamp_ns, CW_DOT_REPRESENTATION), "ns timestamps: add Dot");
+		cte->expect_op_int(cte, CW_SUCCESS, "==", LIBCW_TEST_FUT(cw_rec_add_mark_ns)(rec, timestamp_ns, CW_DASH_REPRESENTATION), "ns timestamps: add Dash");
+
+		char representation[CW_REC_REPRESENTATION_CAPACITY + 1] = { 0 };
+		bool is_end_of_word = true;
+		errno = 0;
+		cw_ret_t cwret = LIBCW_TEST_FUT(cw_rec_poll_representation_ns)(rec, timestamp_ns + 100000 * 1000, representation, &is_end_of_word, NULL);
+		cte->expect_op_int(cte, EAGAIN, "==", errno, "ns timestamps: poll representation in inter-mark-space");
+
+		cwret = LIBCW_TEST_FUT(cw_rec_poll_representation_ns)(rec, timestamp_ns + 300000 * 1000, representation, &is_end_of_word, NULL);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, "ns timestamps: poll representation in inter-character-space");
+		cte->expect_op_int(cte, 0, "==", strcmp(representation, ".-"), "ns timestamps: polled representation");
+		cte->expect_op_int(cte, false, "==", is_end_of_word, "ns timestamps: polled representation: end of word");
+
+		cwret = LIBCW_TEST_FUT(cw_rec_poll_representation_ns)(rec, timestamp_ns + 1000000 * 1000, representation, &is_end_of_word, NULL);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, "ns timestamps: poll representation in inter-word-space");
+		cte->expect_op_int(cte, true, "==", is_end_of_word, "ns timestamps: polled representation: end of word");
+
+		/* Timestamp is not needed when inter-word-space has been
+		   already recognized, so it is not validated. */
+		const struct timeval invalid_timestamp = { .tv_sec = -1, .tv_usec = 0 };
+		memset(representation, 0, sizeof (representation));
+		cwret = LIBCW_TEST_FUT(cw_rec_poll_representation)(rec, &invalid_timestamp, representation, &is_end_of_word, NULL);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, "ns timestamps: poll representation with unused invalid timestamp");
+		cte->expect_op_int(cte, 0, "==", strcmp(representation, ".-"), "ns timestamps: polled representation with unused invalid timestamp");
+
+		cw_rec_reset_state(rec);
+	}
+
+
+	/* Test: representation that can't form a valid character is
+	   reported as error. */
+	{
+		cw_rec_reset_state(rec);
+
+		const char * invalid_representation = "----.-";
+		const int64_t timestamp_ns = 10 * (int64_t) CW_NSECS_PER_SEC;
+		bool add_failure = false;
+		for (size_t i = 0; invalid_representation[i]; i++) {
+			if (CW_SUCCESS != LIBCW_TEST_FUT(cw_rec_add_mark_ns)(rec, timestamp_ns, invalid_representation[i])) {
+				add_failure = true;
+			}
+		}
+		cte->expect_op_int(cte, false, "==", add_failure, "ns timestamps: add Marks of invalid representation");
+
+		char representation[CW_REC_REPRESENTATION_CAPACITY + 1] = { 0 };
+		bool is_error = false;
+		cw_ret_t cwret = LIBCW_TEST_FUT(cw_rec_poll_representation_ns)(rec, timestamp_ns + 300000 * 1000, representation, NULL, &is_error);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, "ns timestamps: poll invalid representation");
+		cte->expect_op_int(cte, 0, "==", strcmp(representation, invalid_representation), "ns timestamps: polled invalid representation");
+		cte->expect_op_int(cte, true, "==", is_error, "ns timestamps: polled invalid representation: error");
+
+		cw_rec_reset_state(rec);
+	}
+
+
+	/* Test: timestamp earlier than reference timestamp by less than
+	   a microsecond. */
+	{
+		const int duration = LIBCW_TEST_FUT(cw_timestamp_compare_ns_internal)(1000000, 1000000 - 500);
+		cte->expect_op_int(cte, INT_MAX, "==", duration, "ns timestamps: compare timestamps in wrong order");
+	}
+
+
+	/* Test: negative timestamp. */
+	{
+		errno = 0;
+		const cw_ret_t cwret = LIBCW_TEST_FUT(cw_rec_mark_begin_ns)(rec, -1);
+		cte->expect_op_int(cte, CW_FAILURE, "==", cwret, "ns timestamps: negative timestamp: cwret");
+		cte->expect_op_int(cte, EINVAL, "==", errno, "ns timestamps: negative timestamp: errno");
+	}
+
+	cw_rec_delete(&rec);
+
+	cte->print_test_footer(cte, __func__);
+
+	return 0;
+}
+
+
+
+
+#define TEST_CW_REC_CALLBACK_MODE_CAPACITY 16
+typedef struct {
+	pthread_mutex_t mutex;
+	char characters[TEST_CW_REC_CALLBACK_MODE_CAPACITY + 1];
+	bool is_end_of_word[TEST_CW_REC_CALLBACK_MODE_CAPACITY];
+	size_t n_received;
+} test_cw_rec_callback_mode_data_t;
+
+
+
+
+/**
+   @brief Callback collecting characters received in callback mode
+*/
+static void test_cw_rec_callback_mode_callback(void * arg, char character, __attribute__((unused)) const char * representation, bool is_end_of_word, __attribute__((unused)) bool is_error)
+{
+	test_cw_rec_callback_mode_data_t * data = (test_cw_rec_callback_mode_data_t *) arg;
+	pthread_mutex_lock(&data->mutex);
+	if (data->n_received < TEST_CW_REC_CALLBACK_MODE_CAPACITY) {
+		data->characters[data->n_received] = character;
+		data->is_end_of_word[data->n_received] = is_end_of_word;
+	}
+	data->n_received++;
+	pthread_mutex_unlock(&data->mutex);
+}
+
+
+
+
+/**
+   @brief Test receiver in callback mode
+*/
+int test_cw_rec_callback_mode(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, __func__);
+
+	cw_rec_t * rec = cw_rec_new();
+	cte->assert2(cte, rec, "callback mode: failed to create new receiver\n");
+	cw_rec_disable_adaptive_mode(rec);
+	cw_rec_set_speed(rec, 12); /* Dot = 100000 [us]. */
+	const int dot_duration = 100000;
+
+	test_cw_rec_callback_mode_data_t data;
+	memset(&data, 0, sizeof (data));
+	pthread_mutex_init(&data.mutex, NULL);
+
+	cw_ret_t cwret = LIBCW_TEST_FUT(cw_rec_register_callback)(rec, test_cw_rec_callback_mode_callback, &data);
+	cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, "callback mode: register callback");
+
+
+	/* Test: characters keyed in real time are passed to callback
+	   without polling the receiver. */
+	{
+		/* 'E' and 'T', separated by inter-character-space. */
+		cw_rec_mark_begin(rec, NULL);
+		cw_usleep_internal(dot_duration);
+		cw_rec_mark_end(rec, NULL);
+		cw_usleep_internal(3 * dot_duration);
+		cw_rec_mark_begin(rec, NULL);
+		cw_usleep_internal(3 * dot_duration);
+		cw_rec_mark_end(rec, NULL);
+
+		/* Wait for end of inter-word-space. */
+		cw_usleep_internal(10 * dot_duration);
+
+		pthread_mutex_lock(&data.mutex);
+		cte->expect_op_int(cte, 3, "==", (int) data.n_received, "callback mode: real time: count of callbacks");
+		cte->expect_op_int(cte, 0, "==", strcmp("ET ", data.characters), "callback mode: real time: characters: '%s'", data.characters);
+		const bool expected_end_of_word = !data.is_end_of_word[0] && !data.is_end_of_word[1] && data.is_end_of_word[2];
+		cte->expect_op_int(cte, true, "==", expected_end_of_word, "callback mode: real time: end of word");
+		memset(data.characters, 0, sizeof (data.characters));
+		data.n_received = 0;
+		pthread_mutex_unlock(&data.mutex);
+	}
+
+
+	/* Test: timestamps advancing faster than real time. Character
+	   is passed to callback when Mark following
+	   inter-character-space begins. */
+	{
+		const int64_t base_ns = 1000 * (int64_t) CW_NSECS_PER_SEC;
+		const int64_t dot_ns = dot_duration * (int64_t) 1000;
+		cw_rec_mark_begin_ns(rec, base_ns);
+		cw_rec_mark_end_ns(rec, base_ns + dot_ns);
+		cw_rec_mark_begin_ns(rec, base_ns + 4 * dot_ns);
+
+		pthread_mutex_lock(&data.mutex);
+		cte->expect_op_int(cte, 1, "==", (int) data.n_received, "callback mode: fast timestamps: count of callbacks at begin of Mark");
+		pthread_mutex_unlock(&data.mutex);
+
+		cw_rec_mark_end_ns(rec, base_ns + 5 * dot_ns);
+		cw_usleep_internal(10 * dot_duration);
+
+		pthread_mutex_lock(&data.mutex);
+		cte->expect_op_int(cte, 3, "==", (int) data.n_received, "callback mode: fast timestamps: count of callbacks");
+		cte->expect_op_int(cte, 0, "==", strcmp("EE ", data.characters), "callback mode: fast timestamps: characters: '%s'", data.characters);
+		pthread_mutex_unlock(&data.mutex);
+	}
+
+
+	/* Test: parameters of receiver can be changed while thread of
+	   receiver is running. */
+	{
+		cwret = LIBCW_TEST_FUT(cw_rec_set_speed)(rec, 12);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, "callback mode: set speed");
+		cwret = LIBCW_TEST_FUT(cw_rec_set_tolerance)(rec, CW_TOLERANCE_INITIAL);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, "callback mode: set tolerance");
+		cwret = LIBCW_TEST_FUT(cw_rec_set_noise_spike_threshold)(rec, CW_REC_NOISE_THRESHOLD_INITIAL);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, "callback mode: set noise spike threshold");
+	}
+
+
+	cwret = LIBCW_TEST_FUT(cw_rec_register_callback)(rec, NULL, NULL);
+	cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, "callback mode: unregister callback");
+
+	/* Receiver in callback mode can be deleted. */
+	cwret = LIBCW_TEST_FUT(cw_rec_register_callback)(rec, test_cw_rec_callback_mode_callback, &data);
+	cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, "callback mode: register callback again");
+	cw_rec_delete(&rec);
+
+	pthread_mutex_destroy(&data.mutex);
+
+	cte->print_test_footer(cte, __func__);
+
+	return 0;
+}
+
+
+
+
+#define TEST_CW_REC_POOL_N_CHANNELS 300
+#define TEST_CW_REC_POOL_TEXT_CAPACITY 32
+typedef struct {
+	char text[TEST_CW_REC_POOL_N_CHANNELS][TEST_CW_REC_POOL_TEXT_CAPACITY + 1];
+	size_t length[TEST_CW_REC_POOL_N_CHANNELS];
+	pthread_mutex_t gate; /* Locked by test to block workers in callback. */
+} test_cw_rec_pool_data_t;
+
+
+
+
+/**
+   @brief Collect text received in channels of pool of receivers
+
+   Each channel is handled by one worker thread, so text of a channel
+   can be modified without locking.
+
+   A ' ' character passed by pool after a character that has been
+   already passed ends a word.
+*/
+static void test_cw_rec_pool_callback(void * arg, size_t channel, char character, __attribute__((unused)) const char * representation, bool is_end_of_word, __attribute__((unused)) bool is_error)
+{
+	test_cw_rec_pool_data_t * data = (test_cw_rec_pool_data_t *) arg;
+	pthread_mutex_lock(&data->gate);
+	pthread_mutex_unlock(&data->gate);
+	if (channel >= TEST_CW_REC_POOL_N_CHANNELS || data->length[channel] + 2 > TEST_CW_REC_POOL_TEXT_CAPACITY) {
+		return;
+	}
+	data->text[channel][data->length[channel]++] = character;
+	if (is_end_of_word && ' ' != character) {
+		data->text[channel][data->length[channel]++] = ' ';
+	}
+}
+
+
+
+
+/**
+   @brief Append Marks and Spaces of @p text to @p events
+
+   Spaces are appended as many events: a Space after a Mark, and
+   separate events extending it to inter-character-space or
+   inter-word-space. With @p split_marks each Mark is appended as two
+   events.
+
+   @return count of events
+*/
+static size_t test_cw_rec_pool_text_to_events(const char * text, int dot_duration, bool split_marks, cw_rec_event_t * events)
+{
+	size_t n = 0;
+	for (size_t i = 0; text[i]; i++) {
+		if (' ' == text[i]) {
+			events[n++] = (cw_rec_event_t) { false, 4 * dot_duration };
+			continue;
+		}
+		const char * representation = cw_character_to_representation_internal(text[i]);
+		for (size_t m = 0; representation[m]; m++) {
+			const int duration = (CW_DOT_REPRESENTATION == representation[m] ? 1 : 3) * dot_duration;
+			if (split_marks) {
+				events[n++] = (cw_rec_event_t) { true, duration / 2 };
+				events[n++] = (cw_rec_event_t) { true, duration - duration / 2 };
+			} else {
+				events[n++] = (cw_rec_event_t) { true, duration };
+			}
+			events[n++] = (cw_rec_event_t) { false, dot_duration };
+		}
+		events[n++] = (cw_rec_event_t) { false, 2 * dot_duration };
+	}
+	return n;
+}
+
+
+
+
+/**
+   @brief Test pool of receivers decoding many channels
+*/
+int test_cw_rec_pool(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, __func__);
+
+	const char * text = "PARIS CQ DE";
+	const char * expected_text = "PARIS CQ DE "; /* End of stream is end of word. */
+	const int dot_duration = 60000; /* 20 wpm. */
+
+	cw_rec_event_t events[2][128];
+	size_t n_events[2] = { 0 };
+	n_events[0] = test_cw_rec_pool_text_to_events(text, dot_duration, false, events[0]);
+	n_events[1] = test_cw_rec_pool_text_to_events(text, dot_duration, true, events[1]);
+
+	test_cw_rec_pool_data_t * data = (test_cw_rec_pool_data_t *) calloc(1, sizeof (test_cw_rec_pool_data_t));
+	cte->assert2(cte, data, "pool: failed to allocate test data\n");
+	pthread_mutex_init(&data->gate, NULL);
+
+	cw_rec_pool_t * pool = LIBCW_TEST_FUT(cw_rec_pool_new)(TEST_CW_REC_POOL_N_CHANNELS, 4, test_cw_rec_pool_callback, data);
+	cte->assert2(cte, pool, "pool: failed to create pool\n");
+
+	for (size_t channel = 0; channel < TEST_CW_REC_POOL_N_CHANNELS; channel++) {
+		cw_rec_t * rec = LIBCW_TEST_FUT(cw_rec_pool_get_receiver)(pool, channel);
+		cw_rec_disable_adaptive_mode(rec);
+		cw_rec_set_speed(rec, 20);
+	}
+
+
+	/* Test: events of all channels, pushed in interleaved chunks
+	   of different sizes. */
+	{
+		bool push_failure = false;
+		for (size_t offset = 0; offset < n_events[1]; offset++) {
+			for (size_t channel = 0; channel < TEST_CW_REC_POOL_N_CHANNELS; channel++) {
+				const size_t variant = channel % 2;
+				const size_t chunk = channel % 7 + 1;
+				if (offset % chunk || offset >= n_events[variant]) {
+					continue;
+				}
+				const size_t n = offset + chunk > n_events[variant] ? n_events[variant] - offset : chunk;
+				cw_ret_t cwret = LIBCW_TEST_FUT(cw_rec_pool_push_events)(pool, channel, events[variant] + offset, n);
+				if (CW_FAILURE == cwret && EAGAIN == errno) {
+					/* Queue of worker is full. */
+					cw_rec_pool_wait(pool);
+					cwret = LIBCW_TEST_FUT(cw_rec_pool_push_events)(pool, channel, events[variant] + offset, n);
+				}
+				if (CW_SUCCESS != cwret) {
+					push_failure = true;
+				}
+			}
+		}
+		for (size_t channel = 0; channel < TEST_CW_REC_POOL_N_CHANNELS; channel++) {
+			if (CW_SUCCESS != LIBCW_TEST_FUT(cw_rec_pool_end_stream)(pool, channel)) {
+				push_failure = true;
+			}
+		}
+		cte->expect_op_int(cte, false, "==", push_failure, "pool: push events");
+
+		const cw_ret_t cwret = LIBCW_TEST_FUT(cw_rec_pool_wait)(pool);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, "pool: wait");
+
+		bool text_failure = false;
+		for (size_t channel = 0; channel < TEST_CW_REC_POOL_N_CHANNELS; channel++) {
+			if (!cte->expect_op_int_errors_only(cte, 0, "==", strcmp(expected_text, data->text[channel]), "pool: text in channel %zu: '%s'", channel, data->text[channel])) {
+				text_failure = true;
+				break;
+			}
+		}
+		cte->expect_op_int(cte, false, "==", text_failure, "pool: received text");
+	}
+
+
+	/* Test: queue of worker is bounded. The worker is blocked in
+	   callback, so the queue is not emptied. */
+	{
+		memset(data->text[0], 0, sizeof (data->text[0]));
+		data->length[0] = 0;
+		pthread_mutex_lock(&data->gate);
+
+		/* The character is passed to callback as soon as the Space
+		   after it is inter-character-space. */
+		const cw_rec_event_t character_events[] = { { true, dot_duration }, { false, 3 * dot_duration } };
+		cw_ret_t cwret = LIBCW_TEST_FUT(cw_rec_pool_push_events)(pool, 0, character_events, 2);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, "pool: bounded queue: push character");
+
+		/* The worker may take some of the jobs before it is blocked,
+		   but not more than a full queue. */
+		const cw_rec_event_t space_event = { false, dot_duration };
+		int n_rejected = 0;
+		for (int i = 0; i < 2 * CW_REC_POOL_WORKER_QUEUE_CAPACITY + 1; i++) {
+			if (CW_FAILURE == LIBCW_TEST_FUT(cw_rec_pool_push_events)(pool, 0, &space_event, 1)) {
+				cte->expect_op_int(cte, EAGAIN, "==", errno, "pool: bounded queue: errno");
+				n_rejected++;
+				break;
+			}
+		}
+		cte->expect_op_int(cte, 1, "==", n_rejected, "pool: bounded queue: rejected push");
+
+		pthread_mutex_unlock(&data->gate);
+		cwret = LIBCW_TEST_FUT(cw_rec_pool_wait)(pool);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, "pool: bounded queue: wait for queued events");
+		cwret = LIBCW_TEST_FUT(cw_rec_pool_end_stream)(pool, 0);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, "pool: bounded queue: end stream");
+		cwret = LIBCW_TEST_FUT(cw_rec_pool_wait)(pool);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, "pool: bounded queue: wait");
+		cte->expect_op_int(cte, 0, "==", strcmp("E ", data->text[0]), "pool: bounded queue: text: '%s'", data->text[0]);
+	}
+
+
+	/* Test: invalid arguments. */
+	{
+		errno = 0;
+		cte->expect_null_pointer(cte, LIBCW_TEST_FUT(cw_rec_pool_get_receiver)(pool, TEST_CW_REC_POOL_N_CHANNELS), "pool: get receiver of invalid channel");
+		cte->expect_op_int(cte, EINVAL, "==", errno, "pool: get receiver of invalid channel: errno");
+
+		const cw_rec_event_t invalid_events[] = { { true, 60000 }, { false, -1 } };
+		cte->expect_op_int(cte, CW_FAILURE, "==", LIBCW_TEST_FUT(cw_rec_pool_push_events)(pool, 0, invalid_events, 2), "pool: push negative duration");
+		cte->expect_op_int(cte, CW_FAILURE, "==", LIBCW_TEST_FUT(cw_rec_pool_end_stream)(pool, TEST_CW_REC_POOL_N_CHANNELS), "pool: end stream of invalid channel");
+
+		cte->expect_null_pointer(cte, LIBCW_TEST_FUT(cw_rec_pool_new)(0, 1, test_cw_rec_pool_callback, data), "pool: new pool without channels");
+	}
+
+	LIBCW_TEST_FUT(cw_rec_pool_delete)(&pool);
+	cte->expect_null_pointer(cte, pool, "pool: deleted pool");
+	pthread_mutex_destroy(&data->gate);
+	free(data);
+
+	cte->print_test_footer(cte, __func__);
+
+	return 0;
+}
+
+
+
+
 /**
    \brief The core test function, testing receiver's "begin" and "end" functions
 
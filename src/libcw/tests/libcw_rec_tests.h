@@ -21,6 +21,10 @@ int test_cw_rec_with_random_data_adaptive(void);
 int test_cw_rec_identify_mark_internal(cw_test_executor_t * cte);
 int test_cw_rec_test_with_constant_speeds(cw_test_executor_t * cte);
 int test_cw_rec_test_with_varying_speeds(cw_test_executor_t * cte);
+int test_cw_rec_decode_events(cw_test_executor_t * cte);
+int test_cw_rec_ns_timestamps(cw_test_executor_t * cte);
+int test_cw_rec_callback_mode(cw_test_executor_t * cte);
+int test_cw_rec_pool(cw_test_executor_t * cte);
 int test_cw_rec_get_receive_parameters(cw_test_executor_t * cte);
 int test_cw_rec_parameter_getters_setters_1(cw_test_executor_t * cte);
 int test_cw_rec_parameter_getters_setters_2(cw_test_executor_t * cte);
@@ -23,6 +23,10 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
@@ -40,6 +44,7 @@
 #include "libcw_utils.h"
 #include "libcw_tq.h"
 #include "libcw_tq_internal.h"
+#include "libcw_gen_internal.h"
 #include "libcw_tq_tests.h"
 #include "libcw_debug.h"
 #include "test_framework.h"
@@ -60,6 +65,13 @@ static void enqueue_tone_low_level(cw_test_executor_t * cte, cw_tone_queue_t * t
 static cw_tone_queue_t * test_cw_tq_capacity_test_init(cw_test_executor_t * cte, size_t capacity, size_t high_water_mark, int head_shift);
 static void test_helper_tq_callback(void * data);
 static cwt_retv test_helper_fill_queue(cw_test_executor_t * cte, cw_tone_queue_t * tq, size_t count);
+static void * test_cw_tq_contention_tones_producer(void * arg);
+static void * test_cw_tq_contention_characters_producer(void * arg);
+static void test_cw_tq_contention_value_tracking_callback(void * callback_arg, int state);
+static void * test_cw_tq_wait_channels_level_waiter(void * arg);
+static void * test_cw_tq_wait_channels_tone_waiter(void * arg);
+static void * test_cw_tq_wait_timed_consumer(void * arg);
+static void test_cw_tq_wait_timed_deadline(struct timespec * deadline, int msecs);
 
 
 
@@ -303,18 +315,18 @@ void enqueue_tone_low_level(cw_test_executor_t * cte, cw_tone_queue_t * tq, cons
 	   we trust that this is enforced by for loop's conditions. */
 
 	/* Notice that this is *before* enqueueing the tone. */
-	cte->assert2(cte, tq->len < tq->capacity,
+	cte->assert2(cte, (tq->n_enqueued - tq->n_dequeued) < tq->capacity,
 		     "length before enqueue reached capacity: %zu / %zu",
-		     tq->len, tq->capacity);
+		     (tq->n_enqueued - tq->n_dequeued), tq->capacity);
 
 	/* Enqueue the new tone and set the new tail index. */
-	tq->queue[tq->tail] = *tone;
+	cw_tq_tone_pack_internal(&tq->queue[tq->tail], tone);
 	tq->tail = cw_tq_next_index_internal(tq, tq->tail);
-	tq->len++;
+	tq->n_enqueued++;
 
-	cte->assert2(cte, tq->len <= tq->capacity,
+	cte->assert2(cte, (tq->n_enqueued - tq->n_dequeued) <= tq->capacity,
 		     "length after enqueue exceeded capacity: %zu / %zu",
-		     tq->len, tq->capacity);
+		     (tq->n_enqueued - tq->n_dequeued), tq->capacity);
 }
 
 
@@ -349,7 +361,7 @@ int test_cw_tq_length_internal_1(cw_test_executor_t * cte)
 			failure = true;
 			break;
 		}
-		if (!cte->expect_op_int_errors_only(cte, tq->len, "==", readback_len, "tone queue length A, readback #2")) {
+		if (!cte->expect_op_int_errors_only(cte, (tq->n_enqueued - tq->n_dequeued), "==", readback_len, "tone queue length A, readback #2")) {
 			failure = true;
 			break;
 		}
@@ -444,7 +456,7 @@ cwt_retv test_cw_tq_enqueue_internal(cw_test_executor_t * cte, cw_tone_queue_t *
 			break;
 		}
 		if (!cte->expect_op_int_errors_only(cte,
-						    tq->len, "==", readback_len,
+						    (tq->n_enqueued - tq->n_dequeued), "==", readback_len,
 						    "%s:%d: readback #2",
 						    __func__, __LINE__)) {
 			length_failure = true;
@@ -472,9 +484,9 @@ int test_cw_tq_dequeue_internal(cw_test_executor_t * cte, cw_tone_queue_t * tq)
 	   function. */
 
 	/* Test some assertions about full tq, just to be sure. */
-	cte->assert2(cte, tq->capacity == tq->len,
+	cte->assert2(cte, tq->capacity == (tq->n_enqueued - tq->n_dequeued),
 		     "dequeue: capacity != len of full queue: %zu != %zu",
-		     tq->capacity, tq->len);
+		     tq->capacity, (tq->n_enqueued - tq->n_dequeued));
 
 	cw_tone_t tone;
 	CW_TONE_INIT(&tone, 1, 1, CW_SLOPE_MODE_NO_SLOPES);
@@ -487,7 +499,7 @@ int test_cw_tq_dequeue_internal(cw_test_executor_t * cte, cw_tone_queue_t * tq)
 		size_t readback_len;
 
 		expected_len = i;
-		readback_len = tq->len;
+		readback_len = (tq->n_enqueued - tq->n_dequeued);
 		/* Length of tone queue before dequeue. */
 		if (!cte->expect_op_int_errors_only(cte, expected_len, "==", readback_len, "dequeue: length before dequeueing tone #%zu", i)) {
 			length_failure = true;
@@ -511,7 +523,7 @@ int test_cw_tq_dequeue_internal(cw_test_executor_t * cte, cw_tone_queue_t * tq)
 
 		/* Length of tone queue after dequeue. */
 		expected_len = i - 1;
-		readback_len = tq->len;
+		readback_len = (tq->n_enqueued - tq->n_dequeued);
 		if (!cte->expect_op_int_errors_only(cte, expected_len, "==", readback_len, "dequeue: length after dequeueing tone #%zu",  i)) {
 			length_failure = true;
 			break;
@@ -974,8 +986,10 @@ cw_tone_queue_t * test_cw_tq_capacity_test_init(cw_test_executor_t * cte, size_t
 	/* Initialize *all* tones with known value. Do this manually,
 	   to be 100% sure that all tones in queue table have been
 	   initialized. */
-	for (int i = 0; i < CW_TONE_QUEUE_CAPACITY_MAX; i++) {
-		CW_TONE_INIT(&tq->queue[i], 10000 + i, 1, CW_SLOPE_MODE_STANDARD_SLOPES);
+	for (size_t i = 0; i < tq->capacity; i++) {
+		cw_tone_t tone;
+		CW_TONE_INIT(&tone, 10000 + (int) i, 1, CW_SLOPE_MODE_STANDARD_SLOPES);
+		cw_tq_tone_pack_internal(&tq->queue[i], &tone);
 	}
 
 	/* Move head and tail of empty queue to initial position. The
@@ -984,7 +998,8 @@ cw_tone_queue_t * test_cw_tq_capacity_test_init(cw_test_executor_t * cte, size_t
 	   tones. */
 	tq->tail = head_shift;
 	tq->head = tq->tail;
-	tq->len = 0;
+	tq->n_enqueued = 0;
+	tq->n_dequeued = 0;
 
 	/* TODO: why do this here? */
 	//tq->state = CW_TQ_NONEMPTY;
@@ -1084,7 +1099,7 @@ cwt_retv test_helper_fill_queue(cw_test_executor_t * cte, cw_tone_queue_t * tq,
 		}
 	}
 
-	const size_t len = tq->len;
+	const size_t len = (tq->n_enqueued - tq->n_dequeued);
 	if (len == count) {
 		return cwt_retv_ok;
 	} else {
@@ -1511,7 +1526,7 @@ cwt_retv test_cw_tq_properties_empty(cw_test_executor_t * cte)
 			break;
 		}
 		if (!cte->expect_op_int_errors_only(cte,
-						    0, "==", tq->len,
+						    0, "==", (tq->n_enqueued - tq->n_dequeued),
 						    "%s:%d: empty queue's length",
 						    __func__, __LINE__)) {
 			failure_length = true;
@@ -1606,7 +1621,7 @@ cwt_retv test_cw_tq_properties_full(cw_test_executor_t * cte)
 	/* This tests for correctness of working of the 'enqueue' function.
 	   Full tq should not grow beyond its capacity. */
 	cte->expect_op_int(cte,
-			   tq->capacity, "==", tq->len,
+			   tq->capacity, "==", (tq->n_enqueued - tq->n_dequeued),
 			   "%s:%d: length of full queue vs. capacity (first variant)",
 			   __func__, __LINE__);
 	cte->expect_op_int(cte,
@@ -1835,3 +1850,848 @@ cwt_retv test_cw_tq_dequeue_internal_returns(cw_test_executor_t * cte)
 	return cwt_retv_ok;
 }
 
+
+
+
+
+/* Data shared by producer thread and consumer (test) thread in contention test. */
+typedef struct {
+	cw_tone_queue_t * tq;
+	cw_gen_t * gen;
+	int n_items;         /* Count of tones or characters to enqueue. */
+	int n_full;          /* How many times the producer has found the queue full. */
+	bool failure;
+	volatile bool done;
+} test_cw_tq_contention_t;
+
+
+
+
+/**
+   @brief Test and benchmark of a producer and a consumer operating on a tone queue at the same time
+
+   Producer thread enqueues items as fast as it can. Consumer (test code)
+   drains the queue as fast as it can: first by dequeueing tones directly
+   from a queue, then by pulling samples from a generator with
+   cw_gen_fill().
+*/
+cwt_retv test_cw_tq_contention(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, "%s", __func__);
+
+	/* Test: consumer dequeues tones directly from queue. Each tone is
+	   identified by its duration, so the consumer can verify that
+	   tones arrive complete and in order. */
+	{
+		test_cw_tq_contention_t data = { 0 };
+		data.tq = cw_tq_new_internal();
+		cte->assert2(cte, data.tq, "failed to create new tone queue");
+		data.n_items = 500000;
+
+		struct timeval start;
+		struct timeval stop;
+		gettimeofday(&start, NULL);
+
+		pthread_t producer;
+		pthread_create(&producer, NULL, test_cw_tq_contention_tones_producer, &data);
+
+		bool order_failure = false;
+		int expected = 1;
+		while (expected <= data.n_items) {
+			cw_tone_t tone;
+			const cw_queue_state_t queue_state = LIBCW_TEST_FUT(cw_tq_dequeue_internal)(data.tq, &tone);
+			if (CW_TQ_EMPTY == queue_state) {
+				sched_yield();
+				continue;
+			}
+			if (tone.duration != expected) {
+				cte->log_error(cte, "%s:%d: dequeued tone %d, expected %d\n", __func__, __LINE__, tone.duration, expected);
+				order_failure = true;
+				break;
+			}
+			expected++;
+		}
+		if (order_failure) {
+			/* Let the producer finish. */
+			while (!data.done) {
+				cw_tone_t tone;
+				cw_tq_dequeue_internal(data.tq, &tone);
+			}
+		}
+		pthread_join(producer, NULL);
+
+		gettimeofday(&stop, NULL);
+		const int duration = cw_timestamp_compare_internal(&start, &stop) + 1; /* +1 to avoid division by zero. */
+
+		cte->expect_op_int(cte, false, "==", data.failure, "tones: enqueueing");
+		cte->expect_op_int(cte, false, "==", order_failure, "tones: order of dequeued tones");
+		cte->expect_op_int(cte, 0, "==", (int) cw_tq_length_internal(data.tq), "tones: queue is drained");
+		cte->log_info(cte, "tones: %.2f Mtones/s, queue full %d times\n", 1.0 * data.n_items / duration, data.n_full);
+
+		cw_tq_delete_internal(&data.tq);
+	}
+
+
+	/* Test: producer enqueues characters, and generator drains the
+	   queue at maximum speed. */
+	{
+		test_cw_tq_contention_t data = { 0 };
+		if (0 != gen_setup(cte, &data.gen)) {
+			cte->log_error(cte, "%s:%d: Failed to create generator\n", __func__, __LINE__);
+			return cwt_retv_err;
+		}
+		cw_gen_set_speed(data.gen, CW_SPEED_MAX);
+		data.tq = data.gen->tq;
+		data.n_items = 500;  /* Repetitions of "PARIS ". */
+
+		int n_closed = 0;
+		cw_gen_register_value_tracking_callback_internal(data.gen, test_cw_tq_contention_value_tracking_callback, &n_closed);
+
+		cw_sample_t samples[512];
+		const size_t n_samples = sizeof (samples) / sizeof (samples[0]);
+		bool fill_failure = false;
+
+		struct timeval start;
+		struct timeval stop;
+		gettimeofday(&start, NULL);
+
+		pthread_t producer;
+		pthread_create(&producer, NULL, test_cw_tq_contention_characters_producer, &data);
+		while (!data.done || 0 != cw_tq_length_internal(data.tq)) {
+			if (CW_SUCCESS != LIBCW_TEST_FUT(cw_gen_fill)(data.gen, samples, n_samples)) {
+				fill_failure = true;
+			}
+		}
+		pthread_join(producer, NULL);
+		/* Complete last tone. */
+		cw_gen_fill(data.gen, samples, n_samples);
+
+		gettimeofday(&stop, NULL);
+		const int duration = cw_timestamp_compare_internal(&start, &stop) + 1;
+
+		const int expected_n_marks = data.n_items * (4 + 2 + 3 + 2 + 3); /* Marks of "PARIS". */
+		cte->expect_op_int(cte, false, "==", data.failure, "characters: enqueueing");
+		cte->expect_op_int(cte, false, "==", fill_failure, "characters: fill");
+		cte->expect_op_int(cte, expected_n_marks, "==", n_closed, "characters: count of marks seen by value tracking");
+		cte->log_info(cte, "characters: %.0f characters/s, queue full %d times\n",
+			      1.0 * data.n_items * 6 * CW_USECS_PER_SEC / duration,
+			      data.n_full);
+
+		cw_gen_register_value_tracking_callback_internal(data.gen, NULL, NULL);
+		gen_destroy(&data.gen);
+	}
+
+	cte->print_test_footer(cte, __func__);
+
+	return cwt_retv_ok;
+}
+
+
+
+
+/**
+   @brief Enqueue tones with durations 1, 2, 3, ... into queue, retry when queue is full
+*/
+static void * test_cw_tq_contention_tones_producer(void * arg)
+{
+	test_cw_tq_contention_t * data = (test_cw_tq_contention_t *) arg;
+
+	for (int i = 1; i <= data->n_items; i++) {
+		cw_tone_t tone;
+		CW_TONE_INIT(&tone, 500, i, CW_SLOPE_MODE_NO_SLOPES);
+		while (CW_SUCCESS != cw_tq_enqueue_internal(data->tq, &tone)) {
+			if (EAGAIN != errno) {
+				data->failure = true;
+				data->done = true;
+				return NULL;
+			}
+			data->n_full++;
+			sched_yield();
+		}
+	}
+	data->done = true;
+
+	return NULL;
+}
+
+
+
+
+/**
+   @brief Enqueue "PARIS " characters into generator, retry when queue is full
+*/
+static void * test_cw_tq_contention_characters_producer(void * arg)
+{
+	test_cw_tq_contention_t * data = (test_cw_tq_contention_t *) arg;
+	const char * text = "PARIS ";
+
+	for (int i = 0; i < data->n_items; i++) {
+		for (const char * c = text; '\0' != *c; c++) {
+			while (CW_SUCCESS != cw_gen_enqueue_character(data->gen, *c)) {
+				if (EAGAIN != errno) {
+					data->failure = true;
+					data->done = true;
+					return NULL;
+				}
+				data->n_full++;
+				sched_yield();
+			}
+		}
+	}
+	data->done = true;
+
+	return NULL;
+}
+
+
+
+
+static void test_cw_tq_contention_value_tracking_callback(void * callback_arg, int state)
+{
+	int * n_closed = (int *) callback_arg;
+	if (CW_KEY_VALUE_CLOSED == state) {
+		(*n_closed)++;
+	}
+}
+
+
+
+
+
+/* Data shared by waiting threads and test thread in test of wait channels. */
+typedef struct {
+	cw_tone_queue_t * tq;
+	size_t length;              /* Length of queue that ends a wait. */
+	volatile int n_wakeups;     /* How many times the thread has been woken up. */
+} test_cw_tq_wait_channels_t;
+
+
+
+
+/**
+   @brief Test that events in tone queue wake up only threads waiting on event's channel
+
+   One thread waits for queue to drain, another waits for queue to grow.
+   Dequeueing must not wake up the latter, and enqueueing must not wake up
+   the former.
+*/
+cwt_retv test_cw_tq_wait_channels(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, "%s", __func__);
+
+	cw_tone_queue_t * tq = cw_tq_new_internal();
+	cte->assert2(cte, tq, "failed to create new tone queue");
+
+	cw_tone_t tone;
+	CW_TONE_INIT(&tone, 500, 1000, CW_SLOPE_MODE_NO_SLOPES);
+	for (int i = 0; i < 10; i++) {
+		cw_tq_enqueue_internal(tq, &tone);
+	}
+
+	test_cw_tq_wait_channels_t level_data = { .tq = tq, .length = 0, .n_wakeups = 0 };
+	test_cw_tq_wait_channels_t tone_data = { .tq = tq, .length = 20, .n_wakeups = 0 };
+	pthread_t level_waiter;
+	pthread_t tone_waiter;
+	pthread_create(&level_waiter, NULL, test_cw_tq_wait_channels_level_waiter, &level_data);
+	pthread_create(&tone_waiter, NULL, test_cw_tq_wait_channels_tone_waiter, &tone_data);
+
+	/* Let both threads start waiting. */
+	while (0 == __atomic_load_n(&tq->wait_channels[CW_TQ_WAIT_LEVEL].n_waiters, __ATOMIC_SEQ_CST)
+	       || 0 == __atomic_load_n(&tq->wait_channels[CW_TQ_WAIT_TONE_AVAILABLE].n_waiters, __ATOMIC_SEQ_CST)) {
+		usleep(1000);
+	}
+
+
+	/* Drain part of the queue. Only the thread waiting for level
+	   should notice that. */
+	for (int i = 0; i < 5; i++) {
+		LIBCW_TEST_FUT(cw_tq_dequeue_internal)(tq, &tone);
+	}
+	usleep(100 * 1000);
+	const int level_wakeups = level_data.n_wakeups;
+	cte->expect_op_int(cte, 0, "<", level_wakeups, "dequeue wakes up waiter for level");
+	cte->expect_op_int(cte, 0, "==", tone_data.n_wakeups, "dequeue doesn't wake up waiter for tones");
+
+
+	/* Fill the queue. Only the thread waiting for tones should notice
+	   that. */
+	for (int i = 0; i < 15; i++) {
+		LIBCW_TEST_FUT(cw_tq_enqueue_internal)(tq, &tone);
+	}
+	pthread_join(tone_waiter, NULL);
+	usleep(100 * 1000);
+	cte->expect_op_int(cte, 0, "<", tone_data.n_wakeups, "enqueue wakes up waiter for tones");
+	cte->expect_op_int(cte, level_wakeups, "==", level_data.n_wakeups, "enqueue doesn't wake up waiter for level");
+
+
+	/* Drain the queue completely to release the thread waiting for
+	   level. */
+	while (CW_TQ_EMPTY != cw_tq_dequeue_internal(tq, &tone)) {
+		;
+	}
+	pthread_join(level_waiter, NULL);
+
+	cw_tq_delete_internal(&tq);
+
+	cte->print_test_footer(cte, __func__);
+
+	return cwt_retv_ok;
+}
+
+
+
+
+/**
+   @brief Wait on "level" channel until queue drains to given length
+*/
+static void * test_cw_tq_wait_channels_level_waiter(void * arg)
+{
+	test_cw_tq_wait_channels_t * data = (test_cw_tq_wait_channels_t *) arg;
+
+	cw_tq_waiter_lock_internal(data->tq, CW_TQ_WAIT_LEVEL);
+	while (cw_tq_length_internal(data->tq) > data->length) {
+		cw_tq_waiter_wait_internal(data->tq, CW_TQ_WAIT_LEVEL);
+		data->n_wakeups++;
+	}
+	cw_tq_waiter_unlock_internal(data->tq, CW_TQ_WAIT_LEVEL);
+
+	return NULL;
+}
+
+
+
+
+/**
+   @brief Wait on "tone available" channel until queue grows to given length
+*/
+static void * test_cw_tq_wait_channels_tone_waiter(void * arg)
+{
+	test_cw_tq_wait_channels_t * data = (test_cw_tq_wait_channels_t *) arg;
+
+	cw_tq_waiter_lock_internal(data->tq, CW_TQ_WAIT_TONE_AVAILABLE);
+	while (cw_tq_length_internal(data->tq) < data->length) {
+		cw_tq_waiter_wait_internal(data->tq, CW_TQ_WAIT_TONE_AVAILABLE);
+		data->n_wakeups++;
+	}
+	cw_tq_waiter_unlock_internal(data->tq, CW_TQ_WAIT_TONE_AVAILABLE);
+
+	return NULL;
+}
+
+
+
+
+
+/**
+   @brief Test timed waits on tone queue
+
+   Nobody dequeues tones in first part of the test, so the waits must
+   time out. In the second part a thread drains the queue before
+   deadline.
+*/
+cwt_retv test_cw_tq_wait_timed(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, "%s", __func__);
+
+	cw_tone_queue_t * tq = cw_tq_new_internal();
+	cte->assert2(cte, tq, "failed to create new tone queue");
+
+	cw_tone_t tone;
+	CW_TONE_INIT(&tone, 500, 1000, CW_SLOPE_MODE_NO_SLOPES);
+	for (int i = 0; i < 5; i++) {
+		cw_tq_enqueue_internal(tq, &tone);
+	}
+
+
+	/* Test: wait for level that has been already reached. */
+	{
+		struct timespec deadline;
+		test_cw_tq_wait_timed_deadline(&deadline, 0);
+		const cw_ret_t cwret = LIBCW_TEST_FUT(cw_tq_wait_for_level_timed_internal)(tq, 5, &deadline);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, "level already reached");
+	}
+
+
+	/* Test: waits time out at deadline. */
+	{
+		struct timespec start;
+		struct timespec deadline;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		test_cw_tq_wait_timed_deadline(&deadline, 50);
+
+		errno = 0;
+		const cw_ret_t cwret = LIBCW_TEST_FUT(cw_tq_wait_for_level_timed_internal)(tq, 0, &deadline);
+		const int saved_errno = errno;
+		struct timespec stop;
+		clock_gettime(CLOCK_MONOTONIC, &stop);
+		const long elapsed = (stop.tv_sec - start.tv_sec) * 1000 + (stop.tv_nsec - start.tv_nsec) / 1000000;
+
+		cte->expect_op_int(cte, CW_FAILURE, "==", cwret, "level: timeout: cwret");
+		cte->expect_op_int(cte, ETIMEDOUT, "==", saved_errno, "level: timeout: errno");
+		cte->expect_op_int(cte, 49, "<=", (int) elapsed, "level: timeout: not before deadline");
+
+		test_cw_tq_wait_timed_deadline(&deadline, 20);
+		errno = 0;
+		const cw_ret_t cwret2 = LIBCW_TEST_FUT(cw_tq_wait_for_end_of_current_tone_timed_internal)(tq, &deadline);
+		cte->expect_op_int(cte, CW_FAILURE, "==", cwret2, "end of tone: timeout: cwret");
+		cte->expect_op_int(cte, ETIMEDOUT, "==", errno, "end of tone: timeout: errno");
+	}
+
+
+	/* Test: deadline in the past. */
+	{
+		struct timespec deadline;
+		test_cw_tq_wait_timed_deadline(&deadline, -1000);
+		const cw_ret_t cwret = LIBCW_TEST_FUT(cw_tq_wait_for_level_timed_internal)(tq, 0, &deadline);
+		cte->expect_op_int(cte, CW_FAILURE, "==", cwret, "deadline in the past");
+	}
+
+
+	/* Test: queue is drained before deadline. */
+	{
+		struct timespec deadline;
+		test_cw_tq_wait_timed_deadline(&deadline, 5000);
+
+		pthread_t consumer;
+		pthread_create(&consumer, NULL, test_cw_tq_wait_timed_consumer, tq);
+		const cw_ret_t cwret = LIBCW_TEST_FUT(cw_tq_wait_for_level_timed_internal)(tq, 0, &deadline);
+		pthread_join(consumer, NULL);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, "queue drained before deadline");
+	}
+
+	cw_tq_delete_internal(&tq);
+
+	cte->print_test_footer(cte, __func__);
+
+	return cwt_retv_ok;
+}
+
+
+
+
+/**
+   @brief Drain tone queue after a short delay
+*/
+static void * test_cw_tq_wait_timed_consumer(void * arg)
+{
+	cw_tone_queue_t * tq = (cw_tone_queue_t *) arg;
+
+	usleep(20 * 1000);
+	cw_tone_t tone;
+	while (CW_TQ_EMPTY != cw_tq_dequeue_internal(tq, &tone)) {
+		;
+	}
+
+	return NULL;
+}
+
+
+
+
+/**
+   @brief Calculate deadline that is @p msecs milliseconds from now
+*/
+static void test_cw_tq_wait_timed_deadline(struct timespec * deadline, int msecs)
+{
+	clock_gettime(CLOCK_MONOTONIC, deadline);
+	long nsec = deadline->tv_nsec + (msecs % 1000) * 1000000L;
+	deadline->tv_sec += msecs / 1000;
+	if (nsec >= 1000000000L) {
+		nsec -= 1000000000L;
+		deadline->tv_sec++;
+	} else if (nsec < 0) {
+		nsec += 1000000000L;
+		deadline->tv_sec--;
+	}
+	deadline->tv_nsec = nsec;
+}
+
+
+
+
+/**
+   @brief Test enqueueing of sequence of tones in one step
+
+   Sequence is either enqueued as a whole, or not at all. The test
+   uses a small queue with head in the middle of the queue, so that
+   the sequence wraps around end of the queue.
+*/
+cwt_retv test_cw_tq_enqueue_many_internal(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, "%s", __func__);
+
+	cw_tone_queue_t * tq = cw_tq_new_internal();
+	cte->assert2(cte, tq, "failed to create new tone queue");
+
+	const size_t capacity = 10;
+	cw_tq_set_capacity_internal(tq, capacity, capacity);
+
+	/* Move head of queue to the middle of the queue. */
+	cw_tone_t tone;
+	CW_TONE_INIT(&tone, 500, 1000, CW_SLOPE_MODE_NO_SLOPES);
+	for (int i = 0; i < 7; i++) {
+		cw_tq_enqueue_internal(tq, &tone);
+	}
+	for (int i = 0; i < 5; i++) {
+		cw_tq_dequeue_internal(tq, &tone);
+	}
+
+	cw_tone_t tones[10];
+	for (int i = 0; i < 10; i++) {
+		CW_TONE_INIT(&tones[i], 500, 2000 + i, CW_SLOPE_MODE_NO_SLOPES);
+	}
+
+
+	/* Test: sequence longer than free space is not enqueued at all. */
+	{
+		errno = 0;
+		const cw_ret_t cwret = LIBCW_TEST_FUT(cw_tq_enqueue_many_internal)(tq, tones, 10);
+		cte->expect_op_int(cte, CW_FAILURE, "==", cwret, "too many tones: cwret");
+		cte->expect_op_int(cte, EAGAIN, "==", errno, "too many tones: errno");
+		cte->expect_op_int(cte, 2, "==", (int) cw_tq_length_internal(tq), "too many tones: length of queue");
+	}
+
+
+	/* Test: sequence with invalid tone is not enqueued at all. */
+	{
+		tones[4].frequency = CW_FREQUENCY_MAX + 1;
+		errno = 0;
+		const cw_ret_t cwret = LIBCW_TEST_FUT(cw_tq_enqueue_many_internal)(tq, tones, 5);
+		cte->expect_op_int(cte, CW_FAILURE, "==", cwret, "invalid tone: cwret");
+		cte->expect_op_int(cte, EINVAL, "==", errno, "invalid tone: errno");
+		cte->expect_op_int(cte, 2, "==", (int) cw_tq_length_internal(tq), "invalid tone: length of queue");
+		tones[4].frequency = 500;
+	}
+
+
+	/* Test: sequence that fits into free space is enqueued in order,
+	   without empty tones. */
+	{
+		tones[3].duration = 0;
+		const cw_ret_t cwret = LIBCW_TEST_FUT(cw_tq_enqueue_many_internal)(tq, tones, 9);
+		cte->expect_op_int(cte, CW_SUCCESS, "==", cwret, "enqueue: cwret");
+		cte->expect_op_int(cte, (int) capacity, "==", (int) cw_tq_length_internal(tq), "enqueue: length of queue");
+
+		cw_tq_dequeue_internal(tq, &tone);
+		cw_tq_dequeue_internal(tq, &tone);
+		bool order_failure = false;
+		for (int i = 0; i < 9; i++) {
+			if (3 == i) {
+				continue;
+			}
+			cw_tq_dequeue_internal(tq, &tone);
+			if (2000 + i != tone.duration) {
+				order_failure = true;
+			}
+		}
+		cte->expect_op_int(cte, false, "==", order_failure, "enqueue: order of tones");
+		cte->expect_op_int(cte, 0, "==", (int) cw_tq_length_internal(tq), "enqueue: queue is drained");
+	}
+
+	cw_tq_delete_internal(&tq);
+
+	cte->print_test_footer(cte, __func__);
+
+	return cwt_retv_ok;
+}
+
+
+
+
+/**
+   @brief Test storing of tones in compact records of tone queue
+
+   Fields set by code enqueueing a tone must survive a round trip
+   through the record, fields calculated by generator must be reset.
+*/
+cwt_retv test_cw_tq_tone_pack_internal(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, "%s", __func__);
+
+	cte->expect_op_int(cte, 16, ">=", (int) sizeof (cw_tq_tone_t), "size of record");
+
+	cw_tone_t tone;
+	CW_TONE_INIT(&tone, CW_FREQUENCY_MAX, 123456789, CW_SLOPE_MODE_FALLING_SLOPE);
+	tone.is_forever = true;
+	tone.is_first = true;
+	tone.debug_id = 'x';
+	tone.symbol = 'Q';
+	tone.symbol_flags = CW_TONE_SYMBOL_NO_ICS;
+	tone.n_samples = 1000;
+	tone.sample_iterator = 100;
+	tone.rising_slope_n_samples = 10;
+	tone.falling_slope_n_samples = 10;
+
+	cw_tq_tone_t record;
+	LIBCW_TEST_FUT(cw_tq_tone_pack_internal)(&record, &tone);
+	cw_tone_t readback;
+	LIBCW_TEST_FUT(cw_tq_tone_unpack_internal)(&readback, &record);
+
+	cte->expect_op_int(cte, tone.frequency, "==", readback.frequency, "frequency");
+	cte->expect_op_int(cte, tone.duration, "==", readback.duration, "duration");
+	cte->expect_op_int(cte, tone.slope_mode, "==", readback.slope_mode, "slope mode");
+	cte->expect_op_int(cte, true, "==", readback.is_forever, "is forever");
+	cte->expect_op_int(cte, true, "==", readback.is_first, "is first");
+	cte->expect_op_int(cte, tone.debug_id, "==", readback.debug_id, "debug id");
+	cte->expect_op_int(cte, tone.symbol, "==", readback.symbol, "symbol");
+	cte->expect_op_int(cte, tone.symbol_flags, "==", readback.symbol_flags, "symbol flags");
+	cte->expect_op_int(cte, 0, "==", (int) readback.n_samples, "count of samples");
+	cte->expect_op_int(cte, 0, "==", (int) readback.sample_iterator, "sample iterator");
+	cte->expect_op_int(cte, 0, "==", readback.rising_slope_n_samples + readback.falling_slope_n_samples, "slopes");
+
+	CW_TONE_INIT(&tone, 0, 0, CW_SLOPE_MODE_NO_SLOPES);
+	LIBCW_TEST_FUT(cw_tq_tone_pack_internal)(&record, &tone);
+	LIBCW_TEST_FUT(cw_tq_tone_unpack_internal)(&readback, &record);
+	cte->expect_op_int(cte, false, "==", readback.is_forever || readback.is_first, "flags not set");
+
+	cte->print_test_footer(cte, __func__);
+
+	return cwt_retv_ok;
+}
+
+
+
+
+#define TEST_CW_TQ_STAGING_N_PRODUCERS    4
+#define TEST_CW_TQ_STAGING_N_BATCHES     20
+#define TEST_CW_TQ_STAGING_N_CHARACTERS  25 /* Characters per batch. More tones than fit in staging buffer. */
+#define TEST_CW_TQ_STAGING_N_TONES        3 /* Tones per character. */
+
+#define TEST_CW_TQ_STAGING_N_REPETITIONS 60 /* Repetitions of text enqueued in generator by each producer. */
+
+typedef struct {
+	cw_tone_queue_t * tq;
+	int frequency;
+	int * n_producers_done;
+} test_cw_tq_staging_data_t;
+
+typedef struct {
+	cw_gen_t * gen;
+	bool use_strings;
+	bool failure;
+	int * n_producers_done;
+} test_cw_tq_staging_gen_data_t;
+
+
+
+
+static void * test_cw_tq_staging_producer(void * arg)
+{
+	test_cw_tq_staging_data_t * data = (test_cw_tq_staging_data_t *) arg;
+
+	for (int b = 0; b < TEST_CW_TQ_STAGING_N_BATCHES; b++) {
+		while (true) {
+			cw_tq_staging_t staging;
+			cw_tq_staging_init_internal(&staging);
+
+			bool staged = true;
+			for (int c = 0; c < TEST_CW_TQ_STAGING_N_CHARACTERS && staged; c++) {
+				for (int t = 0; t < TEST_CW_TQ_STAGING_N_TONES && staged; t++) {
+					cw_tone_t tone;
+					CW_TONE_INIT(&tone, data->frequency, 100 + t, CW_SLOPE_MODE_NO_SLOPES);
+					tone.is_first = 0 == t;
+					staged = CW_SUCCESS == cw_tq_stage_internal(data->tq, &staging, &tone);
+				}
+			}
+			if (staged && CW_SUCCESS == cw_tq_commit_internal(data->tq, &staging)) {
+				break;
+			}
+			/* Queue is full. Some characters of the batch may
+			   have been enqueued already, which is fine for this
+			   test. Try again with the whole batch. */
+			sched_yield();
+		}
+	}
+
+	__atomic_add_fetch(data->n_producers_done, 1, __ATOMIC_RELEASE);
+
+	return NULL;
+}
+
+
+
+
+static void * test_cw_tq_staging_gen_producer(void * arg)
+{
+	test_cw_tq_staging_gen_data_t * data = (test_cw_tq_staging_gen_data_t *) arg;
+
+	/* Leading inter-word-spaces are shortened by spaces enqueued
+	   right before them, possibly by another producer. */
+	const char * text = " E  T";
+
+	for (int i = 0; i < TEST_CW_TQ_STAGING_N_REPETITIONS && !data->failure; i++) {
+		if (data->use_strings) {
+			while (CW_SUCCESS != cw_gen_enqueue_string(data->gen, text)) {
+				if (EAGAIN != errno) {
+					data->failure = true;
+					break;
+				}
+				/* Some characters of the string may have been
+				   enqueued already, which is fine for this
+				   test. */
+				sched_yield();
+			}
+		} else {
+			for (const char * c = text; '\0' != *c && !data->failure; c++) {
+				while (CW_SUCCESS != cw_gen_enqueue_character(data->gen, *c)) {
+					if (EAGAIN != errno) {
+						data->failure = true;
+						break;
+					}
+					sched_yield();
+				}
+			}
+		}
+	}
+
+	__atomic_add_fetch(data->n_producers_done, 1, __ATOMIC_RELEASE);
+
+	return NULL;
+}
+
+
+
+
+/**
+   @brief Test that characters staged by many producers are not interleaved in tone queue
+
+   Characters enqueued in generator by many producers must also have
+   correct durations of spaces between them.
+*/
+cwt_retv test_cw_tq_staging(cw_test_executor_t * cte)
+{
+	cte->print_test_header(cte, "%s", __func__);
+
+	cw_tone_queue_t * tq = cw_tq_new_internal();
+	cte->assert2(cte, tq, "failed to create new tone queue");
+	cw_tq_set_capacity_internal(tq, 200, 150);
+
+	int n_producers_done = 0;
+	pthread_t producers[TEST_CW_TQ_STAGING_N_PRODUCERS];
+	test_cw_tq_staging_data_t data[TEST_CW_TQ_STAGING_N_PRODUCERS];
+	for (int i = 0; i < TEST_CW_TQ_STAGING_N_PRODUCERS; i++) {
+		data[i].tq = tq;
+		data[i].frequency = 300 + 100 * i;
+		data[i].n_producers_done = &n_producers_done;
+		pthread_create(&producers[i], NULL, test_cw_tq_staging_producer, &data[i]);
+	}
+
+	/* Consume tones until all producers are done and the queue is
+	   drained. Every character must consist of exactly
+	   TEST_CW_TQ_STAGING_N_TONES tones of the same producer. */
+	bool producers_done = false;
+	int n_characters = 0;
+	int n_bad_characters = 0;
+	int position = 0;
+	int frequency = 0;
+	while (true) {
+		cw_tone_t tone;
+		if (CW_TQ_EMPTY == cw_tq_dequeue_internal(tq, &tone)) {
+			if (producers_done) {
+				/* Queue found empty after all producers have finished. */
+				break;
+			}
+			producers_done = TEST_CW_TQ_STAGING_N_PRODUCERS == __atomic_load_n(&n_producers_done, __ATOMIC_ACQUIRE);
+			continue;
+		}
+
+		if (tone.is_first) {
+			if (0 != position && TEST_CW_TQ_STAGING_N_TONES != position) {
+				n_bad_characters++;
+			}
+			n_characters++;
+			position = 0;
+			frequency = tone.frequency;
+		} else if (tone.frequency != frequency || 100 + position != tone.duration) {
+			n_bad_characters++;
+		}
+		position++;
+	}
+	if (TEST_CW_TQ_STAGING_N_TONES != position) {
+		n_bad_characters++;
+	}
+	for (int i = 0; i < TEST_CW_TQ_STAGING_N_PRODUCERS; i++) {
+		pthread_join(producers[i], NULL);
+	}
+
+	cte->expect_op_int(cte, TEST_CW_TQ_STAGING_N_PRODUCERS * TEST_CW_TQ_STAGING_N_BATCHES * TEST_CW_TQ_STAGING_N_CHARACTERS, "<=", n_characters, "count of characters");
+	cte->expect_op_int(cte, 0, "==", n_bad_characters, "count of interleaved characters");
+
+	cw_tq_delete_internal(&tq);
+
+
+	/* Test: producers enqueue characters and strings in one generator.
+	   A space between two Marks must be either inter-character-space,
+	   or one or more full inter-word-spaces (the first of them is
+	   shortened by inter-character-space before it). */
+	{
+		cw_gen_t * gen = NULL;
+		if (0 != gen_setup(cte, &gen)) {
+			cte->log_error(cte, "%s:%d: Failed to create generator\n", __func__, __LINE__);
+			return cwt_retv_err;
+		}
+		const int unit = gen->durations.unit_duration;
+
+		n_producers_done = 0;
+		test_cw_tq_staging_gen_data_t gen_data[TEST_CW_TQ_STAGING_N_PRODUCERS];
+		for (int i = 0; i < TEST_CW_TQ_STAGING_N_PRODUCERS; i++) {
+			gen_data[i].gen = gen;
+			gen_data[i].use_strings = 0 != i % 2;
+			gen_data[i].failure = false;
+			gen_data[i].n_producers_done = &n_producers_done;
+			pthread_create(&producers[i], NULL, test_cw_tq_staging_gen_producer, &gen_data[i]);
+		}
+
+		producers_done = false;
+		int n_marks = 0;
+		int n_bad_marks = 0;
+		int n_bad_spaces = 0;
+		int space_duration = -1; /* Spaces before first Mark are not checked. */
+		while (true) {
+			cw_tone_t tone;
+			if (CW_TQ_EMPTY == cw_tq_dequeue_internal(gen->tq, &tone)) {
+				if (producers_done) {
+					break;
+				}
+				producers_done = TEST_CW_TQ_STAGING_N_PRODUCERS == __atomic_load_n(&n_producers_done, __ATOMIC_ACQUIRE);
+				continue;
+			}
+
+			if (0 == tone.frequency) {
+				if (-1 != space_duration) {
+					space_duration += tone.duration;
+				}
+				continue;
+			}
+
+			n_marks++;
+			if (tone.duration != gen->durations.dot_duration && tone.duration != gen->durations.dash_duration) {
+				n_bad_marks++;
+			}
+			if (-1 != space_duration) {
+				const int space_units = (space_duration + unit / 2) / unit;
+				if (UNITS_PER_ICS != space_units && (0 == space_units || 0 != space_units % UNITS_PER_IWS)) {
+					n_bad_spaces++;
+				}
+			}
+			space_duration = 0;
+		}
+
+		bool failure = false;
+		for (int i = 0; i < TEST_CW_TQ_STAGING_N_PRODUCERS; i++) {
+			pthread_join(producers[i], NULL);
+			failure = failure || gen_data[i].failure;
+		}
+
+		cte->expect_op_int(cte, false, "==", failure, "generator: enqueueing");
+		cte->expect_op_int(cte, TEST_CW_TQ_STAGING_N_PRODUCERS * TEST_CW_TQ_STAGING_N_REPETITIONS * 2, "<=", n_marks, "generator: count of marks");
+		cte->expect_op_int(cte, 0, "==", n_bad_marks, "generator: count of marks with incorrect duration");
+		cte->expect_op_int(cte, 0, "==", n_bad_spaces, "generator: count of spaces with incorrect duration");
+
+		gen_destroy(&gen);
+	}
+
+	cte->print_test_footer(cte, __func__);
+
+	return cwt_retv_ok;
+}
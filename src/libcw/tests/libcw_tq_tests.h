@@ -41,6 +41,13 @@ cwt_retv test_cw_tq_properties_full(cw_test_executor_t * cte);
 
 cwt_retv test_cw_tq_dequeue_internal_returns(cw_test_executor_t * cte);
 
+cwt_retv test_cw_tq_contention(cw_test_executor_t * cte);
+cwt_retv test_cw_tq_wait_channels(cw_test_executor_t * cte);
+cwt_retv test_cw_tq_wait_timed(cw_test_executor_t * cte);
+cwt_retv test_cw_tq_enqueue_many_internal(cw_test_executor_t * cte);
+cwt_retv test_cw_tq_tone_pack_internal(cw_test_executor_t * cte);
+cwt_retv test_cw_tq_staging(cw_test_executor_t * cte);
+
 
 
 #endif /* #ifndef _LIBCW_TQ_TESTS_H_ */
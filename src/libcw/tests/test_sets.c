@@ -27,10 +27,12 @@
 
 
 #include "libcw_utils_tests.h"
+#include "libcw_gen_kernels_tests.h"
 #include "libcw_data_tests.h"
 #include "libcw_debug_tests.h"
 #include "libcw_tq_tests.h"
 #include "libcw_gen_tests.h"
+#include "libcw_mixer_tests.h"
 #include "libcw_key_tests.h"
 #include "libcw_rec_tests.h"
 
@@ -44,6 +46,11 @@
 #include "gen/cw_gen_remove_last_character.h"
 #include "gen/cw_gen_enqueue_character_no_ics.h"
 #include "gen/cw_gen_get_timing_parameters_internal.h"
+#include "gen/cw_gen_calculate_sine_wave_internal.h"
+#include "gen/cw_gen_mark_cache_internal.h"
+#include "gen/cw_gen_slope_table_internal.h"
+#include "gen/cw_gen_apply_output_gain_internal.h"
+#include "gen/cw_gen_wavetable_internal.h"
 #include "legacy/cw_get_receive_parameters.h"
 #include "legacy/cw_get_send_parameters.h"
 
@@ -195,6 +202,7 @@ cw_test_set_t cw_test_sets[] = {
 			/* cw_data topic */
 			LIBCW_TEST_FUNCTION_INSERT(test_cw_representation_to_hash_internal, true),
 			LIBCW_TEST_FUNCTION_INSERT(test_cw_representation_to_character_internal, true),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_data_trie_internal, true),
 			LIBCW_TEST_FUNCTION_INSERT(test_cw_representation_to_character_internal_speed_gain, true),
 
 			LIBCW_TEST_FUNCTION_INSERT(test_data_main_table_get_count, true),
@@ -246,6 +254,12 @@ cw_test_set_t cw_test_sets[] = {
 			LIBCW_TEST_FUNCTION_INSERT(test_cw_tq_properties_full, true),
 
 			LIBCW_TEST_FUNCTION_INSERT(test_cw_tq_dequeue_internal_returns, true),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_tq_contention, true),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_tq_wait_channels, true),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_tq_wait_timed, true),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_tq_enqueue_many_internal, true),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_tq_tone_pack_internal, true),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_tq_staging, true),
 
 			LIBCW_TEST_FUNCTION_INSERT(NULL, true),
 		}
@@ -266,6 +280,9 @@ cw_test_set_t cw_test_sets[] = {
 			LIBCW_TEST_FUNCTION_INSERT(test_cw_gen_set_tone_slope, true),
 			LIBCW_TEST_FUNCTION_INSERT(test_cw_gen_tone_slope_shape_enums, true),
 			LIBCW_TEST_FUNCTION_INSERT(test_cw_gen_get_timing_parameters_internal, g_is_quick),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_gen_calculate_sine_wave_internal, true),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_sine_kernels_internal, true),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_gain_kernels_internal, true),
 			LIBCW_TEST_FUNCTION_INSERT(test_cw_gen_parameter_getters_setters, true),
 			LIBCW_TEST_FUNCTION_INSERT(test_cw_gen_volume_functions, false),
 			LIBCW_TEST_FUNCTION_INSERT(test_cw_gen_enqueue_primitives, false),
@@ -276,6 +293,19 @@ cw_test_set_t cw_test_sets[] = {
 			LIBCW_TEST_FUNCTION_INSERT(test_cw_gen_forever_internal, false),
 			LIBCW_TEST_FUNCTION_INSERT(test_cw_gen_enqueue_character_no_ics, !g_is_quick),
 			LIBCW_TEST_FUNCTION_INSERT(test_cw_gen_state_callback, false),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_gen_render, true),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_gen_fill, true),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_gen_sustained_tone, true),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_gen_event_fd, true),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_gen_queue_mode, true),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_gen_enqueue_string_atomic, true),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_gen_get_queue_stats, true),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_mixer_fill, true),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_mixer_start_stop, true),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_gen_mark_cache_internal, true),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_gen_slope_table_internal, true),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_gen_apply_output_gain_internal, true),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_gen_wavetable_internal, true),
 
 			LIBCW_TEST_FUNCTION_INSERT(NULL, true),
 		}
@@ -325,6 +355,10 @@ cw_test_set_t cw_test_sets[] = {
 			LIBCW_TEST_FUNCTION_INSERT(test_cw_rec_identify_mark_internal,      true),
 			LIBCW_TEST_FUNCTION_INSERT(test_cw_rec_test_with_constant_speeds,   true),
 			LIBCW_TEST_FUNCTION_INSERT(test_cw_rec_test_with_varying_speeds,    true),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_rec_decode_events,               true),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_rec_ns_timestamps,               true),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_rec_callback_mode,               true),
+			LIBCW_TEST_FUNCTION_INSERT(test_cw_rec_pool,                        true),
 
 			LIBCW_TEST_FUNCTION_INSERT(NULL, true) /* Guard. */
 		}